@@ -12,6 +12,9 @@
 #include <net.h>
 #include <uart.h>
 #include <loader.h>
+#include <init.h>
+#include <task.h>
+#include <job.h>
 
 #define AUTOBOOT_FILENAME "boot"
 #define AUTOBOOT_TIMEOUT_MS 500 /* this is actually enough as you can pre-stuff the UART receiver */
@@ -21,6 +24,8 @@
 char *cmd_buffer;
 
 static void execute_cmd(char *linebuffer);
+static int parse_args(char *linebuffer, char *arg[]);
+static void execute_args(char *arg[], int numarg);
 static void handle_any_command(char *argv[], int argc);
 
 const cmd_entry_t builtin_cmd_table[] = {
@@ -37,6 +42,19 @@ const cmd_entry_t builtin_cmd_table[] = {
     {"rename",      2,      2,  &do_mv,       "rename a file" },
     {"rm",          1, MAXARG,  &do_rm,       "delete a file" },
     {"rxfile",      1,      1,  &do_rxfile,   "receive file through console UART" },
+    {"rx",          1,      2,  &do_rx,       "rx file [baud]: receive file through console UART with XMODEM/YMODEM" },
+    {"crc32",       1,      2,  &do_crc32,    "crc32 file | address length: CRC32, as the crc32 tool prints it" },
+    {"sha256",      1,      2,  &do_sha256,   "sha256 file | address length: SHA-256, as sha256sum prints it" },
+
+    /* -- cli_disk.c ------------------- */
+    /* name         min     max function */
+    {"ramdisk",     0,      1,  &do_ramdisk,  "ramdisk [KB]: make a FAT volume in RAM, or show where it is" },
+    {"dd",          4,      5,  &do_dd,       "dd from-disk from-sector to-disk to-sector [count]: copy raw sectors between disks" },
+
+    /* -- cli_jobs.c ------------------- */
+    /* name         min     max function */
+    {"jobs",        0,      0,  &do_jobs,     "list background jobs (commands run with a trailing &)" },
+    {"kill",        1, MAXARG,  &do_kill,     "kill job ...: abandon background jobs" },
 
     /* -- cli_env.c -------------------- */
     /* name         min     max function */
@@ -48,21 +66,51 @@ const cmd_entry_t builtin_cmd_table[] = {
     {"dump",        2,      2,  &do_dump,     "dump memory <from> <count>" },
     {"wm",          2,      0,  &do_writemem, "synonym for WRITEMEM"},
     {"writemem",    2,      0,  &do_writemem, "write memory <addr> [byte ...]" },
-    {"testmem",     0,      2,  &do_memtest,  "test memory [base size]" },
-    {"memtest",     0,      2,  &do_memtest,  "test memory [base size]" },
+    {"testmem",     0,      3,  &do_memtest,  "test memory [fast] [base size]" },
+    {"memtest",     0,      3,  &do_memtest,  "test memory [fast] [base size]" },
+    {"memmap",      0,      3,  &do_memmap,   "list memory regions, or add [base] [max size]" },
+    {"ramdump",     2,      4,  &do_ramdump,  "ramdump save file|put [server:]file [address length]: sparse, compressed dump of RAM" },
 
     /* -- cli_info.c ------------------- */
     /* name         min     max function */
-    {"meminfo",    0,      0,   &do_meminfo,  "info on memory state" },
-    {"netinfo",     0,      0,  &do_netinfo,  "network statistics" },
+    {"meminfo",    0,      1,   &do_meminfo,  "info on memory state, with the heap and stack high water [reset]" },
+    {"netinfo",     0,      1,  &do_netinfo,  "network statistics [reset]" },
+    {"ethtx",       0,      2,  &do_ethtx,    "ethtx [ethN] [count]: show or set number of ethernet transmit buffers" },
+    {"ethirq",      0,      2,  &do_ethirq,   "ethirq [ethN] [irq|off]: receive ethernet frames on an interrupt (ISA IRQ on Q40, MF/PIC input on KISS/mini)" },
+    {"ethmedia",    0,      2,  &do_ethmedia, "ethmedia [ethN] [auto|10t|10t-fd|10base2|aui]: RTL8019 media and duplex" },
+    {"ifconfig",    0,      2,  &do_ifconfig, "ifconfig [ethN [a.b.c.d/len]]: show or set an interface's IPv4 address (0.0.0.0 to clear)" },
+    {"netcap",      0,      3,  &do_netcap,   "netcap [start [frames [snaplen]]|stop|save file|put [server:]file]: capture frames to pcap" },
+    {"rmem",        0,      0,  &do_rmem,     "serve memory reads, writes and execution to tools/rmem over UDP (needs rmem_key)" },
+    {"diskinfo",    0,      0,  &do_diskinfo, "disk I/O statistics" },
+    {"diskcache",   0,      1,  &do_diskcache, "disk cache statistics [writeback|writethrough|sync|flush]" },
+    {"cache",       0,      1,  &do_cache,    "list CPU cache policies, or pick one" },
+    {"profile",     1,      3,  &do_profile,  "profile [heap] on|off|report [count]: sample where the CPU spends its time, or who allocates memory" },
+    {"boottime",    0,      0,  &do_boottime, "how long each stage of startup took" },
     {"help",        0,      0,  &help,        "list this help info"   },
     {"date",        0,      0,  &do_date,     "display date from RTC"   },
 
     /* -- cli_tftp.c ------------------- */
     /* name         min     max function */
-    {"tftp",        1,      3,  &do_tftp_get, "retrieve file with TFTP" },
+    {"tftp",        1, MAXARG,  &do_tftp_get, "retrieve file with TFTP; tftp mget [server:]file ... for several at once" },
     {"tftpget",     1,      3,  &do_tftp_get, "retrieve file with TFTP" },
-    {"tftpput",     1,      3,  &do_tftp_put, "send file with TFTP" },
+    {"tftpput",     1,      3,  &do_tftp_put, "send file with TFTP, or memory: tftpput server:file address length" },
+    {"tftpraw",     2,      3,  &do_tftp_raw, "tftpraw [server:]file disk [sector]: write a disk image straight to sectors with TFTP" },
+    {"tftpload",    2,      2,  &do_tftp_load, "tftpload [server:]file address: retrieve file to memory with TFTP" },
+    {"tftpboot",    1, MAXARG,  &do_tftp_boot, "tftpboot [server:]file [args]: retrieve and run an executable with TFTP" },
+    {"tftpd",       0,      4,  &do_tftpd, "tftpd [seed|list|ram name address length]: serve files with TFTP in the background" },
+    {"netboot",     0, MAXARG,  &do_netboot,  "netboot [args]: retrieve and run the boot file named by DHCP" },
+
+    /* -- cli_http.c ------------------- */
+    /* name         min     max function */
+    {"httpget",     2,      2,  &do_http_get, "httpget http://ip[:port]/path file|address: retrieve file with HTTP" },
+
+    /* -- cli_bench.c ------------------ */
+    /* name         min     max function */
+    {"diskbench",   0,      2,  &do_diskbench, "disk benchmark [disk] [scratch sector]; write test DESTROYS 1MB at scratch sector" },
+    {"netbench",    4,      4,  &do_netbench, "netbench rx|tx host port seconds: UDP throughput benchmark" },
+    {"membench",    0,      4,  &do_membench, "membench [size ...]: memory bandwidth and latency of each region" },
+    {"libbench",    0,      0,  &do_libbench, "libbench: checksum, CRC32, SHA-256, copy, sort, allocator and RAM disk file speed" },
+    {"bench",       1,      3,  &do_bench,    "bench all [file | put [server:]file]: fixed run of the benchmarks, as a CSV line" },
 
     /* -- cli_load.c ------------------- */
     /* name         min     max function */
@@ -175,43 +223,210 @@ static bool handle_cmd_table(char *arg[], int numarg, const cmd_entry_t *cmd)
     return false;
 }
 
+/* A script is read in one go and split into lines, and each line is broken
+ * into arguments once. The result is kept, so running the same file again
+ * (the boot script, every power on) does not re-parse it; the file is still
+ * read, and its CRC must match, since FAT times only have 2 second resolution.
+ * Each line is held as its argument count (one byte), the line as typed (to
+ * echo) and then the arguments, each NUL terminated. A script being run is
+ * pinned: scripts run other scripts, which may push it out of the cache. */
+#define SCRIPT_MAX_SIZE     (64*1024)
+#define SCRIPT_CACHE_SIZE   4
+
+typedef struct script_t script_t;
+
+struct script_t {
+    script_t *next;
+    FATFS *fs;                  /* which file this was: volume, mount, first cluster, ... */
+    WORD fs_id;
+    DWORD sclust;
+    FSIZE_t size;
+    WORD fdate, ftime;
+    uint32_t crc;
+    int users;                  /* script_run() calls in progress */
+    bool cached;                /* on the script_cache list; if not, the last user frees it */
+    int lines;
+    uint32_t length;
+    char text[];
+};
+
+static script_t *script_cache = NULL;
+
+static script_t *script_parse(const char *source, uint32_t length)
+{
+    char *line, *end, *arg[MAXARG+1], *out, *copy;
+    int numarg, len;
+    script_t *script;
+
+    /* the parsed form is never longer than the source plus a little per line */
+    copy = arena_alloc(length + 1);
+    memcpy(copy, source, length);
+    copy[length] = 0;
+    script = malloc(sizeof(script_t) + 2 * (length + 1) + length / 2 + 2);
+    memset(script, 0, sizeof(script_t));
+    out = script->text;
+
+    for(line = copy; line < copy + length; line = end + 1){
+        for(end = line; *end && *end != '\n' && *end != '\r'; end++);
+        *end = 0;
+        if(!*line || *line == '#')
+            continue;
+        len = strlen(line) + 1;
+        memcpy(out + 1, line, len);
+        numarg = parse_args(line, arg); /* in place: the copy is scratch */
+        if(numarg <= 0)
+            continue;
+        *out = numarg;
+        out += 1 + len;
+        for(int i=0; i<numarg; i++){
+            len = strlen(arg[i]) + 1;
+            memcpy(out, arg[i], len);
+            out += len;
+        }
+        script->lines++;
+    }
+
+    script->length = out - script->text;
+    return script;
+}
+
+static void script_run(const char *name, script_t *script)
+{
+    const char *p = script->text, *line;
+    char *args, *arg[MAXARG+1];
+    int numarg, len;
+    arena_mark_t mark;
+
+    script->users++;
+    for(int l=0; l<script->lines; l++){
+        numarg = (uint8_t)*(p++);
+        line = p;
+        p += strlen(p) + 1;
+
+        /* commands may scribble on their arguments, so each run gets a copy */
+        args = (char*)p;
+        for(int i=0; i<numarg; i++)
+            args += strlen(args) + 1;
+        len = args - p;
+
+        task_pump(); /* yes, once per line inside scripts! */
+        printf("%s: %s\n", name, line);
+
+        mark = arena_mark();
+        args = arena_alloc(len);
+        memcpy(args, p, len);
+        for(int i=0; i<numarg; i++){
+            arg[i] = args;
+            args += strlen(args) + 1;
+        }
+        arg[numarg] = 0;
+        execute_args(arg, numarg);
+        arena_release(mark);
+
+        p += len;
+    }
+    if(--script->users == 0 && !script->cached)
+        free(script);
+}
+
+static script_t *script_cache_lookup(FIL *fd, const FILINFO *fi, uint32_t crc)
+{
+    script_t **link, *script;
+
+    for(link = &script_cache; (script = *link); link = &script->next){
+        if(script->fs == fd->obj.fs && script->fs_id == fd->obj.id &&
+           script->sclust == fd->obj.sclust && script->size == f_size(fd) &&
+           script->fdate == fi->fdate && script->ftime == fi->ftime &&
+           script->crc == crc){
+            /* most recently used goes to the front */
+            *link = script->next;
+            script->next = script_cache;
+            script_cache = script;
+            return script;
+        }
+    }
+
+    return NULL;
+}
+
+static void script_cache_add(script_t *script)
+{
+    script_t **link = &script_cache, *old;
+    int count = 0;
+
+    script->cached = true;
+    script->next = script_cache;
+    script_cache = script;
+
+    /* drop the least recently used; one still running is freed when it finishes */
+    while(*link && count++ < SCRIPT_CACHE_SIZE)
+        link = &(*link)->next;
+    while((old = *link)){
+        *link = old->next;
+        old->cached = false;
+        if(old->users == 0)
+            free(old);
+    }
+}
+
 static void execute_script(char *_name, FIL *fd) /* the buffer name lives in will be re-used shortly */
 {
-    int i;
-    bool eof;
+    char name[40], *source;
     unsigned int bytes_read;
+    script_t *script;
+    uint32_t crc;
+    FILINFO fi;
+    FRESULT fr;
+
+    fr = f_stat(_name, &fi);
+
+    strncpy(name, _name, sizeof(name));
+    name[sizeof(name)-1] = 0; /* ensure null termination */
+
+    if(f_size(fd) > SCRIPT_MAX_SIZE){
+        printf("%s: script too large\n", name);
+        return;
+    }
+
+    source = arena_alloc(f_size(fd));
+    if(f_read(fd, source, f_size(fd), &bytes_read) != FR_OK){
+        printf("%s: cannot read script\n", name);
+        return;
+    }
+    crc = crc32_update(0, source, bytes_read);
+
+    if(fr == FR_OK && (script = script_cache_lookup(fd, &fi, crc))){
+        script_run(name, script);
+        return;
+    }
+
+    script = script_parse(source, bytes_read);
+    if(fr == FR_OK){
+        script->fs = fd->obj.fs;
+        script->fs_id = fd->obj.id;
+        script->sclust = fd->obj.sclust;
+        script->size = f_size(fd);
+        script->fdate = fi.fdate;
+        script->ftime = fi.ftime;
+        script->crc = crc;
+        script_cache_add(script);
+    }
+    script_run(name, script); /* frees it if it was not cached */
+}
+
+/* the script is parsed first, its commands may well load something over it */
+void execute_script_memory(const char *_name, const char *script, uint32_t length)
+{
+    script_t *parsed;
     char name[40];
 
     strncpy(name, _name, sizeof(name));
     name[sizeof(name)-1] = 0; /* ensure null termination */
 
-    eof = false;
-    i = 0;
-    do{
-        if(f_read(fd, &cmd_buffer[i], 1, &bytes_read) != FR_OK || bytes_read != 1){
-            cmd_buffer[i] = '\n';
-            eof = true;
-        }
-        if(cmd_buffer[i] == '\n' || cmd_buffer[i] == '\r'){
-            cmd_buffer[i] = 0;
-            net_pump(); /* yes, once per line inside scripts! */
-            if(i > 0){
-                if(cmd_buffer[0] != '#'){
-                    printf("%s: %s\n", name, cmd_buffer);
-                    execute_cmd(cmd_buffer);
-                }
-            }
-            i = 0;
-        }else
-            i++;
-        if(i == LINELEN){
-            printf("Script line too long!\n");
-            eof = true;
-        }
-    }while(!eof);
+    parsed = script_parse(script, length);
+    script_run(name, parsed); /* not cached, so this frees it */
 }
 
-#define HEADER_EXAMINE_SIZE 16 /* number of bytes we examine to determine the file type */
 const char coff_header_bytes[2] = { 0x01, 0x50 };
 const char elf_header_bytes[4]  = { 0x7F, 0x45, 0x4c, 0x46 };
 const char m68k_header_bytes[2] = { 0x60, 0x1a };
@@ -223,6 +438,8 @@ static bool handle_cmd_executable(char *argv[], int argc)
     FRESULT fr;
     char buffer[HEADER_EXAMINE_SIZE];
     unsigned int br;
+    const char *format;
+    decomp_t *dc;
 
     // ugh .. until I fix this you'll have to type the whole name in. sorry.
     // if(!extend_filename(argv))
@@ -239,7 +456,7 @@ static bool handle_cmd_executable(char *argv[], int argc)
         return true; /* we tried and failed */
     }
 
-    printf("%s: %ld bytes, ", argv[0], f_size(&fd));
+    printf("%s: %ld bytes, ", argv[0], (uint32_t)f_size(&fd));
 
     /* below this point buffer holds file data, not the expanded file name */
     memset(buffer, 0, HEADER_EXAMINE_SIZE);
@@ -248,10 +465,23 @@ static bool handle_cmd_executable(char *argv[], int argc)
     fr = f_read(&fd, buffer, HEADER_EXAMINE_SIZE, &br);
     f_lseek(&fd, 0);
 
+    /* compressed: what matters is what it decompresses to */
+    format = fr == FR_OK ? decomp_detect(buffer, br) : NULL;
+    if(format){
+        printf("%s compressed, ", format);
+        dc = decomp_open(&fd, NULL, 0);
+        memset(buffer, 0, HEADER_EXAMINE_SIZE);
+        fr = dc ? decomp_read(dc, buffer, 0, HEADER_EXAMINE_SIZE) : FR_INT_ERR;
+        decomp_close(dc);
+        f_lseek(&fd, 0);
+    }
+
     if(fr == FR_OK){
         if(memcmp(buffer, elf_header_bytes, sizeof(elf_header_bytes)) == 0){
             printf("ELF.\n");
             load_elf_executable(argv, argc, &fd);
+        }else if(format && strncasecmp(buffer, script_header_bytes, sizeof(script_header_bytes)) == 0){
+            printf("script: compressed scripts are unsupported\n");
         }else if(strncasecmp(buffer, script_header_bytes, sizeof(script_header_bytes)) == 0){
             printf("script\n");
             execute_script(argv[0], &fd);
@@ -273,9 +503,10 @@ static bool handle_cmd_executable(char *argv[], int argc)
     return true;
 }
 
-static void execute_cmd(char *linebuffer)
+/* break linebuffer into arguments in place; -1 if it won't parse */
+static int parse_args(char *linebuffer, char *arg[])
 {
-    char *p, *arg[MAXARG+1], term;
+    char *p, term;
     int numarg;
 
     /* parse linebuffer into list of args */
@@ -300,7 +531,7 @@ static void execute_cmd(char *linebuffer)
                 p++;
             if(!*p){
                 printf("Could not find end of quoted string (looking for %c)\n", term);
-                return;
+                return -1;
             }
             *(p++) = 0;
         }else if(*p){
@@ -317,7 +548,39 @@ static void execute_cmd(char *linebuffer)
     //    printf(" argv[%d]=\"%s\"", i, arg[i]);
     //printf("\n");
 
+    return numarg;
+}
+
+static void execute_args(char *arg[], int numarg)
+{
+    arena_mark_t mark;
+    bool outer_background = cli_background;
+
+    /* a trailing "&" asks for the command to run as a background job; commands
+     * that can do so clear cli_background once they have started the job */
+    cli_background = false;
+    if(numarg > 1 && strcmp(arg[numarg-1], "&") == 0){
+        arg[--numarg] = 0;
+        cli_background = true;
+    }
+
+    mark = arena_mark();
     handle_any_command(arg, numarg);
+    arena_release(mark); /* frees the command's scratch memory */
+
+    if(cli_background)
+        printf("%s: cannot run in the background, so it ran in the foreground\n", arg[0]);
+    cli_background = outer_background;
+}
+
+static void execute_cmd(char *linebuffer)
+{
+    char *arg[MAXARG+1];
+    int numarg;
+
+    numarg = parse_args(linebuffer, arg);
+    if(numarg >= 0)
+        execute_args(arg, numarg);
 }
 
 static void handle_any_command(char *argv[], int argc) 
@@ -348,8 +611,11 @@ static int getline(char *line, int linesize)
     int ch;
 
     do {
-        net_pump(); /* call this regularly */
-        ch = uart_read_byte();
+        task_pump(); /* call this regularly */
+        job_pump();
+        ch = netcon_read_byte();
+        if(ch < 0)
+            ch = uart_read_byte();
 
         if(ch >= 0){
             if (ch >= 32 && ch < 127) {
@@ -382,7 +648,9 @@ static void run_autoexec(const char *filename)
         f_close(&fd);
     }else{
         printf("No \"%s\" script: %s\n", filename, f_errmsg(fr));
-        return; // nothing found
+        if(!dhcp_running())
+            return; // nothing found
+        filename = "netboot"; // perhaps we are diskless: DHCP may name something to boot
     }
 
     timer = set_timer_ms(AUTOBOOT_TIMEOUT_MS);
@@ -396,7 +664,9 @@ static void run_autoexec(const char *filename)
     }
 
     strcpy(cmd_buffer, filename);
+    boot_stage_mark("autoexec start");
     execute_cmd(cmd_buffer);
+    boot_stage_mark("autoexec end");
 }
 
 void command_line_interpreter(void)
@@ -411,6 +681,8 @@ void command_line_interpreter(void)
 
     /* check for autoexec file */
     run_autoexec(AUTOBOOT_FILENAME);
+    boot_stage_mark("prompt");
+    boot_stages_done();
 
     while(true){
         f_getcwd(cmd_buffer, LINELEN);
@@ -0,0 +1,1077 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <uart.h>
+#include <disk.h>
+#include <net.h>
+#include <cli.h>
+#include <cpu.h>
+#include <init.h>
+#include <version.h>
+
+#define BENCH_TICKS             (2 * TIMER_HZ)  /* run each test for ~2 seconds */
+#define BENCH_MAX_SECTORS       256
+#define BENCH_RANDOM_SECTORS    8               /* 4KB random reads */
+#define BENCH_WRITE_SECTORS     2048            /* 1MB scratch region for write tests */
+#define NETBENCH_PAYLOAD        1472            /* largest UDP payload in one 1500 byte frame */
+#define NETBENCH_TX_INFLIGHT    8               /* packets we let queue for the card */
+
+static uint32_t bench_seed = 0x12345678;
+
+static uint32_t bench_random(void)
+{
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return bench_seed >> 8;
+}
+
+/* microseconds per operation */
+static uint32_t bench_op_time_us(uint32_t ops, timer_t ticks)
+{
+    if(!ops)
+        return 0;
+    return (ticks * (1000000 / TIMER_HZ)) / ops;
+}
+
+/* print a transfer rate in KB/s */
+static void bench_report_rate(const char *what, int count, uint32_t ops, timer_t ticks)
+{
+    uint32_t kbytes = (ops * count) >> 1;
+
+    if(!ticks)
+        ticks = 1;
+    printf("%s %3d sectors/cmd: %lu KB/s (%lu us/cmd)\n", what, count,
+            (kbytes * TIMER_HZ) / ticks, bench_op_time_us(ops, ticks));
+}
+
+/* Repeatedly transfer 'count' sectors within [start, limit) for BENCH_TICKS,
+ * sequentially (wrapping at limit) or at random offsets. Returns false on error
+ * or if cancelled, otherwise the number of commands issued and time taken. */
+static bool disk_bench_run(int disknr, void *buffer, uint32_t start, uint32_t limit, int count,
+                           bool is_write, bool random, uint32_t *ops_out, timer_t *ticks_out)
+{
+    uint32_t sector = start, ops = 0;
+    timer_t begin, timeout;
+    bool ok;
+
+    if(limit - start < count)
+        return false;
+
+    begin = gogoboot_read_timer();
+    timeout = set_timer_ticks(BENCH_TICKS);
+
+    while(!timer_expired(timeout)){
+        if(random)
+            sector = start + (bench_random() % (limit - start - count + 1));
+        else if(sector + count > limit)
+            sector = start;
+
+        if(is_write)
+            ok = disk_data_write(disknr, buffer, sector, count);
+        else
+            ok = disk_data_read(disknr, buffer, sector, count);
+        if(!ok){
+            printf("diskbench: I/O error at sector %lu\n", sector);
+            return false;
+        }
+
+        sector += count;
+        ops++;
+
+        if(uart_check_cancel_key())
+            return false;
+    }
+
+    *ops_out = ops;
+    *ticks_out = gogoboot_read_timer() - begin;
+    return true;
+}
+
+static void disk_bench(int disknr, uint32_t scratch, bool do_write)
+{
+    int count;
+    disk_t *disk;
+    void *buffer;
+    uint32_t ops, limit;
+    timer_t ticks;
+
+    disk = disk_get_info(disknr);
+    if(!disk){
+        printf("diskbench: no disk %d\n", disknr);
+        return;
+    }
+
+    if(do_write && (scratch >= disk->sectors || disk->sectors - scratch < BENCH_WRITE_SECTORS)){
+        printf("diskbench: scratch region at sector %lu does not fit on disk\n", scratch);
+        return;
+    }
+
+    buffer = malloc_unchecked(BENCH_MAX_SECTORS * 512);
+    if(!buffer){
+        printf("diskbench: insufficient memory\n");
+        return;
+    }
+
+    printf("diskbench: disk %d, %lu sectors, multiple %d (press Q to cancel)\n",
+            disknr, disk->sectors, disk->multiple);
+
+    /* command latency: re-read a single sector, the drive will have it cached */
+    if(!disk_bench_run(disknr, buffer, 0, 1, 1, false, false, &ops, &ticks))
+        goto done;
+    printf("command latency: %lu us\n", bench_op_time_us(ops, ticks));
+
+    /* sequential read, sweeping the transfer size */
+    for(count=1; count<=BENCH_MAX_SECTORS; count<<=1){
+        if(!disk_bench_run(disknr, buffer, 0, disk->sectors, count, false, false, &ops, &ticks))
+            goto done;
+        bench_report_rate("sequential read", count, ops, ticks);
+    }
+
+    /* random 4KB reads across the whole disk */
+    if(!disk_bench_run(disknr, buffer, 0, disk->sectors, BENCH_RANDOM_SECTORS, false, true, &ops, &ticks))
+        goto done;
+    printf("random 4KB read: %lu IOPS (%lu us/op)\n",
+            ticks ? (ops * TIMER_HZ) / ticks : 0, bench_op_time_us(ops, ticks));
+
+    /* sequential write is destructive; only into a scratch region we were given */
+    if(do_write){
+        limit = scratch + BENCH_WRITE_SECTORS;
+        memset(buffer, 0xA5, BENCH_MAX_SECTORS * 512);
+        for(count=1; count<=BENCH_MAX_SECTORS; count<<=4){
+            if(!disk_bench_run(disknr, buffer, scratch, limit, count, true, false, &ops, &ticks))
+                goto done;
+            bench_report_rate("sequential write", count, ops, ticks);
+        }
+    }else{
+        printf("sequential write: skipped (specify a scratch sector to enable)\n");
+    }
+
+done:
+    free(buffer);
+}
+
+void do_diskbench(char *argv[], int argc)
+{
+    if(argc == 0){
+        /* read-only tests on every disk */
+        for(int disk=0; disk<disk_get_count(); disk++)
+            disk_bench(disk, 0, false);
+        return;
+    }
+
+    disk_bench(parse_uint32(argv[0], NULL), argc >= 2 ? parse_uint32(argv[1], NULL) : 0, argc >= 2);
+}
+
+/* netbench datagrams start with a 32-bit big-endian sequence number, so the
+ * receiving end can count what went missing */
+typedef struct {
+    uint32_t packets, bytes, lost;
+    uint32_t next_seq;
+    timer_t first, last;
+} netbench_rx_t;
+
+static void netbench_received(packet_sink_t *sink, packet_t *packet)
+{
+    netbench_rx_t *rx = sink->sink_private;
+    uint32_t seq;
+
+    rx->last = gogoboot_read_timer();
+    if(!rx->packets)
+        rx->first = rx->last;
+
+    if(packet->data_length >= 4){
+        seq = ntohl(*(uint32_t*)packet->data);
+        if(rx->packets && seq > rx->next_seq)
+            rx->lost += seq - rx->next_seq;
+        rx->next_seq = seq + 1;
+    }
+
+    rx->packets++;
+    rx->bytes += packet->data_length;
+    packet_free(packet);
+}
+
+static void netbench_report(const char *what, uint32_t packets, uint32_t bytes, timer_t ticks)
+{
+    uint32_t rate;
+
+    if(!ticks)
+        ticks = 1;
+    rate = ((bytes / ticks) * TIMER_HZ * 8) / 10000; /* Mbit/s * 100 */
+    printf("%s: %lu packets, %lu bytes in %lu.%02lus: %lu packets/s, %lu.%02lu Mbit/s\n",
+            what, packets, bytes, ticks / TIMER_HZ, ((ticks % TIMER_HZ) * 100) / TIMER_HZ,
+            (packets * TIMER_HZ) / ticks, rate / 100, rate % 100);
+}
+
+/* cost of the software checksum for one full size datagram, in microseconds
+ * (times 10, the timer is too coarse to time a single call) */
+static uint32_t netbench_checksum_cost(void)
+{
+    uint8_t *buffer;
+    uint32_t calls = 0;
+    timer_t begin, timeout;
+
+    buffer = malloc(NETBENCH_PAYLOAD);
+    memset(buffer, 0x5A, NETBENCH_PAYLOAD);
+    begin = gogoboot_read_timer();
+    timeout = set_timer_ticks(TIMER_HZ / 2);
+    while(!timer_expired(timeout)){
+        net_checksum_partial(buffer, NETBENCH_PAYLOAD);
+        calls++;
+    }
+    free(buffer);
+
+    return ((gogoboot_read_timer() - begin) * (10000000 / TIMER_HZ)) / (calls ? calls : 1);
+}
+
+static void netbench_checksum_report(uint32_t packets, timer_t ticks)
+{
+    uint32_t cost = netbench_checksum_cost();
+    uint32_t busy_ms = (packets * cost) / 10000;
+
+    if(!ticks)
+        ticks = 1;
+    printf("checksum: %lu.%lu us per %d byte datagram, ~%lu ms of the run (%lu%%)\n",
+            cost / 10, cost % 10, NETBENCH_PAYLOAD, busy_ms,
+            (busy_ms * 100) / (ticks * (1000 / TIMER_HZ)));
+}
+
+static void netbench_rx(uint32_t host, uint16_t port, timer_t ticks)
+{
+    netbench_rx_t rx;
+    eth_stats_t before = *eth_get_stats();
+    const eth_stats_t *after;
+    uint32_t discards = packet_discard_count, cksum = packet_bad_cksum_count;
+    packet_sink_t *sink;
+    timer_t timeout;
+
+    memset(&rx, 0, sizeof(rx));
+    sink = packet_sink_alloc();
+    sink->match_interface_local_ip = true;
+    sink->match_ipv4_protocol = ip_proto_udp;
+    sink->match_remote_ip = host;
+    sink->match_local_port = port;
+    sink->sink_private = &rx;
+    sink->cb_packet_received = netbench_received;
+    net_add_packet_sink(sink);
+
+    printf("netbench: receiving on UDP port %d (press Q to cancel)\n", port);
+    timeout = set_timer_ticks(ticks);
+    while(!rx.packets || !timer_expired(timeout)){
+        net_pump();
+        if(!rx.packets)
+            timeout = set_timer_ticks(ticks); /* the clock starts with the first packet */
+        if(uart_check_cancel_key())
+            break;
+    }
+
+    net_remove_packet_sink(sink);
+    packet_sink_free(sink);
+
+    after = eth_get_stats();
+    netbench_report("rx", rx.packets, rx.bytes, rx.last - rx.first);
+    printf("dropped: %lu by sequence, card missed %lu, overflows %lu, irq overruns %lu, crc errors %lu\n",
+            rx.lost, after->missed_frames - before.missed_frames, after->overflows - before.overflows,
+            after->irq_overruns - before.irq_overruns, after->crc_errors - before.crc_errors);
+    printf("discarded: %lu unmatched, %lu bad checksum\n",
+            packet_discard_count - discards, packet_bad_cksum_count - cksum);
+    netbench_checksum_report(rx.packets, rx.last - rx.first);
+}
+
+/* returns the packets sent, and how long they took to go */
+static uint32_t netbench_tx_run(uint32_t host, uint16_t port, timer_t ticks, timer_t *taken)
+{
+    uint32_t packets = 0, alive = packet_alive_count;
+    timer_t begin, timeout;
+    packet_t *packet;
+
+    begin = gogoboot_read_timer();
+    timeout = set_timer_ticks(ticks);
+    while(!timer_expired(timeout)){
+        /* keep a few packets queued so the card never waits for us */
+        while(packet_alive_count - alive < NETBENCH_TX_INFLIGHT){
+            packet = packet_create_udp(host, port, port, NETBENCH_PAYLOAD);
+            *(uint32_t*)packet->data = htonl(packets);
+            memset(packet->data + 4, 0, NETBENCH_PAYLOAD - 4);
+            net_tx(packet);
+            packets++;
+        }
+        net_pump();
+        if(uart_check_cancel_key())
+            break;
+    }
+
+    /* let the queue drain */
+    timeout = set_timer_ms(500);
+    while(packet_alive_count != alive && !timer_expired(timeout))
+        net_pump();
+
+    *taken = gogoboot_read_timer() - begin;
+    return packets;
+}
+
+static void netbench_tx(uint32_t host, uint16_t port, timer_t ticks)
+{
+    eth_stats_t before = *eth_get_stats();
+    uint32_t packets, alive = packet_alive_count;
+    timer_t taken;
+
+    printf("netbench: sending to UDP port %d (press Q to cancel)\n", port);
+    packets = netbench_tx_run(host, port, ticks, &taken);
+    netbench_report("tx", packets, packets * NETBENCH_PAYLOAD, taken);
+    printf("card busy %lu times, %lu packets still queued\n",
+            eth_get_stats()->tx_busy - before.tx_busy, packet_alive_count - alive);
+    netbench_checksum_report(packets, taken);
+}
+
+void do_netbench(char *argv[], int argc)
+{
+    uint32_t host, seconds;
+    uint16_t port;
+
+    if(!eth_rxbuffer_size()){
+        printf("netbench: no network card\n");
+        return;
+    }
+
+    host = net_parse_ipv4(argv[1]);
+    if(!host){
+        printf("netbench: cannot parse IPv4 address \"%s\"\n", argv[1]);
+        return;
+    }
+    port = parse_uint32(argv[2], NULL);
+    seconds = parse_uint32(argv[3], NULL);
+    if(!port || !seconds){
+        printf("netbench: need a port and a duration\n");
+        return;
+    }
+
+    if(!strcasecmp(argv[0], "rx"))
+        netbench_rx(host, port, seconds * TIMER_HZ);
+    else if(!strcasecmp(argv[0], "tx"))
+        netbench_tx(host, port, seconds * TIMER_HZ);
+    else
+        printf("netbench: specify rx or tx\n");
+}
+
+/* membench: bandwidth and latency of each memory region, under each cache mode */
+#define MEMBENCH_TICKS          (TIMER_HZ / 2)  /* per test and cache mode */
+#define MEMBENCH_MAX_SIZE       (1024*1024)     /* fill_32/check_pattern count with dbf */
+#define MEMBENCH_MIN_SIZE       4096
+#define MEMBENCH_CHASE_STRIDE   64              /* bigger than any cache line */
+#define MEMBENCH_CHASE_BATCH    1024            /* loads between looks at the timer */
+#define MEMBENCH_MAX_SIZES      4               /* as the command table allows */
+
+#ifdef CPU_68020_OR_LATER
+#define MEMBENCH_CACHE_MODES    3
+static const char * const membench_cache_name[MEMBENCH_CACHE_MODES] = { "cache on", "no dcache", "cache off" };
+#else
+#define MEMBENCH_CACHE_MODES    1
+static const char * const membench_cache_name[MEMBENCH_CACHE_MODES] = { "no cache" };
+#endif
+
+/* each runs once over the buffer and returns the bytes moved (loads, for the chase) */
+static uint32_t membench_read(uint32_t base, uint32_t size)
+{
+    memtest_check_pattern(0, (volatile uint32_t *)base, (volatile uint32_t *)(base + size));
+    return size;
+}
+
+static uint32_t membench_write(uint32_t base, uint32_t size)
+{
+    memtest_fill_32(0x5a5a5a5a, (volatile uint32_t *)base, (volatile uint32_t *)(base + size));
+    return size;
+}
+
+static uint32_t membench_memset(uint32_t base, uint32_t size)
+{
+    memset((void*)base, 0x5a, size);
+    return size;
+}
+
+static uint32_t membench_memcpy(uint32_t base, uint32_t size)
+{
+    memcpy((void*)base, (void*)(base + size/2), size/2);
+    return size/2;
+}
+
+static uint32_t membench_chase_position;
+
+static uint32_t membench_chase(uint32_t base, uint32_t size)
+{
+    uint32_t p = membench_chase_position, n = MEMBENCH_CHASE_BATCH;
+
+    asm volatile (
+        "1: move.l (%0),%0; subq.l #1,%1; bne.s 1b"
+        : "=a" (p), "=d" (n)
+        : "0" (p), "1" (n));
+
+    membench_chase_position = p;
+    return MEMBENCH_CHASE_BATCH;
+}
+
+/* one cycle through the buffer in random order, a slot every stride (Sattolo's algorithm) */
+static void membench_chase_setup(uint32_t base, uint32_t size)
+{
+    uint32_t slots = size / MEMBENCH_CHASE_STRIDE, j, t;
+    uint32_t *slot;
+
+    #define CHASE_SLOT(i) ((uint32_t*)(base + (i) * MEMBENCH_CHASE_STRIDE))
+    for(uint32_t i=0; i<slots; i++)
+        *CHASE_SLOT(i) = i;
+    for(uint32_t i=slots-1; i>0; i--){
+        j = bench_random() % i;
+        t = *CHASE_SLOT(i);
+        *CHASE_SLOT(i) = *CHASE_SLOT(j);
+        *CHASE_SLOT(j) = t;
+    }
+    for(uint32_t i=0; i<slots; i++){
+        slot = CHASE_SLOT(i);
+        *slot = (uint32_t)CHASE_SLOT(*slot);
+    }
+    #undef CHASE_SLOT
+
+    membench_chase_position = base;
+}
+
+typedef struct {
+    const char *name;
+    uint32_t (*run)(uint32_t base, uint32_t size);
+    bool latency;
+} membench_test_t;
+
+static const membench_test_t membench_tests[] = {
+    { "read KB/s",      membench_read,   false },
+    { "write KB/s",     membench_write,  false },
+    { "memset KB/s",    membench_memset, false },
+    { "memcpy KB/s",    membench_memcpy, false },
+    { "latency ns",     membench_chase,  true  },
+};
+#define MEMBENCH_TESTS (sizeof(membench_tests) / sizeof(membench_tests[0]))
+
+static void membench_cache_mode(int mode)
+{
+#ifdef CPU_68020_OR_LATER
+    switch(mode){
+        case CACHE_FULL:    cpu_cache_enable();         break;
+        case CACHE_NODATA:  cpu_cache_enable_nodata();  break;
+        case CACHE_NONE:    cpu_cache_disable();        break;
+    }
+#endif
+}
+
+/* one test over the buffer in the current cache mode: KB/s, or ns per load */
+static uint32_t membench_measure(const membench_test_t *test, uint32_t base, uint32_t size)
+{
+    uint32_t amount = 0;
+    timer_t begin, timeout, ticks;
+
+    if(test->latency)
+        membench_chase_setup(base, size);
+    cpu_cache_flush();
+    begin = gogoboot_read_timer();
+    timeout = set_timer_ticks(MEMBENCH_TICKS);
+    while(!timer_expired(timeout))
+        amount += test->run(base, size);
+    ticks = gogoboot_read_timer() - begin;
+    if(!ticks)
+        ticks = 1;
+
+    if(test->latency)
+        return (ticks * (1000000000 / TIMER_HZ)) / amount;
+    return ((amount >> 10) * TIMER_HZ) / ticks;
+}
+
+/* returns false if cancelled */
+static bool membench_region(const char *name, uint32_t base, uint32_t size)
+{
+    uint32_t result[MEMBENCH_TESTS][MEMBENCH_CACHE_MODES];
+    bool cancelled = false;
+
+    printf("membench: %s at 0x%08lx, %ld KB, cache policy %s\n", name, base, size >> 10, cache_policy_name());
+
+    for(int mode=0; mode<MEMBENCH_CACHE_MODES && !cancelled; mode++){
+        membench_cache_mode(mode);
+        for(int t=0; t<MEMBENCH_TESTS && !cancelled; t++){
+            result[t][mode] = membench_measure(&membench_tests[t], base, size);
+            net_pump();
+            cancelled = uart_check_cancel_key();
+        }
+    }
+    cpu_cache_enable();
+
+    if(cancelled)
+        return false;
+
+    printf("%-14s", "");
+    for(int mode=0; mode<MEMBENCH_CACHE_MODES; mode++)
+        printf("%11s", membench_cache_name[mode]);
+    printf("\n");
+    for(int t=0; t<MEMBENCH_TESTS; t++){
+        printf("%-14s", membench_tests[t].name);
+        for(int mode=0; mode<MEMBENCH_CACHE_MODES; mode++)
+            printf("%11ld", result[t][mode]);
+        printf("\n");
+    }
+
+    return true;
+}
+
+static const char *membench_region_name(const mem_region_t *region)
+{
+    switch(region->type){
+        case mem_ram:   return region->base ? "RAM" : "RAM (low)";
+        case mem_video: return "video RAM";
+        case mem_sram:  return "SRAM";
+    }
+    return "?";
+}
+
+/* each region in turn, in its free part, at each size */
+void do_membench(char *argv[], int argc)
+{
+    static const uint32_t default_size[] = { 4*1024, 256*1024 };
+    uint32_t sizes[MEMBENCH_MAX_SIZES], base, top, size;
+    int count = 0;
+
+    if(argc == 0){
+        for(int i=0; i<sizeof(default_size)/sizeof(default_size[0]); i++)
+            sizes[count++] = default_size[i];
+    }else
+        for(int i=0; i<argc; i++)
+            sizes[count++] = parse_uint32(argv[i], NULL);
+
+    printf("membench: %d ms per test (press Q to cancel)\n", (int)(MEMBENCH_TICKS * TIMER_MS_PER_TICK));
+
+    for(int r=0; r<mem_region_count; r++){
+        base = mem_region[r].base;
+        top = base + mem_region[r].size;
+        if(base == 0){ /* our own region: only the free part */
+            base = bounce_below_addr;
+            top = free_ram_top;
+        }
+        base = (base + 15) & ~15;
+
+        for(int i=0; i<count; i++){
+            size = sizes[i] & ~(MEMBENCH_CHASE_STRIDE-1);
+            if(size > MEMBENCH_MAX_SIZE)
+                size = MEMBENCH_MAX_SIZE;
+            if(size > top - base)
+                size = (top - base) & ~(MEMBENCH_CHASE_STRIDE-1);
+            if(size < MEMBENCH_MIN_SIZE || check_writable_range(base, size, false))
+                continue;
+            if(!membench_region(membench_region_name(&mem_region[r]), base, size))
+                return;
+        }
+    }
+}
+
+/* libbench: the portable library code, timed in place -- checksums, copies,
+ * sorting, the allocator, and FatFs over the RAM disk if there is one */
+#define LIBBENCH_TICKS          (TIMER_HZ / 2)  /* per test */
+#define LIBBENCH_BUFFER         (16*1024)
+#define LIBBENCH_COPY           4096
+#define LIBBENCH_SORT           256             /* words per sort */
+#define LIBBENCH_ALLOCS         64              /* blocks held at once */
+#define LIBBENCH_ALLOC_MAX      600             /* bytes: the size classes and a little past */
+#define LIBBENCH_FILE_SIZE      (64*1024)
+#define LIBBENCH_FILE_CHUNK     4096
+
+static uint8_t *libbench_buffer;
+static char libbench_path[16];
+
+/* each runs once and returns the bytes (or operations) it did, 0 on failure */
+static uint32_t libbench_checksum(void)
+{
+    net_checksum_partial(libbench_buffer, NETBENCH_PAYLOAD);
+    return NETBENCH_PAYLOAD;
+}
+
+static uint32_t libbench_crc32(void)
+{
+    crc32_update(0, libbench_buffer, LIBBENCH_COPY);
+    return LIBBENCH_COPY;
+}
+
+static uint32_t libbench_sha256(void)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_t s;
+
+    sha256_init(&s);
+    sha256_update(&s, libbench_buffer, LIBBENCH_COPY);
+    sha256_final(&s, digest);
+    return LIBBENCH_COPY;
+}
+
+static uint32_t libbench_memcpy(void)
+{
+    memcpy(libbench_buffer, libbench_buffer + LIBBENCH_BUFFER/2, LIBBENCH_COPY);
+    return LIBBENCH_COPY;
+}
+
+static uint32_t libbench_memcpy_odd(void)
+{
+    memcpy(libbench_buffer, libbench_buffer + LIBBENCH_BUFFER/2 + 1, LIBBENCH_COPY - 1);
+    return LIBBENCH_COPY - 1;
+}
+
+static uint32_t libbench_memset(void)
+{
+    memset(libbench_buffer, 0x5a, LIBBENCH_COPY);
+    return LIBBENCH_COPY;
+}
+
+static int libbench_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t libbench_qsort(void)
+{
+    uint32_t *word = (uint32_t *)libbench_buffer;
+
+    for(int i=0; i<LIBBENCH_SORT; i++)
+        word[i] = bench_random();
+    qsort(word, LIBBENCH_SORT, sizeof(uint32_t), libbench_compare);
+    return 1;
+}
+
+static uint32_t libbench_malloc(void)
+{
+    void *block[LIBBENCH_ALLOCS];
+
+    for(int i=0; i<LIBBENCH_ALLOCS; i++)
+        block[i] = malloc_unchecked(1 + bench_random() % LIBBENCH_ALLOC_MAX);
+    for(int i=0; i<LIBBENCH_ALLOCS; i++)
+        free(block[LIBBENCH_ALLOCS - 1 - (i ^ 5) % LIBBENCH_ALLOCS]); /* not quite in order */
+    return 2 * LIBBENCH_ALLOCS;
+}
+
+static uint32_t libbench_file_write(void)
+{
+    FIL fd;
+    UINT done;
+    uint32_t bytes = 0;
+
+    if(f_open(&fd, libbench_path, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        return 0;
+    while(bytes < LIBBENCH_FILE_SIZE &&
+          f_write(&fd, libbench_buffer, LIBBENCH_FILE_CHUNK, &done) == FR_OK && done == LIBBENCH_FILE_CHUNK)
+        bytes += done;
+    if(f_close(&fd) != FR_OK)
+        return 0;
+    return bytes;
+}
+
+static uint32_t libbench_file_read(void)
+{
+    FIL fd;
+    UINT done;
+    uint32_t bytes = 0;
+
+    if(f_open(&fd, libbench_path, FA_READ) != FR_OK)
+        return 0;
+    while(f_read(&fd, libbench_buffer, LIBBENCH_FILE_CHUNK, &done) == FR_OK && done)
+        bytes += done;
+    f_close(&fd);
+    return bytes;
+}
+
+static uint32_t libbench_file_open(void)
+{
+    FIL fd;
+
+    if(f_open(&fd, libbench_path, FA_READ) != FR_OK)
+        return 0;
+    f_close(&fd);
+    return 1;
+}
+
+typedef struct {
+    const char *name;
+    uint32_t (*run)(void);
+    bool bytes;                 /* report KB/s, not operations/s */
+    bool ramdisk;               /* needs the RAM disk */
+} libbench_test_t;
+
+static const libbench_test_t libbench_tests[] = {
+    { "checksum",       libbench_checksum,      true,  false },
+    { "crc32",          libbench_crc32,         true,  false },
+    { "sha256",         libbench_sha256,        true,  false },
+    { "memcpy",         libbench_memcpy,        true,  false },
+    { "memcpy odd",     libbench_memcpy_odd,    true,  false },
+    { "memset",         libbench_memset,        true,  false },
+    { "qsort 256",      libbench_qsort,         false, false },
+    { "malloc+free",    libbench_malloc,        false, false },
+    { "file write",     libbench_file_write,    true,  true  },
+    { "file read",      libbench_file_read,     true,  true  },
+    { "file open",      libbench_file_open,     false, true  },
+};
+#define LIBBENCH_TESTS (sizeof(libbench_tests) / sizeof(libbench_tests[0]))
+
+/* the buffer the tests work on, and the RAM disk file path; false if no memory */
+static bool libbench_open(int ramdisk)
+{
+    libbench_buffer = malloc_unchecked(LIBBENCH_BUFFER);
+    if(!libbench_buffer){
+        printf("libbench: no memory\n");
+        return false;
+    }
+    for(int i=0; i<LIBBENCH_BUFFER; i++)
+        libbench_buffer[i] = bench_random();
+    libbench_path[0] = '0' + ramdisk;
+    strcpy(libbench_path + 1, ":/libbench.tmp");
+    return true;
+}
+
+static void libbench_close(int ramdisk)
+{
+    if(ramdisk >= 0)
+        f_unlink(libbench_path);
+    free(libbench_buffer);
+}
+
+/* KB/s or operations/s, and microseconds per run of the test; false if it failed */
+static bool libbench_measure(const libbench_test_t *test, uint32_t *rate, uint32_t *us_per_op)
+{
+    uint32_t amount = 0, done = 1;
+    timer_t begin, timeout, ticks;
+
+    begin = gogoboot_read_timer();
+    timeout = set_timer_ticks(LIBBENCH_TICKS);
+    while(!timer_expired(timeout)){
+        done = test->run();
+        if(!done)
+            return false;
+        amount += done;
+    }
+    ticks = gogoboot_read_timer() - begin;
+    if(!ticks)
+        ticks = 1;
+
+    if(test->bytes)
+        *rate = ((amount >> 10) * TIMER_HZ) / ticks;
+    else
+        *rate = (amount * TIMER_HZ) / ticks;
+    *us_per_op = bench_op_time_us(amount, ticks);
+    return true;
+}
+
+void do_libbench(char *argv[], int argc)
+{
+    const libbench_test_t *test;
+    uint32_t rate, us;
+    int ramdisk = ramdisk_get();
+
+    if(!libbench_open(ramdisk))
+        return;
+
+    printf("libbench: %d ms per test (press Q to cancel)\n", (int)(LIBBENCH_TICKS * TIMER_MS_PER_TICK));
+    if(ramdisk < 0)
+        printf("libbench: no RAM disk, so no file tests (ramdisk KB makes one)\n");
+
+    for(int t=0; t<LIBBENCH_TESTS; t++){
+        test = &libbench_tests[t];
+        if(test->ramdisk && ramdisk < 0)
+            continue;
+
+        if(!libbench_measure(test, &rate, &us))
+            printf("%-14s failed\n", test->name);
+        else if(test->bytes)
+            printf("%-14s %8lu KB/s\n", test->name, rate);
+        else
+            printf("%-14s %8lu ops/s  %lu us/op\n", test->name, rate, us);
+
+        net_pump();
+        if(uart_check_cancel_key())
+            break;
+    }
+
+    libbench_close(ramdisk);
+}
+
+/* bench all: one run of a fixed set of the tests above, a number from each,
+ * kept as a line of CSV -- appended to a file, or sent with TFTP -- so that
+ * builds can be compared over time. a column this machine cannot fill (no
+ * disk, no RAM disk, no bench_host to send to) is left empty, so the columns
+ * line up whatever ran */
+#define BENCH_MAX_RESULTS       24
+#define BENCH_NAME_LENGTH       24
+#define BENCH_DISK_SECTORS      64
+#define BENCH_MEM_SIZE          (256*1024)
+#define BENCH_NET_PORT          9               /* discard */
+#define BENCH_CSV_LENGTH        2048
+
+#if defined(TARGET_Q40)
+#define BENCH_TARGET "q40"
+#elif defined(TARGET_KISS)
+#define BENCH_TARGET "kiss"
+#elif defined(TARGET_MINI)
+#define BENCH_TARGET "mini"
+#else
+#define BENCH_TARGET "?"
+#endif
+
+#if defined(__mc68060__)
+#define BENCH_CPU "68060"
+#elif defined(__mc68040__)
+#define BENCH_CPU "68040"
+#elif defined(__mc68030__)
+#define BENCH_CPU "68030"
+#elif defined(__mc68020__)
+#define BENCH_CPU "68020"
+#else
+#define BENCH_CPU "68000"
+#endif
+
+typedef struct {
+    char name[BENCH_NAME_LENGTH];
+    bool valid;
+    uint32_t value;
+} bench_result_t;
+
+static bench_result_t *bench_results;
+static int bench_result_count;
+
+static void bench_record(const char *prefix, const char *name, const char *unit, bool valid, uint32_t value)
+{
+    bench_result_t *r = &bench_results[bench_result_count++];
+
+    r->name[0] = 0;
+    strncat(r->name, prefix, BENCH_NAME_LENGTH-1);
+    strncat(r->name, name, BENCH_NAME_LENGTH-1 - strlen(r->name));
+    strncat(r->name, unit, BENCH_NAME_LENGTH-1 - strlen(r->name));
+    r->valid = valid;
+    r->value = value;
+
+    if(valid)
+        printf("%-22s %8lu\n", r->name, value);
+    else
+        printf("%-22s        -\n", r->name);
+}
+
+/* returns false if cancelled */
+static bool bench_all_lib(void)
+{
+    const libbench_test_t *test;
+    int ramdisk = ramdisk_get();
+    uint32_t rate, us;
+    bool ok;
+
+    if(!libbench_open(ramdisk))
+        return false;
+
+    for(int t=0; t<LIBBENCH_TESTS; t++){
+        test = &libbench_tests[t];
+        ok = !(test->ramdisk && ramdisk < 0) && libbench_measure(test, &rate, &us);
+        bench_record("", test->name, test->bytes ? " KB/s" : " ops/s", ok, rate);
+        net_pump();
+        if(uart_check_cancel_key()){
+            libbench_close(ramdisk);
+            return false;
+        }
+    }
+
+    libbench_close(ramdisk);
+    return true;
+}
+
+/* the free part of low RAM, in the cache mode already chosen */
+static bool bench_all_mem(void)
+{
+    uint32_t base = (bounce_below_addr + 15) & ~15, size = BENCH_MEM_SIZE;
+    bool ok;
+
+    if(size > free_ram_top - base)
+        size = (free_ram_top - base) & ~(MEMBENCH_CHASE_STRIDE-1);
+    ok = size >= MEMBENCH_MIN_SIZE && !check_writable_range(base, size, false);
+
+    for(int t=0; t<MEMBENCH_TESTS; t++){
+        bench_record("mem ", membench_tests[t].name, "", ok, ok ? membench_measure(&membench_tests[t], base, size) : 0);
+        net_pump();
+        if(uart_check_cancel_key())
+            return false;
+    }
+
+    return true;
+}
+
+/* reads only, on disk 0; an I/O error abandons the run, as a cancel does */
+static bool bench_all_disk(void)
+{
+    disk_t *disk = disk_get_count() ? disk_get_info(0) : NULL;
+    uint32_t latency, rate, iops, ops;
+    void *buffer = NULL;
+    timer_t ticks;
+    bool ok;
+
+    if(disk && disk->sectors >= BENCH_DISK_SECTORS)
+        buffer = malloc_unchecked(BENCH_DISK_SECTORS * 512);
+
+    if(!buffer){
+        bench_record("disk ", "latency", " us", false, 0);
+        bench_record("disk ", "read", " KB/s", false, 0);
+        bench_record("disk ", "random 4KB", " IOPS", false, 0);
+        return true;
+    }
+
+    ok = disk_bench_run(0, buffer, 0, 1, 1, false, false, &ops, &ticks);
+    if(ok){
+        latency = bench_op_time_us(ops, ticks);
+        ok = disk_bench_run(0, buffer, 0, disk->sectors, BENCH_DISK_SECTORS, false, false, &ops, &ticks);
+    }
+    if(ok){
+        rate = (((ops * BENCH_DISK_SECTORS) >> 1) * TIMER_HZ) / ticks;
+        ok = disk_bench_run(0, buffer, 0, disk->sectors, BENCH_RANDOM_SECTORS, false, true, &ops, &ticks);
+    }
+    free(buffer);
+    if(!ok)
+        return false;
+
+    iops = (ops * TIMER_HZ) / ticks;
+    bench_record("disk ", "latency", " us", true, latency);
+    bench_record("disk ", "read", " KB/s", true, rate);
+    bench_record("disk ", "random 4KB", " IOPS", true, iops);
+    return true;
+}
+
+/* UDP to the discard port of bench_host, if there is one */
+static bool bench_all_net(void)
+{
+    const char *host_name = get_environment_variable("bench_host");
+    uint32_t host = host_name ? net_parse_ipv4(host_name) : 0;
+    uint32_t packets;
+    timer_t taken;
+
+    if(!host || !eth_rxbuffer_size()){
+        bench_record("net ", "tx", " KB/s", false, 0);
+        return true;
+    }
+
+    packets = netbench_tx_run(host, BENCH_NET_PORT, BENCH_TICKS, &taken);
+    bench_record("net ", "tx", " KB/s", true, (((packets * NETBENCH_PAYLOAD) >> 10) * TIMER_HZ) / (taken ? taken : 1));
+    return !uart_check_cancel_key();
+}
+
+static void bench_csv_string(char *line, const char *s, bool quote)
+{
+    strcat(line, ",");
+    if(quote)
+        strcat(line, "\"");
+    strcat(line, s);
+    if(quote)
+        strcat(line, "\"");
+}
+
+static void bench_csv_number(char *line, uint32_t value)
+{
+    char digits[11], *p = digits + sizeof(digits);
+
+    *--p = 0;
+    do{
+        *--p = '0' + value % 10;
+        value /= 10;
+    }while(value);
+    bench_csv_string(line, digits, false);
+}
+
+/* the header line, or the results; each ends with a newline */
+static void bench_csv(char *line, bool header)
+{
+    strcpy(line, header ? "version" : "\"");
+    if(!header){
+        strncat(line, software_version_string, BENCH_CSV_LENGTH / 4);
+        strcat(line, "\"");
+    }
+    bench_csv_string(line, header ? "target" : BENCH_TARGET, !header);
+    bench_csv_string(line, header ? "cpu" : BENCH_CPU, !header);
+    bench_csv_string(line, header ? "cache" : cache_policy_name(), !header);
+
+    for(int i=0; i<bench_result_count; i++){
+        if(header)
+            bench_csv_string(line, bench_results[i].name, false);
+        else if(bench_results[i].valid)
+            bench_csv_number(line, bench_results[i].value);
+        else
+            bench_csv_string(line, "", false);
+    }
+    strcat(line, "\n");
+}
+
+/* appended, after a header line if the file is new */
+static void bench_csv_save(const char *filename, const char *header, const char *line)
+{
+    FIL fd;
+    FRESULT fr;
+    UINT done;
+
+    fr = f_open(&fd, filename, FA_WRITE | FA_OPEN_APPEND);
+    if(fr == FR_OK && !f_size(&fd))
+        fr = f_write(&fd, header, strlen(header), &done);
+    if(fr == FR_OK)
+        fr = f_write(&fd, line, strlen(line), &done);
+    if(fr == FR_OK)
+        fr = f_close(&fd);
+    else
+        f_close(&fd);
+
+    if(fr != FR_OK){
+        printf("bench: \"%s\": ", filename);
+        f_perror(fr);
+    }else
+        printf("bench: results added to \"%s\"\n", filename);
+}
+
+/* bench all [file | put [server:]file]: TFTP cannot append, so what is put is
+ * a file of its own, header and one line */
+void do_bench(char *argv[], int argc)
+{
+    const char *filename = NULL;
+    uint32_t targetip = 0;
+    char *header, *line;
+    bool put = false;
+
+    if(argc >= 2)
+        put = !strcasecmp(argv[1], "put");
+    if(strcasecmp(argv[0], "all") || put != (argc == 3)){
+        printf("bench: want all [file | put [server:]file]\n");
+        return;
+    }
+    if(put && !tftp_parse_source(argv[2], &targetip, &filename))
+        return;
+    if(argc == 2)
+        filename = argv[1];
+
+    bench_results = malloc(BENCH_MAX_RESULTS * sizeof(bench_result_t));
+    bench_result_count = 0;
+    bench_seed = 0x12345678; /* the same random numbers every run */
+
+    printf("bench: %s, %s %s, cache policy %s (press Q to cancel)\n",
+            software_version_string, BENCH_TARGET, BENCH_CPU, cache_policy_name());
+    if(!bench_all_lib() || !bench_all_mem() || !bench_all_disk() || !bench_all_net()){
+        printf("bench: cancelled\n");
+        free(bench_results);
+        return;
+    }
+
+    header = malloc(BENCH_CSV_LENGTH);
+    line = malloc(BENCH_CSV_LENGTH);
+    bench_csv(header, true);
+    bench_csv(line, false);
+
+    if(put){
+        strcat(header, line);
+        tftp_save(targetip, filename, (uint32_t)header, strlen(header));
+    }else if(filename)
+        bench_csv_save(filename, header, line);
+    else
+        printf("%s%s", header, line);
+
+    free(header);
+    free(line);
+    free(bench_results);
+}
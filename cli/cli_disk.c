@@ -0,0 +1,134 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <uart.h>
+#include <disk.h>
+#include <net.h>
+#include <cli.h>
+
+#define DD_BATCH_MAX        512                 /* sectors per disk_data_read/write, if the heap allows */
+#define DD_BATCH_MIN        64
+#define DD_PROGRESS_SECTORS (16*1024*1024/512)  /* report every 16MB */
+
+static void dd_report(const char *what, uint32_t sectors, timer_t ticks)
+{
+    uint32_t kbytes = sectors >> 1;
+    uint32_t rate;
+
+    if(!ticks)
+        ticks = 1;
+    rate = (((kbytes * 10) / ticks) * TIMER_HZ) >> 10; /* MB/s * 10 */
+    printf("%s %lu KB in %lu.%02lus: %lu.%lu MB/s\n", what, kbytes,
+            ticks / TIMER_HZ, ((ticks % TIMER_HZ) * 100) / TIMER_HZ, rate / 10, rate % 10);
+}
+
+/* ramdisk [KB]: make a RAM disk, or say where it is */
+void do_ramdisk(char *argv[], int argc)
+{
+    int nr = ramdisk_get();
+    disk_t *disk;
+
+    if(argc){
+        ramdisk_create(strtoul(argv[0], NULL, 10) << 10);
+        return;
+    }
+
+    if(nr < 0){
+        printf("No RAM disk (ramdisk KB makes one).\n");
+        return;
+    }
+
+    disk = disk_get_info(nr);
+    printf("RAM disk: drive %d:, %ld KB at 0x%lx\n", nr, disk->sectors >> 1, (uint32_t)disk->ram);
+}
+
+/* dd from-disk from-sector to-disk to-sector [count]: raw sectors, no FatFs */
+void do_dd(char *argv[], int argc)
+{
+    int from, to, batch;
+    disk_t *src, *dst;
+    uint32_t from_sector, to_sector, count, done = 0, reported = 0;
+    timer_t start;
+    void *buffer;
+
+    from = parse_uint32(argv[0], NULL);
+    from_sector = parse_uint32(argv[1], NULL);
+    to = parse_uint32(argv[2], NULL);
+    to_sector = parse_uint32(argv[3], NULL);
+
+    src = disk_get_info(from);
+    dst = disk_get_info(to);
+    if(!src || !dst){
+        printf("dd: no disk %d\n", src ? to : from);
+        return;
+    }
+    if(from_sector >= src->sectors || to_sector >= dst->sectors){
+        printf("dd: start sector is past the end of the disk\n");
+        return;
+    }
+
+    /* by default, as much as there is room for */
+    count = src->sectors - from_sector;
+    if(count > dst->sectors - to_sector)
+        count = dst->sectors - to_sector;
+    if(argc >= 5){
+        if(parse_uint32(argv[4], NULL) > count){
+            printf("dd: only %lu sectors fit\n", count);
+            return;
+        }
+        count = parse_uint32(argv[4], NULL);
+    }
+
+    /* copying forwards, a destination just above the source would eat it */
+    if(from == to && to_sector > from_sector && to_sector < from_sector + count){
+        printf("dd: the ranges overlap\n");
+        return;
+    }
+
+    for(batch = DD_BATCH_MAX; !(buffer = malloc_unchecked(batch * 512)) && batch > DD_BATCH_MIN; batch >>= 1);
+    if(!buffer){
+        printf("dd: insufficient memory\n");
+        return;
+    }
+
+    /* FatFs may have writes for either disk still cached */
+    if(!disk_cache_sync(-1)){
+        free(buffer);
+        return;
+    }
+
+    printf("dd: disk %d sectors %lu-%lu to disk %d from sector %lu (press Q to cancel)\n",
+            from, from_sector, from_sector + count - 1, to, to_sector);
+    start = gogoboot_read_timer();
+
+    while(done < count){
+        if(batch > count - done)
+            batch = count - done;
+        if(!disk_data_read(from, buffer, from_sector + done, batch)){
+            printf("dd: read error at sector %lu\n", from_sector + done);
+            break;
+        }
+        if(!disk_data_write(to, buffer, to_sector + done, batch)){
+            printf("dd: write error at sector %lu\n", to_sector + done);
+            break;
+        }
+        done += batch;
+
+        if(done - reported >= DD_PROGRESS_SECTORS){
+            reported = done;
+            printf("dd: %lu/%lu MB\n", done >> 11, count >> 11);
+        }
+
+        net_pump();
+        if(uart_check_cancel_key()){
+            printf("Aborted.\n");
+            break;
+        }
+    }
+
+    dd_report("dd: copied", done, gogoboot_read_timer() - start);
+    free(buffer);
+    disk_remount(to);
+}
@@ -8,6 +8,9 @@
 #include <fatfs/ff.h>
 #include <cli.h>
 #include <uart.h>
+#include <timers.h>
+#include <job.h>
+#include <init.h>
 
 void do_cd(char *argv[], int argc)
 {
@@ -27,60 +30,286 @@ void do_mkdir(char *argv[], int argc)
     }
 }
 
-#define COPY_BUFFER_SIZE 65536
-void do_cp(char *argv[], int argc)
-{
-    FRESULT fr;
+#define COPY_BUFFER_MIN  (64*1024)
+#define COPY_BUFFER_MAX  (256*1024)
+#define COPY_JOB_CHUNK   8192   /* per step in the background, so the prompt stays responsive */
+
+typedef struct {
     FIL src, dst;
+    char *src_name, *dst_name;
     char *buffer;
-    bool done = false;
+    UINT buffer_size;
+    uint32_t copied;
+    bool failed;
+    bool contiguous;            /* dst was preallocated in one run */
+} copy_t;
+
+static void copy_close(copy_t *cp)
+{
+    FRESULT fr;
+
+    /* a preallocated destination is already full size: cut it back to what was copied */
+    if(cp->failed && f_size(&cp->dst) > cp->copied){
+        if(f_lseek(&cp->dst, cp->copied) == FR_OK)
+            f_truncate(&cp->dst);
+    }
+
+    fr = f_close(&cp->src);
+    if(fr != FR_OK) f_perror(fr);
+    fr = f_close(&cp->dst);
+    if(fr != FR_OK) f_perror(fr);
+
+    free(cp->buffer);
+    free(cp->src_name);
+    free(cp->dst_name);
+    free(cp);
+}
+
+static copy_t *copy_open(const char *src_name, const char *dst_name)
+{
+    FRESULT fr;
+    UINT cluster;
+    copy_t *cp = malloc(sizeof(copy_t));
+
+    fr = f_open(&cp->src, src_name, FA_READ);
+    if(fr != FR_OK){
+        printf("f_open(\"%s\"): ", src_name);
+        f_perror(fr);
+        free(cp);
+        return NULL;
+    }
+
+    fr = f_open(&cp->dst, dst_name, FA_WRITE | FA_CREATE_ALWAYS);
+    if(fr != FR_OK){
+        printf("f_open(\"%s\"): ", dst_name);
+        f_perror(fr);
+        f_close(&cp->src);
+        free(cp);
+        return NULL;
+    }
+
+    cp->src_name = strdup(src_name);
+    cp->dst_name = strdup(dst_name);
+    cp->copied = 0;
+    cp->failed = false;
+    cp->contiguous = false;
+
+#if FF_USE_EXPAND
+    /* one contiguous run of clusters for the destination, if there is room;
+     * otherwise it grows as it is written, as before */
+    if(f_size(&cp->src) && f_expand(&cp->dst, f_size(&cp->src), 1) == FR_OK)
+        cp->contiguous = true;
+    else
+        f_lseek(&cp->dst, 0);
+#endif
+
+    /* each f_read/f_write covers whole clusters of both files, so FatFs
+     * transfers straight to and from the buffer, in runs as long as the
+     * cluster chains allow. larger is better, if the heap can spare it */
+    cluster = (cp->src.obj.fs->csize > cp->dst.obj.fs->csize ?
+            cp->src.obj.fs->csize : cp->dst.obj.fs->csize) * FF_MAX_SS;
+    cp->buffer_size = COPY_BUFFER_MAX;
+    while(true){
+        cp->buffer = malloc_unchecked(cp->buffer_size);
+        if(cp->buffer || cp->buffer_size <= COPY_BUFFER_MIN || cp->buffer_size <= cluster)
+            break;
+        cp->buffer_size >>= 1;
+    }
+    if(!cp->buffer)
+        cp->buffer = malloc(cp->buffer_size);
+
+    return cp;
+}
+
+/* copy up to size bytes; false once the copy has finished or failed */
+static bool copy_step(copy_t *cp, UINT size)
+{
+    FRESULT fr;
     UINT bytes_read, bytes_written;
 
-    fr = f_open(&src, argv[0], FA_READ);
+    fr = f_read(&cp->src, cp->buffer, size, &bytes_read);
     if(fr != FR_OK){
-        printf("f_open(\"%s\"): ", argv[0]);
+        printf("f_read(\"%s\"): ", cp->src_name);
         f_perror(fr);
+        cp->failed = true;
+        return false;
+    }
+
+    if(bytes_read > 0){
+        fr = FR_DENIED;
+#if FF_USE_EXPAND
+        /* into the preallocated run as a single disk write */
+        if(cp->contiguous && !(bytes_read % FF_MAX_SS)){
+            fr = f_write_contiguous(&cp->dst, cp->buffer, bytes_read / FF_MAX_SS);
+            bytes_written = bytes_read;
+        }
+#endif
+        if(fr == FR_DENIED)
+            fr = f_write(&cp->dst, cp->buffer, bytes_read, &bytes_written);
+        if(fr != FR_OK || bytes_read != bytes_written){
+            printf("f_write(\"%s\"): ", cp->dst_name);
+            f_perror(fr);
+            cp->failed = true;
+            return false;
+        }
+        cp->copied += bytes_written;
+    }
+
+    return bytes_read == size;
+}
+
+static bool copy_job_step(job_t *job)
+{
+    copy_t *cp = job->context;
+
+    if(copy_step(cp, COPY_JOB_CHUNK))
+        return true;
+
+    copy_close(cp);
+    return false;
+}
+
+static void copy_job_status(job_t *job)
+{
+    copy_t *cp = job->context;
+
+    printf("%ld/%ld KB", cp->copied >> 10, (uint32_t)f_size(&cp->src) >> 10);
+}
+
+static void copy_job_kill(job_t *job)
+{
+    copy_t *cp = job->context;
+
+    /* as on an error: a preallocated destination is cut back to what was copied */
+    cp->failed = true;
+    copy_close(cp);
+}
+
+void do_cp(char *argv[], int argc)
+{
+    copy_t *cp;
+    job_t *job;
+
+    cp = copy_open(argv[0], argv[1]);
+    if(!cp)
+        return;
+
+    if(cli_background){
+        cli_background = false;
+        job = job_alloc("cp", cp->src_name);
+        job->context = cp;
+        job->cb_step = copy_job_step;
+        job->cb_status = copy_job_status;
+        job->cb_kill = copy_job_kill;
+        job_add(job);
         return;
     }
 
-    fr = f_open(&dst, argv[1], FA_WRITE | FA_CREATE_ALWAYS);
+    while(copy_step(cp, cp->buffer_size));
+    copy_close(cp);
+}
+
+typedef struct {
+    bool sha256;                /* else CRC32 */
+    uint32_t crc;
+    sha256_t sha;
+} checksum_t;
+
+static void checksum_update(checksum_t *ck, const void *data, uint32_t len)
+{
+    if(ck->sha256)
+        sha256_update(&ck->sha, data, len);
+    else
+        ck->crc = crc32_update(ck->crc, data, len);
+}
+
+/* a file read in buffer sized runs, which FatFs transfers straight from the
+ * disk, as for cp */
+static bool checksum_file(checksum_t *ck, const char *name)
+{
+    FIL fd;
+    FRESULT fr;
+    UINT buffer_size, bytes_read;
+    char *buffer;
+
+    fr = f_open(&fd, name, FA_READ);
     if(fr != FR_OK){
-        printf("f_open(\"%s\"): ", argv[1]);
+        printf("f_open(\"%s\"): ", name);
         f_perror(fr);
-        f_close(&src);
-        return;
+        return false;
     }
 
-    buffer = malloc(COPY_BUFFER_SIZE);
-    if(!buffer){
-        printf("Out of memory\n");
-    }else{
-        while(!done){
-            fr = f_read(&src, buffer, COPY_BUFFER_SIZE, &bytes_read);
-            if(fr != FR_OK){
-                printf("f_read(\"%s\"): ", argv[0]);
-                f_perror(fr);
-                done = true;
-            }else{
-                if(bytes_read > 0){
-                    fr = f_write(&dst, buffer, bytes_read, &bytes_written);
-                    if(fr != FR_OK || bytes_read != bytes_written){
-                        printf("f_write(\"%s\"): ", argv[1]);
-                        f_perror(fr);
-                        done = true;
-                    }
-                }
-                if(bytes_read < COPY_BUFFER_SIZE)
-                    done = true;
-            }
+    buffer_size = COPY_BUFFER_MAX;
+    while(!(buffer = malloc_unchecked(buffer_size)) && buffer_size > COPY_BUFFER_MIN)
+        buffer_size >>= 1;
+    if(!buffer)
+        buffer = malloc(buffer_size);
+
+    do{
+        fr = f_read(&fd, buffer, buffer_size, &bytes_read);
+        if(fr != FR_OK){
+            printf("f_read(\"%s\"): ", name);
+            f_perror(fr);
+            break;
         }
-        free(buffer);
-    }
+        checksum_update(ck, buffer, bytes_read);
+        if(uart_check_cancel_key()){
+            printf("(cancelled)\n");
+            fr = FR_INT_ERR;
+            break;
+        }
+    }while(bytes_read == buffer_size);
 
-    fr = f_close(&src);
-    if(fr != FR_OK) f_perror(fr);
-    fr = f_close(&dst);
-    if(fr != FR_OK) f_perror(fr);
+    free(buffer);
+    f_close(&fd);
+    return fr == FR_OK;
+}
+
+/* crc32|sha256 file, or address length: printed as crc32 or sha256sum would,
+ * so the line can go straight into a FILE.crc32 or FILE.sha256 */
+static void do_checksum(char *argv[], int argc, bool sha256)
+{
+    checksum_t ck;
+    uint32_t address, length;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+
+    ck.sha256 = sha256;
+    ck.crc = 0;
+    if(sha256)
+        sha256_init(&ck.sha);
+
+    if(argc == 2){
+        address = parse_uint32(argv[0], NULL);
+        length = parse_uint32(argv[1], NULL);
+        if(!mem_find_region(address, length)){
+            printf("0x%lx length 0x%lx: not in a memory region\n", address, length);
+            return;
+        }
+        checksum_update(&ck, (void*)address, length);
+    }else if(!checksum_file(&ck, argv[0]))
+        return;
+
+    if(sha256){
+        sha256_final(&ck.sha, digest);
+        for(int i=0; i<SHA256_DIGEST_SIZE; i++)
+            printf("%02x", digest[i]);
+    }else
+        printf("%08lx", ck.crc);
+
+    if(argc == 2)
+        printf("  0x%lx+0x%lx\n", address, length);
+    else
+        printf("  %s\n", argv[0]);
+}
+
+void do_crc32(char *argv[], int argc)
+{
+    do_checksum(argv, argc, false);
+}
+
+void do_sha256(char *argv[], int argc)
+{
+    do_checksum(argv, argc, true);
 }
 
 void do_mv(char *argv[], int argc)
@@ -141,12 +370,12 @@ void do_ls(char *argv[], int argc)
         return;
     }
 
-    fat_file = malloc(sizeof(FILINFO) * fat_file_length);
+    fat_file = arena_alloc(sizeof(FILINFO) * fat_file_length);
 
     while(true){
         if(fat_file_used == fat_file_length){
+            fat_file = arena_realloc(fat_file, sizeof(FILINFO) * fat_file_length, sizeof(FILINFO) * fat_file_length * 2);
             fat_file_length *= 2;
-            fat_file = realloc(fat_file, sizeof(FILINFO) * fat_file_length);
         }
         fr = f_readdir(&fat_dir, &fat_file[fat_file_used]);
         if(fr != FR_OK){
@@ -169,7 +398,7 @@ void do_ls(char *argv[], int argc)
     // sort into name order
     // it is faster to sort pointers, since it avoids copying around 
     // the entries themselves, which are quite large with LFN enabled.
-    fat_file_ptr = (FILINFO**)malloc(sizeof(FILINFO*)*fat_file_used);
+    fat_file_ptr = (FILINFO**)arena_alloc(sizeof(FILINFO*)*fat_file_used);
     for(int i=0; i<fat_file_used; i++)
         fat_file_ptr[i] = &fat_file[i];
 
@@ -189,7 +418,7 @@ void do_ls(char *argv[], int argc)
             used_space += fat_file_ptr[i]->fsize;
             /* regular file */
             printf("%10lu %04d-%02d-%02d %02d:%02d %s", 
-                    fat_file_ptr[i]->fsize, 
+                    (uint32_t)fat_file_ptr[i]->fsize, 
                     1980 + ((fat_file_ptr[i]->fdate >> 9) & 0x7F),
                     (fat_file_ptr[i]->fdate >> 5) & 0xF,
                     fat_file_ptr[i]->fdate & 0x1F,
@@ -201,8 +430,6 @@ void do_ls(char *argv[], int argc)
         printf("\n");
     }
 
-    free(fat_file);
-    free(fat_file_ptr);
 
     fr = f_getfree(path, &free_clusters, &fatfs);
     if(fr != FR_OK){
@@ -276,3 +503,209 @@ void do_rxfile(char *argv[], int argc)
 
     free(image);
 }
+
+/* XMODEM (checksum, CRC and 1K) and single-file YMODEM receive. Each block
+ * goes to the file as it arrives; the sender waits for our ACK, so a slow disk
+ * cannot overrun the UART, and the file can be as large as the disk allows. */
+#define XM_SOH          0x01
+#define XM_STX          0x02
+#define XM_EOT          0x04
+#define XM_ACK          0x06
+#define XM_NAK          0x15
+#define XM_CAN          0x18
+#define XM_CRC          'C'
+#define XM_RETRIES      10
+#define XM_CRC_TRIES    6       /* then fall back to checksums */
+
+static int xmodem_read_byte(int timeout_ms)
+{
+    timer_t timeout = set_timer_ms(timeout_ms);
+    int ch;
+
+    while((ch = uart_read_byte()) < 0)
+        if(timer_expired(timeout))
+            return -1;
+
+    return ch;
+}
+
+static uint16_t xmodem_crc(const uint8_t *data, int len)
+{
+    static const uint16_t nibble[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+        0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef };
+    uint16_t crc = 0;
+
+    while(len--){
+        crc = (crc << 4) ^ nibble[(crc >> 12) ^ (*data >> 4)];
+        crc = (crc << 4) ^ nibble[(crc >> 12) ^ (*data++ & 0x0f)];
+    }
+
+    return crc;
+}
+
+/* the rest of a block after its SOH/STX: number, complement, data, check */
+static bool xmodem_read_block(uint8_t *block, int len, bool crc)
+{
+    int total = 2 + len + (crc ? 2 : 1), ch;
+    uint8_t sum = 0;
+
+    for(int i=0; i<total; i++){
+        ch = xmodem_read_byte(1000);
+        if(ch < 0)
+            return false;
+        block[i] = ch;
+    }
+
+    if(block[0] != (uint8_t)~block[1])
+        return false;
+
+    if(crc)
+        return xmodem_crc(block + 2, len) == ((block[2+len] << 8) | block[3+len]);
+
+    for(int i=0; i<len; i++)
+        sum += block[2+i];
+    return sum == block[2+len];
+}
+
+static void xmodem_purge(void)
+{
+    while(xmodem_read_byte(100) >= 0);
+}
+
+void do_rx(char *argv[], int argc)
+{
+    uint8_t *block;
+    uint32_t baud = 0, size = 0, received = 0, want;
+    uint8_t expected = 1;
+    bool crc = true, started = false, ymodem = false, done = false;
+    const char *error = NULL;
+    int errors = 0, tries = 0, ch, len;
+    FRESULT fr = FR_OK;
+    FIL fd;
+
+    if(argc > 1)
+        baud = strtoul(argv[1], NULL, 10);
+
+    fr = f_open(&fd, argv[0], FA_WRITE | FA_CREATE_ALWAYS);
+    if(fr != FR_OK){
+        printf("rx: failed to open \"%s\": ", argv[0]);
+        f_perror(fr);
+        return;
+    }
+
+    printf("rx: send with XMODEM or YMODEM");
+    if(baud)
+        printf(" at %ld baud", baud);
+    printf(" now (CAN CAN to abort)\n");
+    if(baud && !uart_set_baud(baud)){
+        printf("rx: this UART cannot run at %ld baud\n", baud);
+        f_close(&fd);
+        return;
+    }
+
+    block = malloc(2 + 1024 + 2);
+
+    while(!done && !error){
+        if(!started)
+            uart_write_byte((crc && tries < XM_CRC_TRIES) ? XM_CRC : XM_NAK);
+        ch = xmodem_read_byte(started ? 10000 : 3000);
+
+        switch(ch){
+            case -1:
+                if(!started){
+                    if(++tries >= XM_CRC_TRIES + XM_RETRIES)
+                        error = "no sender";
+                    else if(tries >= XM_CRC_TRIES)
+                        crc = false;
+                }else if(++errors > XM_RETRIES)
+                    error = "timeout";
+                else
+                    uart_write_byte(XM_NAK);
+                break;
+            case XM_CAN:
+                if(xmodem_read_byte(1000) == XM_CAN)
+                    error = "cancelled by sender";
+                break;
+            case XM_EOT:
+                uart_write_byte(XM_ACK);
+                if(ymodem){ /* YMODEM ends the batch with an empty block 0 */
+                    uart_write_byte(XM_CRC);
+                    ch = xmodem_read_byte(3000);
+                    if((ch == XM_SOH || ch == XM_STX) && xmodem_read_block(block, ch == XM_STX ? 1024 : 128, true))
+                        uart_write_byte(XM_ACK);
+                }
+                done = true;
+                break;
+            case XM_SOH:
+            case XM_STX:
+                len = (ch == XM_STX) ? 1024 : 128;
+                if(!started && tries >= XM_CRC_TRIES)
+                    crc = false;
+                if(!xmodem_read_block(block, len, crc)){
+                    xmodem_purge();
+                    if(++errors > XM_RETRIES)
+                        error = "too many errors";
+                    else
+                        uart_write_byte(XM_NAK);
+                    break;
+                }
+                if(!started && block[0] == 0 && crc){
+                    /* YMODEM header: "name\0size ..."; an empty name means no files */
+                    ymodem = true;
+                    if(!block[2]){
+                        uart_write_byte(XM_ACK);
+                        done = true;
+                        break;
+                    }
+                    size = strtoul((char*)block + 2 + strlen((char*)block + 2) + 1, NULL, 10);
+                    uart_write_byte(XM_ACK);
+                    tries = 0; /* the data follows another 'C' */
+                    break;
+                }
+                if(started && block[0] == (uint8_t)(expected - 1)){
+                    uart_write_byte(XM_ACK); /* our ACK was lost; we have this one */
+                    break;
+                }
+                if(block[0] != expected){
+                    error = "block out of sequence";
+                    break;
+                }
+                started = true;
+                want = len;
+                if(size && want > size - received)
+                    want = size - received; /* YMODEM: trim the padding */
+                if(want){
+                    fr = f_write(&fd, block + 2, want, NULL);
+                    if(fr != FR_OK){
+                        error = "disk write failed";
+                        break;
+                    }
+                }
+                received += want;
+                expected++;
+                errors = 0;
+                uart_write_byte(XM_ACK);
+                break;
+            default:
+                break; /* line noise */
+        }
+    }
+
+    if(error){
+        uart_write_byte(XM_CAN);
+        uart_write_byte(XM_CAN);
+        uart_write_byte(XM_CAN);
+    }
+    xmodem_purge(); /* and give the sender time to finish */
+    if(baud)
+        uart_set_baud(0);
+
+    f_close(&fd);
+    free(block);
+
+    if(error)
+        printf("rx: FAILED after %ld bytes: %s\n", received, error);
+    else
+        printf("rx: received %ld bytes%s\n", received, ymodem ? "" : " (XMODEM pads to a whole block)");
+}
@@ -0,0 +1,20 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <cli.h>
+#include <net.h>
+
+void do_http_get(char *argv[], int argc)
+{
+    const char *end;
+    uint32_t address, size;
+
+    /* a number is a memory address, anything else a file name */
+    address = parse_uint32(argv[1], &end);
+    if(argv[1][0] >= '0' && argv[1][0] <= '9' && !*end){
+        if(http_get(argv[0], NULL, address, &size))
+            printf("Loaded %ld bytes at 0x%lx\n", size, address);
+    }else
+        http_get(argv[0], argv[1], 0, &size);
+}
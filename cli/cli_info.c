@@ -7,6 +7,11 @@
 #include <init.h>
 #include <tinyalloc.h>
 #include <rtc.h>
+#include <disk.h>
+#include <fatfs/ffbitmap.h>
+#include <fatfs/ffdircache.h>
+#include <cpu.h>
+#include <profile.h>
 
 static void help_cmd_table(const cmd_entry_t *cmd)
 {
@@ -22,29 +27,149 @@ void help(char *argv[], int argc)
     help_cmd_table(target_cmd_table);
 }
 
+static void report_heap_classes(void)
+{
+    ta_class_info_t info;
+    size_t pages_used, pages_total, fallbacks, free, largest;
+
+    ta_class_totals(&pages_used, &pages_total, &fallbacks);
+    printf("size classes: %ld of %ld pages (%d bytes) assigned, %ld allocations fell back\n",
+            pages_used, pages_total, TA_CLASS_PAGE, fallbacks);
+    printf("  size  pages  in use  capacity  allocs\n");
+    for(int c=0; ta_class_info(c, &info); c++)
+        if(info.pages)
+            printf("%6ld %6ld %7ld %9ld %7ld\n", info.size, info.pages, info.in_use,
+                    info.pages * (TA_CLASS_PAGE / info.size), info.allocs);
+
+    free = ta_bytes_free();
+    largest = ta_largest_free();
+    printf("large blocks: %ld bytes free, largest %ld, fragmentation %ld%%, %ld merges\n",
+            free, largest, free ? 100 - (largest * 100) / free : 0, ta_compactions());
+}
+
+/* the most the heap and stack have held since boot, or meminfo reset */
+static void report_high_water(void)
+{
+    size_t in_use, peak, largest;
+
+    ta_usage(&in_use, &peak, &largest);
+    printf("heap: %ld bytes in use, at most %ld of %ld, largest allocation %ld\n",
+            in_use, peak, heap_size, largest);
+    printf("stack: at most %ld of %ld bytes used\n", stack_high_water(), stack_size);
+}
+
 void do_meminfo(char *argv[], int argc)
 {
+    if(argc == 1){
+        if(strcasecmp(argv[0], "reset")){
+            printf("meminfo: unknown option \"%s\" (reset)\n", argv[0]);
+            return;
+        }
+        ta_usage_reset();
+        stack_paint();
+        return;
+    }
+
     report_memory_layout();
     printf("internal heap (tinyalloc):\nfresh blocks: %ld\nfree blocks: %ld\nused blocks: %ld\nalloc bytes: %ld\n",
             ta_num_fresh(), ta_num_free(), ta_num_used(), ta_bytes_used());
     printf("ta_check %s\n", ta_check() ? "ok" : "FAILED");
+    report_heap_classes();
+    arena_report();
+    report_high_water();
 }
 
-void do_netinfo(char *argv[], int argc)
+static void report_eth_buffers(int ifindex)
+{
+    printf("eth%d: %d transmit buffers, %d KB receive buffer\n",
+            ifindex, eth_tx_slots(ifindex), eth_rxbuffer_size() >> 10);
+    if(eth_irq(ifindex) >= 0)
+        printf("eth%d: receive on IRQ %d\n", ifindex, eth_irq(ifindex));
+    else
+        printf("eth%d: receive polled\n", ifindex);
+}
+
+static void report_eth_media(int ifindex)
+{
+    const char *media = eth_media(ifindex);
+
+    if(media)
+        printf("eth%d: %s\n", ifindex, media);
+}
+
+static int prefix_length(uint32_t mask)
 {
     int prefixlen = 0;
-    uint32_t mask = interface_subnet_mask;
+
     while(mask){
         prefixlen++;
         mask <<= 1;
     }
+    return prefixlen;
+}
+
+static void report_interface(int ifindex)
+{
+    net_interface_t *iface = &net_interface[ifindex];
+    char ip[16];
+
+    printf("eth%d: MAC %02x:%02x:%02x:%02x:%02x:%02x, IPv4 address %s/%d\n", ifindex,
+            iface->macaddr[0], iface->macaddr[1], iface->macaddr[2],
+            iface->macaddr[3], iface->macaddr[4], iface->macaddr[5],
+            net_format_ipv4(iface->ipv4_address, ip), prefix_length(iface->subnet_mask));
+}
+
+/* an optional leading "ethN" picks the interface, otherwise eth0; -1 if there is no such card */
+static int eth_argument(char **argv[], int *argc)
+{
+    int ifindex = 0;
+
+    if(*argc && !strncasecmp((*argv)[0], "eth", 3)){
+        ifindex = strtol((*argv)[0] + 3, NULL, 10);
+        (*argv)++;
+        (*argc)--;
+    }
+
+    if(ifindex < 0 || ifindex >= net_interface_count){
+        printf("no interface eth%d\n", ifindex);
+        return -1;
+    }
+    return ifindex;
+}
+
+static void report_eth_stats(void)
+{
+    const eth_stats_t *s = eth_get_stats();
+
+    printf("eth missed frames %ld, crc errors %ld, frame errors %ld\n",
+            s->missed_frames, s->crc_errors, s->frame_errors);
+    printf("eth rx overflows %ld, too big %ld, ring high water %d of %d pages\n",
+            s->overflows, s->rx_too_big, s->rx_high_water, eth_rxbuffer_size() >> 8);
+    printf("eth tx busy %ld, irq overruns %ld\n", s->tx_busy, s->irq_overruns);
+    printf("arp resolved %ld (wait avg %ld ms, max %ld ms), failed %ld\n",
+            arp_resolved_count,
+            arp_resolved_count ? (arp_wait_ticks * (1000 / TIMER_HZ)) / arp_resolved_count : 0,
+            arp_wait_max_ticks * (1000 / TIMER_HZ), arp_failed_count);
+}
+
+void do_netinfo(char *argv[], int argc)
+{
+    if(argc){
+        if(strcasecmp(argv[0], "reset")){
+            printf("netinfo: unknown option \"%s\"\n", argv[0]);
+            return;
+        }
+        net_reset_stats();
+        printf("network statistics reset\n");
+        return;
+    }
 
     printf("IPv4 address: %d.%d.%d.%d/%d\n", 
             (int)(interface_ipv4_address >> 24 & 0xff),
             (int)(interface_ipv4_address >> 16 & 0xff),
             (int)(interface_ipv4_address >>  8 & 0xff),
             (int)(interface_ipv4_address       & 0xff),
-            prefixlen);
+            prefix_length(interface_subnet_mask));
     printf("Gateway: %d.%d.%d.%d\n", 
             (int)(interface_ipv4_gateway >> 24 & 0xff),
             (int)(interface_ipv4_gateway >> 16 & 0xff),
@@ -58,13 +183,213 @@ void do_netinfo(char *argv[], int argc)
 
     printf("packet_rx_count %ld\n", packet_rx_count);
     printf("packet_tx_count %ld\n", packet_tx_count);
+    report_eth_stats();
     printf("packet_alive_count %ld\n", packet_alive_count);
     printf("packet_discard_count %ld\n", packet_discard_count);
     printf("packet_bad_cksum_count %ld\n", packet_bad_cksum_count);
+    printf("ipfrag reassembled %ld, dropped %ld\n", ipfrag_reassembled_count, ipfrag_dropped_count);
+    printf("packet_pool %ld buffers, %ld free, high water %ld, exhausted %ld\n",
+            packet_pool_size, packet_pool_free,
+            packet_pool_size - packet_pool_low_water, packet_pool_exhausted);
+
+    for(int i=0; i<net_interface_count; i++){
+        if(net_interface_count > 1)
+            report_interface(i);
+        report_eth_buffers(i);
+        report_eth_media(i);
+    }
 
     net_dump_packet_sinks();
 }
 
+void do_ethirq(char *argv[], int argc)
+{
+    int ifindex = eth_argument(&argv, &argc);
+
+    if(ifindex < 0 || (argc && !eth_set_irq(ifindex, strcasecmp(argv[0], "off") ? (int)parse_uint32(argv[0], NULL) : -1)))
+        return;
+    report_eth_buffers(ifindex);
+}
+
+void do_ethmedia(char *argv[], int argc)
+{
+    int ifindex = eth_argument(&argv, &argc);
+
+    if(ifindex < 0 || (argc && !eth_set_media(ifindex, argv[0])))
+        return;
+    report_eth_media(ifindex);
+}
+
+void do_ethtx(char *argv[], int argc)
+{
+    int ifindex = eth_argument(&argv, &argc);
+
+    if(ifindex < 0 || (argc && !eth_set_tx_slots(ifindex, parse_uint32(argv[0], NULL))))
+        return;
+    report_eth_buffers(ifindex);
+}
+
+/* ifconfig [ethN [a.b.c.d/len]]: eth0 is normally left to DHCP */
+void do_ifconfig(char *argv[], int argc)
+{
+    int ifindex, prefixlen;
+    const char *slash;
+    uint32_t ip;
+
+    if(!argc){
+        for(int i=0; i<net_interface_count; i++)
+            report_interface(i);
+        return;
+    }
+
+    ifindex = eth_argument(&argv, &argc);
+    if(ifindex < 0)
+        return;
+
+    if(argc){
+        ip = net_parse_ipv4(argv[0]);
+        /* a malformed address parses to 0 too: only 0.0.0.0 itself clears it */
+        if(!ip && (strncmp(argv[0], "0.0.0.0", 7) || (argv[0][7] && argv[0][7] != '/'))){
+            printf("ifconfig: bad address \"%s\"\n", argv[0]);
+            return;
+        }
+        slash = strchr(argv[0], '/');
+        prefixlen = slash ? strtol(slash + 1, NULL, 10) : 24;
+        if(prefixlen < 1 || prefixlen > 30){
+            printf("ifconfig: bad prefix length %d\n", prefixlen);
+            return;
+        }
+        net_interface[ifindex].ipv4_address = ip;
+        net_interface[ifindex].subnet_mask = ip ? 0xffffffff << (32 - prefixlen) : 0;
+        net_templates_invalidate();
+    }
+    report_interface(ifindex);
+}
+
+static bool netcap_save(const char *filename, const void *image, uint32_t size)
+{
+    FRESULT fr;
+    FIL fd;
+    UINT done;
+
+    fr = f_open(&fd, filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if(fr == FR_OK){
+        fr = f_write(&fd, image, size, &done);
+        if(fr == FR_OK && done != size)
+            fr = FR_DENIED; // disk full
+        f_close(&fd);
+    }
+    if(fr != FR_OK){
+        printf("netcap: \"%s\": %s\n", filename, f_errmsg(fr));
+        return false;
+    }
+
+    printf("netcap: wrote %ld bytes to \"%s\"\n", size, filename);
+    return true;
+}
+
+void do_rmem(char *argv[], int argc)
+{
+    rmem_start();
+}
+
+/* netcap [start [frames [snaplen]] | stop | save file | put [server:]file] */
+void do_netcap(char *argv[], int argc)
+{
+    const char *filename;
+    uint32_t targetip, size;
+    void *image;
+
+    if(!argc){
+        netcap_status();
+        return;
+    }
+
+    if(!strcmp(argv[0], "start")){
+        if(netcap_start(argc >= 2 ? parse_uint32(argv[1], NULL) : 0, argc >= 3 ? parse_uint32(argv[2], NULL) : 0))
+            netcap_status();
+    }else if(!strcmp(argv[0], "stop") && argc == 1){
+        netcap_stop();
+        netcap_status();
+    }else if(!strcmp(argv[0], "save") && argc == 2){
+        if(netcap_pcap(&image, &size)){
+            netcap_save(argv[1], image, size);
+            free(image);
+        }
+    }else if(!strcmp(argv[0], "put") && argc == 2){
+        if(tftp_parse_source(argv[1], &targetip, &filename) && netcap_pcap(&image, &size)){
+            tftp_save(targetip, filename, (uint32_t)image, size);
+            free(image);
+        }
+    }else
+        printf("netcap: want start [frames [snaplen]], stop, save file or put [server:]file\n");
+}
+
+void do_diskinfo(char *argv[], int argc)
+{
+    disk_report_stats();
+    ff_bitmap_report();
+    ff_dircache_report();
+}
+
+void do_diskcache(char *argv[], int argc)
+{
+    bool ok = true;
+
+    if(argc == 1){
+        if(!strcasecmp(argv[0], "writeback"))
+            ok = disk_cache_set_writeback(true);
+        else if(!strcasecmp(argv[0], "writethrough"))
+            ok = disk_cache_set_writeback(false);
+        else if(!strcasecmp(argv[0], "sync"))
+            ok = disk_cache_sync(-1);
+        else if(!strcasecmp(argv[0], "flush"))
+            ok = disk_cache_invalidate();
+        else{
+            printf("diskcache: unknown option \"%s\" (writeback, writethrough, sync, flush)\n", argv[0]);
+            return;
+        }
+        if(!ok)
+            printf("diskcache: failed to write back dirty sectors\n");
+    }
+
+    disk_cache_report();
+}
+
+void do_cache(char *argv[], int argc)
+{
+    if(argc == 1 && !cache_policy_select(argv[0]))
+        printf("cache: unknown policy \"%s\"\n", argv[0]);
+
+    cache_policy_report();
+}
+
+void do_profile(char *argv[], int argc)
+{
+    if(!strcasecmp(argv[0], "heap") && argc >= 2){
+        if(!strcasecmp(argv[1], "on"))
+            profile_heap_start();
+        else if(!strcasecmp(argv[1], "off"))
+            profile_heap_stop();
+        else if(!strcasecmp(argv[1], "report"))
+            profile_heap_report(argc > 2 ? strtoul(argv[2], NULL, 0) : 20);
+        else
+            printf("profile: unknown option \"%s\" (heap on, off, report)\n", argv[1]);
+    }else if(!strcasecmp(argv[0], "on"))
+        profile_start();
+    else if(!strcasecmp(argv[0], "off"))
+        profile_stop();
+    else if(!strcasecmp(argv[0], "report"))
+        profile_report(argc > 1 ? strtoul(argv[1], NULL, 0) : 20);
+    else
+        printf("profile: unknown option \"%s\" (on, off, report)\n", argv[0]);
+}
+
+void do_boottime(char *argv[], int argc)
+{
+    boot_stage_report();
+}
+
 void do_date(char *argv[], int argc)
 {
 	report_current_time();
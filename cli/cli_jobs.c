@@ -0,0 +1,111 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <cli.h>
+#include <job.h>
+
+bool cli_background = false;
+static job_t *job_list = NULL;
+static int job_next_id = 1;
+
+/* described as "what detail", eg "cp a b" */
+job_t *job_alloc(const char *what, const char *detail)
+{
+    job_t *job = malloc(sizeof(job_t));
+    int what_len = strlen(what), detail_len = strlen(detail);
+
+    memset(job, 0, sizeof(job_t));
+    job->description = malloc(what_len + 1 + detail_len + 1);
+    memcpy(job->description, what, what_len);
+    job->description[what_len] = ' ';
+    memcpy(job->description + what_len + 1, detail, detail_len + 1);
+    return job;
+}
+
+static void job_free(job_t *job)
+{
+    free(job->description);
+    free(job);
+}
+
+void job_add(job_t *job)
+{
+    job_t **link = &job_list;
+
+    if(!job_list)
+        job_next_id = 1;
+    job->id = job_next_id++;
+
+    /* keep the list in id order, for "jobs" */
+    while(*link)
+        link = &(*link)->next;
+    job->next = NULL;
+    *link = job;
+
+    printf("[%d] %s\n", job->id, job->description);
+}
+
+void job_pump(void)
+{
+    job_t **link = &job_list, *job;
+
+    while((job = *link)){
+        if(job->cb_step(job)){
+            link = &job->next;
+        }else{
+            printf("[%d] done: %s\n", job->id, job->description);
+            *link = job->next;
+            job_free(job);
+        }
+    }
+}
+
+void do_jobs(char *argv[], int argc)
+{
+    if(!job_list){
+        printf("No background jobs.\n");
+        return;
+    }
+
+    for(job_t *job = job_list; job; job = job->next){
+        printf("[%d] %s", job->id, job->description);
+        if(job->cb_status){
+            printf(": ");
+            job->cb_status(job);
+        }
+        putchar('\n');
+    }
+}
+
+void do_kill(char *argv[], int argc)
+{
+    job_t **link, *job;
+    const char *p;
+    int id;
+
+    for(int i=0; i<argc; i++){
+        p = argv[i];
+        if(*p == '%')
+            p++;
+        id = strtoul(p, &p, 10);
+        if(*p){
+            printf("kill: bad job number \"%s\"\n", argv[i]);
+            continue;
+        }
+
+        for(link = &job_list; (job = *link); link = &job->next)
+            if(job->id == id)
+                break;
+
+        if(!job){
+            printf("kill: no job %d\n", id);
+            continue;
+        }
+
+        *link = job->next;
+        job->cb_kill(job);
+        printf("[%d] killed: %s\n", job->id, job->description);
+        job_free(job);
+    }
+}
@@ -4,6 +4,10 @@
 #include <stdlib.h>
 #include <init.h>
 #include <cli.h>
+#include <uart.h>
+#include <net.h>
+#include <ramdump.h>
+#include <fatfs/ff.h>
 
 void pretty_dump_memory(void *start, int len)
 {
@@ -62,6 +66,57 @@ void pretty_dump_memory(void *start, int len)
     puts(linebuffer);
 }
 
+static const char *mem_type_name(mem_type_t type)
+{
+    switch(type){
+        case mem_ram:   return "RAM";
+        case mem_video: return "video RAM";
+        case mem_sram:  return "SRAM";
+    }
+    return "?";
+}
+
+void do_memmap(char *argv[], int argc)
+{
+    uint32_t base, max_size, size;
+
+    if(argc == 0){
+        for(int r=0; r<mem_region_count; r++)
+            printf("0x%08lx -- 0x%08lx  %5ld KB  %s\n", mem_region[r].base,
+                    mem_region[r].base + mem_region[r].size - 1,
+                    mem_region[r].size >> 10, mem_type_name(mem_region[r].type));
+        return;
+    }
+
+    if(argc != 3 || strcasecmp(argv[0], "add")){
+        printf("memmap: list memory regions\n" \
+               "memmap add [base] [max size]: find how much RAM there is at base, and add it\n");
+        return;
+    }
+
+    base = parse_uint32(argv[1], NULL);
+    max_size = parse_uint32(argv[2], NULL);
+    if((base | max_size) & (mem_get_granularity()-1)){
+        printf("memmap: base and size must be multiples of %ldKB\n", mem_get_granularity() >> 10);
+        return;
+    }
+    if(base < ram_size || mem_find_region(base, 1)){
+        printf("memmap: 0x%lx is already in a memory region\n", base);
+        return;
+    }
+
+    size = mem_probe_extra_bank(base, max_size);
+    if(!size){
+        printf("memmap: no separate RAM found at 0x%lx\n", base);
+        return;
+    }
+
+    if(!mem_add_region(base, size, mem_ram))
+        printf("memmap: cannot add region\n");
+    else
+        printf("memmap: added %ld KB of RAM at 0x%lx\n", size >> 10, base);
+}
+
 void do_dump(char *argv[], int argc)
 {
     unsigned long start, count;
@@ -72,18 +127,121 @@ void do_dump(char *argv[], int argc)
     pretty_dump_memory((void*)start, count);
 }
 
+#define RAMDUMP_FILE_BUFFER (16*1024)
+
+static void ramdump_save(ramdump_t *dump, const char *filename)
+{
+    uint8_t *buffer;
+    FRESULT fr;
+    FIL fd;
+    int n;
+
+    buffer = malloc_unchecked(RAMDUMP_FILE_BUFFER);
+    if(!buffer){
+        printf("ramdump: no memory\n");
+        return;
+    }
+
+    fr = f_open(&fd, filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if(fr != FR_OK){
+        printf("ramdump: failed to open \"%s\": %s\n", filename, f_errmsg(fr));
+        free(buffer);
+        return;
+    }
+
+    do{
+        if(uart_check_cancel_key()){
+            printf("ramdump: cancelled\n");
+            break;
+        }
+        n = ramdump_read(dump, buffer, RAMDUMP_FILE_BUFFER);
+        fr = f_write(&fd, buffer, n, NULL);
+        if(fr != FR_OK){
+            printf("ramdump: failed to write to \"%s\": %s\n", filename, f_errmsg(fr));
+            break;
+        }
+    }while(n == RAMDUMP_FILE_BUFFER);
+
+    f_close(&fd);
+    free(buffer);
+}
+
+/* ramdump save file|put [server:]file [address length] */
+void do_ramdump(char *argv[], int argc)
+{
+    uint32_t targetip, address = 0, size = 0;
+    const char *filename;
+    ramdump_t *dump;
+    bool put;
+
+    put = !strcmp(argv[0], "put");
+    if((!put && strcmp(argv[0], "save")) || argc == 3){
+        printf("ramdump: want save file or put [server:]file, then optionally address length\n");
+        return;
+    }
+
+    if(argc == 4){
+        address = parse_uint32(argv[2], NULL);
+        size = parse_uint32(argv[3], NULL);
+        if(!size){
+            printf("ramdump: nothing to dump\n");
+            return;
+        }
+    }
+
+    filename = argv[1];
+    if(put && !tftp_parse_source(argv[1], &targetip, &filename))
+        return;
+
+    dump = ramdump_open(address, size);
+    if(!dump)
+        return;
+
+    if(put)
+        tftp_stream(targetip, filename, ramdump_read, dump);
+    else
+        ramdump_save(dump, filename);
+
+    ramdump_close(dump);
+}
+
+/* the free part of region 0, and all of the other RAM regions */
+static void memtest_all_ram(bool fast)
+{
+    uint32_t base[MEM_MAX_REGIONS], size[MEM_MAX_REGIONS];
+    int count = 0;
+
+    for(int r=0; r<mem_region_count; r++){
+        if(mem_region[r].type != mem_ram)
+            continue;
+        if(mem_region[r].base == 0){
+            base[count] = bounce_below_addr;
+            size[count] = free_ram_top - bounce_below_addr;
+        }else{
+            base[count] = mem_region[r].base;
+            size[count] = mem_region[r].size;
+        }
+        count++;
+    }
+
+    memory_test_ranges(count, base, size, fast);
+}
+
 void do_memtest(char *argv[], int argc)
 {
-    unsigned long start, count;
+    uint32_t start, count;
+    bool fast = false;
+
+    if(argc > 0 && !strcasecmp(argv[0], "fast")){
+        fast = true;
+        argv++;
+        argc--;
+    }
 
     switch(argc){
         case 0:
-            start = bounce_below_addr;
-            if(heap_base > ram_size)
-                count = ram_size - start;
-            else
-                count = heap_base - start;
-            break;
+            memtest_all_ram(fast);
+            return;
         case 2:
             start = parse_uint32(argv[0], NULL);
             count = parse_uint32(argv[1], NULL);
@@ -91,11 +249,12 @@ void do_memtest(char *argv[], int argc)
         default:
             printf("memtest: wrong number of arguments\n" \
                    "memtest -- test all free memory\n" \
-                   "memtest [start] [count] -- test specified region only\n");
+                   "memtest [start] [count] -- test specified region only\n" \
+                   "memtest fast [start count] -- burst fill and verify each block, cache on\n");
             return;
     }
 
-    memory_test(start, count);
+    memory_test_ranges(1, &start, &count, fast);
 }
 
 static int fromhex(char c)
@@ -3,8 +3,45 @@
 #include <types.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <fatfs/ff.h>
+#include <timers.h>
 #include <cli.h>
 #include <net.h>
+#include <uart.h>
+#include <loader.h>
+#include <job.h>
+
+#define NETBOOT_DHCP_WAIT_SEC 15
+
+/* parse [server:]filename, using the tftp_server environment variable if no server is given */
+bool tftp_parse_source(char *arg, uint32_t *targetip, const char **filename)
+{
+    const char *server;
+    char *colon;
+
+    colon = strchr(arg, ':');
+    if(colon){
+        *colon = 0;
+        server = arg;
+        *filename = colon + 1;
+    }else{
+        server = get_environment_variable("tftp_server");
+        *filename = arg;
+    }
+
+    if(!server){
+        printf("please specify the server IP address (or 'set tftp_server <ip>')\n");
+        return false;
+    }
+
+    *targetip = net_parse_ipv4(server);
+    if(*targetip == 0){
+        printf("Cannot parse server IPv4 address \"%s\"\n", server);
+        return false;
+    }
+
+    return true;
+}
 
 void do_tftp_cli(char *argv[], int argc, bool is_put)
 {
@@ -47,19 +84,248 @@ void do_tftp_cli(char *argv[], int argc, bool is_put)
     }
 
     /* NOTE: src and dst argument order differs between put and get */
-    if(is_put)
+    if(cli_background){
+        cli_background = false;
+        if(is_put)
+            tftp_transfer_background(targetip, dst, src, true);
+        else
+            tftp_transfer_background(targetip, src, dst, false);
+    }else if(is_put)
         tftp_transfer(targetip, dst, src, true);
     else
         tftp_transfer(targetip, src, dst, false);
 }
 
 
+/* tftp mget [server:]file ... */
+static void do_tftp_mget(char *argv[], int argc)
+{
+    uint32_t *targetip;
+    char **filename;
+    const char *name;
+
+    targetip = malloc(argc * sizeof(uint32_t));
+    filename = malloc(argc * sizeof(char*));
+
+    for(int i=0; i<argc; i++){
+        if(!tftp_parse_source(argv[i], &targetip[i], &name))
+            goto out;
+        filename[i] = (char*)name;
+    }
+
+    tftp_mget(argc, targetip, filename);
+
+out:
+    free(targetip);
+    free(filename);
+}
+
 void do_tftp_get(char *argv[], int argc)
 {
-    do_tftp_cli(argv, argc, false);
+    if(argc >= 2 && !strcasecmp(argv[0], "mget"))
+        do_tftp_mget(argv + 1, argc - 1);
+    else
+        do_tftp_cli(argv, argc, false);
 }
 
 void do_tftp_put(char *argv[], int argc)
 {
+    const char *filename;
+    uint32_t targetip, address, size;
+
+    /* "server:file address length" sends memory; "server src dst" has no colon */
+    if(argc == 3 && strchr(argv[0], ':')){
+        if(!tftp_parse_source(argv[0], &targetip, &filename))
+            return;
+        address = parse_uint32(argv[1], NULL);
+        size = parse_uint32(argv[2], NULL);
+        tftp_save(targetip, filename, address, size);
+        return;
+    }
+
     do_tftp_cli(argv, argc, true);
 }
+
+void do_tftp_load(char *argv[], int argc)
+{
+    const char *filename;
+    uint32_t targetip, address, size;
+
+    if(!tftp_parse_source(argv[0], &targetip, &filename))
+        return;
+
+    address = parse_uint32(argv[1], NULL);
+    if(tftp_load(targetip, filename, &address, &size))
+        printf("Loaded %ld bytes at 0x%lx\n", size, address);
+}
+
+void do_tftp_raw(char *argv[], int argc)
+{
+    uint32_t targetip;
+    const char *filename;
+
+    if(!tftp_parse_source(argv[0], &targetip, &filename))
+        return;
+
+    tftp_raw(targetip, filename, parse_uint32(argv[1], NULL), argc >= 3 ? parse_uint32(argv[2], NULL) : 0);
+}
+
+/* tftpd [seed | list | ram name address length] */
+void do_tftpd(char *argv[], int argc)
+{
+    if(argc == 0)
+        tftpd_start(false);
+    else if(!strcmp(argv[0], "seed") && argc == 1)
+        tftpd_start(true);
+    else if(!strcmp(argv[0], "list") && argc == 1)
+        tftpd_list();
+    else if(!strcmp(argv[0], "ram") && argc == 4)
+        tftpd_publish(argv[1], NULL, parse_uint32(argv[2], NULL), parse_uint32(argv[3], NULL));
+    else
+        printf("tftpd: want nothing, \"seed\", \"list\" or \"ram name address length\"\n");
+}
+
+/* with tftp_verify set to sha256 or crc32, fetch filename.sha256 (or .crc32)
+ * and have the loader check the image against it */
+static bool tftp_fetch_digest(uint32_t targetip, const char *filename)
+{
+    const char *kind = get_environment_variable("tftp_verify");
+    uint32_t address = TFTP_LOAD_HIGH, size;
+    char text[80], *sidecar;
+
+    if(!kind)
+        return true;
+    if(strcasecmp(kind, "sha256") && strcasecmp(kind, "crc32")){
+        printf("tftp_verify: want sha256 or crc32\n");
+        return false;
+    }
+
+    sidecar = arena_alloc(strlen(filename) + strlen(kind) + 2);
+    strcpy(sidecar, filename);
+    strcat(sidecar, ".");
+    strcat(sidecar, kind);
+    if(!tftp_load(targetip, sidecar, &address, &size))
+        return false;
+
+    if(size > sizeof(text) - 1)
+        size = sizeof(text) - 1;
+    memcpy(text, (const char*)address, size);
+    text[size] = 0;
+    return load_verify_expect(text);
+}
+
+/* retrieve filename to the top of free memory and run it; argv[0] is replaced by filename */
+static void tftp_boot_file(uint32_t targetip, const char *filename, char *argv[], int argc)
+{
+    uint32_t address = TFTP_LOAD_HIGH, size, header_size;
+    const char *image, *header, *format;
+    char buffer[HEADER_EXAMINE_SIZE];
+    decomp_t *dc;
+
+    if(!tftp_fetch_digest(targetip, filename) || !tftp_load(targetip, filename, &address, &size)){
+        load_verify_expect(NULL);
+        return;
+    }
+
+    /* the image sits at the top of free memory, the loader copies it down into place */
+    image = header = (const char*)address;
+    header_size = size;
+    argv[0] = (char*)filename;
+
+    /* compressed: what matters is what it decompresses to */
+    format = decomp_detect(image, size);
+    if(format){
+        printf("%s: %s compressed\n", filename, format);
+        dc = decomp_open(NULL, image, size);
+        if(!dc || decomp_read(dc, buffer, 0, HEADER_EXAMINE_SIZE) != FR_OK){
+            decomp_close(dc);
+            load_verify_expect(NULL);
+            return;
+        }
+        decomp_close(dc);
+        header = buffer;
+        header_size = HEADER_EXAMINE_SIZE;
+    }
+
+    if(header_size >= sizeof(elf_header_bytes) && memcmp(header, elf_header_bytes, sizeof(elf_header_bytes)) == 0){
+        printf("%s: ELF.\n", filename);
+        load_elf_image(argv, argc, image, size);
+    }else if(header_size >= sizeof(m68k_header_bytes) && memcmp(header, m68k_header_bytes, sizeof(m68k_header_bytes)) == 0){
+        printf("%s: 68K or SYS\n", filename);
+        load_m68k_image(argv, argc, image, size);
+    }else if(header_size >= sizeof(script_header_bytes) && strncasecmp(header, script_header_bytes, sizeof(script_header_bytes)) == 0){
+        if(format)
+            printf("%s: script: compressed scripts are unsupported\n", filename);
+        else{
+            printf("%s: script\n", filename);
+            execute_script_memory(filename, image, size);
+        }
+    }else{
+        printf("%s: unknown format.\n", filename);
+    }
+
+    load_verify_expect(NULL); /* if the loader did not take it */
+}
+
+void do_tftp_boot(char *argv[], int argc)
+{
+    const char *filename;
+    uint32_t targetip;
+
+    if(!tftp_parse_source(argv[0], &targetip, &filename))
+        return;
+
+    tftp_boot_file(targetip, filename, argv, argc);
+}
+
+/* boot the file named by DHCP (option 67 or the BOOTP file field) from the
+ * server it named (option 66 or siaddr), straight into memory */
+void do_netboot(char *argv[], int argc)
+{
+    const char *filename, *server;
+    uint32_t targetip;
+    timer_t timeout;
+    char **args;
+
+    if(!dhcp_running()){
+        printf("netboot: no network interface\n");
+        return;
+    }
+
+    if(!dhcp_bound()){
+        printf("netboot: waiting for DHCP (hit Q to cancel)\n");
+        timeout = set_timer_sec(NETBOOT_DHCP_WAIT_SEC);
+        while(!dhcp_bound()){
+            net_pump();
+            if(uart_check_cancel_key()){
+                printf("(cancelled)\n");
+                return;
+            }
+            if(timer_expired(timeout)){
+                printf("netboot: no DHCP lease\n");
+                return;
+            }
+        }
+    }
+
+    filename = get_environment_variable("bootfile");
+    if(!filename){
+        printf("netboot: DHCP server did not name a boot file\n");
+        return;
+    }
+
+    server = get_environment_variable("next_server");
+    if(!server)
+        server = get_environment_variable("tftp_server");
+    targetip = server ? net_parse_ipv4(server) : 0;
+    if(!targetip){
+        printf("netboot: DHCP server did not name a boot server\n");
+        return;
+    }
+
+    /* the loaded program gets the boot file name as argv[0], then our arguments */
+    args = malloc((argc + 2) * sizeof(char*));
+    memcpy(args + 1, argv, (argc + 1) * sizeof(char*));
+    tftp_boot_file(targetip, filename, args, argc + 1);
+    free(args);
+}
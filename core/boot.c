@@ -9,6 +9,60 @@
 #include <rtc.h>
 #include <version.h>
 #include <tinyalloc.h>
+#include <timers.h>
+
+/* when each stage of startup finished, for the boottime command. the timer
+ * only starts in setup_interrupts(), so the stages before it are not timed */
+#define BOOT_STAGES 16
+
+typedef struct {
+    const char *what;
+    uint32_t us;                /* timer_read_fine() */
+    bool timed;
+} boot_stage_t;
+
+static boot_stage_t boot_stage[BOOT_STAGES];
+static int boot_stages = 0;
+static bool boot_timer_running = false;
+
+/* the first time only: DHCP may bind again, scripts may run again */
+void boot_stage_mark(const char *what)
+{
+    for(int i=0; i<boot_stages; i++)
+        if(boot_stage[i].what == what)
+            return;
+    if(boot_stages == BOOT_STAGES)
+        return;
+
+    boot_stage[boot_stages].what = what;
+    boot_stage[boot_stages].timed = boot_timer_running;
+    boot_stage[boot_stages].us = boot_timer_running ? timer_read_fine() : 0;
+    boot_stages++;
+}
+
+/* at the prompt: any later stages (DHCP, a boot) are timed to the tick */
+void boot_stages_done(void)
+{
+    if(boot_timer_running)
+        timer_fine_release();
+}
+
+void boot_stage_report(void)
+{
+    uint32_t previous = 0;
+
+    printf("Boot stages, ms from when the timer started:\n");
+    for(int i=0; i<boot_stages; i++){
+        if(!boot_stage[i].timed){
+            printf("  %-16s (before the timer)\n", boot_stage[i].what);
+            continue;
+        }
+        printf("  %-16s %6ld.%03ld  +%ld.%03ld\n", boot_stage[i].what,
+                boot_stage[i].us / 1000, boot_stage[i].us % 1000,
+                (boot_stage[i].us - previous) / 1000, (boot_stage[i].us - previous) % 1000);
+        previous = boot_stage[i].us;
+    }
+}
 
 static void report_segment(const char *name, int start, int size, int load)
 {
@@ -35,26 +89,34 @@ static void report_segment(const char *name, int start, int size, int load)
 
 void report_memory_layout(void)
 {
-    uint32_t free_ram_top;
-
-    if(heap_base > ram_size)
-        free_ram_top = ram_size;
-    else
-        free_ram_top = heap_base;
-
     printf(" segment     start    length\n");
     report_segment("text",   (int)&text_start,   (int)&text_size, 0); 
     report_segment("rodata", (int)&rodata_start, (int)&rodata_size, 0); 
     report_segment("data",   (int)&data_start,   (int)&data_size, (int)&data_load_start);
     report_segment("bss",    (int)&bss_start,    (int)&bss_size, 0);
     report_segment("(free)", (int)bounce_below_addr, (int)free_ram_top - (int)bounce_below_addr, 0);
+    if(free_ram_top < heap_base && free_ram_top < ram_size)
+        report_segment("(resvd)", (int)free_ram_top, (heap_base < ram_size ? (int)heap_base : (int)ram_size) - (int)free_ram_top, 0);
     report_segment("heap",   (int)heap_base,     (int)heap_size, 0);
     report_segment("stack",  (int)stack_base,    (int)stack_size, 0);
+    for(int r=1; r<mem_region_count; r++)
+        report_segment(mem_region[r].type == mem_video ? "(video)" :
+                       mem_region[r].type == mem_sram  ? "(sram)"  : "(free)",
+                (int)mem_region[r].base, (int)mem_region[r].size, 0);
+    /* a load may go anywhere below free_ram_top, bouncing over our own image */
+    printf("memory profile %s: %ld KB kept, %ld KB of %ld KB loadable\n", MEMORY_PROFILE_NAME,
+            (ram_size - free_ram_top) >> 10, free_ram_top >> 10, ram_size >> 10);
 }
 
 static void heap_init(void)
 {
-    ta_init((void*)heap_base, (void*)heap_base + heap_size - 1, heap_size > (200*1024) ? 2048 : 256, 16, 4);
+#ifdef HEAP_BLOCKS
+    int blocks = HEAP_BLOCKS;
+#else
+    int blocks = heap_size > (200*1024) ? 2048 : 256;
+#endif
+    // an eighth of the heap for small allocations, in size classes
+    ta_init((void*)heap_base, (void*)heap_base + heap_size - 1, blocks, 16, 4, heap_size / 8);
 }
 
 void report_ram_installed(void)
@@ -86,28 +148,45 @@ void gogoboot(void)
 {
     early_init();
     uart_init();
+    boot_stage_mark("uart");
     puts(copyright_msg);
     printf("Version %s\n", software_version_string);
     heap_init();
+    stack_paint();
+    boot_stage_mark("heap");
     report_ram_installed();
     uart_identify();
     printf("Setup interrupts: ");
     setup_interrupts(); /* do this early to get timers ticking */
+    boot_timer_running = true;
+    timer_fine_hold(); /* until boot_stages_done() */
+    boot_stage_mark("interrupts");
     printf("done\n");
 
     printf("Initialise RTC: ");
     rtc_init();
     report_current_time();
+    boot_stage_mark("rtc");
 
+    /* the disks are probed in the background while we carry on */
     disk_init();
+    disk_cache_init();
 
     target_hardware_init();
+    boot_stage_mark("hardware");
 
     printf("Initialise ethernet: ");
     net_init();
     if(eth_init()){
         dhcp_init();
     }
+    boot_stage_mark("ethernet");
+
+    /* DHCP makes progress while we wait */
+    disk_wait_ready();
+    if(!disk_get_count())
+        ramdisk_create(0); /* diskless: somewhere to put files */
+    boot_stage_mark("disk");
 
     command_line_interpreter();
 
@@ -0,0 +1,89 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <cpu.h>
+
+/* how the CPU caches memory: the CACR bits and transparent translation
+ * registers for each policy the `cache` command can pick. the first is what
+ * startup sets up. in all of them the I/O at the top of the address space is
+ * not cached (serialised, on the 68040); they differ in how RAM is. */
+
+typedef struct {
+    const char *name;
+    const char *description;
+    uint32_t cacr;
+    uint32_t ttr[4];                    /* 68040: ITT0, ITT1, DTT0, DTT1; 68030: TT0, TT1 */
+} cache_policy_t;
+
+#if defined(TARGET_Q40)
+#define CACR_EI                 (1UL << 15)
+#define CACR_ED                 (1UL << 31)
+/* base, mask, e=1, s=10, then cm: see q40/startup.s */
+#define TTR_IO                  0xff00c040      /* top 16MB, cm=10 noncached, serialised */
+#define TTR_COPYBACK            0x00ffc020      /* the rest, cm=01 cached, copyback */
+#define TTR_WRITETHROUGH        0x00ffc000      /* the rest, cm=00 cached, writethrough */
+
+static const cache_policy_t cache_policy[] = {
+    { "copyback",     "data and instruction caches, RAM copyback",
+      CACR_EI | CACR_ED, { TTR_IO, TTR_COPYBACK, TTR_IO, TTR_COPYBACK } },
+    { "writethrough", "data and instruction caches, RAM writethrough",
+      CACR_EI | CACR_ED, { TTR_IO, TTR_WRITETHROUGH, TTR_IO, TTR_WRITETHROUGH } },
+    { "nodata",       "instruction cache only",
+      CACR_EI,           { TTR_IO, TTR_COPYBACK, TTR_IO, TTR_COPYBACK } },
+    { "off",          "no caches",
+      0,                 { TTR_IO, TTR_COPYBACK, TTR_IO, TTR_COPYBACK } },
+};
+#elif defined(TARGET_KISS)
+#define CACR_EI                 (1 << 0)
+#define CACR_IBE                (1 << 4)
+#define CACR_ED                 (1 << 8)
+#define CACR_DBE                (1 << 12)
+#define CACR_WA                 (1 << 13)
+/* data in the top 16MB cache inhibited: see kiss/startup.s. the 68030 data
+ * cache is always writethrough */
+#define TT_IO                   0xff008514
+
+static const cache_policy_t cache_policy[] = {
+    { "writethrough", "data and instruction caches",
+      CACR_EI | CACR_ED, { TT_IO, 0 } },
+    { "burst",        "data and instruction caches, burst fills, write allocate",
+      CACR_EI | CACR_IBE | CACR_ED | CACR_DBE | CACR_WA, { TT_IO, 0 } },
+    { "nodata",       "instruction cache only",
+      CACR_EI,           { TT_IO, 0 } },
+    { "off",          "no caches",
+      0,                 { TT_IO, 0 } },
+};
+#else
+static const cache_policy_t cache_policy[] = {
+    { "none",         "the 68000 has no cache", 0, { 0 } },
+};
+#endif
+
+#define CACHE_POLICIES (sizeof(cache_policy) / sizeof(cache_policy[0]))
+
+static int cache_policy_current = 0;
+
+const char *cache_policy_name(void)
+{
+    return cache_policy[cache_policy_current].name;
+}
+
+bool cache_policy_select(const char *name)
+{
+    for(int i=0; i<CACHE_POLICIES; i++)
+        if(!strcasecmp(name, cache_policy[i].name)){
+            cpu_cache_configure(cache_policy[i].cacr, cache_policy[i].ttr);
+            cache_policy_current = i;
+            return true;
+        }
+
+    return false;
+}
+
+void cache_policy_report(void)
+{
+    for(int i=0; i<CACHE_POLICIES; i++)
+        printf("%c %-13s %s\n", i == cache_policy_current ? '*' : ' ',
+                cache_policy[i].name, cache_policy[i].description);
+}
@@ -3,8 +3,11 @@
         .globl  cpu_cache_disable
         .globl  cpu_cache_flush
         .globl  cpu_cache_invalidate
+        .globl  cpu_cache_configure
         .globl  cpu_interrupts_on
         .globl  cpu_interrupts_off
+        .globl  cpu_interrupts_save
+        .globl  cpu_interrupts_restore
 
         .section .text
         .even
@@ -14,6 +17,7 @@ cpu_cache_invalidate:           /* flush data and instruction caches */
 cpu_cache_enable_nodata:        /* enable cpu instruction cache, disable data cache */
 cpu_cache_enable:               /* enable both cpu caches */
 cpu_cache_disable:              /* disable and flush data and intsruction caches */
+cpu_cache_configure:            /* no caches, no TTRs */
         rts
 
 cpu_interrupts_on:              /* enable CPU interrupts */
@@ -24,4 +28,14 @@ cpu_interrupts_off:             /* disable CPU interrupts */
         or.w #0x0700, %sr
         rts
 
+cpu_interrupts_save:            /* disable CPU interrupts, return the SR from before */
+        moveq #0, %d0
+        move.w %sr, %d0
+        or.w #0x0700, %sr
+        rts
+
+cpu_interrupts_restore:         /* put back the SR cpu_interrupts_save returned */
+        move.w 6(%sp), %sr
+        rts
+
         .end
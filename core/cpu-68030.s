@@ -4,8 +4,11 @@
         .globl  cpu_cache_disable
         .globl  cpu_cache_flush
         .globl  cpu_cache_invalidate
+        .globl  cpu_cache_configure
         .globl  cpu_interrupts_on
         .globl  cpu_interrupts_off
+        .globl  cpu_interrupts_save
+        .globl  cpu_interrupts_restore
 
         .section .text
         .even
@@ -28,15 +31,28 @@ cpu_cache_invalidate:           /* flush data and instruction caches */
         bra.s cpu_cache_write
 
 cpu_cache_enable_nodata:        /* enable cpu instruction cache, disable data cache */
-        move.l #(CACR_EI), %d0
+        move.l cpu_cacr_enable, %d0
+        and.l #(CACR_EI+CACR_IBE), %d0
         movec %d0, %cacr        /* enable instruction cache only */
         rts
 
-cpu_cache_enable:               /* enable both cpu caches */
-        move.l #(CACR_EI+CACR_ED), %d0
+cpu_cache_enable:               /* enable the caches the policy wants */
+        move.l cpu_cacr_enable, %d0
         movec %d0, %cacr        /* enable data, instruction caches */
         rts
 
+cpu_cache_configure:            /* cpu_cache_configure(cacr, ttr[2]): CACR, TT0, TT1 */
+        move.l 4(%sp), %d0
+        movea.l 8(%sp), %a0
+        move.l %d0, cpu_cacr_enable
+        pmove (%a0), %tt0       /* the data cache is writethrough, so nothing to write back */
+        pmove 4(%a0), %tt1
+        pflusha
+        or.w #(CACR_CI+CACR_CD), %d0
+        movec %d0, %cacr        /* and nothing cached under the old TTs survives */
+        nop
+        rts
+
 cpu_cache_disable:              /* disable and flush data and intsruction caches */
         move.l #(CACR_CI+CACR_CD), %d0
         movec %d0, %cacr        /* disable and clear data, instruction caches */
@@ -51,4 +67,19 @@ cpu_interrupts_off:             /* disable CPU interrupts */
         or.w #0x0700, %sr
         rts
 
+cpu_interrupts_save:            /* disable CPU interrupts, return the SR from before */
+        moveq #0, %d0
+        move.w %sr, %d0
+        or.w #0x0700, %sr
+        rts
+
+cpu_interrupts_restore:         /* put back the SR cpu_interrupts_save returned */
+        move.w 6(%sp), %sr
+        rts
+
+        .section .data
+        .even
+cpu_cacr_enable:                /* what cpu_cache_enable() writes to the CACR */
+        .long CACR_EI+CACR_ED
+
         .end
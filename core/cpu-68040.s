@@ -4,8 +4,11 @@
         .globl  cpu_cache_disable
         .globl  cpu_cache_flush
         .globl  cpu_cache_invalidate
+        .globl  cpu_cache_configure
         .globl  cpu_interrupts_on
         .globl  cpu_interrupts_off
+        .globl  cpu_interrupts_save
+        .globl  cpu_interrupts_restore
 
         .section .text
         .even
@@ -20,15 +23,41 @@ cpu_cache_invalidate:           /* flush data and instruction caches */
 
 cpu_cache_enable_nodata:        /* enable cpu instruction cache, disable data cache */
         cpusha %dc              /* write back data cache entries */
-        move.l #(CACR_EI), %d0
+        move.l cpu_cacr_enable, %d0
+        and.l #(CACR_EI), %d0
         movec %d0, %cacr        /* enable instruction cache only */
         rts
 
-cpu_cache_enable:               /* enable both cpu caches */
-        move.l #(CACR_EI+CACR_ED), %d0
+cpu_cache_enable:               /* enable the caches the policy wants */
+        move.l cpu_cacr_enable, %d0
         movec %d0, %cacr        /* enable data, instruction caches */
         rts
 
+cpu_cache_configure:            /* cpu_cache_configure(cacr, ttr[4]): CACR, ITT0, ITT1, DTT0, DTT1 */
+        move.l 4(%sp), %d0
+        movea.l 8(%sp), %a0
+        move.l %d0, cpu_cacr_enable
+        cpusha %bc              /* write back, copyback lines may be about to go writethrough */
+        nop
+        moveq #0, %d1
+        movec %d1, %cacr        /* caches off while the TTRs change */
+        cpusha %bc
+        nop
+        move.l (%a0)+, %d1
+        movec %d1, %itt0
+        move.l (%a0)+, %d1
+        movec %d1, %itt1
+        move.l (%a0)+, %d1
+        movec %d1, %dtt0
+        move.l (%a0), %d1
+        movec %d1, %dtt1
+        nop
+        pflusha                 /* motorola says do a pflush after messing with TTRs */
+        nop
+        movec %d0, %cacr
+        nop
+        rts
+
 cpu_cache_disable:              /* disable and flush data and intsruction caches */
         move.l #0, %d0
         cpusha %bc              /* write back and invalidate all data/instruction cache entries */
@@ -46,4 +75,19 @@ cpu_interrupts_off:             /* disable CPU interrupts */
         or.w #0x0700, %sr
         rts
 
+cpu_interrupts_save:            /* disable CPU interrupts, return the SR from before */
+        moveq #0, %d0
+        move.w %sr, %d0
+        or.w #0x0700, %sr
+        rts
+
+cpu_interrupts_restore:         /* put back the SR cpu_interrupts_save returned */
+        move.w 6(%sp), %sr
+        rts
+
+        .section .data
+        .even
+cpu_cacr_enable:                /* what cpu_cache_enable() writes to the CACR */
+        .long CACR_EI+CACR_ED
+
         .end
@@ -0,0 +1,813 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <fatfs/ff.h>
+#include <loader.h>
+
+// Streaming decompression for the loader: gzip (deflate, RFC 1951/1952) and
+// LZ4 (frame and legacy formats). The compressed data is read a little at a
+// time from a file or an image in memory, and never staged whole in RAM.
+//
+// Output goes through a window, which holds the history the matches refer
+// to, plus the block we most recently produced. decomp_read() copies the bytes
+// wanted out of it, so reads should move forwards through the stream: a small
+// step back is served from the window, anything further means decompressing
+// again from the start. The ELF loader's reads (header, program headers, then
+// segments in file order) fit that pattern.
+
+#define DECOMP_INPUT_SIZE       4096
+#define DECOMP_CHUNK            (16*1024)       // most we produce at a time
+#define DEFLATE_HISTORY         (32*1024)
+#define LZ4_HISTORY             (64*1024)
+#define FAST_BITS               9                // huffman codes this short decode by table
+#define FAST_SIZE               (1 << FAST_BITS)
+
+typedef enum { FORMAT_GZIP, FORMAT_LZ4, FORMAT_LZ4_LEGACY } decomp_format_t;
+
+typedef enum {
+    S_BLOCK_HEADER,     // deflate: next block header; LZ4: next block size
+    S_STORED,           // copying an uncompressed block
+    S_HUFFMAN,          // deflate: decoding a compressed block
+    S_LZ4_TOKEN,        // LZ4: next sequence
+    S_LZ4_LITERALS,     // LZ4: copying a sequence's literals
+    S_LZ4_MATCH,        // LZ4: copying a sequence's match
+    S_DONE,
+    S_FAILED
+} decomp_state_t;
+
+typedef struct {
+    uint16_t count[16];         // number of codes of each length
+    uint16_t symbol[288];       // symbols in canonical code order
+    uint16_t fast[FAST_SIZE];   // (length << 9) | symbol by the next FAST_BITS bits; 0 if longer
+} huffman_t;
+
+struct decomp_t {
+    decomp_format_t format;
+
+    // input
+    FIL *fd;
+    const uint8_t *image;
+    uint32_t source_size;
+    uint32_t in_offset;                     // source offset of in[in_length]
+    uint8_t in[DECOMP_INPUT_SIZE];
+    int in_pos, in_length;
+    bool in_eof;
+    decomp_observer_t observer;             // told about the input as it is read
+    void *observer_context;
+    uint32_t bitbuf;
+    int bitcnt;
+
+    // output
+    uint8_t *window;
+    uint32_t window_mask;
+    uint32_t out;                           // bytes produced so far
+    uint32_t size;                          // total, once known; 0 until then
+    decomp_state_t state;
+
+    // deflate
+    bool last_block;
+    huffman_t lencode, distcode;
+    uint32_t copy_length, copy_distance;    // match (or literal bytes) still to copy
+
+    // LZ4
+    bool lz4_block_checksum;
+    uint32_t block_in;                      // compressed bytes left in this block
+    uint8_t match_token;                    // low nibble of the sequence's token
+};
+
+/* ---- input ---- */
+
+static bool decomp_refill(decomp_t *dc)
+{
+    unsigned int got;
+    uint32_t want = DECOMP_INPUT_SIZE;
+
+    dc->in_pos = 0;
+    dc->in_length = 0;
+
+    if(dc->in_offset >= dc->source_size){
+        dc->in_eof = true;
+        return false;
+    }
+    if(want > dc->source_size - dc->in_offset)
+        want = dc->source_size - dc->in_offset;
+
+    if(dc->fd){
+        /* others may have moved the file pointer since we last read */
+        if((f_tell(dc->fd) != dc->in_offset && f_lseek(dc->fd, dc->in_offset) != FR_OK) ||
+           f_read(dc->fd, dc->in, want, &got) != FR_OK || got != want){
+            dc->in_eof = true;
+            return false;
+        }
+    }else
+        memcpy(dc->in, dc->image + dc->in_offset, want);
+
+    if(dc->observer)
+        dc->observer(dc->observer_context, dc->in_offset, dc->in, want);
+
+    dc->in_length = want;
+    dc->in_offset += want;
+    return true;
+}
+
+/* past the end we return zeros, and in_eof tells the decoder it overran */
+static inline int decomp_byte(decomp_t *dc)
+{
+    if(dc->in_pos == dc->in_length && !decomp_refill(dc))
+        return 0;
+    return dc->in[dc->in_pos++];
+}
+
+static bool decomp_seek_input(decomp_t *dc, uint32_t offset)
+{
+    dc->in_offset = offset;
+    dc->in_pos = dc->in_length = 0;
+    dc->in_eof = false;
+    dc->bitbuf = 0;
+    dc->bitcnt = 0;
+    return !dc->fd || f_lseek(dc->fd, offset) == FR_OK;
+}
+
+static uint32_t decomp_le32(decomp_t *dc)
+{
+    uint32_t v = decomp_byte(dc);
+    v |= decomp_byte(dc) << 8;
+    v |= decomp_byte(dc) << 16;
+    v |= (uint32_t)decomp_byte(dc) << 24;
+    return v;
+}
+
+/* deflate packs its fields least significant bit first */
+static inline uint32_t decomp_bits(decomp_t *dc, int need)
+{
+    uint32_t v;
+
+    while(dc->bitcnt < need){
+        dc->bitbuf |= (uint32_t)decomp_byte(dc) << dc->bitcnt;
+        dc->bitcnt += 8;
+    }
+    v = dc->bitbuf & ((1UL << need) - 1);
+    dc->bitbuf >>= need;
+    dc->bitcnt -= need;
+    return v;
+}
+
+/* to a byte boundary, keeping any whole bytes the bit buffer has read ahead */
+static void decomp_align(decomp_t *dc)
+{
+    dc->bitbuf >>= dc->bitcnt & 7;
+    dc->bitcnt &= ~7;
+}
+
+/* ---- output ---- */
+
+static inline void decomp_put(decomp_t *dc, uint8_t byte)
+{
+    dc->window[dc->out++ & dc->window_mask] = byte;
+}
+
+/* copy the pending match, but no more than room bytes of it */
+static uint32_t decomp_copy_match(decomp_t *dc, uint32_t room)
+{
+    uint32_t n = dc->copy_length < room ? dc->copy_length : room;
+    uint32_t from = dc->out - dc->copy_distance;
+
+    for(uint32_t i=0; i<n; i++)
+        decomp_put(dc, dc->window[from++ & dc->window_mask]);
+
+    dc->copy_length -= n;
+    return n;
+}
+
+/* copy up to room literal bytes straight from the input */
+static uint32_t decomp_copy_literal(decomp_t *dc, uint32_t room, bool counted)
+{
+    uint32_t n = dc->copy_length < room ? dc->copy_length : room;
+
+    for(uint32_t i=0; i<n; i++)
+        decomp_put(dc, decomp_byte(dc));
+
+    dc->copy_length -= n;
+    if(counted)
+        dc->block_in -= n;
+    return n;
+}
+
+/* ---- deflate ---- */
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/* canonical huffman table from code lengths; false if over-subscribed */
+static bool huffman_build(huffman_t *h, const uint8_t *length, int n)
+{
+    uint16_t offs[16];
+    uint32_t code, rev;
+    int left, idx;
+
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast, 0, sizeof(h->fast));
+    for(int s=0; s<n; s++)
+        h->count[length[s]]++;
+
+    left = 1;
+    for(int len=1; len<16; len++){
+        left = (left << 1) - h->count[len];
+        if(left < 0)
+            return false;
+    }
+
+    offs[1] = 0;
+    for(int len=1; len<15; len++)
+        offs[len+1] = offs[len] + h->count[len];
+    for(int s=0; s<n; s++)
+        if(length[s])
+            h->symbol[offs[length[s]]++] = s;
+
+    /* the short codes also go in the lookup table, bit reversed as they arrive */
+    code = 0;
+    idx = 0;
+    for(int len=1; len<=FAST_BITS; len++){
+        for(int k=0; k<h->count[len]; k++, idx++, code++){
+            rev = 0;
+            for(int b=0; b<len; b++)
+                rev |= ((code >> b) & 1) << (len - 1 - b);
+            for(uint32_t i=rev; i<FAST_SIZE; i += 1 << len)
+                h->fast[i] = (len << 9) | h->symbol[idx];
+        }
+        code <<= 1;
+    }
+
+    return true;
+}
+
+static int huffman_decode(decomp_t *dc, const huffman_t *h)
+{
+    int code, first, index, count, entry;
+
+    while(dc->bitcnt < FAST_BITS){
+        dc->bitbuf |= (uint32_t)decomp_byte(dc) << dc->bitcnt;
+        dc->bitcnt += 8;
+    }
+
+    entry = h->fast[dc->bitbuf & (FAST_SIZE-1)];
+    if(entry){
+        dc->bitbuf >>= entry >> 9;
+        dc->bitcnt -= entry >> 9;
+        return entry & 0x1ff;
+    }
+
+    /* a long code: one bit at a time */
+    code = first = index = 0;
+    for(int len=1; len<16; len++){
+        code |= decomp_bits(dc, 1);
+        count = h->count[len];
+        if(code - count < first)
+            return h->symbol[index + (code - first)];
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+static bool deflate_fixed_tables(decomp_t *dc)
+{
+    uint8_t length[288];
+    int s;
+
+    for(s=0; s<144; s++) length[s] = 8;
+    for(; s<256; s++) length[s] = 9;
+    for(; s<280; s++) length[s] = 7;
+    for(; s<288; s++) length[s] = 8;
+    huffman_build(&dc->lencode, length, 288);
+
+    for(s=0; s<30; s++) length[s] = 5;
+    huffman_build(&dc->distcode, length, 30);
+    return true;
+}
+
+static bool deflate_dynamic_tables(decomp_t *dc)
+{
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    uint8_t length[288+30];
+    int nlen, ndist, ncode, index, symbol, len, repeat;
+
+    nlen = decomp_bits(dc, 5) + 257;
+    ndist = decomp_bits(dc, 5) + 1;
+    ncode = decomp_bits(dc, 4) + 4;
+    if(nlen > 286 || ndist > 30)
+        return false;
+
+    memset(length, 0, 19);
+    for(index=0; index<ncode; index++)
+        length[order[index]] = decomp_bits(dc, 3);
+    if(!huffman_build(&dc->lencode, length, 19))
+        return false;
+
+    for(index=0; index < nlen + ndist; ){
+        symbol = huffman_decode(dc, &dc->lencode);
+        if(symbol < 0)
+            return false;
+        if(symbol < 16){
+            length[index++] = symbol;
+            continue;
+        }
+        len = 0;
+        if(symbol == 16){
+            if(index == 0)
+                return false;
+            len = length[index-1];
+            repeat = 3 + decomp_bits(dc, 2);
+        }else if(symbol == 17)
+            repeat = 3 + decomp_bits(dc, 3);
+        else
+            repeat = 11 + decomp_bits(dc, 7);
+        if(index + repeat > nlen + ndist)
+            return false;
+        while(repeat--)
+            length[index++] = len;
+    }
+
+    if(length[256] == 0) /* no end of block code */
+        return false;
+
+    return huffman_build(&dc->lencode, length, nlen) &&
+           huffman_build(&dc->distcode, length + nlen, ndist);
+}
+
+static uint32_t deflate_produce(decomp_t *dc, uint32_t room)
+{
+    uint32_t produced = 0, len;
+    int symbol;
+
+    while(produced < room){
+        switch(dc->state){
+            case S_BLOCK_HEADER:
+                if(dc->last_block){
+                    /* the gzip trailer: CRC32 then the length mod 2^32 */
+                    decomp_align(dc);
+                    decomp_bits(dc, 16);
+                    decomp_bits(dc, 16);
+                    len = decomp_bits(dc, 16);
+                    len |= decomp_bits(dc, 16) << 16;
+                    if(len != dc->out || dc->in_eof){
+                        dc->state = S_FAILED;
+                        return produced;
+                    }
+                    dc->size = dc->out;
+                    dc->state = S_DONE;
+                    return produced;
+                }
+                dc->last_block = decomp_bits(dc, 1);
+                switch(decomp_bits(dc, 2)){
+                    case 0:
+                        decomp_align(dc);
+                        len = decomp_bits(dc, 16);
+                        if(decomp_bits(dc, 16) != (~len & 0xffff)){
+                            dc->state = S_FAILED;
+                            return produced;
+                        }
+                        dc->copy_length = len;
+                        dc->state = S_STORED;
+                        break;
+                    case 1:
+                        deflate_fixed_tables(dc);
+                        dc->copy_length = 0;
+                        dc->state = S_HUFFMAN;
+                        break;
+                    case 2:
+                        if(!deflate_dynamic_tables(dc)){
+                            dc->state = S_FAILED;
+                            return produced;
+                        }
+                        dc->copy_length = 0;
+                        dc->state = S_HUFFMAN;
+                        break;
+                    default:
+                        dc->state = S_FAILED;
+                        return produced;
+                }
+                break;
+            case S_STORED:
+                produced += decomp_copy_literal(dc, room - produced, false);
+                if(!dc->copy_length)
+                    dc->state = S_BLOCK_HEADER;
+                break;
+            case S_HUFFMAN:
+                if(dc->copy_length){
+                    produced += decomp_copy_match(dc, room - produced);
+                    break;
+                }
+                symbol = huffman_decode(dc, &dc->lencode);
+                if(symbol < 256){
+                    if(symbol < 0){
+                        dc->state = S_FAILED;
+                        return produced;
+                    }
+                    decomp_put(dc, symbol);
+                    produced++;
+                }else if(symbol == 256)
+                    dc->state = S_BLOCK_HEADER;
+                else{
+                    symbol -= 257;
+                    if(symbol >= 29){
+                        dc->state = S_FAILED;
+                        return produced;
+                    }
+                    dc->copy_length = length_base[symbol] + decomp_bits(dc, length_extra[symbol]);
+                    symbol = huffman_decode(dc, &dc->distcode);
+                    if(symbol < 0 || symbol >= 30){
+                        dc->state = S_FAILED;
+                        return produced;
+                    }
+                    dc->copy_distance = dist_base[symbol] + decomp_bits(dc, dist_extra[symbol]);
+                    if(dc->copy_distance > dc->out){
+                        dc->state = S_FAILED;
+                        return produced;
+                    }
+                }
+                break;
+            default:
+                return produced;
+        }
+        if(dc->in_eof){
+            dc->state = S_FAILED;
+            return produced;
+        }
+    }
+
+    return produced;
+}
+
+static bool gzip_header(decomp_t *dc)
+{
+    int flags, len;
+
+    if(decomp_byte(dc) != 0x1f || decomp_byte(dc) != 0x8b || decomp_byte(dc) != 8)
+        return false;
+    flags = decomp_byte(dc);
+    for(int i=0; i<6; i++) /* mtime, xfl, os */
+        decomp_byte(dc);
+    if(flags & 0x04){ /* FEXTRA */
+        len = decomp_byte(dc);
+        len |= decomp_byte(dc) << 8;
+        while(len--)
+            decomp_byte(dc);
+    }
+    if(flags & 0x08) /* FNAME */
+        while(decomp_byte(dc) && !dc->in_eof);
+    if(flags & 0x10) /* FCOMMENT */
+        while(decomp_byte(dc) && !dc->in_eof);
+    if(flags & 0x02){ /* FHCRC */
+        decomp_byte(dc);
+        decomp_byte(dc);
+    }
+
+    return !dc->in_eof;
+}
+
+/* ---- LZ4 ---- */
+
+#define LZ4_MAGIC               0x184D2204
+#define LZ4_LEGACY_MAGIC        0x184C2102
+#define LZ4_SKIPPABLE_MASK      0xFFFFFFF0
+#define LZ4_SKIPPABLE_MAGIC     0x184D2A50
+
+static bool lz4_frame_header(decomp_t *dc)
+{
+    int flags;
+    uint32_t size_low, size_high;
+
+    if(decomp_le32(dc) !=
+       (dc->format == FORMAT_LZ4 ? LZ4_MAGIC : LZ4_LEGACY_MAGIC))
+        return false;
+    if(dc->format == FORMAT_LZ4_LEGACY)
+        return true;
+
+    flags = decomp_byte(dc);
+    if((flags & 0xc0) != 0x40 || (flags & 0x01)) /* version 01; no dictionaries */
+        return false;
+    dc->lz4_block_checksum = flags & 0x10;
+    decomp_byte(dc); /* block size: we don't care */
+    if(flags & 0x08){ /* content size */
+        size_low = decomp_le32(dc);
+        size_high = decomp_le32(dc);
+        if(size_high) /* a 4GB kernel? */
+            return false;
+        dc->size = size_low;
+    }
+    decomp_byte(dc); /* header checksum */
+
+    return !dc->in_eof;
+}
+
+/* an LZ4 length continues in bytes of 255 */
+static uint32_t lz4_length(decomp_t *dc, uint32_t len)
+{
+    int b;
+
+    if(len == 15){
+        do{
+            b = decomp_byte(dc);
+            dc->block_in--;
+            len += b;
+        }while(b == 255 && !dc->in_eof);
+    }
+    return len;
+}
+
+static uint32_t lz4_produce(decomp_t *dc, uint32_t room)
+{
+    uint32_t produced = 0, size;
+    int token;
+
+    while(produced < room){
+        switch(dc->state){
+            case S_BLOCK_HEADER:
+                if(dc->format == FORMAT_LZ4_LEGACY && dc->in_pos == dc->in_length &&
+                   dc->in_offset >= dc->source_size){
+                    dc->size = dc->out; /* legacy streams just end */
+                    dc->state = S_DONE;
+                    return produced;
+                }
+                size = decomp_le32(dc);
+                if(dc->format == FORMAT_LZ4_LEGACY){
+                    if(size == LZ4_LEGACY_MAGIC)
+                        break; /* concatenated legacy streams */
+                    if(dc->in_pos == dc->in_length && dc->in_offset >= dc->source_size){
+                        /* kernel builds append the uncompressed size */
+                        dc->size = dc->out;
+                        dc->state = S_DONE;
+                        return produced;
+                    }
+                }else if(size == 0){
+                    dc->size = dc->out; /* end mark; a content checksum may follow */
+                    dc->state = S_DONE;
+                    return produced;
+                }
+                if(dc->format == FORMAT_LZ4 && (size & 0x80000000)){
+                    dc->copy_length = size & 0x7fffffff;
+                    dc->block_in = dc->copy_length;
+                    dc->state = S_STORED;
+                }else{
+                    dc->block_in = size;
+                    dc->state = S_LZ4_TOKEN;
+                }
+                break;
+            case S_STORED:
+                produced += decomp_copy_literal(dc, room - produced, true);
+                if(!dc->copy_length){
+                    if(dc->lz4_block_checksum)
+                        decomp_le32(dc);
+                    dc->state = S_BLOCK_HEADER;
+                }
+                break;
+            case S_LZ4_TOKEN:
+                if(!dc->block_in){
+                    if(dc->lz4_block_checksum)
+                        decomp_le32(dc);
+                    dc->state = S_BLOCK_HEADER;
+                    break;
+                }
+                token = decomp_byte(dc);
+                dc->block_in--;
+                dc->match_token = token & 15;
+                dc->copy_length = lz4_length(dc, token >> 4);
+                dc->state = S_LZ4_LITERALS;
+                break;
+            case S_LZ4_LITERALS:
+                produced += decomp_copy_literal(dc, room - produced, true);
+                if(dc->copy_length)
+                    break;
+                if((int32_t)dc->block_in <= 0){
+                    /* the last sequence of a block has no match */
+                    dc->block_in = 0;
+                    dc->state = S_LZ4_TOKEN;
+                    break;
+                }
+                dc->copy_distance = decomp_byte(dc);
+                dc->copy_distance |= decomp_byte(dc) << 8;
+                dc->block_in -= 2;
+                dc->copy_length = lz4_length(dc, dc->match_token) + 4;
+                if(!dc->copy_distance || dc->copy_distance > dc->out){
+                    dc->state = S_FAILED;
+                    return produced;
+                }
+                dc->state = S_LZ4_MATCH;
+                break;
+            case S_LZ4_MATCH:
+                produced += decomp_copy_match(dc, room - produced);
+                if(!dc->copy_length)
+                    dc->state = S_LZ4_TOKEN;
+                break;
+            default:
+                return produced;
+        }
+        if(dc->in_eof){
+            dc->state = S_FAILED;
+            return produced;
+        }
+    }
+
+    return produced;
+}
+
+/* ---- the stream ---- */
+
+static int decomp_format(const uint8_t *h, uint32_t len)
+{
+    if(len >= 3 && h[0] == 0x1f && h[1] == 0x8b && h[2] == 8)
+        return FORMAT_GZIP;
+    if(len >= 4 && h[0] == 0x04 && h[1] == 0x22 && h[2] == 0x4d && h[3] == 0x18)
+        return FORMAT_LZ4;
+    if(len >= 4 && h[0] == 0x02 && h[1] == 0x21 && h[2] == 0x4c && h[3] == 0x18)
+        return FORMAT_LZ4_LEGACY;
+    return -1;
+}
+
+static const char *decomp_format_name[] = { "gzip", "LZ4", "LZ4 legacy" };
+
+const char *decomp_detect(const void *header, uint32_t len)
+{
+    int format = decomp_format(header, len);
+
+    return format < 0 ? NULL : decomp_format_name[format];
+}
+
+static uint32_t decomp_produce(decomp_t *dc, uint32_t room)
+{
+    if(dc->format == FORMAT_GZIP)
+        return deflate_produce(dc, room);
+    return lz4_produce(dc, room);
+}
+
+/* back to the start of the stream */
+static bool decomp_rewind(decomp_t *dc)
+{
+    dc->out = 0;
+    dc->last_block = false;
+    dc->copy_length = dc->copy_distance = 0;
+    dc->state = S_BLOCK_HEADER;
+
+    if(!decomp_seek_input(dc, 0) ||
+       !(dc->format == FORMAT_GZIP ? gzip_header(dc) : lz4_frame_header(dc))){
+        dc->state = S_FAILED;
+        return false;
+    }
+
+    return true;
+}
+
+/* the stream comes from fd if it is not NULL, otherwise an image in memory.
+ * returns NULL (having said why) if it is not compressed in a format we know,
+ * or if we cannot start decompressing it. */
+decomp_t *decomp_open(FIL *fd, const void *image, uint32_t image_size)
+{
+    uint8_t magic[4];
+    unsigned int br = 0;
+    int format;
+    uint32_t window_size;
+    decomp_t *dc;
+
+    if(fd){
+        image_size = f_size(fd);
+        if(f_lseek(fd, 0) != FR_OK || f_read(fd, magic, sizeof(magic), &br) != FR_OK)
+            return NULL;
+    }else{
+        br = image_size < sizeof(magic) ? image_size : sizeof(magic);
+        memcpy(magic, image, br);
+    }
+
+    format = decomp_format(magic, br);
+    if(format < 0)
+        return NULL;
+
+    // the history the matches may reach back to, and a chunk beyond it
+    window_size = 2 * (format == FORMAT_GZIP ? DEFLATE_HISTORY : LZ4_HISTORY);
+
+    dc = malloc_unchecked(sizeof(decomp_t));
+    if(dc){
+        dc->window = malloc_unchecked(window_size);
+        if(!dc->window){
+            free(dc);
+            dc = NULL;
+        }
+    }
+    if(!dc){
+        printf("%s: not enough memory to decompress\n", decomp_format_name[format]);
+        return NULL;
+    }
+
+    dc->format = format;
+    dc->fd = fd;
+    dc->image = image;
+    dc->source_size = image_size;
+    dc->window_mask = window_size - 1;
+    dc->size = 0;
+    dc->lz4_block_checksum = false;
+    dc->observer = NULL;
+
+    // gzip records the size (mod 2^32) in its last four bytes
+    if(format == FORMAT_GZIP && image_size >= 18 && decomp_seek_input(dc, image_size - 4))
+        dc->size = decomp_le32(dc);
+
+    if(!decomp_rewind(dc)){
+        printf("%s: bad header\n", decomp_format_name[format]);
+        decomp_close(dc);
+        return NULL;
+    }
+
+    return dc;
+}
+
+void decomp_observe(decomp_t *dc, decomp_observer_t observer, void *context)
+{
+    dc->observer = observer;
+    dc->observer_context = context;
+}
+
+void decomp_close(decomp_t *dc)
+{
+    if(dc){
+        free(dc->window);
+        free(dc);
+    }
+}
+
+/* decompressed bytes [offset, offset+len) to dest, or just skipped if dest is NULL */
+FRESULT decomp_read(decomp_t *dc, void *dest, uint32_t offset, uint32_t len)
+{
+    uint8_t *to = dest;
+    uint32_t window_size = dc->window_mask + 1, n, start, first;
+
+    while(len){
+        if(dc->out > window_size && offset < dc->out - window_size){
+            if(!decomp_rewind(dc))
+                return FR_INT_ERR;
+            continue;
+        }
+
+        if(offset < dc->out){
+            n = dc->out - offset;
+            if(n > len)
+                n = len;
+            if(to){
+                start = offset & dc->window_mask;
+                first = window_size - start;
+                if(first > n)
+                    first = n;
+                memcpy(to, dc->window + start, first);
+                memcpy(to + first, dc->window, n - first);
+                to += n;
+            }
+            offset += n;
+            len -= n;
+            continue;
+        }
+
+        if(dc->state == S_DONE){
+            printf("%s: %ld bytes requested beyond the end\n", decomp_format_name[dc->format], len);
+            return FR_INT_ERR;
+        }
+        if(dc->state == S_FAILED){
+            printf("%s: data is corrupt after %ld bytes\n", decomp_format_name[dc->format], dc->out);
+            return FR_INT_ERR;
+        }
+
+        decomp_produce(dc, DECOMP_CHUNK);
+    }
+
+    return FR_OK;
+}
+
+/* decompressed size; without a record of it this means a pass over the data. 0 on error. */
+uint32_t decomp_size(decomp_t *dc)
+{
+    if(dc->size || dc->state == S_DONE)
+        return dc->size;
+
+    while(dc->state != S_DONE && dc->state != S_FAILED)
+        decomp_produce(dc, DECOMP_CHUNK);
+
+    if(dc->state == S_FAILED){
+        printf("%s: data is corrupt after %ld bytes\n", decomp_format_name[dc->format], dc->out);
+        return 0;
+    }
+
+    return dc->size;
+}
@@ -0,0 +1,406 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+/* Set-associative LRU sector cache sitting between FatFs and the IDE driver.
+ * Single-sector transfers (FAT, directory and partial-cluster I/O) go through
+ * the cache; larger transfers go straight to the disk so bulk file data does
+ * not flush the metadata working set.  Write-through by default, optionally
+ * write-back with dirty sectors flushed on CTRL_SYNC.
+ *
+ * Writes that would go to the disk are first gathered in a write-behind buffer
+ * holding one run of consecutive sectors, which is written with a single
+ * multi-sector command when it fills, when a write lands elsewhere, when a
+ * read overlaps it, or on CTRL_SYNC (ie f_sync and f_close).
+ *
+ * Asynchronous requests (disk_cache_submit) bypass the cache like bulk
+ * transfers, and are made coherent with it when they are submitted. */
+
+#include <stdlib.h>
+#include <types.h>
+#include <init.h>
+#include <disk.h>
+
+#define CACHE_WAYS          4               /* lines per set */
+#define CACHE_MAX_SETS      128             /* 128 * 4 * 512 = 256KB */
+#define CACHE_MIN_SETS      4
+#define CACHE_HEAP_FRACTION 8               /* use at most 1/8th of the heap */
+#define SECTOR_SIZE         512
+#define WB_MAX_SECTORS      64              /* write-behind buffer, up to 32KB */
+#define WB_MIN_SECTORS      8
+#define WB_HEAP_FRACTION    16              /* use at most 1/16th of the heap */
+
+typedef struct {
+    uint32_t lba;
+    uint32_t last_used;                     /* LRU timestamp */
+    uint8_t disk;
+    bool valid;
+    bool dirty;
+} cache_line_t;
+
+static cache_line_t *cache_line = NULL;
+static uint8_t *cache_data = NULL;
+static int cache_sets = 0;                  /* 0 = cache disabled */
+static uint32_t cache_clock = 0;
+static bool cache_writeback = false;
+static int cache_dirty_count = 0;
+
+static uint32_t cache_hits, cache_misses, cache_evictions, cache_flushes;
+
+static uint8_t *wb_data = NULL;             /* NULL = write-behind disabled */
+static int wb_disk;
+static uint32_t wb_lba;
+static int wb_count = 0;                    /* sectors held */
+static int wb_max = 0;                      /* buffer size, in sectors */
+static uint32_t wb_merged, wb_writes;
+
+void disk_cache_init(void)
+{
+    int sets = CACHE_MAX_SETS;
+    uint32_t budget = heap_size / CACHE_HEAP_FRACTION;
+
+    while(sets >= CACHE_MIN_SETS && sets * CACHE_WAYS * (SECTOR_SIZE + sizeof(cache_line_t)) > budget)
+        sets >>= 1;
+
+    if(sets < CACHE_MIN_SETS){
+        cache_sets = 0;
+        return;
+    }
+
+    cache_line = malloc_unchecked(sets * CACHE_WAYS * sizeof(cache_line_t));
+    cache_data = malloc_unchecked(sets * CACHE_WAYS * SECTOR_SIZE);
+    if(!cache_line || !cache_data){
+        free(cache_line);
+        free(cache_data);
+        cache_line = NULL;
+        cache_data = NULL;
+        cache_sets = 0;
+        return;
+    }
+
+    memset(cache_line, 0, sets * CACHE_WAYS * sizeof(cache_line_t));
+    cache_sets = sets;
+
+    wb_max = heap_size / WB_HEAP_FRACTION / SECTOR_SIZE;
+    if(wb_max > WB_MAX_SECTORS)
+        wb_max = WB_MAX_SECTORS;
+    if(wb_max >= WB_MIN_SECTORS)
+        wb_data = malloc_unchecked(wb_max * SECTOR_SIZE);
+}
+
+/* does [sector, sector+count) overlap the write-behind buffer? */
+static bool wb_overlaps(int disk, uint32_t sector, int count)
+{
+    return wb_count && disk == wb_disk && sector < wb_lba + wb_count && wb_lba < sector + count;
+}
+
+static bool wb_flush(void)
+{
+    if(!wb_count)
+        return true;
+
+    if(!disk_data_write(wb_disk, wb_data, wb_lba, wb_count))
+        return false; /* keep the data, a later sync may succeed */
+
+    wb_writes++;
+    wb_count = 0;
+    return true;
+}
+
+/* try to absorb a write into the write-behind buffer */
+static bool wb_write(int disk, const void *buff, uint32_t sector, int count, bool *ok)
+{
+    if(!wb_data || count > wb_max)
+        return false;
+
+    if(wb_count && disk == wb_disk && sector >= wb_lba && sector + count <= wb_lba + wb_count){
+        /* rewriting sectors we already hold */
+    }else if(wb_count && disk == wb_disk && sector == wb_lba + wb_count && wb_count + count <= wb_max){
+        /* extends the run */
+        wb_count += count;
+    }else{
+        /* start a new run */
+        if(!wb_flush()){
+            *ok = false;
+            return true;
+        }
+        wb_disk = disk;
+        wb_lba = sector;
+        wb_count = count;
+    }
+
+    memcpy(wb_data + ((sector - wb_lba) * SECTOR_SIZE), buff, count * SECTOR_SIZE);
+    wb_merged += count;
+    *ok = true;
+    return true;
+}
+
+static int cache_set_index(int disk, uint32_t lba)
+{
+    /* consecutive sectors land in consecutive sets */
+    return (lba ^ (disk << 5)) & (cache_sets - 1);
+}
+
+static cache_line_t *cache_lookup(int disk, uint32_t lba)
+{
+    cache_line_t *line = &cache_line[cache_set_index(disk, lba) * CACHE_WAYS];
+
+    for(int way=0; way<CACHE_WAYS; way++, line++)
+        if(line->valid && line->lba == lba && line->disk == disk)
+            return line;
+
+    return NULL;
+}
+
+static inline uint8_t *cache_line_data(cache_line_t *line)
+{
+    return cache_data + ((line - cache_line) * SECTOR_SIZE);
+}
+
+static bool cache_line_flush(cache_line_t *line)
+{
+    if(!line->dirty)
+        return true;
+
+    if(!disk_data_write(line->disk, cache_line_data(line), line->lba, 1))
+        return false;
+
+    line->dirty = false;
+    cache_dirty_count--;
+    cache_flushes++;
+    return true;
+}
+
+/* pick the LRU line in the set, writing it back first if required */
+static cache_line_t *cache_allocate(int disk, uint32_t lba)
+{
+    cache_line_t *line = &cache_line[cache_set_index(disk, lba) * CACHE_WAYS];
+    cache_line_t *victim = line;
+
+    for(int way=0; way<CACHE_WAYS; way++, line++){
+        if(!line->valid){
+            victim = line;
+            break;
+        }
+        if((int32_t)(line->last_used - victim->last_used) < 0)
+            victim = line;
+    }
+
+    if(victim->valid){
+        if(!cache_line_flush(victim))
+            return NULL;
+        cache_evictions++;
+    }
+
+    victim->valid = false;
+    victim->disk = disk;
+    victim->lba = lba;
+    return victim;
+}
+
+static void cache_touch(cache_line_t *line)
+{
+    line->last_used = ++cache_clock;
+}
+
+bool disk_cache_read(int disk, void *buff, uint32_t sector, int sector_count)
+{
+    cache_line_t *line;
+
+    if(!cache_sets)
+        return disk_data_read(disk, buff, sector, sector_count);
+
+    /* make sure the disk is up to date before we read from it */
+    if(wb_overlaps(disk, sector, sector_count) && !wb_flush())
+        return false;
+
+    if(sector_count == 1){
+        line = cache_lookup(disk, sector);
+        if(line){
+            cache_hits++;
+        }else{
+            cache_misses++;
+            line = cache_allocate(disk, sector);
+            if(!line)
+                return false;
+            if(!disk_data_read(disk, cache_line_data(line), sector, 1))
+                return false;
+            line->valid = true;
+        }
+        cache_touch(line);
+        memcpy(buff, cache_line_data(line), SECTOR_SIZE);
+        return true;
+    }
+
+    /* bulk read bypasses the cache */
+    if(!disk_data_read(disk, buff, sector, sector_count))
+        return false;
+
+    /* ... but dirty cached sectors are newer than what is on the disk */
+    if(cache_dirty_count){
+        for(int i=0; i<sector_count; i++){
+            line = cache_lookup(disk, sector + i);
+            if(line && line->dirty)
+                memcpy(buff + (i * SECTOR_SIZE), cache_line_data(line), SECTOR_SIZE);
+        }
+    }
+
+    return true;
+}
+
+/* refresh any cached copies of sectors just written to the disk or write-behind buffer */
+static void cache_update(int disk, const void *buff, uint32_t sector, int sector_count)
+{
+    cache_line_t *line;
+
+    for(int i=0; i<sector_count; i++){
+        line = cache_lookup(disk, sector + i);
+        if(line){
+            memcpy(cache_line_data(line), buff + (i * SECTOR_SIZE), SECTOR_SIZE);
+            if(line->dirty){
+                line->dirty = false;
+                cache_dirty_count--;
+            }
+        }
+    }
+}
+
+bool disk_cache_write(int disk, const void *buff, uint32_t sector, int sector_count)
+{
+    cache_line_t *line;
+    bool ok;
+
+    if(!cache_sets)
+        return disk_data_write(disk, buff, sector, sector_count);
+
+    if(sector_count == 1 && cache_writeback && !wb_overlaps(disk, sector, 1)){
+        line = cache_lookup(disk, sector);
+        if(!line){
+            line = cache_allocate(disk, sector);
+            if(!line)
+                return false;
+            line->valid = true;
+        }
+        memcpy(cache_line_data(line), buff, SECTOR_SIZE);
+        if(!line->dirty){
+            line->dirty = true;
+            cache_dirty_count++;
+        }
+        cache_touch(line);
+        return true;
+    }
+
+    /* write-through: via the write-behind buffer if it will take it, else disk */
+    if(wb_write(disk, buff, sector, sector_count, &ok)){
+        if(!ok)
+            return false;
+    }else{
+        if(wb_overlaps(disk, sector, sector_count) && !wb_flush())
+            return false;
+        if(!disk_data_write(disk, buff, sector, sector_count))
+            return false;
+    }
+
+    cache_update(disk, buff, sector, sector_count);
+
+    return true;
+}
+
+/* an asynchronous transfer goes straight to the disk, like a bulk one. The
+ * disk first gets anything newer we hold for its sectors, and for a write the
+ * cached copies take the new data now (any later synchronous read waits for
+ * the queue, so it cannot see the disk before the write lands) */
+void disk_cache_submit(disk_request_t *req)
+{
+    cache_line_t *line;
+    bool ok = true;
+
+    if(cache_sets){
+        if(wb_overlaps(req->disk, req->sector, req->count))
+            ok = wb_flush();
+        if(req->is_write){
+            cache_update(req->disk, req->buff, req->sector, req->count);
+        }else if(cache_dirty_count){
+            for(int i=0; ok && i<req->count; i++){
+                line = cache_lookup(req->disk, req->sector + i);
+                if(line && !cache_line_flush(line))
+                    ok = false;
+            }
+        }
+    }
+
+    if(!ok){
+        req->ok = false;
+        req->done = true;
+        return;
+    }
+
+    disk_submit(req);
+}
+
+/* write back dirty sectors, then flush the drive; disk < 0 syncs all disks */
+bool disk_cache_sync(int disk)
+{
+    bool ok = true;
+
+    if(wb_count && (disk < 0 || disk == wb_disk))
+        ok = wb_flush();
+
+    if(cache_dirty_count)
+        for(int i=0; i<cache_sets*CACHE_WAYS; i++)
+            if(cache_line[i].dirty && (disk < 0 || cache_line[i].disk == disk))
+                if(!cache_line_flush(&cache_line[i]))
+                    ok = false;
+
+    /* and then out of the drive's own write cache */
+    if(!disk_flush(disk))
+        ok = false;
+
+    return ok;
+}
+
+/* discard the cached copy of every sector (after a sync) */
+bool disk_cache_invalidate(void)
+{
+    if(!disk_cache_sync(-1))
+        return false;
+
+    for(int i=0; i<cache_sets*CACHE_WAYS; i++)
+        cache_line[i].valid = false;
+
+    return true;
+}
+
+bool disk_cache_set_writeback(bool writeback)
+{
+    if(!writeback && !disk_cache_sync(-1))
+        return false;
+    cache_writeback = writeback;
+    return true;
+}
+
+void disk_cache_report(void)
+{
+    uint32_t total = cache_hits + cache_misses;
+    int used = 0;
+
+    if(!cache_sets){
+        printf("disk cache: disabled (insufficient heap)\n");
+        return;
+    }
+
+    for(int i=0; i<cache_sets*CACHE_WAYS; i++)
+        if(cache_line[i].valid)
+            used++;
+
+    printf("disk cache: %d sets x %d ways (%d KB), %s\n",
+            cache_sets, CACHE_WAYS, (cache_sets * CACHE_WAYS * SECTOR_SIZE) >> 10,
+            cache_writeback ? "write-back" : "write-through");
+    printf("lines valid %d, dirty %d\n", used, cache_dirty_count);
+    printf("hits %lu, misses %lu (%lu%% hit rate)\n", cache_hits, cache_misses,
+            total ? (cache_hits * 100) / total : 0);
+    printf("evictions %lu, writebacks %lu\n", cache_evictions, cache_flushes);
+    if(wb_data)
+        printf("write-behind: %d KB, %lu sectors merged into %lu writes, %d held\n",
+                (wb_max * SECTOR_SIZE) >> 10, wb_merged, wb_writes, wb_count);
+    else
+        printf("write-behind: disabled\n");
+}
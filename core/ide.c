@@ -7,8 +7,38 @@
 #include <fatfs/diskio.h>
 #include <disk.h>
 #include <ide.h>
+#if defined(TARGET_Q40)
+#include <q40/bus.h>
+#elif defined(TARGET_KISS) || defined(TARGET_MINI)
+#include <ecb/bus.h>
+#else
+#pragma error update ide.c for your target
+#endif
+#include <task.h>
+#include <cli.h>
 
 #define MAX_IDE_DISKS FF_VOLUMES
+#define MAX_MULTIPLE_SECTORS 16 /* largest block we'll ask READ/WRITE MULTIPLE to move per DRQ */
+#define MAX_PROBE_CONTROLLERS 4
+#define IDE_TIMEOUT_SEC 3
+#define IDE_FLUSH_TIMEOUT_SEC 30 /* a drive may take this long to empty its write cache */
+
+/* state of the drive probe running on each controller during startup */
+typedef enum {
+    PROBE_SELECT,
+    PROBE_WAIT_READY,
+    PROBE_WAIT_IDENTIFY,
+    PROBE_DONE
+} disk_probe_state_t;
+
+typedef struct {
+    disk_controller_t *ctrl;
+    disk_probe_state_t state;
+    int drivenr;                /* drive currently being probed */
+    uint8_t status;             /* last status read */
+    uint8_t *identify[2];       /* identify data per drive, NULL if not found */
+    const char *result[2];      /* reason no disk was found */
+} disk_probe_t;
 
 // debugging option:
 #undef ATA_DUMP_IDENTIFY_RESULT
@@ -16,38 +46,179 @@
 static disk_t **disk_table = 0;
 static int disk_table_size = 0;
 
-static bool ide_wait_status(disk_controller_t *ctrl, uint8_t bits)
+static void disk_queue_drain(void);
+
+/* check status once: returns 1 when 'bits' are set, 0 while busy, -1 on error */
+static int ide_poll_status(disk_controller_t *ctrl, uint8_t bits, uint8_t *status_out)
 {
     uint8_t status;
-    timer_t timeout = 0;
+
+    status = ide_get_register(ctrl, ATA_REG_STATUS);
+    *status_out = status;
+
+    if((status & (IDE_STATUS_BUSY | IDE_STATUS_ERROR | bits)) == bits)
+        return 1;
+
+    if(((status & (IDE_STATUS_BUSY | IDE_STATUS_ERROR)) == IDE_STATUS_ERROR) ||
+        (status == 0x00) || (status == 0xFF)){ /* error */
+        return -1;
+    }
+
+    return 0;
+}
+
+/* wait for 'bits' to be set in the status register; if 'disk' is non-NULL the
+ * time spent waiting, timeouts and errors are added to its statistics */
+static bool ide_wait_status_timeout(disk_controller_t *ctrl, uint8_t bits, disk_t *disk, int timeout_sec)
+{
+    uint8_t status;
+    timer_t timeout = 0, start = 0;
+    int r;
+
+    if(disk)
+        start = gogoboot_read_timer();
 
     /* read alt status once to ensure we meet timing for reading status */
     status = ide_get_register(ctrl, ATA_REG_ALTSTATUS);
 
     do{
-        status = ide_get_register(ctrl, ATA_REG_STATUS);
-
-        if((status & (IDE_STATUS_BUSY | IDE_STATUS_ERROR | bits)) == bits)
-            return true;
-
-        if(((status & (IDE_STATUS_BUSY | IDE_STATUS_ERROR)) == IDE_STATUS_ERROR) ||
-            (status == 0x00) || (status == 0xFF)){ /* error */
-            return false;
+        r = ide_poll_status(ctrl, bits, &status);
+        if(r){
+            if(disk){
+                disk->stats.wait_ticks += gogoboot_read_timer() - start;
+                if(r < 0)
+                    disk->stats.errors++;
+            }
+            return (r > 0);
         }
 
         if(!timeout)
-            timeout = set_timer_sec(3); 
+            timeout = set_timer_sec(timeout_sec);
     }while(!timer_expired(timeout));
 
+    if(disk){
+        disk->stats.wait_ticks += gogoboot_read_timer() - start;
+        disk->stats.timeouts++;
+    }
+
     printf("IDE timeout, status=%x\n", status);
     return false;
 }
 
+static bool ide_wait_status(disk_controller_t *ctrl, uint8_t bits, disk_t *disk)
+{
+    return ide_wait_status_timeout(ctrl, bits, disk, IDE_TIMEOUT_SEC);
+}
+
+/* bit 'bit' of the IDENTIFY word at byte offset 'word' */
+static bool ide_id_bit(const uint8_t *id, int word, int bit)
+{
+    return id[word + (bit >> 3)] & (1 << (bit & 7));
+}
+
+static bool ide_set_feature(disk_controller_t *ctrl, int drivenr, uint8_t feature, uint8_t value)
+{
+    disk_queue_drain();
+    ide_set_register(ctrl, ATA_REG_DEVICE, drivenr == 0 ? 0xE0 : 0xF0); /* select master/slave */
+    ide_set_register(ctrl, ATA_REG_FEATURE, feature);
+    ide_set_register(ctrl, ATA_REG_NSECT, value);
+    ide_set_register(ctrl, ATA_REG_CMD, IDE_CMD_SET_FEATURES);
+    return ide_wait_status(ctrl, IDE_STATUS_READY, NULL);
+}
+
+/* the fastest PIO mode the drive offers. the bus timing here is fixed by the
+ * hardware, so this only matters to drives that use IORDY to pace the host,
+ * and is only worth telling those; -1 leaves the drive at its default */
+static int disk_init_pio_mode(disk_controller_t *ctrl, int drivenr, const uint8_t *buffer)
+{
+    int mode;
+
+    if(!ide_id_bit(buffer, ATA_ID_CAPABILITY, 11)) /* no IORDY */
+        return -1;
+
+    if(ide_id_bit(buffer, ATA_ID_FIELD_VALID, 1) && (buffer[ATA_ID_PIO_MODES] & 0x03))
+        mode = (buffer[ATA_ID_PIO_MODES] & 0x02) ? 4 : 3;
+    else
+        mode = buffer[ATA_ID_OLD_PIO_MODES + 1] > 2 ? 2 : buffer[ATA_ID_OLD_PIO_MODES + 1];
+
+    if(!ide_set_feature(ctrl, drivenr, IDE_FEATURE_XFER_MODE, IDE_XFER_PIO_FLOW | mode))
+        return -1;
+    return mode;
+}
+
+/* with its write cache on a drive says a write is done once it has the data,
+ * rather than once the data is on the media. disk_flush() sees it through.
+ * a drive that can't be told to flush is left as it is */
+static bool disk_write_cache_capable(const uint8_t *buffer)
+{
+    return (buffer[ATA_ID_COMMAND_SET_2 + 1] & 0xC0) == 0x40 && /* words 82-84 valid */
+        ide_id_bit(buffer, ATA_ID_COMMAND_SET_1, 5) && ide_id_bit(buffer, ATA_ID_COMMAND_SET_2, 12);
+}
+
+/* switch the write cache to match ide_write_cache; returns its new state */
+static bool disk_set_write_cache(disk_controller_t *ctrl, int drivenr, bool enabled)
+{
+    bool want = get_environment_variable_int("ide_write_cache", 1);
+
+    if(want == enabled || !ide_set_feature(ctrl, drivenr, want ? IDE_FEATURE_WCACHE_ON : IDE_FEATURE_WCACHE_OFF, 0))
+        return enabled;
+    return want;
+}
+
+static bool disk_flush_one(disk_t *disk)
+{
+    disk_controller_t *ctrl = disk->ctrl;
+
+    if(disk->ram)
+        return true;
+    disk_queue_drain(); /* its writes may still be queued */
+    if(!disk->write_cache || !disk->unflushed)
+        return true;
+
+    ide_set_register(ctrl, ATA_REG_DEVICE, disk->disk == 0 ? 0xE0 : 0xF0);
+    if(!ide_wait_status(ctrl, IDE_STATUS_READY, disk))
+        return false;
+    ide_set_register(ctrl, ATA_REG_CMD, IDE_CMD_FLUSH_CACHE);
+    disk->stats.flushes++;
+    if(!ide_wait_status_timeout(ctrl, IDE_STATUS_READY, disk, IDE_FLUSH_TIMEOUT_SEC)){
+        printf("disk %s: FLUSH CACHE failed\n", disk->model);
+        return false;
+    }
+
+    disk->unflushed = false;
+    return true;
+}
+
+/* before writing: pick up a change to ide_write_cache, and note that the
+ * drive will have data to flush */
+static void disk_write_begin(disk_t *disk)
+{
+    if(disk->write_cache_ok && disk->write_cache != (bool)get_environment_variable_int("ide_write_cache", 1) &&
+       disk_flush_one(disk))
+        disk->write_cache = disk_set_write_cache(disk->ctrl, disk->disk, disk->write_cache);
+    disk->unflushed = true;
+}
+
+/* histogram bucket for a command taking 'ticks': 0, 1, 2-3, 4-7, ... */
+static int disk_latency_bucket(timer_t ticks)
+{
+    int bucket = 0;
+
+    while(ticks && bucket < DISK_LATENCY_BUCKETS-1){
+        ticks >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
 static bool disk_data_readwrite(int disknr, void *buff, uint32_t sector, int sector_count, bool is_write)
 {
     disk_t *disk;
     disk_controller_t *ctrl;
-    int nsect;
+    int nsect, block;
+    uint8_t cmd;
+    timer_t start;
 
     if(disknr < 0 || disknr >= disk_table_size){
         printf("bad disk %d\n", disknr);
@@ -57,6 +228,28 @@ static bool disk_data_readwrite(int disknr, void *buff, uint32_t sector, int sec
     disk = disk_table[disknr];
     ctrl = disk->ctrl;
 
+    if(disk->ram){
+        if(sector >= disk->sectors || sector_count > disk->sectors - sector)
+            return false;
+        if(is_write){
+            memcpy(disk->ram + (sector << 9), buff, sector_count << 9);
+            disk->stats.sectors_written += sector_count;
+        }else{
+            memcpy(buff, disk->ram + (sector << 9), sector_count << 9);
+            disk->stats.sectors_read += sector_count;
+        }
+        return true;
+    }
+
+    disk_queue_drain(); /* the drive takes one command at a time */
+    if(is_write)
+        disk_write_begin(disk);
+
+    if(disk->multiple > 1)
+        cmd = is_write ? IDE_CMD_WRITE_MULTIPLE : IDE_CMD_READ_MULTIPLE;
+    else
+        cmd = is_write ? IDE_CMD_WRITE_SECTOR : IDE_CMD_READ_SECTOR;
+
     //printf("disk %d op=%s sector=%ld count=%d sectors\n",
     //        disknr, is_write?"write":"read", sector, sector_count);
 
@@ -80,33 +273,231 @@ static bool disk_data_readwrite(int disknr, void *buff, uint32_t sector, int sec
         ide_set_register(ctrl, ATA_REG_NSECT, nsect == 256 ? 0 : nsect);
 
         /* wait for device to be ready */
-        if(!ide_wait_status(ctrl, IDE_STATUS_READY))
+        if(!ide_wait_status(ctrl, IDE_STATUS_READY, disk))
             return false;
 
         /* send command */
-        ide_set_register(ctrl, ATA_REG_CMD, is_write ? IDE_CMD_WRITE_SECTOR : IDE_CMD_READ_SECTOR);
+        ide_set_register(ctrl, ATA_REG_CMD, cmd);
+        start = gogoboot_read_timer();
+        disk->stats.commands++;
+        if(is_write)
+            disk->stats.sectors_written += nsect;
+        else
+            disk->stats.sectors_read += nsect;
 
-        /* read result */
+        /* transfer data; the drive raises DRQ once per block of disk->multiple
+         * sectors (the final block of a command may be short) */
         while(nsect > 0){
-            /* unclear if we need to wait for DRQ on each sector? play it safe */
-            if(!ide_wait_status(ctrl, IDE_STATUS_DATAREQUEST))
+            if(!ide_wait_status(ctrl, IDE_STATUS_DATAREQUEST, disk))
                 return false;
-            if(is_write)
-                ide_transfer_sector_write(ctrl, buff);
-            else
-                ide_transfer_sector_read(ctrl, buff);
-            buff += 512;
-            nsect--;
+            block = (nsect < disk->multiple) ? nsect : disk->multiple;
+            nsect -= block;
+            while(block--){
+                if(is_write)
+                    ide_transfer_sector_write(ctrl, buff);
+                else
+                    ide_transfer_sector_read(ctrl, buff);
+                buff += 512;
+            }
         }
 
         if(is_write) /* wait for write operations to complete */
-            if(!ide_wait_status(ctrl, IDE_STATUS_READY))
+            if(!ide_wait_status(ctrl, IDE_STATUS_READY, disk))
                 return false;
+
+        disk->stats.latency[disk_latency_bucket(gogoboot_read_timer() - start)]++;
     }
 
     return true;
 }
 
+/* the asynchronous queue: one for all the disks, worked through in order */
+typedef enum {
+    DREQ_START,             /* program the next command */
+    DREQ_WAIT_READY,        /* ... and send it once the drive is ready */
+    DREQ_WAIT_DRQ,          /* next block of data */
+    DREQ_WAIT_DONE          /* a write command to complete */
+} disk_request_state_t;
+
+static disk_request_t *disk_queue_head = NULL, *disk_queue_tail = NULL;
+static task_t disk_queue_task;
+static bool disk_queue_task_running = false;
+
+static void disk_request_finish(disk_request_t *req, bool ok)
+{
+    disk_queue_head = req->next;
+    if(!disk_queue_head)
+        disk_queue_tail = NULL;
+    req->next = NULL;
+    req->ok = ok;
+    req->done = true;
+}
+
+/* one look at the drive for the request at the head of the queue; when it is
+ * ready for data, one DRQ block is moved */
+static void disk_queue_step(void)
+{
+    disk_request_t *req = disk_queue_head;
+    disk_t *disk;
+    disk_controller_t *ctrl;
+    uint8_t status;
+    int r, block;
+
+    if(!req)
+        return;
+
+    disk = disk_table[req->disk];
+    ctrl = disk->ctrl;
+
+    switch(req->state){
+        case DREQ_START:
+            ide_set_register(ctrl, ATA_REG_DEVICE, (((req->lba >> 24) & 0x0F) | (disk->disk == 0 ? 0xE0 : 0xF0)));
+            ide_set_register(ctrl, ATA_REG_LBAH,   ( (req->lba >> 16) & 0xFF));
+            ide_set_register(ctrl, ATA_REG_LBAM,   ( (req->lba >>  8) & 0xFF));
+            ide_set_register(ctrl, ATA_REG_LBAL,   ( (req->lba      ) & 0xFF));
+            req->cmd_left = (req->left >= 256) ? 256 : req->left;
+            req->lba += req->cmd_left;
+            ide_set_register(ctrl, ATA_REG_NSECT, req->cmd_left == 256 ? 0 : req->cmd_left);
+            req->state = DREQ_WAIT_READY;
+            req->deadline = set_timer_sec(IDE_TIMEOUT_SEC);
+            return;
+
+        case DREQ_WAIT_READY:
+        case DREQ_WAIT_DONE:
+            r = ide_poll_status(ctrl, IDE_STATUS_READY, &status);
+            break;
+
+        default:
+            r = ide_poll_status(ctrl, IDE_STATUS_DATAREQUEST, &status);
+            break;
+    }
+
+    if(r < 0){
+        disk->stats.errors++;
+        printf("disk %d: error, status=%x\n", req->disk, status);
+        disk_request_finish(req, false);
+        return;
+    }
+    if(r == 0){
+        if(timer_expired(req->deadline)){
+            disk->stats.timeouts++;
+            printf("IDE timeout, status=%x\n", status);
+            disk_request_finish(req, false);
+        }
+        return;
+    }
+
+    switch(req->state){
+        case DREQ_WAIT_READY:
+            if(disk->multiple > 1)
+                ide_set_register(ctrl, ATA_REG_CMD, req->is_write ? IDE_CMD_WRITE_MULTIPLE : IDE_CMD_READ_MULTIPLE);
+            else
+                ide_set_register(ctrl, ATA_REG_CMD, req->is_write ? IDE_CMD_WRITE_SECTOR : IDE_CMD_READ_SECTOR);
+            req->start = gogoboot_read_timer();
+            disk->stats.commands++;
+            if(req->is_write)
+                disk->stats.sectors_written += req->cmd_left;
+            else
+                disk->stats.sectors_read += req->cmd_left;
+            req->state = DREQ_WAIT_DRQ;
+            req->deadline = set_timer_sec(IDE_TIMEOUT_SEC);
+            return;
+
+        case DREQ_WAIT_DRQ:
+            block = (req->cmd_left < disk->multiple) ? req->cmd_left : disk->multiple;
+            req->cmd_left -= block;
+            req->left -= block;
+            while(block--){
+                if(req->is_write)
+                    ide_transfer_sector_write(ctrl, req->pos);
+                else
+                    ide_transfer_sector_read(ctrl, req->pos);
+                req->pos += 512;
+            }
+            req->deadline = set_timer_sec(IDE_TIMEOUT_SEC);
+            if(req->cmd_left)
+                return;
+            if(req->is_write){
+                req->state = DREQ_WAIT_DONE;
+                return;
+            }
+            break;
+
+        default: /* DREQ_WAIT_DONE */
+            break;
+    }
+
+    /* this command has finished */
+    disk->stats.latency[disk_latency_bucket(gogoboot_read_timer() - req->start)]++;
+    if(req->left)
+        req->state = DREQ_START;
+    else
+        disk_request_finish(req, true);
+}
+
+static bool disk_queue_task_step(task_t *task)
+{
+    disk_queue_step();
+    if(disk_queue_head)
+        return true;
+    disk_queue_task_running = false;
+    return false;
+}
+
+static void disk_queue_drain(void)
+{
+    while(disk_queue_head)
+        disk_queue_step();
+}
+
+void disk_submit(disk_request_t *req)
+{
+    disk_t *disk;
+
+    req->done = false;
+    req->ok = false;
+    req->next = NULL;
+
+    if(req->disk < 0 || req->disk >= disk_table_size){
+        printf("bad disk %d\n", req->disk);
+        req->done = true;
+        return;
+    }
+
+    disk = disk_table[req->disk];
+    if(disk->ram || req->count <= 0){ /* nothing to wait for */
+        req->ok = req->count <= 0 || disk_data_readwrite(req->disk, req->buff, req->sector, req->count, req->is_write);
+        req->done = true;
+        return;
+    }
+
+    if(req->is_write)
+        disk_write_begin(disk);
+
+    req->state = DREQ_START;
+    req->pos = req->buff;
+    req->lba = req->sector;
+    req->left = req->count;
+
+    if(disk_queue_tail)
+        disk_queue_tail->next = req;
+    else
+        disk_queue_head = req;
+    disk_queue_tail = req;
+
+    if(!disk_queue_task_running){
+        disk_queue_task_running = true;
+        task_start(&disk_queue_task, "disk queue", disk_queue_task_step, NULL);
+    }
+}
+
+bool disk_request_wait(disk_request_t *req)
+{
+    while(!req->done)
+        disk_queue_step();
+    return req->ok;
+}
+
 static void disk_data_read_name(const uint8_t *id, char *buffer, int offset, int len)
 {
     int rem;
@@ -129,39 +520,44 @@ static void disk_data_read_name(const uint8_t *id, char *buffer, int offset, int
     *s = 0;
 }
 
-static void disk_init_disk(disk_controller_t *ctrl, int drivenr)
+/* a new entry in the disk table, with FatFs ready to mount it; the caller
+ * fills in the rest. NULL if the table is full */
+disk_t *disk_add(void)
 {
-    uint8_t sel, buffer[512];
-    char prod[1+ATA_ID_PROD_LEN];
-    uint32_t sectors;
-
-    printf("  Probe disk %d: ", drivenr);
+    char path[4];
+    disk_t *disk;
 
-    switch(drivenr){
-        case 0: sel = 0xE0; break;
-        case 1: sel = 0xF0; break;
-        default: 
-            printf("bad disk %d?\n", drivenr);
-            return;
+    if(disk_table_size >= MAX_IDE_DISKS){
+        printf("Max disks reached\n");
+        return NULL;
     }
 
-    ide_set_register(ctrl, ATA_REG_DEVICE, sel); /* select master/slave */
+    disk = malloc(sizeof(disk_t));
+    memset(disk, 0, sizeof(disk_t));
+    disk_table = realloc(disk_table, sizeof(disk_t*) * (disk_table_size + 1));
+    disk_table[disk_table_size] = disk;
+    disk->fat_fs_status = STA_NOINIT;
+    disk->multiple = 1;
+    disk->pio_mode = -1;
 
-    /* wait for drive to be ready */
-    if(!ide_wait_status(ctrl, IDE_STATUS_READY)){
-        printf("no disk found.\n");
-        return;
-    }
+    /* prepare FatFs to talk to the volume */
+    path[0] = '0' + disk_table_size;
+    path[1] = ':';
+    path[2] = 0;
 
-    /* send identify command */
-    ide_set_register(ctrl, ATA_REG_CMD, IDE_CMD_IDENTIFY);
+    f_mount(&disk->fat_fs_workarea, path, 0); /* lazy mount */
 
-    if(!ide_wait_status(ctrl, IDE_STATUS_DATAREQUEST)){
-        printf("disk not responding.\n");
-	return;
-    }
+    disk_table_size++;
+    return disk;
+}
 
-    ide_transfer_sector_read(ctrl, buffer);
+static void disk_init_disk(disk_controller_t *ctrl, int drivenr, const uint8_t *buffer)
+{
+    char prod[1+ATA_ID_PROD_LEN];
+    uint32_t sectors;
+    int multiple, pio_mode;
+    bool write_cache, write_cache_ok;
+    disk_t *disk;
 
     /* confirm disk has LBA support */
     if(!(buffer[99] & 0x02)) {
@@ -173,7 +569,36 @@ static void disk_init_disk(disk_controller_t *ctrl, int drivenr)
     sectors = le32_to_cpu(*((uint32_t*)&buffer[ATA_ID_LBA_CAPACITY]));
     disk_data_read_name(buffer, prod,   ATA_ID_PROD,   ATA_ID_PROD_LEN);
 
-    printf("%s (%lu sectors, %lu MB)\n", prod, sectors, sectors>>11);
+    /* use the largest power-of-two READ/WRITE MULTIPLE block the drive supports */
+    multiple = buffer[ATA_ID_MAX_MULTSECT]; /* low byte of word 47 */
+    if(multiple > MAX_MULTIPLE_SECTORS)
+        multiple = MAX_MULTIPLE_SECTORS;
+    while(multiple & (multiple - 1))
+        multiple &= multiple - 1;
+    if(multiple < 1)
+        multiple = 1;
+    if(multiple > 1){
+        ide_set_register(ctrl, ATA_REG_DEVICE, drivenr == 0 ? 0xE0 : 0xF0); /* select master/slave */
+        ide_set_register(ctrl, ATA_REG_NSECT, multiple);
+        ide_set_register(ctrl, ATA_REG_CMD, IDE_CMD_SET_MULTIPLE);
+        if(!ide_wait_status(ctrl, IDE_STATUS_READY, NULL))
+            multiple = 1; /* drive rejected it; fall back to one sector per DRQ */
+    }
+
+    pio_mode = disk_init_pio_mode(ctrl, drivenr, buffer);
+    write_cache_ok = disk_write_cache_capable(buffer);
+    write_cache = write_cache_ok && ide_id_bit(buffer, ATA_ID_CFS_ENABLE_1, 5);
+    if(write_cache_ok)
+        write_cache = disk_set_write_cache(ctrl, drivenr, write_cache);
+
+    printf("%s (%lu sectors, %lu MB", prod, sectors, sectors>>11);
+    if(multiple > 1)
+        printf(", multiple %d", multiple);
+    if(pio_mode >= 0)
+        printf(", PIO %d", pio_mode);
+    if(write_cache)
+        printf(", write cache");
+    printf(")\n");
 
 #ifdef ATA_DUMP_IDENTIFY_RESULT
     for(int i=0; i<512; i+=16){
@@ -186,46 +611,190 @@ static void disk_init_disk(disk_controller_t *ctrl, int drivenr)
     }
 #endif
 
-    if(disk_table_size >= MAX_IDE_DISKS){
-        printf("Max disks reached\n");
-    }else{
-        char path[4];
-        disk_t *disk;
-
-        disk = malloc(sizeof(disk_t));
-        disk_table = realloc(disk_table, sizeof(disk_t*) * (disk_table_size + 1));
-        disk_table[disk_table_size] = disk;
-
+    disk = disk_add();
+    if(disk){
         disk->ctrl = ctrl;
         disk->disk = drivenr;
         disk->sectors = sectors;
-        disk->fat_fs_status = STA_NOINIT;
+        disk->multiple = multiple;
+        disk->pio_mode = pio_mode;
+        disk->write_cache = write_cache;
+        disk->write_cache_ok = write_cache_ok;
+        strcpy(disk->model, prod);
+    }
 
-        /* prepare FatFs to talk to the volume */
-        path[0] = '0' + disk_table_size;
-        path[1] = ':';
-        path[2] = 0;
+    return;
+}
 
-        f_mount(&disk->fat_fs_workarea, path, 0); /* lazy mount */
+/* advance the probe on one controller; returns true if it made progress */
+static bool disk_probe_step(disk_probe_t *probe)
+{
+    int r;
+
+    switch(probe->state){
+        case PROBE_SELECT:
+            ide_set_register(probe->ctrl, ATA_REG_DEVICE, probe->drivenr == 0 ? 0xE0 : 0xF0);
+            /* read alt status once to ensure we meet timing for reading status */
+            ide_get_register(probe->ctrl, ATA_REG_ALTSTATUS);
+            probe->state = PROBE_WAIT_READY;
+            return true;
+        case PROBE_WAIT_READY:
+            r = ide_poll_status(probe->ctrl, IDE_STATUS_READY, &probe->status);
+            if(r == 0)
+                return false;
+            if(r > 0){
+                ide_set_register(probe->ctrl, ATA_REG_CMD, IDE_CMD_IDENTIFY);
+                ide_get_register(probe->ctrl, ATA_REG_ALTSTATUS);
+                probe->state = PROBE_WAIT_IDENTIFY;
+                return true;
+            }
+            probe->result[probe->drivenr] = "no disk found.";
+            break;
+        case PROBE_WAIT_IDENTIFY:
+            r = ide_poll_status(probe->ctrl, IDE_STATUS_DATAREQUEST, &probe->status);
+            if(r == 0)
+                return false;
+            if(r > 0){
+                probe->identify[probe->drivenr] = malloc(512);
+                ide_transfer_sector_read(probe->ctrl, probe->identify[probe->drivenr]);
+            }else{
+                probe->result[probe->drivenr] = "disk not responding.";
+            }
+            break;
+        case PROBE_DONE:
+            return false;
+    }
+
+    /* move on to the next drive on this controller */
+    probe->drivenr++;
+    probe->state = (probe->drivenr < 2) ? PROBE_SELECT : PROBE_DONE;
+    return true;
+}
 
-        disk_table_size++;
+/* Reset all the controllers together, then probe the drives on each of them
+ * in parallel. The two drives on one controller share a register file so are
+ * probed in turn, but a slow or absent drive on one controller no longer
+ * holds up the others. It all runs as a task, so the network (DHCP, mostly)
+ * gets on with things during the reset delays and the probe. */
+typedef enum {
+    STARTUP_RESET,              /* reset asserted, wait 50ms */
+    STARTUP_SETTLE,             /* reset released, wait 200ms */
+    STARTUP_PROBE
+} disk_startup_phase_t;
+
+static struct {
+    task_t task;
+    disk_startup_phase_t phase;
+    disk_probe_t probe[MAX_PROBE_CONTROLLERS];
+    int count;
+    timer_t timer;
+} disk_startup;
+
+static void disk_startup_report(void)
+{
+    disk_probe_t *probe;
+
+    /* report and register in a fixed order, so disk numbering is stable */
+    printf("Disks:\n");
+    for(int c=0; c<disk_startup.count; c++){
+        probe = &disk_startup.probe[c];
+        for(int d=0; d<2; d++){
+            printf("  Controller %d disk %d: ", c, d);
+            if(probe->identify[d]){
+                disk_init_disk(probe->ctrl, d, probe->identify[d]);
+                free(probe->identify[d]);
+            }else if(probe->result[d]){
+                printf("%s\n", probe->result[d]);
+            }else{
+                printf("no disk found (timeout, status=%x).\n", probe->status);
+            }
+        }
     }
+}
 
-    return;
+static bool disk_startup_step(task_t *task)
+{
+    bool busy, progress;
+
+    switch(disk_startup.phase){
+        case STARTUP_RESET:
+            if(!timer_expired(disk_startup.timer))
+                return true;
+            for(int c=0; c<disk_startup.count; c++)
+                ide_set_register(disk_startup.probe[c].ctrl, ATA_REG_ALTSTATUS, 0x02); /* release reset, no interrupts */
+            disk_startup.timer = set_timer_ms(200);
+            disk_startup.phase = STARTUP_SETTLE;
+            return true;
+        case STARTUP_SETTLE:
+            if(!timer_expired(disk_startup.timer))
+                return true;
+            /* the deadline is shared, and is pushed back whenever any drive makes progress */
+            disk_startup.timer = set_timer_sec(IDE_TIMEOUT_SEC);
+            disk_startup.phase = STARTUP_PROBE;
+            return true;
+        case STARTUP_PROBE:
+            busy = progress = false;
+            for(int c=0; c<disk_startup.count; c++){
+                if(disk_probe_step(&disk_startup.probe[c]))
+                    progress = true;
+                if(disk_startup.probe[c].state != PROBE_DONE)
+                    busy = true;
+            }
+            if(progress)
+                disk_startup.timer = set_timer_sec(IDE_TIMEOUT_SEC);
+            if(busy && !timer_expired(disk_startup.timer))
+                return true;
+            break;
+    }
+
+    disk_startup_report();
+    return false;
 }
 
-void disk_controller_startup(disk_controller_t *ctrl)
+/* starts the task; disk_wait_ready() waits for it */
+void disk_controller_startup(disk_controller_t **ctrl, int count)
 {
-    /* reset attached devices */
-    ide_set_register(ctrl, ATA_REG_DEVICE, 0xE0);   /* select master */
-    ide_set_register(ctrl, ATA_REG_ALTSTATUS, 0x06); /* assert reset, no interrupts */
-    delay_ms(50);
-    ide_set_register(ctrl, ATA_REG_ALTSTATUS, 0x02); /* release reset, no interrupts */
-    delay_ms(200);
+    if(count > MAX_PROBE_CONTROLLERS)
+        count = MAX_PROBE_CONTROLLERS;
+
+    memset(&disk_startup, 0, sizeof(disk_startup));
+    disk_startup.count = count;
 
-    for(int disk=0; disk<2; disk++){
-        disk_init_disk(ctrl, disk);
+    /* reset attached devices */
+    for(int c=0; c<count; c++){
+        disk_startup.probe[c].ctrl = ctrl[c];
+        disk_startup.probe[c].state = PROBE_SELECT;
+        ide_set_register(ctrl[c], ATA_REG_DEVICE, 0xE0);   /* select master */
+        ide_set_register(ctrl[c], ATA_REG_ALTSTATUS, 0x06); /* assert reset, no interrupts */
     }
+    disk_startup.timer = set_timer_ms(50);
+    disk_startup.phase = STARTUP_RESET;
+
+    task_start(&disk_startup.task, "disk probe", disk_startup_step, NULL);
+}
+
+void disk_wait_ready(void)
+{
+    if(disk_startup.task.step) /* never started if there are no controllers */
+        task_wait(&disk_startup.task);
+}
+
+/* after the sectors under a volume were written behind FatFs's back: drop
+ * the cached copies and have FatFs read the volume afresh on next use */
+void disk_remount(int nr)
+{
+    char path[3];
+    disk_t *disk = disk_get_info(nr);
+
+    disk_cache_invalidate();
+    if(!disk)
+        return;
+
+    path[0] = '0' + nr;
+    path[1] = ':';
+    path[2] = 0;
+    f_mount(NULL, path, 0);
+    f_mount(&disk->fat_fs_workarea, path, 0); /* lazy mount */
 }
 
 int disk_get_count(void)
@@ -240,6 +809,53 @@ disk_t *disk_get_info(int nr)
     return disk_table[nr];
 }
 
+void disk_report_stats(void)
+{
+    disk_t *disk;
+    int lo, hi;
+
+    for(int nr=0; nr<disk_table_size; nr++){
+        disk = disk_table[nr];
+        if(disk->ram){
+            printf("disk %d: %s (%lu sectors at 0x%lx)\n", nr, disk->model, disk->sectors, (uint32_t)disk->ram);
+            printf("  sectors read %lu, sectors written %lu\n",
+                    disk->stats.sectors_read, disk->stats.sectors_written);
+            continue;
+        }
+        printf("disk %d: %s (%s, %lu sectors, multiple %d", nr, disk->model,
+                disk->disk == 0 ? "master" : "slave", disk->sectors, disk->multiple);
+        if(disk->pio_mode >= 0)
+            printf(", PIO %d", disk->pio_mode);
+        printf(", write cache %s)\n", disk->write_cache ? "on" : "off");
+        printf("  commands %lu, sectors read %lu, sectors written %lu, flushes %lu\n",
+                disk->stats.commands, disk->stats.sectors_read, disk->stats.sectors_written,
+                disk->stats.flushes);
+        printf("  status wait %lu ms, timeouts %lu, errors %lu\n",
+                disk->stats.wait_ticks * TIMER_MS_PER_TICK, disk->stats.timeouts, disk->stats.errors);
+        printf("  latency:");
+        for(int b=0; b<DISK_LATENCY_BUCKETS; b++){
+            lo = b ? (1 << (b-1)) : 0;
+            hi = b ? (1 << b) : 1;
+            if(b == DISK_LATENCY_BUCKETS-1)
+                printf(" %d+ms:%lu", lo * TIMER_MS_PER_TICK, disk->stats.latency[b]);
+            else
+                printf(" <%dms:%lu", hi * TIMER_MS_PER_TICK, disk->stats.latency[b]);
+        }
+        printf("\n");
+    }
+}
+
+bool disk_flush(int nr)
+{
+    bool ok = true;
+
+    for(int i=0; i<disk_table_size; i++)
+        if((nr < 0 || nr == i) && !disk_flush_one(disk_table[i]))
+            ok = false;
+
+    return ok;
+}
+
 bool disk_data_read(int disknr, void *buff, uint32_t sector, int sector_count)
 {
     return disk_data_readwrite(disknr, buff, sector, sector_count, false);
@@ -20,15 +20,24 @@
 #include <elf.h>
 #include <bootinfo.h>
 #include <net.h>
+#include <disk.h>
 #include <cpu.h>
 #include <cli.h>
 #include <init.h>
+#include <loader.h>
+#include <timers.h>
+#include <task.h>
+
+#define SECTOR_SIZE             512
+#define MAX_EXTENT_SECTORS      256     /* largest single ATA command */
+#define CLMT_INITIAL_SIZE       64      /* enough for a file in up to 31 fragments */
 
 /* bounce buffer */
 void   * loader_scratch_space = NULL;
 void   * loader_bounce_buffer_data = NULL;
 uint32_t loader_bounce_buffer_size = 0;
 uint32_t loader_bounce_buffer_target = 0;
+uint32_t loader_entry_caches_off = 0;  /* machine_execute() turns the caches off after the copy */
 
 #if defined(TARGET_MINI)
     #define EXECUTABLE_LOAD_ADDRESS 0
@@ -71,7 +80,13 @@ void execute(void *entry_vector, int argc, char **argv)
         cmdbuf[cmdoff++] = 0;
     }
 
+    boot_stage_mark("execute");
+    if(get_environment_variable("boottime"))
+        boot_stage_report();
+
     printf("Entry at 0x%lx in supervisor mode, SP 0x%lx\n", (uint32_t)entry_vector, ram_size);
+    disk_cache_sync(-1);
+    netcon_shutdown();
     uart_flush();
     eth_halt();
     cpu_interrupts_off();
@@ -82,6 +97,634 @@ void execute(void *entry_vector, int argc, char **argv)
     /* no way back */
 }
 
+/* read a range of the file with f_lseek() + f_read() */
+static FRESULT load_file_bytes(FIL *fd, char *dest, uint32_t offset, uint32_t len)
+{
+    unsigned int bytes_read;
+    FRESULT fr;
+
+    fr = f_lseek(fd, offset);
+    if(fr != FR_OK)
+        return fr;
+
+    fr = f_read(fd, dest, len, &bytes_read);
+    if(fr != FR_OK)
+        return fr;
+
+    if(bytes_read != len){
+        printf("short read (wanted %ld got %d)\n", len, bytes_read);
+        return FR_DISK_ERR;
+    }
+
+    return FR_OK;
+}
+
+/* build a FatFs cluster link map table for the file, caller frees it */
+static DWORD *load_file_build_clmt(FIL *fd)
+{
+    FATFS *fs = fd->obj.fs;
+    DWORD *clmt, need, scl;
+    FRESULT fr;
+
+    /* exFAT NoFatChain file: one run, and no FAT to walk to find it */
+    scl = f_contiguous(fd);
+    if(scl){
+        clmt = malloc(4 * sizeof(DWORD));
+        clmt[0] = 4;
+        clmt[1] = ((DWORD)((f_size(fd) + SECTOR_SIZE - 1) / SECTOR_SIZE) + fs->csize - 1) / fs->csize;
+        clmt[2] = scl;
+        clmt[3] = 0;
+        return clmt;
+    }
+
+    need = CLMT_INITIAL_SIZE;
+    clmt = malloc(need * sizeof(DWORD));
+    clmt[0] = need;
+    fd->cltbl = clmt;
+    fr = f_lseek(fd, CREATE_LINKMAP);
+    if(fr == FR_NOT_ENOUGH_CORE){ /* heavily fragmented: clmt[0] holds the size required */
+        need = clmt[0];
+        free(clmt);
+        clmt = malloc_unchecked(need * sizeof(DWORD));
+        if(clmt){
+            clmt[0] = need;
+            fd->cltbl = clmt;
+            fr = f_lseek(fd, CREATE_LINKMAP);
+        }
+    }
+    fd->cltbl = NULL;
+
+    if(fr != FR_OK || !clmt){
+        free(clmt);
+        return NULL;
+    }
+
+    return clmt;
+}
+
+/* Load a range of the file into memory. Whole sectors are read by walking the
+ * file's cluster link map (built without the FAT for a contiguous exFAT file)
+ * and issuing each contiguous extent as large disk
+ * reads, straight into the destination with no sector buffer staging. Partial
+ * sectors at either end, or files we can't map, go through f_read(). */
+static FRESULT load_file_range(FIL *fd, char *dest, uint32_t offset, uint32_t len)
+{
+    FATFS *fs = fd->obj.fs;
+    DWORD *clmt, *run;
+    uint32_t head, nsect, fsect, run_sects, lba, count, chunk;
+    disk_request_t req;
+    FRESULT fr;
+
+    /* bring the file offset up to a sector boundary */
+    head = (SECTOR_SIZE - (offset & (SECTOR_SIZE-1))) & (SECTOR_SIZE-1);
+    if(head > len)
+        head = len;
+    if(head){
+        fr = load_file_bytes(fd, dest, offset, head);
+        if(fr != FR_OK)
+            return fr;
+        dest += head;
+        offset += head;
+        len -= head;
+    }
+
+    nsect = len / SECTOR_SIZE;
+
+    /* the PIO routines store whole longwords, which a 68000 can't do to odd addresses */
+    if(nsect && !((uint32_t)dest & 3) && (clmt = load_file_build_clmt(fd))){
+        fsect = offset / SECTOR_SIZE;   /* sector index within the file */
+        /* clmt[0] is the table size, then (length, start cluster) pairs, then 0 */
+        for(run = &clmt[1]; nsect && run[0]; run += 2){
+            run_sects = run[0] * fs->csize;
+            if(fsect >= run_sects){
+                fsect -= run_sects;
+                continue;
+            }
+            lba = fs->database + ((run[1] - 2) * fs->csize) + fsect;
+            count = run_sects - fsect;
+            if(count > nsect)
+                count = nsect;
+            fsect = 0;
+            nsect -= count;
+            offset += count * SECTOR_SIZE;
+            len -= count * SECTOR_SIZE;
+            while(count){
+                chunk = (count > MAX_EXTENT_SECTORS) ? MAX_EXTENT_SECTORS : count;
+                /* queued, so the network and other tasks keep running while it reads */
+                req.disk = fs->pdrv;
+                req.buff = dest;
+                req.sector = lba;
+                req.count = chunk;
+                req.is_write = false;
+                disk_cache_submit(&req);
+                while(!req.done)
+                    task_pump();
+                if(!req.ok){
+                    free(clmt);
+                    return FR_DISK_ERR;
+                }
+                dest += chunk * SECTOR_SIZE;
+                lba += chunk;
+                count -= chunk;
+            }
+        }
+        free(clmt);
+        if(nsect){
+            printf("short read (file ends before the data)\n");
+            return FR_DISK_ERR;
+        }
+    }
+
+    /* whatever remains: a partial tail sector, or everything if we couldn't map the file */
+    if(len)
+        return load_file_bytes(fd, dest, offset, len);
+
+    return FR_OK;
+}
+
+/* with loader_timing set, how long each stage of a load took: reported just
+ * before execute(), so it covers all but the bounce copy */
+#define LOAD_TIMING_STAGES      16
+
+typedef struct {
+    const char *what;
+    int segment;                        /* program header number, or -1 */
+    uint32_t bytes;
+    timer_t ticks;
+} load_stage_t;
+
+static load_stage_t load_stage[LOAD_TIMING_STAGES];
+static int load_stages;
+static bool load_timing = false;
+static timer_t load_timing_start, load_stage_start;
+
+static void load_timing_begin(void)
+{
+    load_timing = get_environment_variable_int("loader_timing", 0);
+    load_stages = 0;
+    load_timing_start = load_stage_start = gogoboot_read_timer();
+}
+
+/* the stage that started when the last one ended is over */
+static void load_timing_stage(const char *what, int segment, uint32_t bytes)
+{
+    timer_t now;
+
+    if(!load_timing)
+        return;
+
+    now = gogoboot_read_timer();
+    if(load_stages < LOAD_TIMING_STAGES){
+        load_stage[load_stages].what = what;
+        load_stage[load_stages].segment = segment;
+        load_stage[load_stages].bytes = bytes;
+        load_stage[load_stages].ticks = now - load_stage_start;
+        load_stages++;
+    }
+    load_stage_start = now;
+}
+
+static void load_timing_report(void)
+{
+    load_stage_t *st;
+    uint32_t bytes = 0;
+
+    if(!load_timing)
+        return;
+
+    load_timing_stage("other", -1, 0);
+    printf("Loader timing (ms):\n");
+    for(int i=0; i<load_stages; i++){
+        st = &load_stage[i];
+        if(st->segment >= 0)
+            printf("  %-8s %3d", st->what, st->segment);
+        else
+            printf("  %-12s", st->what);
+        printf(" %6ld", st->ticks * TIMER_MS_PER_TICK);
+        if(st->bytes){
+            printf(" %9ld bytes", st->bytes);
+            if(st->ticks)
+                printf(" %6ld KB/s", (st->bytes / st->ticks) * TIMER_HZ / 1024);
+            bytes += st->bytes;
+        }
+        printf("\n");
+    }
+    printf("  %-12s %6ld %9ld bytes\n", "total",
+            (gogoboot_read_timer() - load_timing_start) * TIMER_MS_PER_TICK, bytes);
+    if(loader_bounce_buffer_size)
+        printf("  %-12s        %9ld bytes, copied into place after this\n", "bounce copy",
+                loader_bounce_buffer_size);
+}
+
+/* checking what we load against an expected digest. the hash covers the file
+ * as stored, and is fed from the buffers the loader has just filled, so the
+ * bytes that get loaded are read only once. those it skips are read just to
+ * hash them: small gaps (between segments) on the spot, the rest at the end. */
+#define VERIFY_GAP_MAX          (64*1024)
+#define VERIFY_CHUNK            4096
+
+typedef struct {
+    bool sha256;                        /* else CRC32 */
+    uint8_t expect[SHA256_DIGEST_SIZE];
+    uint32_t crc;
+    sha256_t sha;
+    uint32_t hashed;                    /* bytes from the start of the file hashed so far */
+    uint32_t extra;                     /* of which we read only to hash them */
+    bool failed;
+} load_verify_t;
+
+static load_verify_t load_verify_pending;
+static bool load_verify_armed = false;
+
+/* where load_data() gets its bytes from: a FatFs file, or an image already in
+ * memory. if either is compressed, offsets are into the decompressed data. */
+typedef struct {
+    FIL *fd;
+    const char *image;
+    uint32_t image_size;
+    decomp_t *dc;
+    load_verify_t *verify;
+} load_source_t;
+
+bool load_verify_expect(const char *text)
+{
+    load_verify_t *v = &load_verify_pending;
+    int digits, d;
+
+    load_verify_armed = false;
+    if(!text)
+        return true;
+
+    while(isspace(*text))
+        text++;
+
+    memset(v->expect, 0, sizeof(v->expect));
+    for(digits=0; digits < 2*SHA256_DIGEST_SIZE && isxdigit(text[digits]); digits++){
+        d = isdigit(text[digits]) ? text[digits] - '0' : tolower(text[digits]) - 'a' + 10;
+        v->expect[digits >> 1] |= d << ((digits & 1) ? 0 : 4);
+    }
+
+    if((digits != 8 && digits != 2*SHA256_DIGEST_SIZE) || (text[digits] && !isspace(text[digits]))){
+        printf("verify: want 8 (CRC32) or 64 (SHA-256) hex digits\n");
+        return false;
+    }
+
+    v->sha256 = (digits != 8);
+    load_verify_armed = true;
+    return true;
+}
+
+/* FILE.sha256 or FILE.crc32, if there is one */
+static bool load_verify_sidecar(const char *name)
+{
+    static const char * const suffix[] = { ".sha256", ".crc32" };
+    char text[80], *path;
+    unsigned int br;
+    FRESULT fr;
+    FIL fd;
+
+    for(int i=0; i<sizeof(suffix)/sizeof(suffix[0]); i++){
+        path = arena_alloc(strlen(name) + strlen(suffix[i]) + 1);
+        strcpy(path, name);
+        strcat(path, suffix[i]);
+        if(f_open(&fd, path, FA_READ) != FR_OK)
+            continue;
+        fr = f_read(&fd, text, sizeof(text)-1, &br);
+        f_close(&fd);
+        if(fr != FR_OK){
+            printf("%s: Cannot read: ", path);
+            f_perror(fr);
+            return false;
+        }
+        text[br] = 0;
+        printf("Checking against %s\n", path);
+        return load_verify_expect(text);
+    }
+
+    return true;
+}
+
+static void load_verify_hash(load_verify_t *v, const void *data, uint32_t len)
+{
+    if(v->sha256)
+        sha256_update(&v->sha, data, len);
+    else
+        v->crc = crc32_update(v->crc, data, len);
+    v->hashed += len;
+}
+
+/* read and hash the bytes up to offset upto, which the loader did not want */
+static bool load_verify_catch_up(load_source_t *src, uint32_t upto)
+{
+    load_verify_t *v = src->verify;
+    arena_mark_t mark;
+    char *buffer;
+    uint32_t len;
+
+    if(v->hashed >= upto)
+        return true;
+
+    v->extra += upto - v->hashed;
+    if(!src->fd){
+        load_verify_hash(v, src->image + v->hashed, upto - v->hashed);
+        return true;
+    }
+
+    mark = arena_mark();
+    buffer = arena_alloc(VERIFY_CHUNK);
+    while(v->hashed < upto){
+        len = upto - v->hashed;
+        if(len > VERIFY_CHUNK)
+            len = VERIFY_CHUNK;
+        if(load_file_bytes(src->fd, buffer, v->hashed, len) != FR_OK){
+            arena_release(mark);
+            return false;
+        }
+        load_verify_hash(v, buffer, len);
+    }
+    arena_release(mark);
+
+    return true;
+}
+
+/* bytes [offset, offset+len) of the file have just been read into data */
+static void load_verify_data(void *context, uint32_t offset, const void *data, uint32_t len)
+{
+    load_source_t *src = context;
+    load_verify_t *v = src->verify;
+    uint32_t skip;
+
+    if(offset > v->hashed){
+        if(offset - v->hashed > VERIFY_GAP_MAX)
+            return; /* we will come back for it at the end */
+        if(!load_verify_catch_up(src, offset)){
+            v->failed = true;
+            return;
+        }
+    }
+
+    if(offset + len <= v->hashed)
+        return; /* seen it */
+
+    skip = v->hashed - offset;
+    load_verify_hash(v, (const char*)data + skip, len - skip);
+}
+
+/* true if the whole file matched the digest, or there was nothing to check */
+static bool load_source_verified(load_source_t *src)
+{
+    load_verify_t *v = src->verify;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    const char *name;
+    bool match;
+
+    if(!v)
+        return true;
+
+    name = v->sha256 ? "SHA-256" : "CRC32";
+    if(v->failed || !load_verify_catch_up(src, src->fd ? f_size(src->fd) : src->image_size)){
+        printf("Cannot read the image to check its %s\n", name);
+        return false;
+    }
+
+    if(v->sha256){
+        sha256_final(&v->sha, digest);
+        match = !memcmp(digest, v->expect, SHA256_DIGEST_SIZE);
+    }else
+        match = v->crc == (((uint32_t)v->expect[0] << 24) | ((uint32_t)v->expect[1] << 16) |
+                           (v->expect[2] << 8) | v->expect[3]);
+
+    if(!match){
+        printf("%s mismatch: the image is corrupt, not running it\n", name);
+        return false;
+    }
+
+    printf("%s matches (%ld of %ld bytes read only to check)\n", name, v->extra, v->hashed);
+    return true;
+}
+
+static FRESULT load_source_range(load_source_t *src, char *dest, uint32_t offset, uint32_t len)
+{
+    FRESULT fr;
+
+    if(src->dc)
+        return decomp_read(src->dc, dest, offset, len);
+
+    if(src->fd)
+        fr = load_file_range(src->fd, dest, offset, len);
+    else if(offset > src->image_size || len > src->image_size - offset){
+        printf("short read (image ends before the data)\n");
+        return FR_DISK_ERR;
+    }else{
+        memcpy(dest, src->image + offset, len);
+        fr = FR_OK;
+    }
+
+    if(fr == FR_OK && src->verify)
+        load_verify_data(src, offset, dest, len);
+    return fr;
+}
+
+static uint32_t load_source_size(load_source_t *src)
+{
+    if(src->dc)
+        return decomp_size(src->dc);
+    return src->fd ? f_size(src->fd) : src->image_size;
+}
+
+/* a gzip or LZ4 compressed source is read through a decompressor, and if we
+ * have a digest for it the loads are checked against that */
+static bool load_source_open(load_source_t *src, const char *name)
+{
+    char magic[4];
+    const char *format;
+
+    src->dc = NULL;
+    src->verify = NULL;
+    if(!load_verify_armed && src->fd && name && !load_verify_sidecar(name))
+        return false;
+    if(load_verify_armed){
+        load_verify_armed = false;
+        src->verify = arena_alloc(sizeof(load_verify_t));
+        *src->verify = load_verify_pending;
+        src->verify->crc = 0;
+        sha256_init(&src->verify->sha);
+        src->verify->hashed = src->verify->extra = 0;
+        src->verify->failed = false;
+    }
+
+    if((src->fd ? f_size(src->fd) : src->image_size) < sizeof(magic))
+        return true;
+    if(load_source_range(src, magic, 0, sizeof(magic)) != FR_OK)
+        return false;
+
+    format = decomp_detect(magic, sizeof(magic));
+    if(!format)
+        return true;
+
+    src->dc = decomp_open(src->fd, src->image, src->image_size);
+    if(!src->dc)
+        return false;
+    if(src->verify)
+        decomp_observe(src->dc, load_verify_data, src);
+
+    printf("Decompressing %s data as it loads\n", format);
+    return true;
+}
+
+static void load_source_close(load_source_t *src)
+{
+    decomp_close(src->dc);
+    src->dc = NULL;
+}
+
+/* with image_cache set, what the last ELF load put where goes in a descriptor
+ * that startup does not clear. if we are reset and asked to load the same
+ * file again, and the memory its read-only segments went into still checks
+ * out, we use them as they are instead of reading them all over again. the
+ * writable segments are loaded every time: the program ran since, so its
+ * .data and .bss are not what the file says, even if the CRC could not tell. */
+#define RESIDENT_MAGIC          0x52455349      /* "RESI" */
+#define RESIDENT_SEGMENTS       8
+#define RESIDENT_PROBES         32
+
+typedef struct {
+    uint32_t base;
+    uint32_t size;
+} resident_segment_t;
+
+typedef struct {
+    uint32_t magic;
+    char name[64];
+    uint32_t file_size;
+    uint16_t fdate, ftime;
+    uint32_t headers_crc;               /* of the program headers */
+    uint32_t load_offset;
+    int segments;
+    resident_segment_t segment[RESIDENT_SEGMENTS];
+    uint32_t image_crc;                 /* of the segments, once loaded */
+    /* at startup measure_ram_size() writes a longword at the end of each unit
+     * of RAM; these are what was there before it did */
+    int probes;
+    struct {
+        uint32_t *address;
+        uint32_t value;
+    } probe[RESIDENT_PROBES];
+    uint32_t crc;                       /* of all the above */
+} resident_image_t;
+
+static resident_image_t resident_image __attribute__((section(".noinit")));
+
+static uint32_t resident_descriptor_crc(void)
+{
+    return crc32_update(0, &resident_image, (char*)&resident_image.crc - (char*)&resident_image);
+}
+
+static uint32_t resident_segments_crc(void)
+{
+    uint32_t crc = 0;
+
+    for(int i=0; i<resident_image.segments; i++)
+        crc = crc32_update(crc, (void*)resident_image.segment[i].base, resident_image.segment[i].size);
+    return crc;
+}
+
+/* the file, its program headers and where they go, as the descriptor has them */
+static bool resident_describe(resident_image_t *r, load_source_t *src, const char *name,
+        const void *proghead_data, int proghead_size, int phentsize, int phnum, uint32_t load_offset)
+{
+    const elf32_program_header *proghead;
+    FILINFO fno;
+
+    if(!src->fd || !name || strlen(name) >= sizeof(r->name) || f_stat(name, &fno) != FR_OK)
+        return false;
+
+    memset(r, 0, sizeof(*r));
+    strcpy(r->name, name);
+    r->file_size = f_size(src->fd);
+    r->fdate = fno.fdate;
+    r->ftime = fno.ftime;
+    r->headers_crc = crc32_update(0, proghead_data, proghead_size);
+    r->load_offset = load_offset;
+
+    for(int i=0; i<phnum; i++){
+        proghead = (const elf32_program_header*)((const char*)proghead_data + i * phentsize);
+        if(proghead->type != PT_LOAD || !proghead->memsz || (proghead->flags & PF_W))
+            continue;
+        if(r->segments == RESIDENT_SEGMENTS)
+            return false;
+        r->segment[r->segments].base = proghead->paddr + load_offset;
+        r->segment[r->segments].size = proghead->memsz;
+        r->segments++;
+    }
+
+    return r->segments > 0; /* all writable: nothing we could keep */
+}
+
+/* true if the image described is in memory already, just as we left it */
+static bool resident_check(load_source_t *src, const char *name, const void *proghead_data,
+        int proghead_size, int phentsize, int phnum, uint32_t load_offset)
+{
+    resident_image_t want;
+
+    if(!get_environment_variable("image_cache"))
+        return false;
+
+    if(resident_image.magic != RESIDENT_MAGIC || resident_image.crc != resident_descriptor_crc() ||
+       !resident_describe(&want, src, name, proghead_data, proghead_size, phentsize, phnum, load_offset) ||
+       strcmp(want.name, resident_image.name) || want.file_size != resident_image.file_size ||
+       want.fdate != resident_image.fdate || want.ftime != resident_image.ftime ||
+       want.headers_crc != resident_image.headers_crc || want.load_offset != resident_image.load_offset){
+        resident_image.magic = 0;
+        return false;
+    }
+
+    /* we are loading it over again whatever happens next */
+    resident_image.magic = 0;
+
+    for(int i=0; i<resident_image.probes; i++)
+        *resident_image.probe[i].address = resident_image.probe[i].value;
+
+    if(resident_segments_crc() != resident_image.image_crc){
+        printf("Image cache: \"%s\" is in memory but has changed since, loading it again\n", name);
+        return false;
+    }
+
+    printf("Image cache: \"%s\" is still in memory, loading only its writable segments\n", name);
+    return true;
+}
+
+/* note what we have just loaded, for next time */
+static void resident_record(load_source_t *src, const char *name, const void *proghead_data,
+        int proghead_size, int phentsize, int phnum, uint32_t load_offset)
+{
+    uint32_t unit_size = mem_get_granularity();
+    uint32_t *address;
+
+    if(!get_environment_variable("image_cache"))
+        return;
+
+    if(!resident_describe(&resident_image, src, name, proghead_data, proghead_size, phentsize, phnum, load_offset))
+        return;
+
+    for(uint32_t unit=1; unit <= ram_size / unit_size; unit++){
+        address = (uint32_t*)(unit * unit_size - sizeof(uint32_t));
+        for(int i=0; i<resident_image.segments; i++)
+            if((uint32_t)address >= resident_image.segment[i].base &&
+               (uint32_t)address - resident_image.segment[i].base < resident_image.segment[i].size){
+                if(resident_image.probes == RESIDENT_PROBES)
+                    return; /* cannot put it all back */
+                resident_image.probe[resident_image.probes].address = address;
+                resident_image.probe[resident_image.probes].value = *address;
+                resident_image.probes++;
+            }
+    }
+
+    resident_image.image_crc = resident_segments_crc();
+    resident_image.magic = RESIDENT_MAGIC;
+    resident_image.crc = resident_descriptor_crc();
+}
+
 static void bounce_expand(uint32_t paddr, uint32_t bounce_size)
 {
     if(loader_bounce_buffer_data){
@@ -112,7 +755,7 @@ static void bounce_expand(uint32_t paddr, uint32_t bounce_size)
             loader_bounce_buffer_size = newsize;
         }
     }else{
-        loader_scratch_space = malloc(128); /* space to hold the copying routine -- typically ~32 bytes */
+        loader_scratch_space = malloc(256); /* space to hold the copying routine -- typically ~100 bytes */
         // this gives us a buffer that is word aligned and a whole number of words long
         loader_bounce_buffer_target = paddr & ~3;
         loader_bounce_buffer_size = (bounce_size + (paddr & 3) +3) & ~3;
@@ -120,9 +763,60 @@ static void bounce_expand(uint32_t paddr, uint32_t bounce_size)
     }
 }
 
-FRESULT load_data(FIL *fd, uint32_t paddr, uint32_t offset, uint32_t file_size, uint32_t size)
+/* Prepare [paddr, paddr+size) to be written piecemeal by load_target_write() or
+ * through load_target_pointer(), applying the same checks as load_data() */
+bool load_target_prepare(uint32_t paddr, uint32_t size)
+{
+    const char *load_err;
+    uint32_t bounce_size;
+
+    load_err = check_writable_range(paddr, size, true);
+    if(load_err){
+        printf("Abort: address range error: %s\n", load_err);
+        return false;
+    }
+
+    if(size && paddr < bounce_below_addr){
+        bounce_size = bounce_below_addr - paddr;
+        if(bounce_size > size)
+            bounce_size = size;
+        bounce_expand(paddr, bounce_size);
+    }
+
+    return true;
+}
+
+/* where data for a prepared target range really goes; NULL if it straddles the bounce buffer limit */
+void *load_target_pointer(uint32_t paddr, uint32_t len)
+{
+    if(paddr >= bounce_below_addr)
+        return (void*)paddr;
+
+    if(paddr + len > bounce_below_addr || !loader_bounce_buffer_data ||
+       paddr < loader_bounce_buffer_target ||
+       paddr + len > loader_bounce_buffer_target + loader_bounce_buffer_size)
+        return NULL;
+
+    return (char*)loader_bounce_buffer_data + (paddr - loader_bounce_buffer_target);
+}
+
+void load_target_write(uint32_t paddr, const void *data, uint32_t len)
+{
+    uint32_t bounce_len = 0;
+
+    if(paddr < bounce_below_addr){
+        bounce_len = bounce_below_addr - paddr;
+        if(bounce_len > len)
+            bounce_len = len;
+        memcpy(load_target_pointer(paddr, bounce_len), data, bounce_len);
+    }
+
+    if(len > bounce_len)
+        memcpy((char*)paddr + bounce_len, (const char*)data + bounce_len, len - bounce_len);
+}
+
+static FRESULT load_source_data(load_source_t *src, uint32_t paddr, uint32_t offset, uint32_t file_size, uint32_t size)
 {
-    unsigned int bytes_read;
     int bounce_addr;
     uint32_t bounce_size, direct_size;
     uint32_t load_size, pad_size;
@@ -179,19 +873,10 @@ FRESULT load_data(FIL *fd, uint32_t paddr, uint32_t offset, uint32_t file_size,
                 offset, (uint32_t)loader_bounce_buffer_data + bounce_addr, paddr);
 
         if(load_size){
-            fr = f_lseek(fd, offset);
-            if(fr != FR_OK)
-                return fr;
-
-            fr = f_read(fd, (char*)loader_bounce_buffer_data + bounce_addr, load_size, &bytes_read);
+            fr = load_source_range(src, (char*)loader_bounce_buffer_data + bounce_addr, offset, load_size);
             if(fr != FR_OK)
                 return fr;
 
-            if(bytes_read != load_size){
-                printf("short read (wanted %ld got %d)\n", load_size, bytes_read);
-                return FR_DISK_ERR;
-            }
-
             /* IMPORTANT: reduce remaining file_size here, for direct loading routine */
             file_size -= load_size;
         }
@@ -200,6 +885,13 @@ FRESULT load_data(FIL *fd, uint32_t paddr, uint32_t offset, uint32_t file_size,
             memset((char*)loader_bounce_buffer_data + bounce_addr + load_size, 0, pad_size);
     }
 
+    /* copying from an image in memory: it must survive until we have finished with it */
+    if(src->image && direct_size && paddr + bounce_size < (uint32_t)src->image + src->image_size &&
+       (uint32_t)src->image < paddr + size){
+        printf("Abort: load address range overlaps the image at 0x%lx\n", (uint32_t)src->image);
+        return FR_DISK_ERR;
+    }
+
     if(direct_size){
         load_size = direct_size;
         if(load_size > file_size){ /* file_size may have been reduced during the bounce buffer loading */
@@ -217,18 +909,10 @@ FRESULT load_data(FIL *fd, uint32_t paddr, uint32_t offset, uint32_t file_size,
             printf(" from file offset 0x%lx to memory at 0x%lx\n", 
                     offset+bounce_size, paddr+bounce_size);
 
-            fr = f_lseek(fd, offset+bounce_size);
+            fr = load_source_range(src, (char*)paddr+bounce_size, offset+bounce_size, load_size);
             if(fr != FR_OK)
                 return fr;
 
-            fr = f_read(fd, (char*)paddr+bounce_size, load_size, &bytes_read);
-            if(fr != FR_OK)
-                return fr;
-            if(bytes_read != load_size){
-                printf("short read (wanted %ld got %d)\n", load_size, bytes_read);
-                return FR_DISK_ERR;
-            }
-
             file_size -= load_size;
         }
         if(pad_size)
@@ -241,7 +925,14 @@ FRESULT load_data(FIL *fd, uint32_t paddr, uint32_t offset, uint32_t file_size,
     return FR_OK;
 }
 
-bool load_m68k_executable(char *argv[], int argc, FIL *fd)
+FRESULT load_data(FIL *fd, uint32_t paddr, uint32_t offset, uint32_t file_size, uint32_t size)
+{
+    load_source_t src = { .fd = fd };
+
+    return load_source_data(&src, paddr, offset, file_size, size);
+}
+
+static bool load_m68k_source(char *argv[], int argc, load_source_t *src)
 {
     // TODO choose a better load address
     // On Q40 SMSQ/E does not like being loaded at 256KB. 2048KB seems fine. Maybe it copies itself downwards?
@@ -250,12 +941,17 @@ bool load_m68k_executable(char *argv[], int argc, FIL *fd)
     uint32_t load_address = 2048*1024; 
     FRESULT fr;
 
-    fr = load_data(fd, load_address, 0, f_size(fd), f_size(fd));
+    fr = load_source_data(src, load_address, 0, load_source_size(src), load_source_size(src));
     if(fr != FR_OK){
         printf("%s: Cannot load: ", argv[0]);
         f_perror(fr);
         return false;
     }
+    load_timing_stage("image", -1, load_source_size(src));
+
+    if(!load_source_verified(src))
+        return false;
+    load_timing_stage("verify", -1, 0);
 
     /* remove program name from command line */
     if(argc > 0){
@@ -263,30 +959,59 @@ bool load_m68k_executable(char *argv[], int argc, FIL *fd)
         argv++;
     }
 
+    load_timing_report();
     execute((void*)load_address, argc, argv);
     return true; /* unlikely we will return ... */
 }
 
-bool load_elf_executable(char *argv[], int argc, FIL *fd)
+#ifdef MACH_THIS
+/* where an initrd of this size can go: at the top of the RAM we share, just
+ * below the heap, which is where Linux likes it best and furthest from the
+ * kernel. failing that, the start of another RAM region. 0 if it fits
+ * nowhere. kernel_end is where the rest of the bootinfo is written. */
+static uint32_t loader_place_initrd(uint32_t kernel_end, uint32_t size)
+{
+    uint32_t top = free_ram_top;
+    uint32_t lowest = ((kernel_end + 0xfff) & ~0xfff) + 0x1000;
+    const mem_region_t *best = NULL;
+    uint32_t addr;
+
+    if(size <= top){
+        addr = (top - size) & ~0xfff;
+        if(addr >= lowest && !check_writable_range(addr, size, false))
+            return addr;
+    }
+
+    for(int r=0; r<mem_region_count; r++)
+        if(mem_region[r].type == mem_ram && mem_region[r].base != 0 && mem_region[r].size >= size &&
+           (!best || mem_region[r].size > best->size))
+            best = &mem_region[r];
+
+    return best ? best->base : 0;
+}
+#endif
+
+static bool load_elf_source(char *argv[], int argc, load_source_t *src)
 {
     int proghead_num;
-    unsigned int bytes_read;
     elf32_header header;
     const char *load_err;
     void *proghead_data = NULL;
     elf32_program_header *proghead = NULL;
 #ifdef MACH_THIS
+    timer_t initrd_start;
+    FRESULT fr;
     struct bootversion *bootver;
     struct bi_record *bootinfo;
     struct mem_info *meminfo;
 #endif
     bool failed = false;
+    bool cacheable, resident;
     uint32_t max_load_addr = 0;
     uint32_t min_load_addr = ~0;
     uint32_t load_offset = 0;
 
-    f_lseek(fd, 0);
-    if(f_read(fd, &header, sizeof(header), &bytes_read) != FR_OK || bytes_read != sizeof(header)){
+    if(load_source_range(src, (char*)&header, 0, sizeof(header)) != FR_OK){
         printf("Cannot read ELF file header\n");
         return false;
     }
@@ -318,11 +1043,9 @@ bool load_elf_executable(char *argv[], int argc, FIL *fd)
         return false;
     }
 
-    proghead_data = malloc(header.phentsize * header.phnum);
-    if(f_lseek(fd, header.phoff) != FR_OK ||
-       f_read(fd, proghead_data, header.phentsize * header.phnum, NULL) != FR_OK){
+    proghead_data = arena_alloc(header.phentsize * header.phnum);
+    if(load_source_range(src, proghead_data, header.phoff, header.phentsize * header.phnum) != FR_OK){
         printf("Cannot read ELF program headers.\n");
-        free(proghead_data);
         return false;
     }
 
@@ -354,10 +1077,8 @@ bool load_elf_executable(char *argv[], int argc, FIL *fd)
         }
     }
 
-    if(failed){
-        free(proghead_data);
+    if(failed)
         return false;
-    }
 
     printf("Load address range 0x%lx -- 0x%lx\n", min_load_addr, max_load_addr);
 
@@ -379,30 +1100,48 @@ bool load_elf_executable(char *argv[], int argc, FIL *fd)
         failed = true;
     }
 
-    if(failed){
-        free(proghead_data);
+    if(failed)
         return false;
-    }
+    load_timing_stage("headers", -1, sizeof(header) + header.phentsize * header.phnum);
+
+    /* anything loaded through the bounce buffer is not where it will run yet */
+    cacheable = min_load_addr >= bounce_below_addr;
+    resident = cacheable && resident_check(src, argv[0], proghead_data,
+            header.phentsize * header.phnum, header.phentsize, header.phnum, load_offset);
+    if(resident)
+        load_timing_stage("resident", -1, max_load_addr - min_load_addr);
+
+    /* size the bounce buffer for all the segments at once; growing it a segment
+     * at a time means a realloc() and, growing downwards, moving what it holds */
+    if(min_load_addr < bounce_below_addr)
+        bounce_expand(min_load_addr, (max_load_addr < bounce_below_addr ?
+                    max_load_addr : bounce_below_addr) - min_load_addr);
 
     // second pass: do the actual loading
     for(proghead_num=0; !failed && proghead_num < header.phnum; proghead_num++){
         proghead = (elf32_program_header*)(proghead_data + proghead_num * header.phentsize);
         switch(proghead->type){
             case PT_LOAD:
-                if(load_data(fd, load_offset + proghead->paddr, proghead->offset, proghead->filesz, proghead->memsz) != FR_OK){
+                if(resident && !(proghead->flags & PF_W))
+                    break; /* still in memory; fresh .data and .bss all the same */
+                if(load_source_data(src, load_offset + proghead->paddr, proghead->offset, proghead->filesz, proghead->memsz) != FR_OK){
                     printf("Unable to load segment from ELF file.\n");
                     failed = true;
-                }                
+                }
+                load_timing_stage("segment", proghead_num, proghead->filesz);
                 break;
             default:
                 break;
         }
     }
 
-    free(proghead_data);
-    proghead_data = NULL;
-    if(failed)
+    if(failed || (!resident && !load_source_verified(src)))
         return false;
+    if(src->verify && !resident)
+        load_timing_stage("verify", -1, 0);
+    if(cacheable && !resident)
+        resident_record(src, argv[0], proghead_data,
+                header.phentsize * header.phnum, header.phentsize, header.phnum, load_offset);
 
 #ifdef MACH_THIS
     /* check for linux kernel magic number at lowest load address */
@@ -473,25 +1212,30 @@ bool load_elf_executable(char *argv[], int argc, FIL *fd)
         bootinfo->size = sizeof(struct bi_record) + sizeof(long);
         bootinfo = (struct bi_record*)(((char*)bootinfo) + bootinfo->size);
 
-        /* RAM location and size */
-        bootinfo->tag = BI_MEMCHUNK;
-        bootinfo->size = sizeof(struct bi_record) + sizeof(struct mem_info);
-        meminfo = (struct mem_info*)bootinfo->data;
-#if defined(TARGET_KISS)
-        meminfo->addr = 0;
-        meminfo->size = (unsigned long)ram_size;
-#endif
+        /* RAM location and size: one chunk per RAM region */
+        int memchunks = 0;
+        for(int r=0; r<mem_region_count; r++){
+            if(mem_region[r].type != mem_ram)
+                continue;
+            if(memchunks == BI_MAX_MEMCHUNKS){
+                printf("WARNING: kernel is told about only %d RAM regions\n", BI_MAX_MEMCHUNKS);
+                break;
+            }
+            bootinfo->tag = BI_MEMCHUNK;
+            bootinfo->size = sizeof(struct bi_record) + sizeof(struct mem_info);
+            meminfo = (struct mem_info*)bootinfo->data;
+            meminfo->addr = mem_region[r].base;
+            meminfo->size = mem_region[r].size;
 #if defined(TARGET_Q40)
-        // we need to make sure our RAM starts on a multiple of 256KB it seems
-        meminfo->addr = (unsigned long)EXECUTABLE_LOAD_ADDRESS;
-        if(ram_size > 32*1024*1024){
-            printf("WARNING: load_elf_executable needs modification to support >32MB RAM on Q40\n");
-            printf("WARNING: limiting BI_MEMCHUNK to 32MB\n");
-            meminfo->size = (unsigned long)(32*1024*1024 - EXECUTABLE_LOAD_ADDRESS);
-        }else
-            meminfo->size = (unsigned long)(ram_size - EXECUTABLE_LOAD_ADDRESS);
+            // we need to make sure our RAM starts on a multiple of 256KB it seems
+            if(mem_region[r].base == 0){
+                meminfo->addr = (unsigned long)EXECUTABLE_LOAD_ADDRESS;
+                meminfo->size = (unsigned long)(ram_size - EXECUTABLE_LOAD_ADDRESS);
+            }
 #endif
-        bootinfo = (struct bi_record*)(((char*)bootinfo) + bootinfo->size);
+            bootinfo = (struct bi_record*)(((char*)bootinfo) + bootinfo->size);
+            memchunks++;
+        }
 
         /* Now let's process the user-provided command line */
 #define MAXCMDLEN 200
@@ -520,24 +1264,51 @@ bool load_elf_executable(char *argv[], int argc, FIL *fd)
         /* knobble argc so that we do not recombine it inside execute() */
         argc = 0;
 
+        load_timing_stage("bootinfo", -1, 0);
+
         /* check for initrd */
         FIL initrd;
         if(initrd_name && (f_open(&initrd, initrd_name, FA_READ) == FR_OK)){
+            /* a compressed initrd is expanded into place; the kernel gets it ready to use */
+            load_source_t initrd_src = { .fd = &initrd };
             bootinfo->tag = BI_RAMDISK;
             bootinfo->size = sizeof(struct bi_record) + sizeof(struct mem_info);
             meminfo = (struct mem_info*)bootinfo->data;
-            /* we need to locate the initrd some distance above the kernel -- 1MB should be enough? */
-            meminfo->addr = ((((unsigned long)bootinfo) + 0xfff) & ~0xfff) + 0x100000;
-            meminfo->size = f_size(&initrd);
+            if(!load_source_open(&initrd_src, initrd_name) || !(meminfo->size = load_source_size(&initrd_src))){
+                printf("Unable to load initrd.\n");
+                load_source_close(&initrd_src);
+                f_close(&initrd);
+                return false;
+            }
+            meminfo->addr = loader_place_initrd((uint32_t)bootinfo, meminfo->size);
+            if(!meminfo->addr){
+                printf("Unable to load initrd: %ld bytes will not fit in any RAM region\n", meminfo->size);
+                load_source_close(&initrd_src);
+                f_close(&initrd);
+                return false;
+            }
             printf("Loading initrd \"%s\": %ld bytes at 0x%lx\n", initrd_name, meminfo->size, meminfo->addr);
-            if(f_read(&initrd, (char*)meminfo->addr, meminfo->size, &bytes_read) != FR_OK || 
-                    bytes_read != meminfo->size){
+            initrd_start = gogoboot_read_timer();
+            fr = load_source_range(&initrd_src, (char*)meminfo->addr, 0, meminfo->size);
+            if(fr == FR_OK){
+                initrd_start = gogoboot_read_timer() - initrd_start;
+                printf("Loaded initrd in %ld ms", initrd_start * TIMER_MS_PER_TICK);
+                if(initrd_start)
+                    printf(" (%ld KB/s)", (meminfo->size / initrd_start) * TIMER_HZ / 1024);
+                printf("\n");
+            }
+            if(fr == FR_OK && !load_source_verified(&initrd_src))
+                fr = FR_INT_ERR;
+            load_source_close(&initrd_src);
+            if(fr != FR_OK){
                 printf("Unable to load initrd.\n");
+                f_close(&initrd);
                 return false;
             }else{
                 bootinfo = (struct bi_record*)(((char*)bootinfo) + bootinfo->size);
             }
             f_close(&initrd);
+            load_timing_stage("initrd", -1, meminfo->size);
         }else if(initrd_name){
             printf("Unable to open \"%s\": No initrd.\n", initrd_name);
             return false;
@@ -551,8 +1322,10 @@ bool load_elf_executable(char *argv[], int argc, FIL *fd)
          * - interrupts disabled
          * - CPU cache disabled
          * - CPU in supervisor mode
+         * the caches stay on while machine_execute() copies the bounce buffer
+         * into place, it turns them off just before the jump.
          */
-        cpu_cache_disable();
+        loader_entry_caches_off = 1;
         cpu_interrupts_off();
     }else{
         /* could bail here if load offset was applied */
@@ -564,8 +1337,61 @@ bool load_elf_executable(char *argv[], int argc, FIL *fd)
             argc--;
             argv++;
         }
+        load_timing_report();
         execute((void*)(header.entry + load_offset), argc, argv);
     }
 
     return true;
 }
+
+bool load_m68k_executable(char *argv[], int argc, FIL *fd)
+{
+    load_source_t src = { .fd = fd };
+    bool r;
+
+    load_timing_begin();
+    if(!load_source_open(&src, argv[0]))
+        return false;
+    r = load_m68k_source(argv, argc, &src);
+    load_source_close(&src);
+    return r;
+}
+
+bool load_elf_executable(char *argv[], int argc, FIL *fd)
+{
+    load_source_t src = { .fd = fd };
+    bool r;
+
+    load_timing_begin();
+    if(!load_source_open(&src, argv[0]))
+        return false;
+    r = load_elf_source(argv, argc, &src);
+    load_source_close(&src);
+    return r;
+}
+
+bool load_m68k_image(char *argv[], int argc, const void *image, uint32_t size)
+{
+    load_source_t src = { .image = image, .image_size = size };
+    bool r;
+
+    load_timing_begin();
+    if(!load_source_open(&src, argv[0]))
+        return false;
+    r = load_m68k_source(argv, argc, &src);
+    load_source_close(&src);
+    return r;
+}
+
+bool load_elf_image(char *argv[], int argc, const void *image, uint32_t size)
+{
+    load_source_t src = { .image = image, .image_size = size };
+    bool r;
+
+    load_timing_begin();
+    if(!load_source_open(&src, argv[0]))
+        return false;
+    r = load_elf_source(argv, argc, &src);
+    load_source_close(&src);
+    return r;
+}
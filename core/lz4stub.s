@@ -0,0 +1,101 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+/* ROM stub for the compressed images (gogoboot-*-lz4.rom). The ROM holds this
+   and an LZ4 block of the RAM-linked image (tools/lz4pack). At reset it
+   unpacks the image into RAM at address 0, where the image is linked, and
+   jumps to its _start, so everything after this runs from RAM.
+
+   Built by the Makefile with the block at <target>/payload.lz4, found through
+   -I, and the image's entry point in PAYLOAD_ENTRY. 68000 safe: byte moves
+   only, no stack. Only for programming into ROM: a copy loaded into low RAM
+   would be overwritten as it runs. */
+
+        .ifdef TARGET_KISS
+        .include "core/cpu-68030-bits.s"
+        .include "kiss/kisshw.s"
+ROM_BASE = KISS68030_ROM_BASE
+        .endif
+        .ifdef TARGET_MINI
+        .include "mini/minihw.s"
+ROM_BASE = MINI68K_ROM_BASE
+        .endif
+
+        /* LZ4 length extension: add bytes to \reg until one is not 255 */
+        .macro  more_length reg
+1:      moveq   #0, %d2
+        move.b  (%a0)+, %d2
+        add.l   %d2, \reg
+        not.b   %d2
+        beq.s   1b
+        .endm
+
+        .text
+stub_start:
+        /* initial SP: actually a relative jump, as in the uncompressed ROMs */
+        bra.w   unpack
+        /* initial PC - ROM address of hwreset */
+        dc.l    hwreset - stub_start + ROM_BASE
+
+hwreset:
+        reset
+unpack:
+        move.w  #0x2700, %sr            /* interrupts off */
+        lea.l   %pc@(payload), %a0      /* source */
+        lea.l   %pc@(payload_end), %a2
+        suba.l  %a1, %a1                /* destination: RAM at 0 */
+
+next_sequence:
+        moveq   #0, %d0
+        move.b  (%a0)+, %d0             /* token: literals << 4 | match length - 4 */
+        move.l  %d0, %d1
+        lsr.w   #4, %d1
+        cmp.w   #15, %d1
+        bne.s   copy_literals
+        more_length %d1
+copy_literals:
+        bra.s   2f
+1:      move.b  (%a0)+, (%a1)+
+2:      subq.l  #1, %d1
+        bcc.s   1b
+
+        cmpa.l  %a2, %a0
+        bcc.s   unpacked                /* the last sequence is literals only */
+
+        moveq   #0, %d1                 /* match offset, little endian */
+        moveq   #0, %d2
+        move.b  (%a0)+, %d2
+        move.b  (%a0)+, %d1
+        lsl.w   #8, %d1
+        or.w    %d1, %d2
+        movea.l %a1, %a3
+        suba.l  %d2, %a3
+
+        moveq   #15, %d1
+        and.w   %d0, %d1
+        cmp.w   #15, %d1
+        bne.s   copy_match
+        more_length %d1
+copy_match:
+        addq.l  #3, %d1                 /* copies d1 + 1: 4 at least, may overlap */
+1:      move.b  (%a3)+, (%a1)+
+        subq.l  #1, %d1
+        bcc.s   1b
+        bra.s   next_sequence
+
+unpacked:
+        .ifdef TARGET_KISS
+        /* nothing cached may survive over the new image */
+        move.l  #(CACR_CI + CACR_CD), %d0
+        movec.l %d0, %cacr
+        nop
+        .endif
+        movea.l #PAYLOAD_ENTRY, %a0
+        jmp     (%a0)
+
+        .even
+payload:
+        .incbin "payload.lz4"
+payload_end:
+        .even
+
+        .end
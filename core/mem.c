@@ -2,57 +2,62 @@
 
 #include <stdlib.h>
 #include <init.h>
+#include <cpu.h>
 
 uint32_t ram_size;
 uint32_t stack_base, stack_size, stack_top;
 uint32_t heap_base, heap_size;
 uint32_t bounce_below_addr, rom_below_addr;
+uint32_t free_ram_top;
 extern const char bss_end; /* linker provides this symbol */
 
-/* TODO: have a list of RAM regions?
- * EG Q40/Q60 with 128MB option have non-contiguous DRAM, and separate VRAM region
- * There's no reason RAM must be in one big chunk.
-
-    typedef enum { mem_ram, mem_video, mem_rom } mem_type_t;
-    typedef struct mem_t mem_t;
-    
-    struct memt_t {
-        uint32_t base;
-        uint32_t size;
-        uint32_t first_free; // offset from base
-        uint32_t last_free;  // offset from base
-        mem_type_t type;
-    };
-
-    // ...
-    add_memory(0, ram_size, mem_ram, &bss_end, heap_base);
-
-    // first_free, last_free: so check_writable_range() can avoid data/bss/heap/stack in RAM
-    // or maybe have different mem_ram_free/mem_ram_used ranges?
-    // or have one type per segment ie mem_text, mem_rodata, mem_data, mem_bss, mem_heap, mem_stack etc?
-    // could eliminate the need for rom_below_addr, bounce_below_addr; check_writable_range might be just a switch statement.
- *
- */
+mem_region_t mem_region[MEM_MAX_REGIONS];
+int mem_region_count = 0;
 
-void measure_ram_size(void)
+/* Memory need not be one contiguous block: the Q40/Q60 128MB option boards
+ * have their DRAM in more than one bank, and there is video RAM. Region 0 is
+ * the RAM at address 0 where our own data, heap and stack live; anything else
+ * is entirely free for loading into. */
+bool mem_add_region(uint32_t base, uint32_t size, mem_type_t type)
 {
-    /* 
-       We write a longword at the end of each unit (typically 
-       1MB) of RAM, from the highest possible address downwards. 
-       Then we read these back and check them, in the reverse 
-       order, to determine how much RAM is actually fitted. 
+    if(!size || mem_region_count == MEM_MAX_REGIONS)
+        return false;
+
+    for(int i=0; i<mem_region_count; i++)
+        if(base < mem_region[i].base + mem_region[i].size && mem_region[i].base < base + size)
+            return false; /* overlaps */
+
+    mem_region[mem_region_count].base = base;
+    mem_region[mem_region_count].size = size;
+    mem_region[mem_region_count].type = type;
+    mem_region_count++;
+    return true;
+}
 
-       Take care to ensure you don't stomp on your code/data.
+/* the region containing all of base .. base+length-1, or NULL */
+const mem_region_t *mem_find_region(uint32_t base, uint32_t length)
+{
+    for(int i=0; i<mem_region_count; i++)
+        if(base >= mem_region[i].base && base - mem_region[i].base <= mem_region[i].size &&
+           length <= mem_region[i].size - (base - mem_region[i].base))
+            return &mem_region[i];
 
-       This is called with a relatively small (256-byte) stack
-    */
+    return NULL;
+}
 
-    uint32_t max_ram = mem_get_max_possible();
-    uint32_t unit_size = mem_get_granularity();
-    uint32_t max_units = max_ram / unit_size;
-    ram_size = 0;
+/* 
+   Size the RAM starting at base. We write a longword at the end of each unit
+   (typically 1MB) of RAM, from the highest possible address downwards. Then we
+   read these back and check them, in the reverse order, to determine how much
+   RAM is actually fitted. This destroys their contents, so take care to ensure
+   you don't stomp on your code/data.
+*/
+uint32_t mem_probe_bank(uint32_t base, uint32_t max_size, uint32_t unit_size)
+{
+    uint32_t max_units = max_size / unit_size;
+    uint32_t size = 0;
 
-    #define UNIT_ADDRESS(unit) ((uint32_t*)(unit * unit_size - sizeof(uint32_t)))
+    #define UNIT_ADDRESS(unit) ((uint32_t*)(base + unit * unit_size - sizeof(uint32_t)))
     #define UNIT_TEST_VALUE(unit) ((uint32_t)(unit | ((~unit) << 16)))
 
     for(int unit=max_units; unit > 0; unit--)
@@ -60,19 +65,82 @@ void measure_ram_size(void)
 
     for(int unit=1; unit<=max_units; unit++)
         if(*UNIT_ADDRESS(unit) == UNIT_TEST_VALUE(unit))
-            ram_size = (unit * unit_size);
+            size = (unit * unit_size);
         else
             break;
 
+    return size;
+}
+
+/* Size a further bank once we are running. It might turn out to be region 0
+ * again at another address, where the probe would write over live data, so
+ * we save what it could hit there first and put it back afterwards. A change
+ * means the bank is not separate RAM. */
+#define MEM_PROBE_MAX_UNITS 256
+
+uint32_t mem_probe_extra_bank(uint32_t base, uint32_t max_size)
+{
+    uint32_t unit_size = mem_get_granularity();
+    uint32_t units = ram_size / unit_size;
+    uint32_t saved[MEM_PROBE_MAX_UNITS];
+    uint32_t size;
+    bool aliased = false;
+
+    if(units > MEM_PROBE_MAX_UNITS)
+        return 0;
+
+    cpu_interrupts_off();
+    for(int unit=1; unit<=units; unit++)
+        saved[unit-1] = *((uint32_t*)(unit * unit_size - sizeof(uint32_t)));
+
+    size = mem_probe_bank(base, max_size, unit_size);
+
+    for(int unit=1; unit<=units; unit++){
+        if(*((uint32_t*)(unit * unit_size - sizeof(uint32_t))) != saved[unit-1])
+            aliased = true;
+        *((uint32_t*)(unit * unit_size - sizeof(uint32_t))) = saved[unit-1];
+    }
+    cpu_interrupts_on();
+
+    return aliased ? 0 : size;
+}
+
+void measure_ram_size(void)
+{
+    /* This is called with a relatively small (256-byte) stack */
+    ram_size = mem_probe_bank(0, mem_get_max_possible(), mem_get_granularity());
+    mem_add_region(0, ram_size, mem_ram);
+
     target_mem_init();
+    free_ram_top = heap_base < ram_size ? heap_base : ram_size;
+}
+
+/* Set aside memory for our own use (the RAM disk) at the top of region 0's
+ * free RAM, just under the heap, where nothing gets loaded. At least half of
+ * the free RAM is always left for loading into. */
+uint32_t mem_reserve_top(uint32_t size)
+{
+    size = (size + 0xfff) & ~0xfff;
+
+    if(free_ram_top < bounce_below_addr || size > (free_ram_top - bounce_below_addr) / 2)
+        return 0;
+
+    free_ram_top -= size;
+    return free_ram_top;
 }
 
 const char *check_writable_range(uint32_t base, uint32_t length, bool can_bounce)
 {
-    if(base + length > ram_size)
-        return "past end of RAM";
+    const mem_region_t *region = mem_find_region(base, length);
+
+    if(!region)
+        return base < ram_size ? "past end of RAM" : "not in any memory region";
+    if(region->base != 0)
+        return NULL; /* nothing of ours lives outside region 0 */
     if(base + length > heap_base)
         return "overlaps heap memory";
+    if(base + length > free_ram_top)
+        return "overlaps reserved memory";
     if(base < rom_below_addr)
         return "overlaps ROM";
     if(!can_bounce && base < bounce_below_addr)
@@ -81,3 +149,27 @@ const char *check_writable_range(uint32_t base, uint32_t length, bool can_bounce
     return NULL;
 }
 
+
+/* The stack is painted with a pattern below wherever it is now; the lowest
+ * word that no longer holds the pattern marks the deepest it has been since.
+ * Nothing that runs on it clears it again, so the measure is a safe one. */
+#define STACK_PAINT 0x57ac57ac
+
+void stack_paint(void)
+{
+    uint32_t *p = (uint32_t*)stack_base;
+    uint32_t *sp = __builtin_frame_address(0);
+
+    sp -= 16; /* room for this function's own calls and an interrupt frame */
+    while(p < sp)
+        *p++ = STACK_PAINT;
+}
+
+uint32_t stack_high_water(void)
+{
+    uint32_t *p = (uint32_t*)stack_base;
+
+    while(p < (uint32_t*)stack_top && *p == STACK_PAINT)
+        p++;
+    return stack_top - (uint32_t)p;
+}
@@ -22,13 +22,6 @@
 #define mb_whole(x) ((x) >> 20)
 #define mb_frac(x) (mul32((x)>>4, 100) >> 16)
 
-enum {
-    CACHE_FULL,   // cpu_cache_enable
-    CACHE_NODATA, // cpu_cache_enable_nodata
-    CACHE_NONE,   // cpu_cache_disable
-    CACHE_INIT
-};
-
 /* 32-bit sequence of length 2^32-1 (all 32-bit values except zero). */
 static inline __attribute__((always_inline)) uint32_t lfsr(uint32_t x)
 {
@@ -39,7 +32,7 @@ static inline __attribute__((always_inline)) uint32_t lfsr(uint32_t x)
 }
 
 /* Fill every 32-bit word from @start to @end. */
-static void fill_32(
+FASTTEXT static void fill_32(
     uint32_t fill, volatile uint32_t *start, volatile uint32_t *end)
 {
     uint32_t x, y;
@@ -51,7 +44,7 @@ static void fill_32(
 }
 
 /* Fill every other 16-bit word from @start to @end. */
-static void fill_alt_16(
+FASTTEXT static void fill_alt_16(
     uint16_t fill, uint16_t shift,
     volatile uint32_t *start, volatile uint32_t *end)
 {
@@ -63,7 +56,7 @@ static void fill_alt_16(
         : "d" (fill), "0" (x), "1" ((end-start)/4-1));
 }
 
-static uint16_t check_pattern(
+FASTTEXT static uint16_t check_pattern(
     uint32_t check, volatile uint32_t *start, volatile uint32_t *end)
 {
     uint32_t x, y, z, val;
@@ -78,6 +71,44 @@ static uint16_t check_pattern(
     return (uint16_t)val;
 }
 
+/* Fill from @start to @end in bursts; at most 1MB, 16-byte aligned. */
+FASTTEXT static void fill_burst_32(
+    uint32_t fill, volatile uint32_t *start, volatile uint32_t *end)
+{
+#if defined(CPU_HAS_MOVE16)
+    /* move16 one line holding the pattern, over and over */
+    uint32_t line[8], x, y, z;
+    uint32_t *pattern = (uint32_t *)(((uint32_t)line + 15) & ~15);
+    pattern[0] = pattern[1] = pattern[2] = pattern[3] = fill;
+    asm volatile (
+        "1: move16 (%0)+,(%1)+; lea -16(%0),%0; dbf %2,1b"
+        : "=a" (x), "=a" (y), "=d" (z)
+        : "0" (pattern), "1" (start), "2" ((end-start)/4-1)
+        : "memory");
+#elif defined(CPU_MOVEM_BURST)
+    uint32_t x, y;
+    asm volatile (
+        "move.l %2,%%d1; move.l %2,%%d2; move.l %2,%%d3; move.l %2,%%d4; "
+        "1: movem.l %%d1-%%d4,(%0); lea 16(%0),%0; dbf %1,1b"
+        : "=a" (x), "=d" (y)
+        : "d" (fill), "0" (start), "1" ((end-start)/4-1)
+        : "d1", "d2", "d3", "d4", "memory");
+#else
+    fill_32(fill, start, end);
+#endif
+}
+
+/* for membench */
+void memtest_fill_32(uint32_t fill, volatile uint32_t *start, volatile uint32_t *end)
+{
+    fill_32(fill, start, end);
+}
+
+uint16_t memtest_check_pattern(uint32_t check, volatile uint32_t *start, volatile uint32_t *end)
+{
+    return check_pattern(check, start, end);
+}
+
 struct test_memory_args {
     /* Testing is split into rounds and subrounds. Each subround covers all 
      * memory before proceeding to the next. Even subrounds fill memory; 
@@ -90,10 +121,87 @@ struct test_memory_args {
     uint32_t seed, _seed;
     uint32_t error_counter;
     int cache_mode, spinner;
+    /* Fast mode: each subround fills a block, flushes the data cache and
+     * verifies the block straight away, so every subround both writes and
+     * checks. The data cache stays on so that writes reach DRAM as copyback
+     * line bursts, and verification reads come back as line fills. */
+    bool fast;
 };
 
+#define FAST_SUBROUNDS  5
+#define FAST_BLOCK      0x8000  /* well over the data cache size */
+
+static const uint32_t fast_pattern[FAST_SUBROUNDS] = {
+    0, /* random */ 0xffff0000, 0x0000ffff, 0xff00ff00, 0x00ff00ff };
+
 const char spinner_symbol[4] = "\\|/-";
 
+static uint32_t test_memory_block_fast(struct test_memory_args *args,
+        volatile uint32_t *start, volatile uint32_t *end)
+{
+    volatile uint32_t *p;
+    uint32_t a = 0, x, seed = args->seed;
+
+    if (args->subround == 0) {
+        x = seed;
+        for (p = start; p != end;) {
+            *p++ = x = lfsr(x);
+            *p++ = x = lfsr(x);
+            *p++ = x = lfsr(x);
+            *p++ = x = lfsr(x);
+        }
+    } else
+        fill_burst_32(fast_pattern[args->subround], start, end);
+
+    /* push the dirty lines out so that we verify DRAM, not the cache */
+    cpu_cache_flush();
+
+    if (args->subround == 0) {
+        x = seed;
+        for (p = start; p != end;) {
+            a |= *p++ ^ (x = lfsr(x));
+            a |= *p++ ^ (x = lfsr(x));
+            a |= *p++ ^ (x = lfsr(x));
+            a |= *p++ ^ (x = lfsr(x));
+        }
+        args->seed = x;
+    } else
+        a |= check_pattern(fast_pattern[args->subround], start, end);
+
+    return a;
+}
+
+/* Errors found: print diagnostic */
+static void memory_test_report(struct test_memory_args *args,
+        volatile uint32_t *start, volatile uint32_t *end, uint32_t a)
+{
+    if (a != 0) {
+        args->error_counter++;
+        putchar('\r'); /* over the spinner */
+        printf("Errors found in memory range 0x%08lx-0x%08lx\n", (uint32_t)start, (uint32_t)end-1);
+        printf("Error bits: D31..D24  D23..D16  D15...D8  D7....D0\n");
+        printf("(X=error)   76543210  76543210  76543210  76543210\n");
+        printf("            %c%c%c%c%c%c%c%c  %c%c%c%c%c%c%c%c  "
+                           "%c%c%c%c%c%c%c%c  %c%c%c%c%c%c%c%c\n",
+                (a & (1u<<31)) ? 'X' : '-', (a & (1u<<30)) ? 'X' : '-',
+                (a & (1u<<29)) ? 'X' : '-', (a & (1u<<28)) ? 'X' : '-',
+                (a & (1u<<27)) ? 'X' : '-', (a & (1u<<26)) ? 'X' : '-',
+                (a & (1u<<25)) ? 'X' : '-', (a & (1u<<24)) ? 'X' : '-',
+                (a & (1u<<23)) ? 'X' : '-', (a & (1u<<22)) ? 'X' : '-',
+                (a & (1u<<21)) ? 'X' : '-', (a & (1u<<20)) ? 'X' : '-',
+                (a & (1u<<19)) ? 'X' : '-', (a & (1u<<18)) ? 'X' : '-',
+                (a & (1u<<17)) ? 'X' : '-', (a & (1u<<16)) ? 'X' : '-',
+                (a & (1u<<15)) ? 'X' : '-', (a & (1u<<14)) ? 'X' : '-',
+                (a & (1u<<13)) ? 'X' : '-', (a & (1u<<12)) ? 'X' : '-',
+                (a & (1u<<11)) ? 'X' : '-', (a & (1u<<10)) ? 'X' : '-',
+                (a & (1u<< 9)) ? 'X' : '-', (a & (1u<< 8)) ? 'X' : '-',
+                (a & (1u<< 7)) ? 'X' : '-', (a & (1u<< 6)) ? 'X' : '-',
+                (a & (1u<< 5)) ? 'X' : '-', (a & (1u<< 4)) ? 'X' : '-',
+                (a & (1u<< 3)) ? 'X' : '-', (a & (1u<< 2)) ? 'X' : '-',
+                (a & (1u<< 1)) ? 'X' : '-', (a & (1u<< 0)) ? 'X' : '-');
+    }
+}
+
 static int test_memory_range(struct test_memory_args *args)
 {
     volatile uint32_t *p;
@@ -107,7 +215,14 @@ static int test_memory_range(struct test_memory_args *args)
     putchar(spinner_symbol[args->spinner]);
     args->spinner = (args->spinner + 1) % 4;
 
-    switch (args->subround) {
+    if (args->fast) {
+        /* an error is reported for its block, and the test goes on */
+        for (p = start; p != end;) {
+            x = end - p > FAST_BLOCK/4 ? FAST_BLOCK/4 : end - p;
+            memory_test_report(args, p, p + x, test_memory_block_fast(args, p, p + x));
+            p += x;
+        }
+    } else switch (args->subround) {
 
     case 0:
         /* Random numbers. */
@@ -170,37 +285,26 @@ static int test_memory_range(struct test_memory_args *args)
 
     putchar('\r');
 
-    /* Errors found: print diagnostic */
-    if (a != 0) {
-        args->error_counter++;
-        printf("Errors found in memory range 0x%08lx-0x%08lx\n", (uint32_t)start, (uint32_t)end-1);
-        printf("Error bits: D31..D24  D23..D16  D15...D8  D7....D0\n");
-        printf("(X=error)   76543210  76543210  76543210  76543210\n");
-        printf("            %c%c%c%c%c%c%c%c  %c%c%c%c%c%c%c%c  "
-                           "%c%c%c%c%c%c%c%c  %c%c%c%c%c%c%c%c\n",
-                (a & (1u<<31)) ? 'X' : '-', (a & (1u<<30)) ? 'X' : '-',
-                (a & (1u<<29)) ? 'X' : '-', (a & (1u<<28)) ? 'X' : '-',
-                (a & (1u<<27)) ? 'X' : '-', (a & (1u<<26)) ? 'X' : '-',
-                (a & (1u<<25)) ? 'X' : '-', (a & (1u<<24)) ? 'X' : '-',
-                (a & (1u<<23)) ? 'X' : '-', (a & (1u<<22)) ? 'X' : '-',
-                (a & (1u<<21)) ? 'X' : '-', (a & (1u<<20)) ? 'X' : '-',
-                (a & (1u<<19)) ? 'X' : '-', (a & (1u<<18)) ? 'X' : '-',
-                (a & (1u<<17)) ? 'X' : '-', (a & (1u<<16)) ? 'X' : '-',
-                (a & (1u<<15)) ? 'X' : '-', (a & (1u<<14)) ? 'X' : '-',
-                (a & (1u<<13)) ? 'X' : '-', (a & (1u<<12)) ? 'X' : '-',
-                (a & (1u<<11)) ? 'X' : '-', (a & (1u<<10)) ? 'X' : '-',
-                (a & (1u<< 9)) ? 'X' : '-', (a & (1u<< 8)) ? 'X' : '-',
-                (a & (1u<< 7)) ? 'X' : '-', (a & (1u<< 6)) ? 'X' : '-',
-                (a & (1u<< 5)) ? 'X' : '-', (a & (1u<< 4)) ? 'X' : '-',
-                (a & (1u<< 3)) ? 'X' : '-', (a & (1u<< 2)) ? 'X' : '-',
-                (a & (1u<< 1)) ? 'X' : '-', (a & (1u<< 0)) ? 'X' : '-');
-    }
+    memory_test_report(args, start, end, a);
 
     return 0;
 }
 
 static void print_memory_test_type(struct test_memory_args *args)
 {
+    if (args->fast) {
+        if (args->subround == 0)
+            printf("Round %u.1: Random Fill+Verify (seed=0x%08lx)", args->round+1, args->seed);
+        else
+            printf("Round %u.%u: Pattern 0x%08lx Fill+Verify", args->round+1,
+                    args->subround+1, fast_pattern[args->subround]);
+        if(args->error_counter)
+            printf(" (ERROR COUNTER: %ld)\n", args->error_counter);
+        else
+            printf("\n");
+        return;
+    }
+
     switch (args->subround) {
     case 0:
         printf("Round %u.%u: Random Fill (seed=0x%08lx)", 
@@ -249,20 +353,29 @@ static void memory_test_next_cpu_cache_mode(struct test_memory_args *args)
 #endif
 }
 
-static void init_memory_test(struct test_memory_args *args)
+static void init_memory_test(struct test_memory_args *args, bool fast)
 {
     args->round = args->subround = 0;
     args->seed = 0x12341234;
     args->error_counter = 0;
     args->cache_mode = CACHE_INIT;
     args->spinner = 0;
-    memory_test_next_cpu_cache_mode(args);
+    args->fast = fast;
+    if (fast) /* runs in the cache mode it finds, whatever the errors */
+        printf("CPU cache policy: %s\n", cache_policy_name());
+    else
+        memory_test_next_cpu_cache_mode(args);
     print_memory_test_type(args);
 }
 
 static void memory_test_next_subround(struct test_memory_args *args)
 {
-    if (args->subround++ == 9) {
+    if (args->fast) {
+        if (++args->subround == FAST_SUBROUNDS) {
+            args->subround = 0;
+            args->round++;
+        }
+    } else if (args->subround++ == 9) {
         args->subround = 0;
         args->round++;
         memory_test_next_cpu_cache_mode(args);
@@ -274,29 +387,34 @@ static void memory_test_next_subround(struct test_memory_args *args)
 /* this is useful to narrow down where memory errors exist */
 #define TEST_CHUNK_SIZE 0x80000
 
-void memory_test(uint32_t base, uint32_t size)
+/* each round covers every range in turn */
+void memory_test_ranges(int count, const uint32_t *base, const uint32_t *size, bool fast)
 {
     bool done = false;
     struct test_memory_args tm_args;
     const char *addr_err;
     uint32_t test_remain, test_size, chunk_end;
+    int range = 0;
 
-    if(size == 0)
-        return;
+    for(int i=0; i<count; i++){
+        if(size[i] == 0)
+            return;
 
-    printf("memory test: testing 0x%08lx -- 0x%08lx (Press Q to end)\n", base, base+size-1);
+        printf("memory test: testing 0x%08lx -- 0x%08lx%s\n", base[i], base[i]+size[i]-1,
+                i == count-1 ? " (Press Q to end)" : "");
 
-    addr_err = check_writable_range(base, size, false);
-    if(addr_err){
-        printf("memory test: address range error: %s\n", addr_err);
-        return;
+        addr_err = check_writable_range(base[i], size[i], false);
+        if(addr_err){
+            printf("memory test: address range error: %s\n", addr_err);
+            return;
+        }
     }
 
-    init_memory_test(&tm_args);
+    init_memory_test(&tm_args, fast);
 
     while(!done){
-        tm_args.start = base;
-        test_remain = size;
+        tm_args.start = base[range];
+        test_remain = size[range];
 
         while(test_remain && !done){ 
             if(test_remain > TEST_CHUNK_SIZE)
@@ -327,10 +445,19 @@ void memory_test(uint32_t base, uint32_t size)
             tm_args.start += test_size;
         }
 
-        if(!done)
-            memory_test_next_subround(&tm_args);
+        if(++range == count){
+            range = 0;
+            if(!done)
+                memory_test_next_subround(&tm_args);
+        }
     }
 
-    cpu_cache_enable();
+    if(!fast)
+        cpu_cache_enable();
     printf("\nmemory test: ended\n");
 }
+
+void memory_test(uint32_t base, uint32_t size)
+{
+    memory_test_ranges(1, &base, &size, false);
+}
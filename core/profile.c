@@ -0,0 +1,213 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <init.h>
+#include <profile.h>
+
+/* The function table is made from nm output at link time (tools/mksymbols)
+ * and sits at the end of .rodata. A function runs from its address up to
+ * the next one's; the last runs up to text_end. Samples anywhere else --
+ * a program we loaded, or code copied into RAM -- are counted apart. */
+
+typedef struct {
+    uint32_t address;
+    const char *name;
+} profile_symbol_t;
+
+extern const uint32_t profile_symbol_count;
+extern const profile_symbol_t profile_symbols[];
+
+volatile bool profile_enabled = false;
+static uint32_t *profile_hits = NULL;   /* one per symbol */
+static uint32_t profile_elsewhere, profile_samples;
+static timer_t profile_ticks, profile_started;
+
+/* the function holding pc, or -1 */
+static int profile_find(uint32_t pc)
+{
+    int low = 0, high = profile_symbol_count - 1, mid;
+
+    if(!profile_symbol_count || pc < profile_symbols[0].address || pc >= (uint32_t)&text_end)
+        return -1;
+
+    /* the last symbol at or below pc */
+    while(low < high){
+        mid = (low + high + 1) >> 1;
+        if(profile_symbols[mid].address <= pc)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return low;
+}
+
+/* in interrupt context */
+void profile_sample(uint32_t pc)
+{
+    int f = profile_find(pc);
+
+    profile_samples++;
+    if(f < 0)
+        profile_elsewhere++;
+    else
+        profile_hits[f]++;
+}
+
+void profile_start(void)
+{
+    if(!profile_symbol_count){
+        printf("profile: this ROM was built without a function table\n");
+        return;
+    }
+
+    profile_enabled = false;
+    if(!profile_hits)
+        profile_hits = malloc(profile_symbol_count * sizeof(uint32_t));
+    memset(profile_hits, 0, profile_symbol_count * sizeof(uint32_t));
+    profile_elsewhere = profile_samples = profile_ticks = 0;
+    profile_started = gogoboot_read_timer();
+    profile_enabled = true;
+}
+
+void profile_stop(void)
+{
+    if(profile_enabled){
+        profile_enabled = false;
+        profile_ticks += gogoboot_read_timer() - profile_started;
+    }
+}
+
+static int profile_by_hits(const void *a, const void *b)
+{
+    uint32_t ha = profile_hits[*(const uint16_t*)a], hb = profile_hits[*(const uint16_t*)b];
+
+    return ha < hb ? 1 : ha > hb ? -1 : 0;
+}
+
+static void profile_line(uint32_t hits, const char *name)
+{
+    uint32_t tenths = profile_samples ? (hits * 1000) / profile_samples : 0;
+
+    printf("%8ld %3ld.%ld%%  %s\n", hits, tenths / 10, tenths % 10, name);
+}
+
+void profile_report(int top)
+{
+    uint16_t *order;
+    uint32_t ticks = profile_ticks;
+    int used = 0;
+
+    if(!profile_hits){
+        printf("profile: nothing recorded yet, use \"profile on\"\n");
+        return;
+    }
+
+    if(profile_enabled)
+        ticks += gogoboot_read_timer() - profile_started;
+    printf("profile: %ld samples in %ld.%02ld seconds%s\n", profile_samples,
+            ticks / TIMER_HZ, ((ticks % TIMER_HZ) * 100) / TIMER_HZ,
+            profile_enabled ? ", still running" : "");
+
+    order = arena_alloc(profile_symbol_count * sizeof(uint16_t));
+    for(int i=0; i<profile_symbol_count; i++)
+        if(profile_hits[i])
+            order[used++] = i;
+    qsort(order, used, sizeof(uint16_t), profile_by_hits);
+
+    printf("   hits    share  function\n");
+    for(int i=0; i<used && i<top; i++)
+        profile_line(profile_hits[order[i]], profile_symbols[order[i]].name);
+    if(profile_elsewhere)
+        profile_line(profile_elsewhere, "(outside the ROM's functions)");
+}
+
+/* Allocation sites: while profile_heap_enabled is set, malloc() and friends
+ * hand profile_heap_record() their caller's return address and the size
+ * asked for. Sites go in a small open hash table, allocated when recording
+ * starts; once it is full, further new sites are only counted. */
+
+#define PROFILE_HEAP_SITES 128 /* a power of 2 */
+
+typedef struct {
+    uint32_t caller;
+    uint32_t calls;
+    uint32_t bytes;
+    uint32_t largest;
+} profile_heap_site_t;
+
+volatile bool profile_heap_enabled = false;
+static profile_heap_site_t *profile_heap_sites = NULL;
+static uint32_t profile_heap_lost;     /* calls from sites that found no room */
+
+void profile_heap_record(uint32_t caller, uint32_t size)
+{
+    profile_heap_site_t *site;
+
+    for(int i=0; i<PROFILE_HEAP_SITES; i++){
+        site = &profile_heap_sites[((caller >> 1) + i) & (PROFILE_HEAP_SITES-1)];
+        if(site->caller != caller && site->caller)
+            continue;
+        site->caller = caller;
+        site->calls++;
+        site->bytes += size;
+        if(size > site->largest)
+            site->largest = size;
+        return;
+    }
+    profile_heap_lost++;
+}
+
+void profile_heap_start(void)
+{
+    profile_heap_enabled = false;
+    if(!profile_heap_sites)
+        profile_heap_sites = malloc(PROFILE_HEAP_SITES * sizeof(profile_heap_site_t));
+    memset(profile_heap_sites, 0, PROFILE_HEAP_SITES * sizeof(profile_heap_site_t));
+    profile_heap_lost = 0;
+    profile_heap_enabled = true;
+}
+
+void profile_heap_stop(void)
+{
+    profile_heap_enabled = false;
+}
+
+static int profile_heap_by_bytes(const void *a, const void *b)
+{
+    uint32_t ba = profile_heap_sites[*(const uint8_t*)a].bytes, bb = profile_heap_sites[*(const uint8_t*)b].bytes;
+
+    return ba < bb ? 1 : ba > bb ? -1 : 0;
+}
+
+void profile_heap_report(int top)
+{
+    profile_heap_site_t *site;
+    uint8_t order[PROFILE_HEAP_SITES];
+    int used = 0, f;
+
+    if(!profile_heap_sites){
+        printf("profile: no allocations recorded yet, use \"profile heap on\"\n");
+        return;
+    }
+
+    for(int i=0; i<PROFILE_HEAP_SITES; i++)
+        if(profile_heap_sites[i].caller)
+            order[used++] = i;
+    qsort(order, used, sizeof(uint8_t), profile_heap_by_bytes);
+
+    printf("profile: %d allocation sites%s\n", used, profile_heap_enabled ? ", still recording" : "");
+    printf("   calls      bytes  largest  caller\n");
+    for(int i=0; i<used && i<top; i++){
+        site = &profile_heap_sites[order[i]];
+        printf("%8ld %10ld %8ld  ", site->calls, site->bytes, site->largest);
+        f = profile_find(site->caller);
+        if(f >= 0)
+            printf("%s+0x%lx\n", profile_symbols[f].name, site->caller - profile_symbols[f].address);
+        else
+            printf("0x%08lx\n", site->caller);
+    }
+    if(profile_heap_lost)
+        printf("%8ld calls from sites the table had no room for\n", profile_heap_lost);
+}
@@ -0,0 +1,85 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <init.h>
+#include <disk.h>
+#include <cli.h>
+#include <fatfs/ff.h>
+
+/* A FAT volume in RAM, taken off the top of the free RAM below the heap so
+ * nothing loaded can land on it. It is a disk like any other as far as FatFs
+ * and the commands are concerned, except that it bypasses the sector cache
+ * and moves data with memcpy. A diskless machine gets one at startup. */
+
+#define RAMDISK_DEFAULT_FRACTION 4                  /* share of the free RAM, when no size is given */
+#define RAMDISK_DEFAULT_MAX     (16*1024*1024)
+#define RAMDISK_MIN_SIZE        (128*512)           /* smallest volume f_mkfs will make */
+#define RAMDISK_MKFS_WORK       (32*512)
+
+static int ramdisk_nr = -1;
+
+/* size 0 picks one from the free RAM */
+bool ramdisk_create(uint32_t size)
+{
+    MKFS_PARM opt = { FM_ANY | FM_SFD, 1, 0, 0, 0 };
+    uint32_t base;
+    disk_t *disk;
+    char path[3];
+    void *work;
+    FRESULT fr;
+
+    if(ramdisk_nr >= 0){
+        printf("ramdisk: already present as disk %d\n", ramdisk_nr);
+        return false;
+    }
+
+    if(disk_get_count() >= FF_VOLUMES){
+        printf("ramdisk: no free drive number\n");
+        return false;
+    }
+
+    if(!size){
+        size = (free_ram_top - bounce_below_addr) / RAMDISK_DEFAULT_FRACTION;
+        if(size > RAMDISK_DEFAULT_MAX)
+            size = RAMDISK_DEFAULT_MAX;
+    }
+    size &= ~511;
+    if(size < RAMDISK_MIN_SIZE)
+        size = RAMDISK_MIN_SIZE;
+
+    base = mem_reserve_top(size);
+    if(!base){
+        printf("ramdisk: %ld KB will not fit (it may take at most half the free RAM)\n", size >> 10);
+        return false;
+    }
+
+    disk = disk_add();
+    disk->ram = (uint8_t*)base;
+    disk->sectors = size >> 9;
+    strcpy(disk->model, "RAM disk");
+    ramdisk_nr = disk_get_count() - 1;
+
+    printf("RAM disk: disk %d, %ld KB at 0x%lx: ", ramdisk_nr, size >> 10, base);
+
+    path[0] = '0' + ramdisk_nr;
+    path[1] = ':';
+    path[2] = 0;
+    work = malloc(RAMDISK_MKFS_WORK);
+    fr = f_mkfs(path, &opt, work, RAMDISK_MKFS_WORK);
+    free(work);
+
+    if(fr != FR_OK){
+        printf("format failed: %s\n", f_errmsg(fr));
+        return false;
+    }
+    printf("formatted\n");
+
+    return true;
+}
+
+/* drive number of the RAM disk, or -1 */
+int ramdisk_get(void)
+{
+    return ramdisk_nr;
+}
@@ -0,0 +1,244 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <cpu.h>
+#include <init.h>
+#include <ramdump.h>
+
+// memory dumps that skip what is empty: a dump is produced a piece at a time,
+// as the reader asks for it, so it can go straight out over TFTP without ever
+// being held whole. memory is scanned in pages; runs of all-zero pages become
+// a single record, and the rest is LZ4 compressed up to a chunk at a time.
+//
+// the format, all big-endian (tools/ramdump expands it):
+//   header   "GOGODUMP", version, page size, number of ranges, 0
+//   index    base and size of each range dumped
+//   records  address, length, stored: then stored bytes. stored is 0 for
+//            length bytes of zeros, length for a plain copy, and anything
+//            between for an LZ4 block that expands to length bytes
+//   end      a record of length 0, stored 4, holding the CRC32 of every
+//            byte of the dump before it
+//
+// the dump's own buffers are in the memory dumped and come out as whatever
+// they held at the time; they are scratch, of no interest to the reader.
+
+#define RAMDUMP_VERSION     1
+#define RAMDUMP_PAGE        4096
+#ifdef MEMORY_PROFILE_SMALL
+#define RAMDUMP_CHUNK       (4*RAMDUMP_PAGE)    // most compressed at once
+#else
+#define RAMDUMP_CHUNK       (16*RAMDUMP_PAGE)
+#endif
+#define RAMDUMP_ZERO_RUN    (4 << 20)           // longest zero record: scanning it is one stall
+
+typedef struct __attribute__((packed, aligned(2))) {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t ranges;
+    uint32_t reserved;
+} ramdump_header_t;
+
+typedef struct __attribute__((packed, aligned(2))) {
+    uint32_t address;
+    uint32_t length;
+    uint32_t stored;
+} ramdump_record_t;
+
+struct ramdump_t {
+    int ranges;
+    uint32_t base[MEM_MAX_REGIONS];
+    uint32_t size[MEM_MAX_REGIONS];
+    int range;                  // being dumped
+    uint32_t offset;            // ... next byte of it
+    bool ended;                 // the end record has been produced
+    uint8_t *out;               // the record being read out
+    uint32_t out_length, out_pos;
+    uint16_t *table;            // LZ4 scratch
+    uint32_t crc;               // of the dump so far
+    uint32_t zero_bytes, copied_bytes, packed_bytes, packed_stored, dump_bytes;
+};
+
+// the page is all zeros; most of memory, mostly, so a quick look for anything else
+static FASTTEXT bool ramdump_zero(const uint32_t *p, uint32_t len)
+{
+    const uint32_t *end = p + len / sizeof(uint32_t);
+
+    for(; p < end; p += 4)
+        if(p[0] | p[1] | p[2] | p[3])
+            return false;
+    return true;
+}
+
+static uint32_t ramdump_page_length(ramdump_t *dump, uint32_t offset)
+{
+    uint32_t left = dump->size[dump->range] - offset;
+    return left < RAMDUMP_PAGE ? left : RAMDUMP_PAGE;
+}
+
+static bool ramdump_page_zero(ramdump_t *dump, uint32_t offset, uint32_t len)
+{
+    // a short page at the end of an odd-sized range is just copied
+    return len == RAMDUMP_PAGE && ramdump_zero((const uint32_t*)(dump->base[dump->range] + offset), len);
+}
+
+// the next record into dump->out
+static void ramdump_next_record(ramdump_t *dump)
+{
+    ramdump_record_t *record = (ramdump_record_t*)dump->out;
+    uint32_t address, length, page;
+    bool zero;
+
+    if(dump->range == dump->ranges){
+        record->address = 0;
+        record->length = 0;
+        record->stored = sizeof(uint32_t);
+        memcpy(dump->out + sizeof(ramdump_record_t), &dump->crc, sizeof(uint32_t));
+        dump->out_length = sizeof(ramdump_record_t) + sizeof(uint32_t);
+        dump->out_pos = 0;
+        dump->ended = true;
+        return;
+    }
+
+    address = dump->base[dump->range] + dump->offset;
+    length = ramdump_page_length(dump, dump->offset);
+    zero = ramdump_page_zero(dump, dump->offset, length);
+
+    // as many more pages of the same kind as will go in one record. zeros take
+    // no room, but each record is made in one go with nothing else serviced,
+    // so a long run of them is split too
+    while(dump->offset + length < dump->size[dump->range] &&
+          length < (zero ? RAMDUMP_ZERO_RUN : RAMDUMP_CHUNK)){
+        page = ramdump_page_length(dump, dump->offset + length);
+        if(ramdump_page_zero(dump, dump->offset + length, page) != zero)
+            break;
+        length += page;
+    }
+
+    record->address = address;
+    record->length = length;
+    if(zero){
+        record->stored = 0;
+        dump->zero_bytes += length;
+    }else{
+        record->stored = lz4_compress((void*)address, length, dump->out + sizeof(ramdump_record_t), dump->table);
+        if(record->stored >= length){
+            memcpy(dump->out + sizeof(ramdump_record_t), (void*)address, length);
+            record->stored = length;
+            dump->copied_bytes += length;
+        }else{
+            dump->packed_bytes += length;
+            dump->packed_stored += record->stored;
+        }
+    }
+
+    dump->out_length = sizeof(ramdump_record_t) + record->stored;
+    dump->out_pos = 0;
+    dump->crc = crc32_update(dump->crc, dump->out, dump->out_length);
+
+    dump->offset += length;
+    if(dump->offset == dump->size[dump->range]){
+        dump->range++;
+        dump->offset = 0;
+    }
+}
+
+ramdump_t *ramdump_open(uint32_t base, uint32_t size)
+{
+    ramdump_header_t *header;
+    uint32_t *index;
+    ramdump_t *dump;
+
+    if(size && (base & 3)){
+        printf("ramdump: address must be a multiple of 4\n");
+        return NULL;
+    }
+    if(size && !mem_find_region(base, size)){
+        printf("ramdump: 0x%lx length 0x%lx is not all in one memory region\n", base, size);
+        return NULL;
+    }
+
+    dump = malloc_unchecked(sizeof(ramdump_t));
+    if(!dump){
+        printf("ramdump: no memory\n");
+        return NULL;
+    }
+    memset(dump, 0, sizeof(ramdump_t));
+
+    if(size){
+        dump->base[0] = base;
+        dump->size[0] = size;
+        dump->ranges = 1;
+    }else{
+        for(int r=0; r<mem_region_count; r++){
+            if(mem_region[r].type != mem_ram)
+                continue;
+            dump->base[dump->ranges] = mem_region[r].base;
+            dump->size[dump->ranges] = mem_region[r].size;
+            dump->ranges++;
+        }
+    }
+
+    dump->table = malloc_unchecked(LZ4_TABLE_SIZE);
+    dump->out = malloc_unchecked(sizeof(ramdump_record_t) + LZ4_BOUND(RAMDUMP_CHUNK));
+    if(!dump->table || !dump->out){
+        printf("ramdump: no memory for a %d KB chunk\n", RAMDUMP_CHUNK >> 10);
+        ramdump_close(dump);
+        return NULL;
+    }
+
+    // the header and index are the first thing read out
+    header = (ramdump_header_t*)dump->out;
+    memcpy(header->magic, "GOGODUMP", sizeof(header->magic));
+    header->version = RAMDUMP_VERSION;
+    header->page_size = RAMDUMP_PAGE;
+    header->ranges = dump->ranges;
+    header->reserved = 0;
+    index = (uint32_t*)(dump->out + sizeof(ramdump_header_t));
+    for(int r=0; r<dump->ranges; r++){
+        *index++ = dump->base[r];
+        *index++ = dump->size[r];
+    }
+    dump->out_length = (uint8_t*)index - dump->out;
+    dump->crc = crc32_update(0, dump->out, dump->out_length);
+
+    return dump;
+}
+
+int ramdump_read(void *context, void *dest, int len)
+{
+    ramdump_t *dump = context;
+    int done = 0, n;
+
+    while(done < len){
+        if(dump->out_pos == dump->out_length){
+            if(dump->ended)
+                break;
+            ramdump_next_record(dump);
+        }
+        n = dump->out_length - dump->out_pos;
+        if(n > len - done)
+            n = len - done;
+        memcpy((uint8_t*)dest + done, dump->out + dump->out_pos, n);
+        dump->out_pos += n;
+        done += n;
+    }
+
+    dump->dump_bytes += done;
+    return done;
+}
+
+void ramdump_close(ramdump_t *dump)
+{
+    uint32_t total = dump->zero_bytes + dump->copied_bytes + dump->packed_bytes;
+
+    if(dump->ended)
+        printf("ramdump: %ld KB of memory in a %ld KB dump: %ld KB zero, %ld KB compressed to %ld KB, %ld KB copied\n",
+                total >> 10, dump->dump_bytes >> 10, dump->zero_bytes >> 10,
+                dump->packed_bytes >> 10, dump->packed_stored >> 10, dump->copied_bytes >> 10);
+
+    free(dump->table);
+    free(dump->out);
+    free(dump);
+}
@@ -0,0 +1,45 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <net.h>
+#include <task.h>
+
+/* Much of startup is waiting on hardware: disks to come out of reset and
+ * answer IDENTIFY, a DHCP server to answer. Written as tasks, the waits
+ * overlap. There is no preemption and no stack per task; a task keeps its
+ * state in its context and picks up where it left off on its next step. */
+
+static task_t *task_list = NULL;
+
+void task_start(task_t *task, const char *name, bool (*step)(task_t *task), void *context)
+{
+    task->name = name;
+    task->step = step;
+    task->context = context;
+    task->done = false;
+    task->next = task_list;
+    task_list = task;
+}
+
+void task_pump(void)
+{
+    task_t **link = &task_list, *task;
+
+    while((task = *link)){
+        if(task->step(task)){
+            link = &task->next;
+        }else{
+            task->done = true;
+            *link = task->next;
+        }
+    }
+
+    net_pump();
+}
+
+void task_wait(task_t *task)
+{
+    while(!task->done)
+        task_pump();
+}
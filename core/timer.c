@@ -22,6 +22,45 @@ bool timer_expired(timer_t timer)
     return ((timer - gogoboot_read_timer()) & 0x80000000);
 }
 
+uint32_t timer_read_fine(void)
+{
+    static uint32_t last;
+    timer_t ticks;
+    uint32_t sub, now;
+
+    /* the tick must not move on while we look at how far into it we are */
+    do{
+        ticks = gogoboot_read_timer();
+        sub = timer_sub_tick_us();
+    }while(ticks != gogoboot_read_timer());
+
+    if(sub >= TIMER_US_PER_TICK)
+        sub = TIMER_US_PER_TICK - 1;
+    now = ticks * TIMER_US_PER_TICK + sub;
+
+    /* with interrupts off, or a tick pending, the counter can wrap before the
+     * tick count catches up; hold the last value until it does */
+    if((int32_t)(now - last) < 0)
+        return last;
+    last = now;
+    return now;
+}
+
+/* held by each user of timer_read_fine() for as long as it wants the resolution */
+static int timer_fine_holders = 0;
+
+void timer_fine_hold(void)
+{
+    if(timer_fine_holders++ == 0)
+        timer_sub_tick_enable(true);
+}
+
+void timer_fine_release(void)
+{
+    if(timer_fine_holders > 0 && --timer_fine_holders == 0)
+        timer_sub_tick_enable(false);
+}
+
 void timer_wait(timer_t timeout)
 {
     while(!timer_expired(timeout));
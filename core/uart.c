@@ -2,23 +2,36 @@
 
 #include <uart.h>
 #include <stdlib.h>
+#include <cpu.h>
+#include <net.h>
 
 #if defined(TARGET_Q40) /* ISA based targets */
     #include <q40/isa.h>
     #define UART_ADDRESS    0x3f8
     #define UARTCLOCK       1843200
     static inline uint8_t uart_inb(uint16_t port) { return isa_read_byte(port); }
+    #ifdef UART_IO_PAUSE
+    static inline void uart_outb(uint16_t port, uint8_t val) { isa_write_byte_pause(port, val); }
+    #else
     static inline void uart_outb(uint16_t port, uint8_t val) { isa_write_byte(port, val); }
+    #endif
 #elif defined(TARGET_KISS) || defined(TARGET_MINI) /* ECB based targets */
     #include <ecb/ecb.h>
     #define UART_ADDRESS     MFPIC_UART
     #define UARTCLOCK        MFPIC_UART_CLK
     static inline uint8_t uart_inb(uint16_t port) { return ecb_read_byte(port); }
+    #ifdef UART_IO_PAUSE
+    static inline void uart_outb(uint16_t port, uint8_t val) { ecb_write_byte_pause(port, val); }
+    #else
     static inline void uart_outb(uint16_t port, uint8_t val) { ecb_write_byte(port, val); }
+    #endif
 #else
     #pragma error update uart.c for your target
 #endif
 
+/* build with UART_IO_PAUSE for a UART that needs recovery time after each
+ * register write; the 16550 family does not */
+
 #ifndef BAUD_RATE
 #define BAUD_RATE 115200          /* desired RS232 baud rate */
 #endif
@@ -40,6 +53,63 @@ static const char* uart_chip_name[] = {
 };
 
 static uart_type_t uart_type = UART_UNKNOWN;
+static bool uart_autoflow = false;
+
+/* Transmit ring. Writers queue here and then top up the FIFO with as much as
+ * it will take, without waiting; the timer tick tops it up again later, so
+ * console output no longer holds up whatever printed it unless the ring is
+ * full. The tick, or an interrupt handler that prints, may come in at any
+ * point, so each change to the ring or the FIFO is made with interrupts off:
+ * a byte at a time, so that waiting on a full ring does not hold them off. */
+#define UART_TX_RING_SIZE 1024 /* must be a power of 2 */
+
+static char uart_tx_ring[UART_TX_RING_SIZE];
+static volatile uint16_t uart_tx_head = 0, uart_tx_tail = 0;
+static int uart_tx_space = 0;     /* bytes we know the FIFO can still take */
+static int uart_fifo_depth = 1;
+
+static const uint8_t uart_fifo_depths[] = {
+    [UART_UNKNOWN] = 1,
+    [UART_16450]   = 1,
+    [UART_16550]   = 1,           /* FIFO is broken, do not use it */
+    [UART_16550A]  = 16,
+    [UART_16750]   = 64,
+    [UART_16950]   = 128,
+    [UART_16950B]  = 128,
+};
+
+/* call with interrupts off */
+static void uart_tx_fill_masked(void)
+{
+    uint16_t tail = uart_tx_tail;
+
+    if(tail == uart_tx_head)
+        return;
+
+    if(!uart_tx_space && (uart_inb(UART_ADDRESS+UART_LSR) & UART_LSR_THRE))
+        uart_tx_space = uart_fifo_depth;
+
+    while(uart_tx_space && tail != uart_tx_head){
+        uart_outb(UART_ADDRESS+UART_THR, uart_tx_ring[tail]);
+        tail = (tail + 1) & (UART_TX_RING_SIZE-1);
+        uart_tx_space--;
+    }
+
+    uart_tx_tail = tail;
+}
+
+static void uart_tx_fill(void)
+{
+    uint32_t sr = cpu_interrupts_save();
+    uart_tx_fill_masked();
+    cpu_interrupts_restore(sr);
+}
+
+/* called from the timer interrupt */
+void uart_tx_tick(void)
+{
+    uart_tx_fill();
+}
 
 static void uart_icr_write(uint8_t offset, uint8_t value)
 {
@@ -56,6 +126,16 @@ static uint8_t uart_icr_read(uint8_t offset)
     return value;
 }
 
+static void uart_set_divisor(uint16_t divisor)
+{
+    uint8_t LCR = uart_inb(UART_ADDRESS+UART_LCR) & ~UART_DLAB;
+
+    uart_outb(UART_ADDRESS+UART_LCR, LCR | UART_DLAB); /* set DLAB to access divisor */
+    uart_outb(UART_ADDRESS+0, divisor & 0xFF);         /* set divisor LSB */
+    uart_outb(UART_ADDRESS+1, divisor >> 8);           /* set divisor MSB */
+    uart_outb(UART_ADDRESS+UART_LCR, LCR);             /* restore LCR */
+}
+
 void uart_init(void)
 {
     bool autoflow;
@@ -69,6 +149,7 @@ void uart_init(void)
     /* Check CTS bit in MSR: if high, hardware auto-flow control will be
      * enabled (for UARTs with this feature) */
     autoflow = uart_inb(UART_ADDRESS+UART_MSR) & 0x10;
+    uart_autoflow = autoflow;
     if(autoflow)
         MCR |= UART_MCR_AFE; /* set auto flow-control enable bit */
 
@@ -129,11 +210,12 @@ void uart_init(void)
             uart_outb(UART_ADDRESS+UART_LCR, LCR);
     }
 
-    uart_outb(UART_ADDRESS+UART_LCR, LCR | UART_DLAB); /* set DLAB to access divisor */
-    uart_outb(UART_ADDRESS+0, UART_DIVISOR & 0xFF);    /* set divisor LSB */
-    uart_outb(UART_ADDRESS+1, UART_DIVISOR >> 8);      /* set divisor MSB */
-    uart_outb(UART_ADDRESS+UART_LCR, LCR);             /* restore LCR */
+    uart_outb(UART_ADDRESS+UART_LCR, LCR);
+    uart_set_divisor(UART_DIVISOR);
     uart_outb(UART_ADDRESS+UART_MCR, MCR);             /* set DTR, RTS and maybe AFE */
+
+    uart_fifo_depth = uart_fifo_depths[uart_type];
+    uart_tx_space = 0;
 }
 
 void uart_identify(void)
@@ -152,32 +234,89 @@ void uart_identify(void)
     return;
 }
 
+/* Change the baud rate, 0 for the usual one. Every UART here runs from a
+ * 1.8432MHz crystal, so 115200 is the limit at 16 samples per bit; only the
+ * 16950, which can take as few as 4 samples per bit (but only in its enhanced
+ * mode), goes faster. */
+bool uart_set_baud(uint32_t baud)
+{
+    int samples = 16;
+    bool is_16950 = (uart_type == UART_16950 || uart_type == UART_16950B);
+    uint8_t LCR;
+
+    if(!baud)
+        baud = BAUD_RATE;
+
+    while(UARTCLOCK % (samples * baud) != 0){
+        if(!is_16950 || samples == 4)
+            return false;
+        samples--;
+    }
+
+    uart_flush();
+
+    if(is_16950){
+        LCR = uart_inb(UART_ADDRESS+UART_LCR);
+        uart_outb(UART_ADDRESS+UART_LCR, UART_LCR_CONF_MODE_B);
+        uart_outb(UART_ADDRESS+UART_EFR, samples == 16 ? 0 :
+                UART_EFR_ECB | (uart_autoflow ? (UART_EFR_RTS | UART_EFR_CTS) : 0));
+        uart_outb(UART_ADDRESS+UART_LCR, LCR);
+        uart_icr_write(UART_TCR, samples & 0x0f); /* 0 means 16 */
+    }
+
+    uart_set_divisor(UARTCLOCK / (samples * baud));
+
+    return true;
+}
+
 bool uart_write_ready(void)
 {
-    return uart_inb(UART_ADDRESS+UART_LSR) & UART_LSR_THRE ? true : false;
+    return ((uart_tx_head + 1) & (UART_TX_RING_SIZE-1)) != uart_tx_tail;
 }
 
 void uart_flush(void)
 {
+    while(uart_tx_tail != uart_tx_head)
+        uart_tx_fill();
     while((uart_inb(UART_ADDRESS+UART_LSR) & (UART_LSR_THRE|UART_LSR_TEMT)) != (UART_LSR_THRE|UART_LSR_TEMT));
 }
 
+static inline void uart_tx_queue(char b)
+{
+    uint16_t next;
+    uint32_t sr;
+
+    while(true){
+        sr = cpu_interrupts_save();
+        next = (uart_tx_head + 1) & (UART_TX_RING_SIZE-1);
+        if(next != uart_tx_tail)
+            break;
+        uart_tx_fill_masked(); /* full: wait for the FIFO to take some */
+        cpu_interrupts_restore(sr);
+    }
+    uart_tx_ring[uart_tx_head] = b;
+    uart_tx_head = next;
+    cpu_interrupts_restore(sr);
+}
+
 void uart_write_byte(char b)
 {
-    while(!(uart_inb(UART_ADDRESS+UART_LSR) & UART_LSR_THRE));
-    uart_outb(UART_ADDRESS+UART_THR, b);
+    uart_tx_queue(b);
+    uart_tx_fill();
 }
 
+/* the whole string goes in the ring, and then to the FIFO */
 int uart_write_string(const char *str)
 {
     int r = 0;
 
     while(*str){
         if(*str == '\n')
-            uart_write_byte('\r');
-        uart_write_byte(*(str++));
+            uart_tx_queue('\r');
+        uart_tx_queue(*(str++));
         r++;
     }
+    uart_tx_fill();
 
     return r;
 }
@@ -216,7 +355,9 @@ bool uart_check_cancel_key(void)
 {
     int byte;
 
-    byte = uart_read_byte();
+    byte = netcon_read_byte();
+    if(byte < 0)
+        byte = uart_read_byte();
     switch(byte){
         case 'q':
         case 'Q':
@@ -0,0 +1,169 @@
+        .globl  ne2000_pio_input
+        .globl  ne2000_pio_output
+        .globl  ne2000_pio_input_csum
+
+        .section .fasttext, "ax"      /* inner loops: in RAM on ROM builds */
+        .even
+
+/* NE2000 remote DMA data port transfers for the 8-bit ECB bus; 68000 safe,
+   so this is shared by KISS and mini. Each byte is a single memory-to-memory
+   move.b. The bulk of the transfer is done 16 bytes per loop; the 1, 2, 4 and
+   8 byte remainders are peeled off first by testing bits of the length. */
+
+ne2000_pio_input:
+    moveal %sp@(4),%a0          /* void *buf */
+    moveal %sp@(8),%a1          /* address of data port */
+    movel %sp@(12),%d1          /* int len (bytes) */
+
+    btst #0,%d1
+    beq ne2000_input_b2
+    moveb %a1@,%a0@+
+ne2000_input_b2:
+    btst #1,%d1
+    beq ne2000_input_b4
+    .rept 2
+    moveb %a1@,%a0@+
+    .endr
+ne2000_input_b4:
+    btst #2,%d1
+    beq ne2000_input_b8
+    .rept 4
+    moveb %a1@,%a0@+
+    .endr
+ne2000_input_b8:
+    btst #3,%d1
+    beq ne2000_input_bulk
+    .rept 8
+    moveb %a1@,%a0@+
+    .endr
+ne2000_input_bulk:
+    lsrl #4,%d1                 /* 16 byte blocks */
+    bra ne2000_input_loop
+
+ne2000_input_nextblock:
+    .rept 16
+    moveb %a1@,%a0@+
+    .endr
+ne2000_input_loop:
+    dbra %d1,ne2000_input_nextblock
+    rts
+
+
+ne2000_pio_output:
+    moveal %sp@(4),%a0          /* const void *buf */
+    moveal %sp@(8),%a1          /* address of data port */
+    movel %sp@(12),%d1          /* int len (bytes) */
+
+    btst #0,%d1
+    beq ne2000_output_b2
+    moveb %a0@+,%a1@
+ne2000_output_b2:
+    btst #1,%d1
+    beq ne2000_output_b4
+    .rept 2
+    moveb %a0@+,%a1@
+    .endr
+ne2000_output_b4:
+    btst #2,%d1
+    beq ne2000_output_b8
+    .rept 4
+    moveb %a0@+,%a1@
+    .endr
+ne2000_output_b8:
+    btst #3,%d1
+    beq ne2000_output_bulk
+    .rept 8
+    moveb %a0@+,%a1@
+    .endr
+ne2000_output_bulk:
+    lsrl #4,%d1                 /* 16 byte blocks */
+    bra ne2000_output_loop
+
+ne2000_output_nextblock:
+    .rept 16
+    moveb %a0@+,%a1@
+    .endr
+ne2000_output_loop:
+    dbra %d1,ne2000_output_nextblock
+    rts
+
+
+/* As ne2000_pio_input, but also returns the ones-complement sum of the data
+   (folded to 16 bits, as net_checksum_partial) so the buffer need not be read
+   again to verify the checksum. Bytes are assembled into words in a register
+   with rol.w, which unlike lsl leaves X alone, so the addx carry chain runs
+   straight through the transfer. buf must be word aligned. */
+
+ne2000_pio_input_csum:
+    moveal %sp@(4),%a0          /* void *buf */
+    moveal %sp@(8),%a1          /* address of data port */
+    movel %sp@(12),%d1          /* int len (bytes) */
+    moveml %d2-%d3,%sp@-        /* len is now at %sp@(20), low byte at %sp@(23) */
+
+    moveq #0,%d0                /* sum */
+    moveq #0,%d3                /* zero, for folding in the final carry */
+    movel %d1,%d2
+    lsrl #4,%d2                 /* 16 byte blocks */
+    addl %d3,%d0                /* clear X before we start the chain */
+
+    btst #1,%sp@(23)
+    beq ne2000_csum_w2
+    moveb %a1@,%d1
+    rolw #8,%d1
+    moveb %a1@,%d1
+    movew %d1,%a0@+
+    addxw %d1,%d0
+ne2000_csum_w2:
+    btst #2,%sp@(23)
+    beq ne2000_csum_w4
+    .rept 2
+    moveb %a1@,%d1
+    rolw #8,%d1
+    moveb %a1@,%d1
+    movew %d1,%a0@+
+    addxw %d1,%d0
+    .endr
+ne2000_csum_w4:
+    btst #3,%sp@(23)
+    beq ne2000_csum_bulk
+    .rept 4
+    moveb %a1@,%d1
+    rolw #8,%d1
+    moveb %a1@,%d1
+    movew %d1,%a0@+
+    addxw %d1,%d0
+    .endr
+ne2000_csum_bulk:
+    bra ne2000_csum_loop
+
+ne2000_csum_nextblock:
+    .rept 8
+    moveb %a1@,%d1              /* high byte */
+    rolw #8,%d1
+    moveb %a1@,%d1              /* low byte */
+    movew %d1,%a0@+
+    addxw %d1,%d0
+    .endr
+ne2000_csum_loop:
+    dbra %d2,ne2000_csum_nextblock
+
+    btst #0,%sp@(23)            /* odd length? */
+    beq ne2000_csum_fold
+    moveq #0,%d1
+    moveb %a1@,%d1
+    moveb %d1,%a0@
+    rolw #8,%d1                 /* summed as the high half of a word */
+    addxw %d1,%d0
+
+ne2000_csum_fold:
+    addxl %d3,%d0               /* final carry ... */
+    addxl %d3,%d0               /* ... which may itself carry if the sum was 0xffffffff */
+    movel %d0,%d1               /* fold 32 bits down to 16 */
+    swap %d1
+    addw %d1,%d0
+    addxw %d3,%d0
+    andil #0xffff,%d0
+
+    moveml %sp@+,%d2-%d3
+    rts
+        .end
@@ -1,7 +1,7 @@
         .globl  ide_sector_xfer_input
         .globl  ide_sector_xfer_output
 
-        .text
+        .section .fasttext, "ax"      /* inner loops: in RAM on ROM builds */
         .even
 
 ide_sector_xfer_input:
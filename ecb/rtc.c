@@ -8,6 +8,8 @@
 #include <rtc.h>
 #include <ecb/ecb.h>
 
+#define DS1302_RAM_SIZE 31
+
 static uint8_t mfpic_rtc_shadow;
 
 static void rtc_set_chipselect(bool enable)
@@ -122,6 +124,47 @@ void rtc_read_clock(rtc_time_t *buffer)
     rtc_idle(); /* all done */
 }
 
+static uint8_t rtc_read_register(uint8_t command)
+{
+    uint8_t value;
+
+    rtc_set_clk(false);
+    rtc_set_chipselect(true);
+    rtc_send_byte(command);
+    value = rtc_read_byte();
+    rtc_idle();
+    return value;
+}
+
+static void rtc_write_register(uint8_t command, uint8_t value)
+{
+    rtc_set_clk(false);
+    rtc_set_chipselect(true);
+    rtc_send_byte(command);
+    rtc_send_byte(value);
+    rtc_idle();
+}
+
+int rtc_nvram_size(void)
+{
+    return DS1302_RAM_SIZE;
+}
+
+uint8_t rtc_nvram_read(int offset)
+{
+    if(offset < 0 || offset >= DS1302_RAM_SIZE)
+        return 0xff;
+    return rtc_read_register(0xC1 | (offset << 1)); /* RAM read */
+}
+
+void rtc_nvram_write(int offset, uint8_t value)
+{
+    if(offset < 0 || offset >= DS1302_RAM_SIZE)
+        return;
+    rtc_write_register(0x8E, 0x00); /* clear write protect */
+    rtc_write_register(0xC0 | (offset << 1), value); /* RAM write */
+}
+
 void rtc_init(void)
 {
     mfpic_rtc_shadow = 0;
@@ -14,6 +14,8 @@
 #define NS32202_USABLE_IRQS (0x12FF)            /* bitmask of usable external IRQ lines on MF/PIC */
 
 volatile uint32_t timer_ticks;
+static void (*ecb_irq_handler[16])(void);
+volatile int target_irq_depth = 0;
 
 timer_t gogoboot_read_timer(void)
 {
@@ -41,6 +43,28 @@ static inline unsigned short ns32202_read_reg_word(uint8_t reg)
     return (ns32202_read_reg_byte(reg+1) << 8) | (ns32202_read_reg_byte(reg) & 0xFF);
 }
 
+/* the high counter counts down from COUNT_PER_TICK-1 to 0 each tick. CFRZ
+ * holds the HCCV we read while the counter itself carries on. */
+#define US_PER_COUNT_16 ((TIMER_US_PER_TICK << 16) / COUNT_PER_TICK) /* avoids a divide */
+
+uint32_t timer_sub_tick_us(void)
+{
+    uint16_t count;
+
+    ns32202_write_reg_byte(NS32202_MCTL, MCTL_FROZEN);
+    count = ns32202_read_reg_word(NS32202_HCCV);
+    ns32202_write_reg_byte(NS32202_MCTL, MCTL_NORMAL);
+
+    if(count >= COUNT_PER_TICK)
+        return 0;
+    return ((uint32_t)(COUNT_PER_TICK - 1 - count) * US_PER_COUNT_16) >> 16;
+}
+
+/* the counter is always running */
+void timer_sub_tick_enable(bool on)
+{
+}
+
 static void ns32202_test(uint16_t high, uint16_t low)
 {
     uint16_t h, l;
@@ -102,3 +126,43 @@ void setup_interrupts(void)
 
     cpu_interrupts_on();
 }
+
+/* called from ns202_irq in vectors.s for every IRQ except our timer */
+void ecb_irq_dispatch(int irq)
+{
+    if(!ecb_irq_handler[irq]){
+        printf(":( UNEXPECTED NS32202 IRQ %d\n", irq);
+        halt();
+    }
+
+    target_irq_depth++;
+    ecb_irq_handler[irq]();
+    target_irq_depth--;
+    ns32202_read_reg_byte(NS32202_EOI); /* end of interrupt cycle */
+}
+
+bool target_irq_attach(int irq, void (*handler)(void))
+{
+    if(irq < 0 || irq > 15 || !(NS32202_USABLE_IRQS & (1 << irq)) ||
+       irq == MFPIC_TIMERH_IRQ || irq == MFPIC_TIMERL_IRQ || irq == MFPIC_UART_IRQ){
+        printf("MF/PIC IRQ %d cannot be used\n", irq);
+        return false;
+    }
+
+    cpu_interrupts_off();
+    ecb_irq_handler[irq] = handler;
+    ns32202_write_reg_word(NS32202_IMSK, ns32202_read_reg_word(NS32202_IMSK) & ~(1 << irq));
+    cpu_interrupts_on();
+    return true;
+}
+
+void target_irq_detach(int irq)
+{
+    if(irq < 0 || irq > 15)
+        return;
+
+    cpu_interrupts_off();
+    ns32202_write_reg_word(NS32202_IMSK, ns32202_read_reg_word(NS32202_IMSK) | (1 << irq));
+    ecb_irq_handler[irq] = NULL;
+    cpu_interrupts_on();
+}
@@ -22,6 +22,8 @@
 #include <stdlib.h>
 #include <fatfs/ff.h>			/* Declarations of FatFs API */
 #include <fatfs/diskio.h>		/* Declarations of device I/O functions */
+#include <fatfs/ffbitmap.h>		/* gogoboot: free-cluster bitmap */
+#include <fatfs/ffdircache.h>		/* gogoboot: directory lookup cache */
 
 
 /*--------------------------------------------------------------------------
@@ -1245,6 +1247,7 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 	UINT bc;
 	BYTE *p;
 	FRESULT res = FR_INT_ERR;
+	DWORD used = val & 0x0FFFFFFF;	/* gogoboot: for the free-cluster bitmap */
 
 
 	if (clst >= 2 && clst < fs->n_fatent) {	/* Check if in valid range */
@@ -1283,6 +1286,7 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 			fs->wflag = 1;
 			break;
 		}
+		if (res == FR_OK) ff_bitmap_update(fs, clst, used != 0);
 	}
 	return res;
 }
@@ -1583,7 +1587,9 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 				ncl = 0;
 			}
 		}
-		if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
+		if (ncl == 0 && ff_bitmap_find_free(fs, scl, &ncl)) {	/* gogoboot: ask the bitmap first */
+			if (ncl == 0) return 0;				/* No free cluster found? */
+		} else if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
 			ncl = scl;	/* Start cluster */
 			for (;;) {
 				ncl++;							/* Next cluster */
@@ -1872,6 +1878,7 @@ static void st_clust (
 	if (fs->fs_type == FS_FAT32) {
 		st_word(dir + DIR_FstClusHI, (WORD)(cl >> 16));
 	}
+	ff_dircache_invalidate_sector(fs, fs->winsect);	/* gogoboot: cluster and size change together */
 }
 #endif
 
@@ -2416,6 +2423,24 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 #endif
 	/* On the FAT/FAT32 volume */
 #if FF_USE_LFN
+	if (!(dp->fn[NSFLAG] & NS_NOLFN)) {	/* gogoboot: try where it was last time */
+		ff_dirloc_t loc;
+
+		if (ff_dircache_lookup(dp, &loc)) {
+			res = dir_sdi(dp, loc.dptr);
+			if (res == FR_OK) res = move_window(fs, dp->sect);
+			if (res != FR_OK) return res;
+			if (!memcmp(dp->dir, loc.sfn, 11) && ld_clust(fs, dp->dir) == loc.sclust
+				&& ld_dword(dp->dir + DIR_FileSize) == loc.size) {
+				dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
+				dp->blk_ofs = loc.blk_ofs;
+				return FR_OK;
+			}
+			ff_dircache_forget(dp);
+			res = dir_sdi(dp, 0);
+			if (res != FR_OK) return res;
+		}
+	}
 	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
 #endif
 	do {
@@ -2451,6 +2476,11 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 		res = dir_next(dp, 0);	/* Next entry */
 	} while (res == FR_OK);
 
+#if FF_USE_LFN
+	if (res == FR_OK && !(dp->fn[NSFLAG] & NS_NOLFN)) {	/* gogoboot: remember it */
+		ff_dircache_record(dp, ld_clust(fs, dp->dir), ld_dword(dp->dir + DIR_FileSize));
+	}
+#endif
 	return res;
 }
 
@@ -2601,6 +2631,7 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 		fs->wflag = 1;
 	}
 #endif
+	ff_dircache_invalidate_dir(fs, dp->obj.sclust);	/* gogoboot: unlink or rename */
 
 	return res;
 }
@@ -4831,9 +4862,14 @@ FRESULT f_getfree (
 	res = mount_volume(&path, &fs, 0);
 	if (res == FR_OK) {
 		*fatfs = fs;				/* Return ptr to the fs object */
+		ff_bitmap_start(fs);		/* gogoboot: in the background, for next time */
 		/* If free_clst is valid, return it without full FAT scan */
 		if (fs->free_clst <= fs->n_fatent - 2) {
 			*nclst = fs->free_clst;
+		} else if (ff_bitmap_free_count(fs, &nfree)) {	/* gogoboot: or the bitmap has it */
+			*nclst = nfree;
+			fs->free_clst = nfree;
+			fs->fsi_flag |= 1;
 		} else {
 			/* Scan FAT to obtain number of free clusters */
 			nfree = 0;
@@ -5599,6 +5635,20 @@ FRESULT f_expand (
 		}
 	} else
 #endif
+	if (ff_bitmap_find_run(fs, stcl, tcl, &scl)) {	/* gogoboot: the bitmap finds it quicker */
+		if (scl == 0) res = FR_DENIED;
+		if (res == FR_OK) {
+			if (opt) {
+				for (clst = scl, n = tcl; n; clst++, n--) {	/* Create a cluster chain on the FAT */
+					res = put_fat(fs, clst, (n == 1) ? 0xFFFFFFFF : clst + 1);
+					if (res != FR_OK) break;
+					lclst = clst;
+				}
+			} else {
+				lclst = scl - 1;
+			}
+		}
+	} else
 	{
 		scl = clst = stcl; ncl = 0;
 		for (;;) {	/* Find a contiguous cluster block */
@@ -5649,10 +5699,97 @@ FRESULT f_expand (
 	LEAVE_FF(fs, res);
 }
 
+
+
+/*-----------------------------------------------------------------------*/
+/* gogoboot: Whole Sectors of a Contiguous File, Written by the Caller   */
+/*-----------------------------------------------------------------------*/
+/* The caller knows the file's clusters are one run from its first, up to
+/  its current size: it has just been given its space by f_expand(), or
+/  f_contiguous() says so. This finds where the next nsect sectors at the
+/  file pointer are on the disk and moves the file pointer past them, for
+/  the caller to write them there itself. FR_DENIED means use f_write(). */
+
+FRESULT f_contiguous_sector (
+	FIL* fp,			/* Pointer to the file object */
+	UINT nsect,			/* Number of sectors at the file pointer */
+	LBA_t* sect			/* Where they start */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	if (!(fp->flag & FA_WRITE) || (fp->flag & FA_DIRTY) || !fp->obj.sclust || fp->fptr % SS(fs)
+		|| fp->fptr > fp->obj.objsize || fp->obj.objsize - fp->fptr < (FSIZE_t)nsect * SS(fs)) {
+		LEAVE_FF(fs, FR_DENIED);		/* Not whole sectors within the allocation */
+	}
+	*sect = clst2sect(fs, fp->obj.sclust) + (DWORD)(fp->fptr / SS(fs));
+#if !FF_FS_TINY
+	if (fp->sect - *sect < nsect) fp->sect = 0;	/* Sector cache is about to go stale (it is clean) */
+#endif
+	fp->flag |= FA_MODIFIED;
+	/* Only a NoFatChain exFAT file is passed over without the FAT; otherwise this
+	/  follows the chain, a get_fat() per cluster crossed (mostly from the window) */
+	res = f_lseek(fp, fp->fptr + (FSIZE_t)nsect * SS(fs));
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* gogoboot: Write Whole Sectors to a Contiguous File in One Request     */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_write_contiguous (
+	FIL* fp,			/* Pointer to the file object */
+	const void* buff,	/* Data to be written */
+	UINT nsect			/* Number of sectors to write at the file pointer */
+)
+{
+	FRESULT res;
+	LBA_t sect;
+
+
+	res = f_contiguous_sector(fp, nsect, &sect);
+	if (res != FR_OK) return res;
+	if (disk_write(fp->obj.fs->pdrv, buff, sect, nsect) != RES_OK) {
+		fp->err = (BYTE)FR_DISK_ERR;
+		return FR_DISK_ERR;
+	}
+
+	return FR_OK;
+}
+
 #endif /* FF_USE_EXPAND && !FF_FS_READONLY */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* gogoboot: First Cluster of a Contiguous (NoFatChain) File             */
+/*-----------------------------------------------------------------------*/
+/* Its data can be addressed from the first cluster without the FAT;
+/  0 if the file is not known to be contiguous. */
+
+DWORD f_contiguous (
+	FIL* fp				/* Pointer to the file object */
+)
+{
+#if FF_FS_EXFAT
+	FATFS *fs;
+
+	if (validate(&fp->obj, &fs) == FR_OK && fs->fs_type == FS_EXFAT && fp->obj.stat == 2) {
+		return fp->obj.sclust;
+	}
+#endif
+	return 0;
+}
+
+
+
 #if FF_USE_FORWARD
 /*-----------------------------------------------------------------------*/
 /* Forward Data to the Stream Directly                                   */
@@ -0,0 +1,252 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <init.h>
+#include <cli.h>
+#include <task.h>
+#include <fatfs/ff.h>
+#include <fatfs/diskio.h>
+#include <fatfs/ffbitmap.h>
+
+/* FatFs finds free clusters by reading the FAT entry by entry, and without a
+ * trustworthy FSINFO it counts them the same way; on a big FAT32 card over PIO
+ * that is a lot of sectors. This keeps one bit per cluster (set = free) for
+ * each mounted volume. It is built a few FAT sectors at a time from a task,
+ * so at the prompt it costs nothing, and from then on put_fat() keeps it up
+ * to date. The build reads the FAT in order; changes to entries it has not
+ * reached yet are picked up when it gets there. FatFs's own window may hold
+ * a FAT sector newer than the disk, so that one is taken from the window.
+ *
+ * "set fat_bitmap 0" stops new bitmaps being built. */
+
+#define BITMAP_STEP_SECTORS     16          /* FAT sectors read per step */
+#define BITMAP_HEAP_FRACTION    8           /* no bitmap bigger than this share of the heap */
+
+typedef struct {
+    FATFS *fs;
+    WORD id;                    /* mount id: a remount invalidates the bitmap */
+    uint32_t *bits;
+    DWORD entries;              /* fs->n_fatent */
+    DWORD scanned;              /* entries below this are in the bitmap */
+    DWORD nfree;                /* free clusters among them */
+    uint8_t *buffer;            /* while building */
+    task_t task;
+} fat_bitmap_t;
+
+static fat_bitmap_t fat_bitmap[FF_VOLUMES];
+
+static fat_bitmap_t *bitmap_get(FATFS *fs)
+{
+    fat_bitmap_t *bm = &fat_bitmap[fs->pdrv];
+
+    if(!bm->bits || bm->fs != fs || bm->id != fs->id)
+        return NULL;
+    return bm;
+}
+
+static fat_bitmap_t *bitmap_ready(FATFS *fs)
+{
+    fat_bitmap_t *bm = bitmap_get(fs);
+
+    return (bm && bm->scanned == bm->entries) ? bm : NULL;
+}
+
+static inline bool bit_free(const fat_bitmap_t *bm, DWORD c)
+{
+    return bm->bits[c >> 5] & (1UL << (c & 31));
+}
+
+static void bitmap_discard(fat_bitmap_t *bm)
+{
+    free(bm->bits);
+    free(bm->buffer);
+    bm->bits = NULL;
+    bm->buffer = NULL;
+}
+
+static bool bitmap_step(task_t *task)
+{
+    fat_bitmap_t *bm = task->context;
+    FATFS *fs = bm->fs;
+    int per_sector = fs->fs_type == FS_FAT16 ? 256 : 128;
+    LBA_t sector = fs->fatbase + bm->scanned / per_sector;
+    UINT count = BITMAP_STEP_SECTORS;
+    const uint8_t *p;
+    DWORD c, value;
+
+    if(bm->id != fs->id || !fs->fs_type){ /* remounted or unmounted under us */
+        bitmap_discard(bm);
+        return false;
+    }
+
+    if((bm->entries - bm->scanned + per_sector - 1) / per_sector < count)
+        count = (bm->entries - bm->scanned + per_sector - 1) / per_sector;
+    if(disk_read(fs->pdrv, bm->buffer, sector, count) != RES_OK){
+        printf("fat_bitmap: cannot read the FAT on drive %d\n", fs->pdrv);
+        bitmap_discard(bm);
+        return false;
+    }
+    if(fs->winsect >= sector && fs->winsect < sector + count)
+        memcpy(bm->buffer + (fs->winsect - sector) * FF_MAX_SS, fs->win, FF_MAX_SS);
+
+    /* scanned is always at the start of a FAT sector here */
+    p = bm->buffer;
+    for(c = bm->scanned; c < bm->entries && c < bm->scanned + count * per_sector; c++){
+        if(fs->fs_type == FS_FAT16){
+            value = p[0] | (p[1] << 8);
+            p += 2;
+        }else{
+            value = (p[0] | (p[1] << 8) | (p[2] << 16) | ((DWORD)p[3] << 24)) & 0x0FFFFFFF;
+            p += 4;
+        }
+        if(value == 0 && c >= 2){
+            bm->bits[c >> 5] |= 1UL << (c & 31);
+            bm->nfree++;
+        }
+    }
+    bm->scanned = c;
+
+    if(bm->scanned < bm->entries)
+        return true;
+
+    /* FSINFO may have been wrong; it is right now */
+    if(fs->free_clst != bm->nfree){
+        fs->free_clst = bm->nfree;
+        fs->fsi_flag |= 1;
+    }
+    free(bm->buffer);
+    bm->buffer = NULL;
+    return false;
+}
+
+void ff_bitmap_start(FATFS *fs)
+{
+    fat_bitmap_t *bm = &fat_bitmap[fs->pdrv];
+    uint32_t size;
+
+    if(bitmap_get(fs) || (fs->fs_type != FS_FAT16 && fs->fs_type != FS_FAT32) ||
+       !get_environment_variable_int("fat_bitmap", 1))
+        return;
+
+    if(bm->buffer) /* a build for an earlier mount is still queued */
+        return;
+    bitmap_discard(bm);
+
+    size = ((fs->n_fatent + 31) >> 5) * sizeof(uint32_t);
+    if(size > heap_size / BITMAP_HEAP_FRACTION)
+        return;
+    bm->bits = malloc_unchecked(size);
+    bm->buffer = malloc_unchecked(BITMAP_STEP_SECTORS * FF_MAX_SS);
+    if(!bm->bits || !bm->buffer){
+        bitmap_discard(bm);
+        return;
+    }
+    memset(bm->bits, 0, size);
+
+    bm->fs = fs;
+    bm->id = fs->id;
+    bm->entries = fs->n_fatent;
+    bm->scanned = 0;
+    bm->nfree = 0;
+    task_start(&bm->task, "fat bitmap", bitmap_step, bm);
+}
+
+void ff_bitmap_update(FATFS *fs, DWORD clst, bool used)
+{
+    fat_bitmap_t *bm = bitmap_get(fs);
+
+    if(!bm || clst >= bm->scanned || used != bit_free(bm, clst))
+        return; /* not reached yet, or no change */
+
+    bm->bits[clst >> 5] ^= 1UL << (clst & 31);
+    if(used)
+        bm->nfree--;
+    else
+        bm->nfree++;
+}
+
+bool ff_bitmap_free_count(FATFS *fs, DWORD *nfree)
+{
+    fat_bitmap_t *bm = bitmap_ready(fs);
+
+    if(!bm)
+        return false;
+    *nfree = bm->nfree;
+    return true;
+}
+
+/* first free cluster in [from, to), or 0 */
+static DWORD bitmap_search(const fat_bitmap_t *bm, DWORD from, DWORD to)
+{
+    DWORD c = from;
+
+    while(c < to){
+        if(!(c & 31) && !bm->bits[c >> 5]){ /* skip a word at a time */
+            c += 32;
+            continue;
+        }
+        if(bit_free(bm, c))
+            return c;
+        c++;
+    }
+    return 0;
+}
+
+bool ff_bitmap_find_free(FATFS *fs, DWORD scl, DWORD *ncl)
+{
+    fat_bitmap_t *bm = bitmap_ready(fs);
+
+    if(!bm){
+        ff_bitmap_start(fs);
+        return false;
+    }
+
+    if(scl < 2 || scl >= bm->entries)
+        scl = 1;
+    *ncl = bm->nfree ? bitmap_search(bm, scl + 1, bm->entries) : 0;
+    if(!*ncl && bm->nfree)
+        *ncl = bitmap_search(bm, 2, scl + 1);
+    return true;
+}
+
+bool ff_bitmap_find_run(FATFS *fs, DWORD scl, DWORD count, DWORD *start)
+{
+    fat_bitmap_t *bm = bitmap_ready(fs);
+    DWORD c, run;
+
+    if(!bm){
+        ff_bitmap_start(fs);
+        return false;
+    }
+
+    /* from scl to the end, then from the start; a run never wraps */
+    for(int pass=0; pass<2; pass++){
+        c = pass ? 2 : scl;
+        while((c = bitmap_search(bm, c, bm->entries))){
+            for(run = 1; run < count && c + run < bm->entries && bit_free(bm, c + run); run++);
+            if(run == count){
+                *start = c;
+                return true;
+            }
+            c += run;
+        }
+    }
+
+    *start = 0;
+    return true;
+}
+
+void ff_bitmap_report(void)
+{
+    for(int v=0; v<FF_VOLUMES; v++){
+        fat_bitmap_t *bm = &fat_bitmap[v];
+        if(!bm->bits)
+            continue;
+        printf("fat bitmap: drive %d: %lu clusters, ", v, bm->entries - 2);
+        if(bm->scanned < bm->entries)
+            printf("building (%lu%%)\n", (bm->scanned / 16) * 100 / (bm->entries / 16 + 1));
+        else
+            printf("%lu free, %lu bytes\n", bm->nfree, ((bm->entries + 31) >> 5) * 4);
+    }
+}
@@ -0,0 +1,195 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <cli.h>
+#include <fatfs/ff.h>
+#include <fatfs/ffdircache.h>
+
+/* Every path FatFs opens is resolved one component at a time, and each
+ * component is a linear scan of its directory from the top. Scripts and
+ * load commands open the same few paths over and over, so this remembers
+ * where recent lookups ended up: (directory, name) -> (entry offset, first
+ * cluster, size). It is direct-mapped on a hash of the case-folded name.
+ *
+ * Entries are dropped when their directory loses an entry (unlink, rename)
+ * and when their sector has an entry's cluster or size rewritten (file
+ * writes, truncation). A hit is checked against the entry on disk anyway,
+ * so a stale slot costs a scan and nothing worse.
+ *
+ * "set dir_cache <n>" sets the number of slots (rounded down to a power of
+ * two); 0 turns it off. */
+
+#define DIRCACHE_DEFAULT        64
+#define DIRCACHE_MAX            1024
+#define DIRCACHE_NAME_MAX       32      /* longer names are not cached */
+
+typedef struct {
+    FATFS *fs;                  /* NULL: slot unused */
+    WORD id;                    /* mount id */
+    BYTE len;
+    DWORD dir;                  /* start cluster of the directory */
+    DWORD hash;
+    LBA_t sect;                 /* sector holding the SFN entry */
+    ff_dirloc_t loc;
+    WCHAR name[DIRCACHE_NAME_MAX];
+} dircache_entry_t;
+
+static dircache_entry_t *dircache = NULL;
+static int dircache_slots = 0;
+static uint32_t dircache_hits = 0, dircache_misses = 0, dircache_stale = 0, dircache_dropped = 0;
+
+static bool dircache_ready(void)
+{
+    int want = get_environment_variable_int("dir_cache", DIRCACHE_DEFAULT);
+    int slots;
+
+    if(want > DIRCACHE_MAX)
+        want = DIRCACHE_MAX;
+    for(slots = want > 0 ? 1 : 0; slots && slots * 2 <= want; slots *= 2);
+
+    if(slots != dircache_slots){
+        free(dircache);
+        dircache = NULL;
+        dircache_slots = 0;
+        if(slots){
+            dircache = malloc_unchecked(slots * sizeof(dircache_entry_t));
+            if(!dircache)
+                return false;
+            memset(dircache, 0, slots * sizeof(dircache_entry_t));
+            dircache_slots = slots;
+        }
+    }
+
+    return dircache_slots != 0;
+}
+
+/* the FAT32 root is cluster 0 or fs->dirbase depending on how it was reached */
+static DWORD dir_key(DIR *dp)
+{
+    FATFS *fs = dp->obj.fs;
+
+    if(dp->obj.sclust == 0 && fs->fs_type == FS_FAT32)
+        return (DWORD)fs->dirbase;
+    return dp->obj.sclust;
+}
+
+/* hash and case-folded copy of the name being looked up; false if unsuitable */
+static bool dircache_name(DIR *dp, WCHAR *name, BYTE *len, DWORD *hash)
+{
+    const WCHAR *lfn = dp->obj.fs->lfnbuf;
+    DWORD h = dir_key(dp);
+    int i;
+
+    for(i=0; lfn[i]; i++){
+        if(i == DIRCACHE_NAME_MAX)
+            return false;
+        name[i] = (WCHAR)ff_wtoupper(lfn[i]);
+        h = ((h << 5) + h) ^ name[i];
+    }
+    if(!i)
+        return false;
+
+    *len = i;
+    *hash = h;
+    return true;
+}
+
+static dircache_entry_t *dircache_slot(DWORD hash)
+{
+    return &dircache[(hash ^ (hash >> 16)) & (dircache_slots - 1)];
+}
+
+bool ff_dircache_lookup(DIR *dp, ff_dirloc_t *loc)
+{
+    FATFS *fs = dp->obj.fs;
+    WCHAR name[DIRCACHE_NAME_MAX];
+    dircache_entry_t *e;
+    DWORD hash;
+    BYTE len;
+
+    if(!dircache_ready() || !dircache_name(dp, name, &len, &hash))
+        return false;
+
+    e = dircache_slot(hash);
+    if(e->fs != fs || e->id != fs->id || e->hash != hash || e->dir != dir_key(dp) ||
+       e->len != len || memcmp(e->name, name, len * sizeof(WCHAR))){
+        dircache_misses++;
+        return false;
+    }
+
+    *loc = e->loc;
+    dircache_hits++;
+    return true;
+}
+
+void ff_dircache_record(DIR *dp, DWORD sclust, DWORD size)
+{
+    FATFS *fs = dp->obj.fs;
+    dircache_entry_t *e, tmp;
+
+    if(!dircache_slots || !dircache_name(dp, tmp.name, &tmp.len, &tmp.hash))
+        return;
+
+    e = dircache_slot(tmp.hash);
+    memcpy(e->name, tmp.name, tmp.len * sizeof(WCHAR));
+    e->len = tmp.len;
+    e->hash = tmp.hash;
+    e->fs = fs;
+    e->id = fs->id;
+    e->dir = dir_key(dp);
+    e->sect = dp->sect;
+    e->loc.dptr = dp->dptr;
+    e->loc.blk_ofs = dp->blk_ofs;
+    e->loc.sclust = sclust;
+    e->loc.size = size;
+    memcpy(e->loc.sfn, dp->dir, sizeof(e->loc.sfn));
+}
+
+void ff_dircache_forget(DIR *dp)
+{
+    WCHAR name[DIRCACHE_NAME_MAX];
+    DWORD hash;
+    BYTE len;
+
+    if(dircache_slots && dircache_name(dp, name, &len, &hash)){
+        dircache_slot(hash)->fs = NULL;
+        dircache_stale++;
+    }
+}
+
+void ff_dircache_invalidate_dir(FATFS *fs, DWORD dir_sclust)
+{
+    if(dir_sclust == 0 && fs->fs_type == FS_FAT32)
+        dir_sclust = (DWORD)fs->dirbase;
+
+    for(int i=0; i<dircache_slots; i++)
+        if(dircache[i].fs == fs && dircache[i].dir == dir_sclust){
+            dircache[i].fs = NULL;
+            dircache_dropped++;
+        }
+}
+
+void ff_dircache_invalidate_sector(FATFS *fs, LBA_t sect)
+{
+    for(int i=0; i<dircache_slots; i++)
+        if(dircache[i].fs == fs && dircache[i].sect == sect){
+            dircache[i].fs = NULL;
+            dircache_dropped++;
+        }
+}
+
+void ff_dircache_report(void)
+{
+    int used = 0;
+
+    if(!dircache_slots)
+        return;
+
+    for(int i=0; i<dircache_slots; i++)
+        if(dircache[i].fs)
+            used++;
+
+    printf("dir cache: %d/%d slots used, %lu hits, %lu misses, %lu stale, %lu invalidated\n",
+            used, dircache_slots, dircache_hits, dircache_misses, dircache_stale, dircache_dropped);
+}
@@ -30,6 +30,15 @@
 #define MERGE2(a, b) a ## b
 #define CVTBL(tbl, cp) MERGE2(tbl, cp)
 
+#if FF_UNICODE_COMPACT != 0	/* gogoboot: trimmed tables */
+#if FF_FS_EXFAT
+#error FF_UNICODE_COMPACT needs FF_FS_EXFAT = 0
+#endif
+#if FF_CODE_PAGE == 0 || FF_CODE_PAGE >= 900
+#error FF_UNICODE_COMPACT needs a fixed SBCS code page
+#endif
+#endif
+
 
 /*------------------------------------------------------------------------*/
 /* Code Conversion Tables                                                 */
@@ -15005,6 +15014,7 @@ static const WCHAR oem2uni950[] = {	/* Big5 --> Unicode pairs */
 };
 #endif
 
+#if FF_UNICODE_COMPACT < 2	/* gogoboot: ASCII-only needs no SBCS table */
 #if FF_CODE_PAGE == 437 || FF_CODE_PAGE == 0
 static const WCHAR uc437[] = {	/*  CP437(U.S.) to Unicode conversion table */
 	0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7, 0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
@@ -15209,6 +15219,7 @@ static const WCHAR uc869[] = {	/*  CP869(Greek 2) to Unicode conversion table */
 	0x00AD, 0x00B1, 0x03C5, 0x03C6, 0x03C7, 0x00A7, 0x03C8, 0x0385, 0x00B0, 0x00A8, 0x03C9, 0x03CB, 0x03B0, 0x03CE, 0x25A0, 0x00A0
 };
 #endif
+#endif /* FF_UNICODE_COMPACT < 2 */
 
 
 
@@ -15218,7 +15229,26 @@ static const WCHAR uc869[] = {	/*  CP869(Greek 2) to Unicode conversion table */
 /* SBCS Fixed Code Page                                                   */
 /*------------------------------------------------------------------------*/
 
-#if FF_CODE_PAGE != 0 && FF_CODE_PAGE < 900
+#if FF_UNICODE_COMPACT == 2	/* gogoboot: ASCII only */
+WCHAR ff_uni2oem (	/* Returns OEM code character, zero on error */
+	DWORD	uni,	/* UTF-16 encoded character to be converted */
+	WORD	cp		/* Code page for the conversion */
+)
+{
+	(void)cp;
+	return uni < 0x80 ? (WCHAR)uni : 0;
+}
+
+WCHAR ff_oem2uni (	/* Returns Unicode character in UTF-16, zero on error */
+	WCHAR	oem,	/* OEM code to be converted */
+	WORD	cp		/* Code page for the conversion */
+)
+{
+	(void)cp;
+	return oem < 0x80 ? oem : 0;
+}
+
+#elif FF_CODE_PAGE != 0 && FF_CODE_PAGE < 900
 WCHAR ff_uni2oem (	/* Returns OEM code character, zero on error */
 	DWORD	uni,	/* UTF-16 encoded character to be converted */
 	WORD	cp		/* Code page for the conversion */
@@ -15467,6 +15497,33 @@ DWORD ff_wtoupper (	/* Returns up-converted code point */
 {
 	const WORD* p;
 	WORD uc, bc, nc, cmd;
+#if FF_UNICODE_COMPACT == 2	/* gogoboot: ASCII only */
+	static const WORD cvt1[] = {
+		0x0061,0x031A,
+		0x0000	/* EOT */
+	};
+	static const WORD cvt2[] = { 0x0000 };
+#elif FF_UNICODE_COMPACT == 1	/* gogoboot: what the SBCS code page can hold */
+	static const WORD cvt1[] = {
+		/* Basic Latin */
+		0x0061,0x031A,
+		/* Latin-1 Supplement */
+		0x00E0,0x0317,
+		0x00F8,0x0307,
+		0x00FF,0x0001,0x0178,
+		/* Latin Extended-A */
+		0x0100,0x0130,
+		0x0132,0x0106,
+		0x0139,0x0110,
+		0x014A,0x012E,
+		0x0179,0x0106,
+		/* Latin Extended-B: CP850 has U+0192 only */
+		0x0192,0x0001,0x0191,
+
+		0x0000	/* EOT */
+	};
+	static const WORD cvt2[] = { 0x0000 };
+#else
 	static const WORD cvt1[] = {	/* Compressed up conversion table for U+0000 - U+0FFF */
 		/* Basic Latin */
 		0x0061,0x031A,
@@ -15558,6 +15615,7 @@ DWORD ff_wtoupper (	/* Returns up-converted code point */
 
 		0x0000	/* EOT */
 	};
+#endif
 
 
 	if (uni < 0x10000) {	/* Is it in BMP? */
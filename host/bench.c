@@ -0,0 +1,344 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+/* make bench-host: the portable code, timed on the machine running make, so
+ * a regression shows up before a ROM is burned. The microbenchmarks follow
+ * libbench (cli/cli_bench.c); then FatFs over an image file, through the
+ * sector cache, and TFTP transfers between our own client and server across
+ * a looped-back network card, clean and then dropping frames. Anything that
+ * gives the wrong answer fails the run. */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <disk.h>
+#include <net.h>
+#include <job.h>
+#include "host.h"
+
+#define BENCH_US                (250*1000)      /* per test */
+#define BENCH_BUFFER            (16*1024)
+#define BENCH_COPY              4096
+#define BENCH_PAYLOAD           1472            /* largest UDP payload in one 1500 byte frame */
+#define BENCH_SORT              256             /* words per sort */
+#define BENCH_ALLOCS            64              /* blocks held at once */
+#define BENCH_ALLOC_MAX         600             /* bytes: the size classes and a little past */
+#define BENCH_IMAGE             "host/bench-host.img"
+#define BENCH_IMAGE_SIZE        (64 << 20)      /* big enough for FAT32 */
+#define BENCH_MKFS_WORK         (32*512)
+#define BENCH_FILE_SIZE         (256*1024)
+#define BENCH_FILE_CHUNK        4096
+#define BENCH_TFTP_SIZE         (512*1024)
+#define BENCH_TFTP_LOSS         20              /* per mille, for the lossy run */
+#define BENCH_IP                0x0a000002      /* 10.0.0.2/24: client and server both */
+
+static uint8_t *bench_buffer;
+static uint32_t bench_random_state = 1;
+static int bench_failures = 0;
+
+static uint32_t bench_random(void)
+{
+    bench_random_state = bench_random_state * 1103515245 + 12345;
+    return bench_random_state >> 8;
+}
+
+static void bench_fail(const char *what)
+{
+    printf("FAILED: %s\n", what);
+    bench_failures++;
+}
+
+/* each runs once and returns the bytes (or operations) it did, 0 on failure */
+static uint32_t bench_checksum(void)
+{
+    net_checksum_partial(bench_buffer, BENCH_PAYLOAD);
+    return BENCH_PAYLOAD;
+}
+
+static uint32_t bench_crc32(void)
+{
+    crc32_update(0, bench_buffer, BENCH_COPY);
+    return BENCH_COPY;
+}
+
+static uint32_t bench_memcpy(void)
+{
+    memcpy(bench_buffer, bench_buffer + BENCH_BUFFER/2, BENCH_COPY);
+    return BENCH_COPY;
+}
+
+static uint32_t bench_memcpy_odd(void)
+{
+    memcpy(bench_buffer, bench_buffer + BENCH_BUFFER/2 + 1, BENCH_COPY - 1);
+    return BENCH_COPY - 1;
+}
+
+static uint32_t bench_memset(void)
+{
+    memset(bench_buffer, 0x5a, BENCH_COPY);
+    return BENCH_COPY;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t bench_qsort(void)
+{
+    uint32_t *word = (uint32_t *)bench_buffer;
+
+    for(int i=0; i<BENCH_SORT; i++)
+        word[i] = bench_random();
+    qsort(word, BENCH_SORT, sizeof(uint32_t), bench_compare);
+    for(int i=1; i<BENCH_SORT; i++)
+        if(word[i-1] > word[i])
+            return 0;
+    return 1;
+}
+
+static uint32_t bench_malloc(void)
+{
+    void *block[BENCH_ALLOCS];
+
+    for(int i=0; i<BENCH_ALLOCS; i++)
+        if(!(block[i] = malloc_unchecked(1 + bench_random() % BENCH_ALLOC_MAX)))
+            return 0;
+    for(int i=0; i<BENCH_ALLOCS; i++)
+        free(block[BENCH_ALLOCS - 1 - (i ^ 5) % BENCH_ALLOCS]); /* not quite in order */
+    return 2 * BENCH_ALLOCS;
+}
+
+static uint32_t bench_file_write(void)
+{
+    FIL fd;
+    UINT done;
+    uint32_t bytes = 0;
+
+    if(f_open(&fd, "0:/bench.tmp", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        return 0;
+    while(bytes < BENCH_FILE_SIZE &&
+          f_write(&fd, bench_buffer, BENCH_FILE_CHUNK, &done) == FR_OK && done == BENCH_FILE_CHUNK)
+        bytes += done;
+    if(f_close(&fd) != FR_OK)
+        return 0;
+    return bytes;
+}
+
+static uint32_t bench_file_read(void)
+{
+    FIL fd;
+    UINT done;
+    uint32_t bytes = 0;
+
+    if(f_open(&fd, "0:/bench.tmp", FA_READ) != FR_OK)
+        return 0;
+    while(f_read(&fd, bench_buffer + BENCH_BUFFER/2, BENCH_FILE_CHUNK, &done) == FR_OK && done)
+        bytes += done;
+    f_close(&fd);
+    return bytes;
+}
+
+static uint32_t bench_file_open(void)
+{
+    FIL fd;
+
+    if(f_open(&fd, "0:/bench.tmp", FA_READ) != FR_OK)
+        return 0;
+    f_close(&fd);
+    return 1;
+}
+
+typedef struct {
+    const char *name;
+    uint32_t (*run)(void);
+    bool bytes;                 /* report KB/s, not operations/s */
+} bench_test_t;
+
+static const bench_test_t bench_tests[] = {
+    { "checksum",       bench_checksum,         true  },
+    { "crc32",          bench_crc32,            true  },
+    { "memcpy",         bench_memcpy,           true  },
+    { "memcpy odd",     bench_memcpy_odd,       true  },
+    { "memset",         bench_memset,           true  },
+    { "qsort 256",      bench_qsort,            false },
+    { "malloc+free",    bench_malloc,           false },
+    { "file write",     bench_file_write,       true  },
+    { "file read",      bench_file_read,        true  },
+    { "file open",      bench_file_open,        false },
+};
+#define BENCH_TESTS (sizeof(bench_tests) / sizeof(bench_tests[0]))
+
+static void bench_run(const bench_test_t *test)
+{
+    unsigned long long begin, elapsed;
+    uint32_t amount = 0, done;
+
+    begin = host_clock_us();
+    do{
+        done = test->run();
+        if(!done){
+            bench_fail(test->name);
+            return;
+        }
+        amount += done;
+        elapsed = host_clock_us() - begin;
+    }while(elapsed < BENCH_US);
+
+    if(test->bytes)
+        printf("%-14s %8lu KB/s\n", test->name, (uint32_t)((amount * 1000000ULL / elapsed) >> 10));
+    else
+        printf("%-14s %8lu ops/s\n", test->name, (uint32_t)(amount * 1000000ULL / elapsed));
+}
+
+/* known answers, so a fast wrong result does not pass */
+static void bench_check_answers(void)
+{
+    static const uint8_t rfc1071[8] = { 0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6, 0xf7 };
+    uint8_t odd[9];
+
+    if(net_checksum_partial(rfc1071, sizeof(rfc1071)) != 0xddf2)
+        bench_fail("checksum of the RFC 1071 example");
+    if(crc32_update(0, "123456789", 9) != 0xcbf43926)
+        bench_fail("crc32 check value");
+
+    for(int i=0; i<BENCH_COPY; i++)
+        bench_buffer[BENCH_BUFFER/2 + i] = i * 7;
+    bench_memcpy_odd();
+    for(int i=0; i<BENCH_COPY-1; i++)
+        if(bench_buffer[i] != (uint8_t)((i + 1) * 7)){
+            bench_fail("memcpy from an odd address");
+            break;
+        }
+    memcpy(odd, "abcdefgh", 9);
+    memmove(odd + 1, odd, 7);
+    if(memcmp(odd, "aabcdefg", 9) != 0)
+        bench_fail("overlapping memmove");
+}
+
+static bool bench_volume(void)
+{
+    static const MKFS_PARM opt = { FM_FAT32 | FM_SFD, 0, 0, 0, 0 };
+    void *work = malloc(BENCH_MKFS_WORK);
+    FRESULT fr;
+
+    if(!host_disk_open(BENCH_IMAGE, BENCH_IMAGE_SIZE)){
+        bench_fail("cannot create " BENCH_IMAGE);
+        return false;
+    }
+    disk_cache_init();
+
+    fr = f_mkfs("0:", &opt, work, BENCH_MKFS_WORK);
+    free(work);
+    if(fr != FR_OK){
+        bench_fail("f_mkfs");
+        return false;
+    }
+    return true;
+}
+
+static uint32_t bench_file_crc(const char *name, uint32_t *size)
+{
+    FIL fd;
+    UINT done;
+    uint32_t crc = 0;
+
+    *size = 0;
+    if(f_open(&fd, name, FA_READ) != FR_OK)
+        return 0;
+    while(f_read(&fd, bench_buffer, BENCH_BUFFER, &done) == FR_OK && done){
+        crc = crc32_update(crc, bench_buffer, done);
+        *size += done;
+    }
+    f_close(&fd);
+    return crc;
+}
+
+/* our client fetches from our server; every frame either sends goes round the
+ * loopback, which loses per_mille of them. Each run keeps its copy: tftpd
+ * serves a fetched file under its remote name, so the next run reads it. */
+static void bench_tftp(const char *name, const char *copy, int per_mille)
+{
+    unsigned long frames, dropped, overflowed, frames0, dropped0, overflowed0;
+    unsigned long long begin, elapsed;
+    uint32_t crc, size, copy_crc, copy_size;
+    bool ok;
+
+    crc = bench_file_crc("0:/tftp.src", &size);
+
+    host_eth_set_loss(per_mille);
+    host_eth_stats(&frames0, &dropped0, &overflowed0);
+    begin = host_clock_us();
+    ok = tftp_transfer(BENCH_IP, "tftp.src", copy, false);
+    elapsed = host_clock_us() - begin;
+    job_pump(); /* the server reaps its session */
+    host_eth_stats(&frames, &dropped, &overflowed);
+
+    copy_crc = bench_file_crc(copy, &copy_size);
+    if(!ok || copy_size != size || copy_crc != crc){
+        bench_fail(name);
+        return;
+    }
+    printf("%-14s %8lu KB/s  %lu frames, %lu dropped, %lu overflowed\n", name,
+            (uint32_t)((size * 1000000ULL / elapsed) >> 10),
+            frames - frames0, dropped - dropped0, overflowed - overflowed0);
+}
+
+static bool bench_tftp_setup(void)
+{
+    static const macaddr_t mac = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    FIL fd;
+    UINT done;
+    uint32_t bytes = 0;
+
+    net_interface_count = 1;
+    memcpy(interface_macaddr, mac, sizeof(macaddr_t));
+    interface_ipv4_address = BENCH_IP;
+    interface_subnet_mask = 0xffffff00;
+    net_init();
+
+    if(f_open(&fd, "0:/tftp.src", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        return false;
+    while(bytes < BENCH_TFTP_SIZE){
+        for(int i=0; i<BENCH_BUFFER; i++)
+            bench_buffer[i] = bench_random();
+        if(f_write(&fd, bench_buffer, BENCH_BUFFER, &done) != FR_OK || done != BENCH_BUFFER)
+            break;
+        bytes += done;
+    }
+    if(f_close(&fd) != FR_OK || bytes != BENCH_TFTP_SIZE)
+        return false;
+
+    return tftpd_start(false);
+}
+
+int main(int argc, char *argv[])
+{
+    host_init();
+    printf("bench-host: %d ms per test\n", BENCH_US / 1000);
+
+    bench_buffer = malloc(BENCH_BUFFER);
+    for(int i=0; i<BENCH_BUFFER; i++)
+        bench_buffer[i] = bench_random();
+    bench_check_answers();
+
+    if(bench_volume()){
+        for(int t=0; t<BENCH_TESTS; t++)
+            bench_run(&bench_tests[t]);
+        f_unlink("0:/bench.tmp");
+
+        if(bench_tftp_setup()){
+            bench_tftp("tftp", "0:/tftp1.dst", 0);
+            bench_tftp("tftp lossy", "0:/tftp2.dst", BENCH_TFTP_LOSS);
+        }else
+            bench_fail("tftp setup");
+    }
+
+    host_image_close();
+    if(bench_failures){
+        printf("bench-host: %d failed\n", bench_failures);
+        return 1;
+    }
+    return 0;
+}
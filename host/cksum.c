@@ -0,0 +1,25 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <net.h>
+
+/* net/cksum.s in C: the sum of the buffer as big-endian 16-bit words, with
+ * a trailing byte as the high half of a word, folded to 16 bits but not
+ * complemented. Byte by byte, so it gives the same answer on any host. */
+uint32_t net_checksum_partial(const void *buf, unsigned int len)
+{
+    const uint8_t *p = buf;
+    uint32_t sum = 0;
+
+    while(len >= 2){
+        sum += (p[0] << 8) | p[1];
+        p += 2;
+        len -= 2;
+    }
+    if(len)
+        sum += p[0] << 8;
+
+    while(sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return sum;
+}
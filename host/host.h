@@ -0,0 +1,24 @@
+#ifndef __HOST_DOT_H__
+#define __HOST_DOT_H__
+
+/* make bench-host: lib/, net/ and fatfs/ built for the machine running make,
+ * over stub hardware. Everything but host/os.c is built with our own headers;
+ * os.c is built with the C library's, and this is all they share, so it
+ * sticks to the basic C types. */
+
+/* host/os.c */
+unsigned long long host_clock_us(void);     /* monotonic */
+void host_write(const char *buf, int len);  /* standard output */
+void host_exit(int status);
+int host_image_open(const char *path, unsigned long size); /* disk image, created at size; 0 on failure */
+int host_image_read(unsigned long offset, void *buf, int len);      /* 0 on failure */
+int host_image_write(unsigned long offset, const void *buf, int len);
+void host_image_close(void);
+
+/* host/hw.c */
+void host_init(void);                       /* heap and timer */
+int host_disk_open(const char *path, unsigned long size); /* disk 0, over a new image; 0 on failure */
+void host_eth_set_loss(int per_mille);      /* frames dropped, each way */
+void host_eth_stats(unsigned long *frames, unsigned long *dropped, unsigned long *overflowed);
+
+#endif
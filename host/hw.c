@@ -0,0 +1,326 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+/* Stub hardware for make bench-host: a timer from the host clock, the console
+ * on standard output, disk 0 over an image file and a looped-back network
+ * card that drops a share of what it carries. Just enough of what the targets
+ * and core/ provide for lib/, net/ and fatfs/ to run unchanged. */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <tinyalloc.h>
+#include <init.h>
+#include <disk.h>
+#include <rtc.h>
+#include <cli.h>
+#include <loader.h>
+#include <net.h>
+#include <profile.h>
+#include "host.h"
+
+#define HOST_HEAP_SIZE      (2 << 20)   /* MAXHEAP, as the Q40 and KISS get */
+#define HOST_HEAP_BLOCKS    1024
+#define HOST_RX_RING        (58 * 256)  /* an NE2000's receive ring, less its transmit buffers */
+#define HOST_PEEK_LENGTH    (sizeof(ethernet_header_t) + sizeof(ipv4_header_t) + sizeof(udp_header_t) + NET_PEEK_DATA)
+#define HOST_WIRE_FRAMES    64          /* frames in flight on the loopback */
+
+uint32_t heap_base, heap_size, free_ram_top;
+volatile bool profile_heap_enabled = false;
+bool netcap_running = false;
+
+static uint8_t host_heap[HOST_HEAP_SIZE] __attribute__((aligned(16)));
+static unsigned long long host_start_us;
+
+void host_init(void)
+{
+    heap_size = HOST_HEAP_SIZE;
+    ta_init(host_heap, host_heap + HOST_HEAP_SIZE - 1, HOST_HEAP_BLOCKS, 16, 4, HOST_HEAP_SIZE / 8);
+    host_start_us = host_clock_us();
+}
+
+void halt(void)
+{
+    printf("halted\n");
+    host_exit(1);
+}
+
+/* --- timer --- */
+
+timer_t gogoboot_read_timer(void)
+{
+    return (host_clock_us() - host_start_us) / TIMER_US_PER_TICK;
+}
+
+uint32_t timer_sub_tick_us(void)
+{
+    return (host_clock_us() - host_start_us) % TIMER_US_PER_TICK;
+}
+
+void timer_sub_tick_enable(bool on)
+{
+}
+
+void rtc_read_clock(rtc_time_t *now)
+{
+    now->year = 2023;
+    now->month = 7;
+    now->day = 23;
+    now->hour = now->minute = now->second = 0;
+}
+
+/* --- console --- */
+
+void uart_write_byte(char b)
+{
+    host_write(&b, 1);
+}
+
+int uart_write_string(const char *str)
+{
+    int len = strlen(str);
+
+    host_write(str, len);
+    return len;
+}
+
+bool uart_check_cancel_key(void)
+{
+    return false;
+}
+
+bool netcon_write_byte(char ch)
+{
+    return false;
+}
+
+bool netcon_write(const char *str, int len)
+{
+    return false;
+}
+
+void netcon_pump(void)
+{
+}
+
+void netcap_frame(packet_t *packet)
+{
+}
+
+void profile_heap_record(uint32_t caller, uint32_t size)
+{
+}
+
+void pretty_dump_memory(void *start, int len)
+{
+    uint8_t *p = start;
+
+    for(int i=0; i<len; i++)
+        printf("%02x%c", p[i], (i & 15) == 15 ? '\n' : ' ');
+    putchar('\n');
+}
+
+int get_environment_variable_int(const char *name, int default_value)
+{
+    return default_value;
+}
+
+const char *f_errmsg(int errno)
+{
+    return "FatFs error";
+}
+
+/* nothing is loaded into memory on the host */
+bool load_target_prepare(uint32_t paddr, uint32_t size)
+{
+    return false;
+}
+
+void *load_target_pointer(uint32_t paddr, uint32_t len)
+{
+    return NULL;
+}
+
+void load_target_write(uint32_t paddr, const void *data, uint32_t len)
+{
+}
+
+/* --- disk 0, over the image file --- */
+
+static disk_t *host_disk = NULL;
+
+int host_disk_open(const char *path, unsigned long size)
+{
+    if(!host_image_open(path, size))
+        return 0;
+
+    host_disk = malloc(sizeof(disk_t));
+    memset(host_disk, 0, sizeof(disk_t));
+    host_disk->sectors = size >> 9;
+    host_disk->multiple = 1;
+    host_disk->pio_mode = -1;
+    strcpy(host_disk->model, "host image");
+    f_mount(&host_disk->fat_fs_workarea, "0:", 0); /* lazy mount */
+    return 1;
+}
+
+disk_t *disk_get_info(int nr)
+{
+    return nr == 0 ? host_disk : NULL;
+}
+
+bool disk_data_read(int disk, void *buff, uint32_t sector, int sector_count)
+{
+    if(disk != 0 || !host_disk || sector + sector_count > host_disk->sectors)
+        return false;
+    host_disk->stats.commands++;
+    host_disk->stats.sectors_read += sector_count;
+    return host_image_read((unsigned long)sector << 9, buff, sector_count << 9);
+}
+
+bool disk_data_write(int disk, const void *buff, uint32_t sector, int sector_count)
+{
+    if(disk != 0 || !host_disk || sector + sector_count > host_disk->sectors)
+        return false;
+    host_disk->stats.commands++;
+    host_disk->stats.sectors_written += sector_count;
+    return host_image_write((unsigned long)sector << 9, buff, sector_count << 9);
+}
+
+bool disk_flush(int nr)
+{
+    return true;
+}
+
+void disk_remount(int nr)
+{
+    disk_cache_invalidate();
+    if(!disk_get_info(nr))
+        return;
+    f_mount(NULL, "0:", 0);
+    f_mount(&host_disk->fat_fs_workarea, "0:", 0);
+}
+
+/* the image answers at once, so requests finish as they are submitted */
+void disk_submit(disk_request_t *req)
+{
+    if(req->is_write)
+        req->ok = req->count <= 0 || disk_data_write(req->disk, req->buff, req->sector, req->count);
+    else
+        req->ok = req->count <= 0 || disk_data_read(req->disk, req->buff, req->sector, req->count);
+    req->done = true;
+}
+
+bool disk_request_wait(disk_request_t *req)
+{
+    return req->ok;
+}
+
+/* --- the network card: what it sends, it receives --- */
+
+typedef struct {
+    uint16_t length;
+    uint8_t frame[PACKET_MAXLEN];
+} wire_frame_t;
+
+static wire_frame_t host_wire[HOST_WIRE_FRAMES];
+static int host_wire_head = 0, host_wire_count = 0;
+static int host_loss = 0;                       /* per mille */
+static uint32_t host_random_state = 1;
+static unsigned long host_frames, host_dropped, host_overflowed;
+
+static uint32_t host_random(void)
+{
+    host_random_state = host_random_state * 1103515245 + 12345;
+    return (host_random_state >> 16) & 0x7fff;
+}
+
+void host_eth_set_loss(int per_mille)
+{
+    host_loss = per_mille;
+    host_random_state = 1; /* the same losses every run */
+}
+
+void host_eth_stats(unsigned long *frames, unsigned long *dropped, unsigned long *overflowed)
+{
+    *frames = host_frames;
+    *dropped = host_dropped;
+    *overflowed = host_overflowed;
+}
+
+static void host_wire_send(packet_t *packet)
+{
+    wire_frame_t *w;
+
+    host_frames++;
+    if(host_loss && (host_random() % 1000) < host_loss){
+        host_dropped++;
+        return;
+    }
+    if(host_wire_count == HOST_WIRE_FRAMES){
+        host_overflowed++;
+        return;
+    }
+    w = &host_wire[(host_wire_head + host_wire_count++) % HOST_WIRE_FRAMES];
+    w->length = packet->buffer_length;
+    memcpy(w->frame, packet->buffer, packet->buffer_length);
+}
+
+/* as the NE2000 driver does: peek at the headers, and let a sink that wants
+ * the payload elsewhere have it there */
+static void host_wire_receive(wire_frame_t *w)
+{
+    packet_t *packet = packet_alloc(w->length);
+    int offset, placed;
+
+    packet->ifindex = 0;
+    if(w->length <= HOST_PEEK_LENGTH){
+        memcpy(packet->buffer, w->frame, w->length);
+    }else{
+        memcpy(packet->buffer, w->frame, HOST_PEEK_LENGTH);
+        offset = net_eth_peek(packet, HOST_PEEK_LENGTH);
+        if(offset){
+            placed = packet->data_length - packet->placed_offset;
+            memcpy(packet->placed_data, w->frame + offset, placed);
+            memcpy(packet->buffer + offset + placed, w->frame + offset + placed, w->length - (offset + placed));
+        }else
+            memcpy(packet->buffer + HOST_PEEK_LENGTH, w->frame + HOST_PEEK_LENGTH, w->length - HOST_PEEK_LENGTH);
+    }
+    net_eth_push(packet);
+}
+
+bool eth_attempt_tx(packet_t *packet)
+{
+    host_wire_send(packet);
+    return true;
+}
+
+void eth_pump(void)
+{
+    packet_t *packet;
+    int count = host_wire_count;
+
+    /* only what was on the wire when we started: replies go round next time */
+    while(count--){
+        host_wire_receive(&host_wire[host_wire_head]);
+        host_wire_head = (host_wire_head + 1) % HOST_WIRE_FRAMES;
+        host_wire_count--;
+    }
+
+    while((packet = net_eth_pull(0))){
+        host_wire_send(packet);
+        packet_free(packet);
+    }
+}
+
+int eth_rxbuffer_size(void)
+{
+    return HOST_RX_RING;
+}
+
+void eth_set_multicast(const macaddr_t *list, int count)
+{
+}
+
+void eth_reset_stats(void)
+{
+}
@@ -0,0 +1,69 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+/* The only part of make bench-host built against the C library. The rest has
+ * its own printf, malloc, memcpy and so on, renamed at link time so the two
+ * sets stay apart; see the Makefile. */
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "host.h"
+
+static int image_fd = -1;
+
+unsigned long long host_clock_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void host_write(const char *buf, int len)
+{
+    ssize_t r;
+
+    while(len > 0){
+        r = write(STDOUT_FILENO, buf, len);
+        if(r <= 0)
+            return;
+        buf += r;
+        len -= r;
+    }
+}
+
+void host_exit(int status)
+{
+    exit(status);
+}
+
+int host_image_open(const char *path, unsigned long size)
+{
+    image_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(image_fd < 0)
+        return 0;
+    if(ftruncate(image_fd, size) != 0){
+        close(image_fd);
+        image_fd = -1;
+        return 0;
+    }
+    return 1;
+}
+
+int host_image_read(unsigned long offset, void *buf, int len)
+{
+    return pread(image_fd, buf, len, offset) == len;
+}
+
+int host_image_write(unsigned long offset, const void *buf, int len)
+{
+    return pwrite(image_fd, buf, len, offset) == len;
+}
+
+void host_image_close(void)
+{
+    if(image_fd >= 0)
+        close(image_fd);
+    image_fd = -1;
+}
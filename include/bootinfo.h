@@ -23,6 +23,7 @@ struct mem_info {
 #define BI_MMUTYPE              0x0004  /* mmu type (unsigned long) */
 #define BI_MEMCHUNK             0x0005  /* memory chunk address and size */
                                         /* (struct mem_info) */
+#define BI_MAX_MEMCHUNKS        4       /* the kernel takes no more (NUM_MEMINFO) */
 #define BI_RAMDISK              0x0006  /* ramdisk address and size */
                                         /* (struct mem_info) */
 #define BI_COMMAND_LINE         0x0007  /* kernel command line parameters */
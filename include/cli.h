@@ -19,6 +19,11 @@ void f_perror(int errno);
 // execute loaded code (wrapper that ultimately calls machine_execute)
 void execute(void *entry_vector, int argc, char **argv);
 FRESULT load_data(FIL *fd, uint32_t paddr, uint32_t offset, uint32_t file_size, uint32_t size);
+extern const char elf_header_bytes[4];
+extern const char m68k_header_bytes[2];
+extern const char script_header_bytes[8];
+#define HEADER_EXAMINE_SIZE 16 /* number of bytes we examine to determine the file type */
+void execute_script_memory(const char *name, const char *script, uint32_t length);
 
 typedef struct
 {
@@ -40,6 +45,17 @@ void do_mkdir(char *argv[], int argc);
 void do_mv(char *argv[], int argc);
 void do_cp(char *argv[], int argc);
 void do_rxfile(char *argv[], int argc);
+void do_rx(char *argv[], int argc);
+void do_crc32(char *argv[], int argc);
+void do_sha256(char *argv[], int argc);
+
+// cli_disk.c
+void do_dd(char *argv[], int argc);
+void do_ramdisk(char *argv[], int argc);
+
+// cli_jobs.c
+void do_jobs(char *argv[], int argc);
+void do_kill(char *argv[], int argc);
 
 // cli_env.c
 void do_set(char *argv[], int argc);
@@ -47,20 +63,52 @@ void do_set(char *argv[], int argc);
 // cli_mem.c
 void do_dump(char *argv[], int argc);
 void do_memtest(char *argv[], int argc);
+void do_memmap(char *argv[], int argc);
+void do_ramdump(char *argv[], int argc);
 void do_writemem(char *argv[], int argc);
 
 // core/memtest.c
 void memory_test(uint32_t base, uint32_t size);
+void memtest_fill_32(uint32_t fill, volatile uint32_t *start, volatile uint32_t *end); /* 16-byte aligned */
+uint16_t memtest_check_pattern(uint32_t check, volatile uint32_t *start, volatile uint32_t *end);
+void memory_test_ranges(int count, const uint32_t *base, const uint32_t *size, bool fast);
 
 // cli_info.c
 void help(char *argv[], int argc);
 void do_meminfo(char *argv[], int argc);
 void do_netinfo(char *argv[], int argc);
+void do_ethtx(char *argv[], int argc);
+void do_ethirq(char *argv[], int argc);
+void do_ethmedia(char *argv[], int argc);
+void do_ifconfig(char *argv[], int argc);
+void do_netcap(char *argv[], int argc);
+void do_rmem(char *argv[], int argc);
 void do_date(char *argv[], int argc);
+void do_diskinfo(char *argv[], int argc);
+void do_diskcache(char *argv[], int argc);
+void do_cache(char *argv[], int argc);
+void do_profile(char *argv[], int argc);
+void do_boottime(char *argv[], int argc);
 
 // cli_tftp.c
 void do_tftp_get(char *argv[], int argc);
 void do_tftp_put(char *argv[], int argc);
+void do_tftp_load(char *argv[], int argc);
+void do_tftp_raw(char *argv[], int argc);
+void do_tftp_boot(char *argv[], int argc);
+void do_tftpd(char *argv[], int argc);
+bool tftp_parse_source(char *arg, uint32_t *targetip, const char **filename); // [server:]filename
+void do_netboot(char *argv[], int argc);
+
+// cli_http.c
+void do_http_get(char *argv[], int argc);
+
+// cli_bench.c
+void do_diskbench(char *argv[], int argc);
+void do_netbench(char *argv[], int argc);
+void do_membench(char *argv[], int argc);
+void do_libbench(char *argv[], int argc);
+void do_bench(char *argv[], int argc);
 
 // cli_load.c
 void do_execute(char *argv[], int argc);
@@ -9,6 +9,22 @@ void cpu_cache_flush(void);
 void cpu_cache_invalidate(void);
 void cpu_interrupts_on(void);
 void cpu_interrupts_off(void);
+uint32_t cpu_interrupts_save(void);        /* off, returning the SR to put back */
+void cpu_interrupts_restore(uint32_t sr);
+void cpu_cache_configure(uint32_t cacr, const uint32_t *ttr); /* cpu_cache_enable() uses cacr from now on */
+
+/* in core/cache.c: the CACR and TTR settings the cache command picks from */
+bool cache_policy_select(const char *name);
+const char *cache_policy_name(void);
+void cache_policy_report(void);
+
+/* cache modes, as memtest and membench cycle through them */
+enum {
+    CACHE_FULL,   // cpu_cache_enable
+    CACHE_NODATA, // cpu_cache_enable_nodata
+    CACHE_NONE,   // cpu_cache_disable
+    CACHE_INIT
+};
 
 /* target provided */
 void machine_execute(void *entry_vector, void *stack_pointer, char *cmdline);
@@ -19,4 +35,16 @@ void machine_execute(void *entry_vector, void *stack_pointer, char *cmdline);
 #define CPU_68010_OR_EARLIER
 #endif
 
+/* bulk copy/fill paths in lib/memcpy.c and lib/memset.c */
+#if defined(__mc68040__) || defined(__mc68060__)
+#define CPU_HAS_MOVE16          /* 16-byte line moves, bypassing the data cache */
+#elif defined(__mc68020__) || defined(__mc68030__)
+#define CPU_MOVEM_BURST         /* movem.l beats a move.l loop */
+#endif
+#define CPU_BULK_MIN 256        /* bytes; shorter copies and fills are not worth the setup */
+
+/* inner loops worth running from RAM: the linker scripts of the builds that
+ * execute from ROM put .fasttext in .data, which startup copies to RAM */
+#define FASTTEXT __attribute__((section(".fasttext"), noinline))
+
 #endif
@@ -2,6 +2,7 @@
 #define __GOGOBOOT_DISK_DOT_H__
 
 #include <types.h>
+#include <timers.h>
 #include <fatfs/ff.h>
 #include <fatfs/diskio.h>
 
@@ -10,26 +11,97 @@ typedef struct disk_controller_t disk_controller_t;
 
 /* target platform provides these methods */
 void ide_controller_reset(disk_controller_t *ctrl);
-void ide_set_register(disk_controller_t *ctrl, int reg, uint8_t val);
-uint8_t ide_get_register(disk_controller_t *ctrl, int reg);
-void ide_transfer_sector_write(disk_controller_t *ctrl, const void *buff);
-void ide_transfer_sector_read(disk_controller_t *ctrl, void *buff);
+
+/* ... and these, inline, in its bus header
+ * (q40/bus.h, ecb/bus.h), which core/ide.c includes:
+ *   uint8_t ide_get_register(disk_controller_t *ctrl, int reg);
+ *   void ide_set_register(disk_controller_t *ctrl, int reg, uint8_t val);
+ *   void ide_transfer_sector_read(disk_controller_t *ctrl, void *buff);
+ *   void ide_transfer_sector_write(disk_controller_t *ctrl, const void *buff);
+ */
+
+#define DISK_LATENCY_BUCKETS 8  /* command latency histogram: 0, 1, 2-3, 4-7, ... 64+ ticks */
+
+typedef struct disk_stats_t {
+    uint32_t commands;      /* ATA read/write commands issued */
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+    uint32_t wait_ticks;    /* timer ticks spent busy-waiting on status */
+    uint32_t timeouts;
+    uint32_t errors;
+    uint32_t flushes;       /* FLUSH CACHE commands issued */
+    uint32_t latency[DISK_LATENCY_BUCKETS];
+} disk_stats_t;
 
 /* common ide code provides this type */
 typedef struct disk_t {
     disk_controller_t *ctrl;
     int disk;               /* 0 = master, 1 = slave */
     uint32_t sectors;       /* 32 bits limits us to 2TB */
+    int multiple;           /* sectors per DRQ block; 1 = READ/WRITE MULTIPLE not in use */
+    int pio_mode;           /* set with SET FEATURES; -1 = left at the drive's default */
+    bool write_cache;       /* drive's write cache on: writes are not safe until flushed */
+    bool write_cache_ok;    /* it has one we can switch, and FLUSH CACHE */
+    bool unflushed;         /* written to since the last FLUSH CACHE */
+    uint8_t *ram;           /* RAM disk: the sectors themselves (no ctrl); NULL for a drive */
+    char model[41];         /* from IDENTIFY */
+    disk_stats_t stats;
     DSTATUS fat_fs_status;
     FATFS fat_fs_workarea;
 } disk_t;
 
+/* asynchronous transfers (core/ide.c): disk_submit() queues a request and
+ * returns at once. A task moves the queue along whenever the task pump runs,
+ * a status read at a time, so seeks and rotation no longer hold up the CPU.
+ * done is set once it has finished, and ok if it worked; buff must stay put
+ * until then. Synchronous transfers wait for the queue to empty first. */
+typedef struct disk_request_t disk_request_t;
+
+struct disk_request_t {
+    int disk;
+    void *buff;
+    uint32_t sector;
+    int count;
+    bool is_write;
+    bool done;
+    bool ok;
+    /* private to core/ide.c */
+    int state;
+    uint8_t *pos;
+    uint32_t lba;           /* next command starts here */
+    int left;               /* sectors not yet transferred */
+    int cmd_left;           /* ... in the current command */
+    timer_t start, deadline;
+    disk_request_t *next;
+};
+
 /* common ide code provides these methods */
 void disk_init(void);
 disk_t *disk_get_info(int nr);
+disk_t *disk_add(void); /* new, zeroed entry; caller fills it in */
 int disk_get_count(void);
 bool disk_data_read(int disk, void *buff, uint32_t sector, int sector_count);
 bool disk_data_write(int disk, const void *buff, uint32_t sector, int sector_count);
-void disk_controller_startup(disk_controller_t *ctrl);
+void disk_controller_startup(disk_controller_t **ctrl, int count); /* starts the probe task */
+void disk_wait_ready(void); /* until the probe has finished */
+void disk_remount(int nr); /* after raw writes under the volume */
+bool disk_flush(int nr); /* drive's write cache to the media; nr < 0 for all */
+void disk_submit(disk_request_t *req);
+bool disk_request_wait(disk_request_t *req); /* spins on the queue alone; returns req->ok */
+
+/* RAM disk (core/ramdisk.c) */
+bool ramdisk_create(uint32_t size); /* bytes; 0 = a share of the free RAM */
+int ramdisk_get(void); /* its drive number, or -1 */
+
+/* sector cache (core/diskcache.c) sits between FatFs and disk_data_read/write */
+void disk_cache_init(void);
+bool disk_cache_read(int disk, void *buff, uint32_t sector, int sector_count);
+bool disk_cache_write(int disk, const void *buff, uint32_t sector, int sector_count);
+void disk_cache_submit(disk_request_t *req); /* disk_submit(), coherent with the cache */
+bool disk_cache_sync(int disk); /* disk < 0 syncs all disks */
+bool disk_cache_invalidate(void);
+bool disk_cache_set_writeback(bool writeback);
+void disk_cache_report(void);
+void disk_report_stats(void);
 
 #endif
@@ -0,0 +1,81 @@
+#ifndef __GOGOBOOT_ECB_BUS_DOT_H__
+#define __GOGOBOOT_ECB_BUS_DOT_H__
+
+/* PPIDE register access for core/ide.c, inline: the register number is a
+ * constant at nearly every call, so selecting it folds down to a single store
+ * to the 8255, and a status poll is a handful of moves to and from the ECB
+ * I/O window. The UART and NE2000 drivers reach the ECB bus through the same
+ * ecb/ecb.h accessors. */
+
+#include <types.h>
+#include <stdlib.h>
+#include <ide.h>
+#include <ecb/ecb.h>
+#include <ecb/ppide.h>
+
+static inline void ide_set_data_direction(disk_controller_t *ctrl, bool read_mode)
+{
+    if(ctrl->read_mode != read_mode){
+        *ctrl->control = read_mode ? PPIDE_PPI_BUS_READ : PPIDE_PPI_BUS_WRITE;
+        ctrl->read_mode = read_mode;
+    }
+}
+
+static inline void ide_select_register(disk_controller_t *ctrl, int reg)
+{
+    if(reg <= ATA_REG_STATUS){
+        *ctrl->select = PPIDE_CS0_LINE | reg;
+        return;
+    }
+    switch(reg){
+        case ATA_REG_ALTSTATUS:
+            *ctrl->select = PPIDE_REG_ALTSTATUS;
+            break;
+        default:
+            printf("ide: bad reg %d?\n", reg);
+            break;
+    }
+}
+
+static inline uint8_t ide_get_register(disk_controller_t *ctrl, int reg)
+{
+    uint8_t val;
+    ide_set_data_direction(ctrl, true);
+    ide_select_register(ctrl, reg);
+    *ctrl->control = 1 | (PPIDE_RD_BIT << 1);
+    val = *ctrl->lsb;
+    *ctrl->control = 0 | (PPIDE_RD_BIT << 1);
+    return val;
+}
+
+static inline void ide_set_register(disk_controller_t *ctrl, int reg, uint8_t val)
+{
+    ide_set_data_direction(ctrl, false);
+    ide_select_register(ctrl, reg);
+    *ctrl->lsb = val;
+    *ctrl->control = 1 | (PPIDE_WR_BIT << 1);
+    *ctrl->control = 0 | (PPIDE_WR_BIT << 1);
+#ifdef IDE_IO_PAUSE
+    ecb_slow_down();        /* recovery time after the write strobe */
+#endif
+    if(reg == ATA_REG_ALTSTATUS){
+        /* when ATA_REG_ALTSTATUS & 0x04 assert the PPIDE /RESET line */
+        *ctrl->control = ((val & 0x04) ? 1 : 0) | (PPIDE_RST_BIT << 1);
+    }
+}
+
+static inline void ide_transfer_sector_read(disk_controller_t *ctrl, void *ptr)
+{
+    ide_set_data_direction(ctrl, true);
+    *ctrl->select = PPIDE_REG_DATA;
+    ide_sector_xfer_input(ptr, ctrl->lsb);
+}
+
+static inline void ide_transfer_sector_write(disk_controller_t *ctrl, const void *ptr)
+{
+    ide_set_data_direction(ctrl, false);
+    *ctrl->select = PPIDE_REG_DATA;
+    ide_sector_xfer_output(ptr, ctrl->lsb);
+}
+
+#endif
@@ -6,6 +6,7 @@
 #define KISS68030_ROM_BASE              0xFFF00000 /* 512KB */
 #define KISS68030_MEM_BASE              0xFFF80000 /* 256KB */
 #define KISS68030_SRAM_BASE             0xFFFE0000 /* 64KB (32KB chip is mapped twice) */
+#define KISS68030_SRAM_SIZE             0x8000
 #define KISS68030_IO_BASE               0xFFFF0000 /* 64KB */
 #define KISS68030_ROM_SIZE              (512*1024)
 
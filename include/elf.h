@@ -45,4 +45,11 @@ enum {
     PT_PHDR     /* 6 */
 };
 
+/* program header flags */
+enum {
+    PF_X = 1,
+    PF_W = 2,
+    PF_R = 4
+};
+
 #endif
@@ -327,6 +327,9 @@ FRESULT f_getlabel (const TCHAR* path, TCHAR* label, DWORD* vsn);	/* Get volume
 FRESULT f_setlabel (const TCHAR* label);							/* Set volume label */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf);	/* Forward data to the stream */
 FRESULT f_expand (FIL* fp, FSIZE_t fsz, BYTE opt);					/* Allocate a contiguous block to the file */
+FRESULT f_contiguous_sector (FIL* fp, UINT nsect, LBA_t* sect);	/* gogoboot: claim sectors of a contiguous file */
+FRESULT f_write_contiguous (FIL* fp, const void* buff, UINT nsect);	/* gogoboot: write sectors to a contiguous file */
+DWORD f_contiguous (FIL* fp);										/* gogoboot: first cluster of a NoFatChain file */
 FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt);			/* Mount/Unmount a logical drive */
 FRESULT f_mkfs (const TCHAR* path, const MKFS_PARM* opt, void* work, UINT len);	/* Create a FAT volume */
 FRESULT f_fdisk (BYTE pdrv, const LBA_t ptbl[], void* work);		/* Divide a physical drive into some partitions */
@@ -0,0 +1,17 @@
+#ifndef __FFBITMAP_DOT_H__
+#define __FFBITMAP_DOT_H__
+
+#include <types.h>
+#include <fatfs/ff.h>
+
+/* free-cluster bitmap for FAT16/FAT32 volumes (fatfs/ffbitmap.c), kept
+ * alongside the FAT by hooks in ff.c. Each query returns false until the
+ * bitmap has been built, and ff.c then scans the FAT as it always did. */
+void ff_bitmap_start(FATFS *fs);                    /* build it in the background, if enabled */
+void ff_bitmap_update(FATFS *fs, DWORD clst, bool used); /* from put_fat() */
+bool ff_bitmap_free_count(FATFS *fs, DWORD *nfree);
+bool ff_bitmap_find_free(FATFS *fs, DWORD scl, DWORD *ncl); /* next free after scl, wrapping; 0 = none */
+bool ff_bitmap_find_run(FATFS *fs, DWORD scl, DWORD count, DWORD *start); /* 0 = none */
+void ff_bitmap_report(void);
+
+#endif
@@ -30,15 +30,15 @@
 /  f_findnext(). (0:Disable, 1:Enable 2:Enable with matching altname[] too) */
 
 
-#define FF_USE_MKFS		0
+#define FF_USE_MKFS		1
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FASTSEEK	0
+#define FF_USE_FASTSEEK	1
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
 
@@ -113,8 +113,29 @@
 */
 
 
+#if defined(TARGET_MINI)
+#define FF_UNICODE_COMPACT	1	/* gogoboot: small ROM */
+#else
+#define FF_UNICODE_COMPACT	0
+#endif
+/* gogoboot: This option trims the Unicode tables in ffunicode.c.
+/
+/   0 - Full up-case conversion for the whole BMP
+/   1 - Up-case conversion only for the characters the SBCS code page can hold
+/       (CP850: Latin-1, Latin Extended-A and U+0192). Other LFNs still work,
+/       but are compared case-sensitively.
+/   2 - ASCII only: no code page table, and names with any other character
+/       are rejected as invalid.
+/
+/  Needs FF_FS_EXFAT = 0 when nonzero: exFAT hashes names in full up-case. */
+
+
 #define FF_USE_LFN		3
+#if defined(TARGET_MINI)
+#define FF_MAX_LFN		128	/* gogoboot: small memory profile (include/init.h) */
+#else
 #define FF_MAX_LFN		255
+#endif
 /* The FF_USE_LFN switches the support for LFN (long file name).
 /
 /   0: Disable LFN. FF_MAX_LFN has no effect.
@@ -145,7 +166,11 @@
 /  When LFN is not enabled, this option has no effect. */
 
 
+#if defined(TARGET_MINI)
+#define FF_LFN_BUF		64	/* gogoboot: small memory profile; longer names read as their SFN */
+#else
 #define FF_LFN_BUF		255
+#endif
 #define FF_SFN_BUF		12
 /* This set of options defines size of file name members in the FILINFO structure
 /  which is used to read out directory items. These values should be suffcient for
@@ -166,7 +191,11 @@
 / Drive/Volume Configurations
 /---------------------------------------------------------------------------*/
 
+#if defined(TARGET_MINI)
+#define FF_VOLUMES		3	/* gogoboot: small memory profile; two drives and a RAM disk */
+#else
 #define FF_VOLUMES		4
+#endif
 /* Number of volumes (logical drives) to be used. (1-10) */
 
 
@@ -224,14 +253,22 @@
 / System Configurations
 /---------------------------------------------------------------------------*/
 
+#if defined(TARGET_MINI)
+#define FF_FS_TINY		1	/* gogoboot: small memory profile; no sector buffer in each FIL */
+#else
 #define FF_FS_TINY		0
+#endif
 /* This option switches tiny buffer configuration. (0:Normal or 1:Tiny)
 /  At the tiny configuration, size of file object (FIL) is shrinked FF_MAX_SS bytes.
 /  Instead of private sector buffer eliminated from the file object, common sector
 /  buffer in the filesystem object (FATFS) is used for the file data transfer. */
 
 
-#define FF_FS_EXFAT		0
+#if defined(TARGET_Q40) || defined(TARGET_KISS)
+#define FF_FS_EXFAT		1
+#else
+#define FF_FS_EXFAT		0	/* gogoboot: keeps FSIZE_t 32-bit on the 68000 */
+#endif
 /* This option switches support for exFAT filesystem. (0:Disable or 1:Enable)
 /  To enable exFAT, also LFN needs to be enabled. (FF_USE_LFN >= 1)
 /  Note that enabling exFAT discards ANSI C (C89) compatibility. */
@@ -0,0 +1,26 @@
+#ifndef __FFDIRCACHE_DOT_H__
+#define __FFDIRCACHE_DOT_H__
+
+#include <types.h>
+#include <fatfs/ff.h>
+
+/* directory lookup cache (fatfs/ffdircache.c), consulted and fed by
+ * dir_find() in ff.c. A hit only says where to look: ff.c reads the entry
+ * and checks it against the cached name and cluster before trusting it.
+ * Not used for dir_register()'s SFN-only searches. */
+typedef struct {
+    DWORD dptr;                 /* offset of the SFN entry in the directory */
+    DWORD blk_ofs;              /* offset of its first LFN entry, or 0xFFFFFFFF */
+    DWORD sclust;               /* first cluster of the object */
+    DWORD size;
+    BYTE sfn[11];
+} ff_dirloc_t;
+
+bool ff_dircache_lookup(DIR *dp, ff_dirloc_t *loc);                    /* dp->fn and fs->lfnbuf hold the name */
+void ff_dircache_record(DIR *dp, DWORD sclust, DWORD size);            /* after dir_find() found it */
+void ff_dircache_forget(DIR *dp);                                      /* a hit that did not check out */
+void ff_dircache_invalidate_dir(FATFS *fs, DWORD dir_sclust);          /* entries removed */
+void ff_dircache_invalidate_sector(FATFS *fs, LBA_t sect);             /* entries in this sector rewritten */
+void ff_dircache_report(void);
+
+#endif
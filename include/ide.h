@@ -16,10 +16,19 @@
 /* IDE command codes */
 #define IDE_CMD_READ_SECTOR     0x20
 #define IDE_CMD_WRITE_SECTOR    0x30
+#define IDE_CMD_READ_MULTIPLE   0xC4
+#define IDE_CMD_WRITE_MULTIPLE  0xC5
+#define IDE_CMD_SET_MULTIPLE    0xC6
 #define IDE_CMD_FLUSH_CACHE     0xE7
 #define IDE_CMD_IDENTIFY        0xEC
 #define IDE_CMD_SET_FEATURES    0xEF
 
+/* SET FEATURES subcommands (feature register) */
+#define IDE_FEATURE_WCACHE_ON   0x02
+#define IDE_FEATURE_XFER_MODE   0x03 // mode in the sector count register
+#define IDE_FEATURE_WCACHE_OFF  0x82
+#define IDE_XFER_PIO_FLOW       0x08 // | PIO mode number, with IORDY flow control
+
 /* excerpted from linux kernel include/linux/ata.h */
 enum {  
         /* ATA command block registers */
@@ -50,6 +59,13 @@ enum {
         ATA_ID_MAX_MULTSECT = 2*47,
         ATA_ID_MULTSECT     = 2*59,
         ATA_ID_LBA_CAPACITY = 2*60,
+        ATA_ID_CAPABILITY   = 2*49,
+        ATA_ID_OLD_PIO_MODES = 2*51,
+        ATA_ID_FIELD_VALID  = 2*53,
+        ATA_ID_PIO_MODES    = 2*64,
+        ATA_ID_COMMAND_SET_1 = 2*82,
+        ATA_ID_COMMAND_SET_2 = 2*83,
+        ATA_ID_CFS_ENABLE_1 = 2*85,
 };
 
 #endif
@@ -3,32 +3,78 @@
 
 #include <stdbool.h>
 
+/* memory profile: how much of region 0 we keep for ourselves. On the
+ * Mini68K's 2MB every byte kept is taken from the program being loaded, so
+ * the small profile has a smaller stack, a heap sized to what the loader and
+ * the network need, a fixed small packet pool (net/packet.c) and a slimmer
+ * FatFs (include/fatfs/ffconf.h) */
+#if defined(TARGET_MINI)
+#define MEMORY_PROFILE_SMALL
+#define MEMORY_PROFILE_NAME "small"
+#define DEFAULT_STACK_SIZE 6144
+#define HEAP_WORKING_SIZE (192*1024) /* heap wanted beyond a bounce buffer the size of our own image */
+#define HEAP_BLOCKS 256 /* tinyalloc block table */
+#else
+#define MEMORY_PROFILE_NAME "standard"
 #define DEFAULT_STACK_SIZE 8192
+#endif
 #define MAXHEAP (2 << 20) /* 2MB */
 
 /* copyright/startup message from early ROM */
 extern const char copyright_msg[];
 
-extern uint32_t ram_size;
+extern uint32_t ram_size; /* the RAM from address 0, where we live */
 extern uint32_t stack_base, stack_size, stack_top;
 extern uint32_t heap_base, heap_size;
 extern uint32_t bounce_below_addr, rom_below_addr;
+extern uint32_t free_ram_top; /* end of the free RAM in region 0: below the heap and any reservation */
 
 void early_init(void);
 void target_hardware_init(void);
 void setup_interrupts(void);
 void measure_ram_size(void);
 void report_memory_layout(void);
+void boot_stage_mark(const char *what); /* for boottime */
+void boot_stages_done(void);
+void boot_stage_report(void);
 const char *check_writable_range(uint32_t base, uint32_t length, bool can_bounce);
+void stack_paint(void);          /* at boot, and to restart the measure */
+uint32_t stack_high_water(void); /* most bytes of stack used since stack_paint() */
+
+/* physical memory map: region 0 is always the RAM from address 0 */
+#define MEM_MAX_REGIONS 8
+
+typedef enum { mem_ram, mem_video, mem_sram } mem_type_t; /* only mem_ram goes to the kernel */
+
+typedef struct {
+    uint32_t base;
+    uint32_t size;
+    mem_type_t type;
+} mem_region_t;
+
+extern mem_region_t mem_region[MEM_MAX_REGIONS];
+extern int mem_region_count;
+
+bool mem_add_region(uint32_t base, uint32_t size, mem_type_t type);
+const mem_region_t *mem_find_region(uint32_t base, uint32_t length);
+uint32_t mem_probe_bank(uint32_t base, uint32_t max_size, uint32_t unit_size);
+uint32_t mem_probe_extra_bank(uint32_t base, uint32_t max_size);
+uint32_t mem_reserve_top(uint32_t size); /* take size bytes off the top of free RAM; 0 if it won't fit */
+
+/* target provides these: route a bus interrupt line (ISA IRQ on Q40, MF/PIC
+ * input on ECB) to a handler, which is called in interrupt context */
+bool target_irq_attach(int irq, void (*handler)(void));
+void target_irq_detach(int irq);
+extern volatile int target_irq_depth; /* nonzero while such a handler runs */
 
 /* target provides these, used by measure_ram_size */
 /* these are called with a relatively small stack! */
 uint32_t mem_get_max_possible(void);
 uint32_t mem_get_granularity(void);
-void target_mem_init(void);
+void target_mem_init(void); /* may mem_add_region() anything beyond region 0 */
 
 /* linker provides these symbols */
-extern const char text_start, text_size;
+extern const char text_start, text_size, text_end;
 extern const char rodata_start, rodata_size;
 extern const char data_start, data_load_start, data_size;
 extern const char bss_start, bss_size, bss_end;
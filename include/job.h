@@ -0,0 +1,28 @@
+#ifndef __JOB_DOT_H__
+#define __JOB_DOT_H__
+
+#include <types.h>
+
+/* background jobs (cli/cli_jobs.c): a command run with a trailing "&" hands
+ * its work to a job and returns to the prompt. The prompt steps each job
+ * while it waits for a key. cb_step returns false once the job has finished
+ * and cleaned up after itself; cb_kill abandons it part way. */
+typedef struct job_t job_t;
+
+struct job_t {
+    int id;
+    char *description;
+    void *context;
+    bool (*cb_step)(job_t *job);
+    void (*cb_status)(job_t *job);      /* optional: progress, for "jobs" */
+    void (*cb_kill)(job_t *job);
+    job_t *next;
+};
+
+extern bool cli_background;             /* set while running a command ending in "&" */
+
+job_t *job_alloc(const char *what, const char *detail);
+void job_add(job_t *job);
+void job_pump(void);
+
+#endif
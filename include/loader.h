@@ -4,4 +4,29 @@
 bool load_m68k_executable(char *argv[], int argc, FIL *fd);
 bool load_elf_executable(char *arg[], int numarg, FIL *fd);
 
+/* the same, from an image already in memory (eg fetched with TFTP) */
+bool load_m68k_image(char *argv[], int argc, const void *image, uint32_t size);
+bool load_elf_image(char *argv[], int argc, const void *image, uint32_t size);
+
+/* check the next image loaded against a digest: 8 hex digits for CRC32 or 64
+ * for SHA-256, as the output of crc32 or sha256sum. NULL cancels. Files loaded
+ * from disk are also checked against a FILE.sha256 or FILE.crc32 beside them */
+bool load_verify_expect(const char *text);
+
+/* write to memory piecemeal, with the same checks and bounce buffering as load_data() */
+bool load_target_prepare(uint32_t paddr, uint32_t size);
+void *load_target_pointer(uint32_t paddr, uint32_t len);
+void load_target_write(uint32_t paddr, const void *data, uint32_t len);
+
+/* -- decomp.c -- streaming gzip and LZ4 decompression */
+typedef struct decomp_t decomp_t;
+const char *decomp_detect(const void *header, uint32_t len); /* format name, or NULL */
+decomp_t *decomp_open(FIL *fd, const void *image, uint32_t image_size);
+FRESULT decomp_read(decomp_t *dc, void *dest, uint32_t offset, uint32_t len);
+uint32_t decomp_size(decomp_t *dc);
+void decomp_close(decomp_t *dc);
+/* observer sees each piece of the compressed input as it is read */
+typedef void (*decomp_observer_t)(void *context, uint32_t offset, const void *data, uint32_t len);
+void decomp_observe(decomp_t *dc, decomp_observer_t observer, void *context);
+
 #endif
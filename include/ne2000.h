@@ -73,24 +73,43 @@ are GPL, so this is, of course, GPL.
 */
 
 #include <types.h>
+#include <net.h>
+
+#define NE2000_TX_SLOTS_MAX     8       /* Tx buffers we can queue frames in */
+#define NE2000_TX_SLOT_PAGES    6       /* 6x256=1.5KB, one full size frame */
+#define NE2000_RX_MIN_PAGES     16      /* 16x256=4KB, smallest receive ring we allow */
+#define NE2000_RXQ_SLOTS_MAX    16      /* IRQ mode: frames held for eth_pump() */
 
 typedef struct dp83902a_priv_data {
     uint16_t base;
     uint16_t data;
     bool rtl8019;
-    int tx_next;           /* First free Tx page */
-    int tx_int;            /* Expecting interrupt from this buffer */
+    bool io_pause;         /* pause after each register write */
+    uint8_t rtl_config2;   /* RTL8019 media and duplex, as last read back */
+    uint8_t rtl_config3;
     int rx_next;           /* First free Rx page */
-    int tx1, tx2;          /* Page numbers for Tx buffers */
-    /* unsigned long tx1_key, tx2_key;   // Used to ack when packet sent */
-    int tx1_len, tx2_len;
+    int irq;               /* Bus IRQ we receive on, -1 if polled */
+    int tx_slots;          /* Number of Tx buffers */
+    int tx_first;          /* Oldest queued Tx buffer, being sent if tx_started */
+    int tx_count;          /* Tx buffers holding a frame */
+    int tx_len[NE2000_TX_SLOTS_MAX];
     bool tx_started, running;
     uint8_t esa[6];
+    uint8_t mar[8];        /* Multicast address filter */
     void* plf_priv;
 
-    /* Buffer allocation */
-    int tx_buf1, tx_buf2;
+    /* Buffer allocation: Tx buffers, then the Rx ring up to the end of memory */
+    int tx_buf_start;
     int rx_buf_start, rx_buf_end;
+
+    int ifindex;           /* our interface in the network stack */
+    eth_stats_t stats;
+
+    /* IRQ mode receive queue */
+    packet_t *rxq_packet[NE2000_RXQ_SLOTS_MAX];
+    uint16_t rxq_length[NE2000_RXQ_SLOTS_MAX];
+    int rxq_slots;         /* power of two */
+    volatile int rxq_head, rxq_tail;
 } dp83902a_priv_data_t;
 
 /*
@@ -175,6 +194,7 @@ static void dp83902a_poll(void);
 #define DP_CR_PAGE0   0x00   /* Page select */
 #define DP_CR_PAGE1   0x40
 #define DP_CR_PAGE2   0x80
+#define DP_CR_PAGE3   0xC0   /* RTL8019 only */
 #define DP_CR_PAGEMSK 0x3F   /* Used to mask out page bits */
 
 /* Data configuration register */
@@ -347,6 +367,25 @@ static void dp83902a_poll(void);
 #define ENTSR_CDH 0x40	/* The collision detect "heartbeat" signal was lost. */
 #define ENTSR_OWC 0x80  /* There was an out-of-window collision. */
 
+/* RTL8019 page 3 configuration registers */
+#define RTL_P3_9346CR   0x01
+#define RTL_P3_CONFIG0  0x03
+#define RTL_P3_CONFIG2  0x05
+#define RTL_P3_CONFIG3  0x06
+
+#define RTL_9346CR_NORMAL       0x00    /* CONFIG1-3 write protected */
+#define RTL_9346CR_CONFIG       0xC0    /* CONFIG1-3 writeable */
+
+#define RTL_CONFIG2_PL_MASK     0xC0    /* media: */
+#define RTL_CONFIG2_PL_AUTO     0x00    /*   10BaseT or 10Base2, detected */
+#define RTL_CONFIG2_PL_10BASET  0x40    /*   10BaseT with link test */
+#define RTL_CONFIG2_PL_10BASE5  0x80
+#define RTL_CONFIG2_PL_10BASE2  0xC0
+
+#define RTL_CONFIG3_FUDUP       0x40    /* full duplex, 10BaseT only */
+#define RTL_CONFIG3_LEDS1       0x20    /* LED1 carrier sense, LED2 MCSB (else Rx, Tx) */
+#define RTL_CONFIG3_LEDS0       0x10    /* LED0 link (else collision) */
+
 #define NIC_RECEIVE_MONITOR_MODE 0x20
 
 #define PCNET_RESET     0x1f    /* Issue a read to reset, a write to clear. */
@@ -13,14 +13,28 @@ typedef struct ipv4_header_t ipv4_header_t;
 typedef struct udp_header_t udp_header_t;
 typedef struct tcp_header_t tcp_header_t;
 typedef struct icmp_header_t icmp_header_t;
+typedef struct igmp_header_t igmp_header_t;
 typedef uint8_t macaddr_t[6];
 
 extern macaddr_t const broadcast_macaddr;
 static const uint32_t ipv4_broadcast = 0xffffffff;
 
-extern macaddr_t interface_macaddr;
-extern uint32_t interface_ipv4_address;
-extern uint32_t interface_subnet_mask;
+#define NET_MAX_INTERFACES 4
+
+// eth0 is configured by DHCP and holds the default route; the others are set
+// with "ifconfig" and reach their own subnets only
+typedef struct {
+    macaddr_t macaddr;
+    uint32_t ipv4_address;
+    uint32_t subnet_mask;
+} net_interface_t;
+
+extern net_interface_t net_interface[NET_MAX_INTERFACES];
+extern int net_interface_count; // cards the driver found
+
+#define interface_macaddr      (net_interface[0].macaddr)
+#define interface_ipv4_address (net_interface[0].ipv4_address)
+#define interface_subnet_mask  (net_interface[0].subnet_mask)
 extern uint32_t interface_ipv4_gateway;
 extern uint32_t interface_dns_server;
 
@@ -29,10 +43,15 @@ extern uint32_t packet_discard_count;
 extern uint32_t packet_bad_cksum_count;
 extern uint32_t packet_rx_count;
 extern uint32_t packet_tx_count;
+extern uint32_t packet_pool_size;
+extern uint32_t packet_pool_free;
+extern uint32_t packet_pool_low_water;
+extern uint32_t packet_pool_exhausted;
 
 struct packet_t {
     packet_t *next;               // used by packet_queue_t to create linked lists
     uint32_t flags;               // flag bits (packet_flag_*)
+    uint8_t ifindex;              // interface it arrived on, or is to leave by
     uint32_t ipv4_nexthop;        // address we're going to ARP for
     ethernet_header_t *eth;       // always set
     arp_header_t *arp;            // set for arp
@@ -42,6 +61,12 @@ struct packet_t {
     icmp_header_t *icmp;          // set for ipv4 icmp
     uint16_t data_length;         // set for ipv4 udp, tcp
     uint8_t *data;                // set for ipv4 udp, tcp
+    uint8_t *placed_data;         // if set, data[placed_offset] onwards was received directly into here
+    uint16_t placed_offset;
+    uint32_t csum_partial;        // with packet_flag_csum_partial: sum of the UDP datagram from csum_offset onwards;
+                                  // with packet_flag_templated: sum of the UDP pseudo-header and ports
+    uint32_t csum_ipv4_partial;   // with packet_flag_templated: sum of the IPv4 header but length and id
+    uint16_t csum_offset;
     uint16_t buffer_length_alloc; // length allocated for buffer[]
     uint16_t buffer_length;       // length used by buffer[] (buffer_length <= length_alloc)
     uint8_t buffer[];             // must be final member of data structure
@@ -49,6 +74,9 @@ struct packet_t {
 
 static const uint32_t packet_flag_destination_mac_valid = 1;
 static const uint32_t packet_flag_nexthop_resolved = 2;
+static const uint32_t packet_flag_pooled = 4; // buffer belongs to the packet pool
+static const uint32_t packet_flag_csum_partial = 8; // driver summed the UDP payload as it was read
+static const uint32_t packet_flag_templated = 16; // headers copied from a sink's template: routed, resolved, partly summed
 
 struct __attribute__((packed, aligned(2))) ethernet_header_t {
     macaddr_t destination_mac;
@@ -93,6 +121,7 @@ struct __attribute__((packed, aligned(2))) ipv4_header_t {
 };
 
 static const uint8_t ip_proto_icmp = 1;
+static const uint8_t ip_proto_igmp = 2;
 static const uint8_t ip_proto_tcp  = 6;
 static const uint8_t ip_proto_udp  = 17;
 
@@ -112,20 +141,36 @@ struct __attribute__((packed, aligned(2))) icmp_header_t {
     uint8_t payload[];          // finally we get to the actual user data
 };
 
+struct __attribute__((packed, aligned(2))) igmp_header_t {
+    uint8_t type;
+    uint8_t max_response_time; // in 1/10 second units, queries only
+    uint16_t checksum;
+    uint32_t group;
+};
+
 struct __attribute__((packed, aligned(2))) tcp_header_t {
     uint16_t source_port;
     uint16_t destination_port;
     uint32_t sequence;
     uint32_t ack;
-    uint8_t data_offset;
+    uint8_t data_offset;        // top 4 bits = header length in 32-bit words
+    uint8_t flags;              // tcp_flag_*
     uint16_t window_size;
-    uint16_t checksum;
-    // optional urgent pointer
+    uint16_t checksum;          // one's complement sum of pseudo-header, header and data
+    uint16_t urgent_pointer;
     uint8_t options[];          // variable length
     // followed by the user data
 };
 
+static const uint8_t tcp_flag_fin = 0x01;
+static const uint8_t tcp_flag_syn = 0x02;
+static const uint8_t tcp_flag_rst = 0x04;
+static const uint8_t tcp_flag_psh = 0x08;
+static const uint8_t tcp_flag_ack = 0x10;
+
 #define PACKET_MAXLEN 1536      /* largest size we will process */
+#define NET_MAX_DATAGRAM 16384  /* largest IPv4 payload we will reassemble */
+#define NET_PEEK_DATA 16        /* bytes of UDP payload available to cb_payload_destination */
 #define DEFAULT_TTL 64
 
 struct packet_queue_t {
@@ -137,7 +182,7 @@ struct packet_sink_t {
     packet_sink_t *next; // for linked lists
     void *sink_private;  // for sink's use
 
-    bool match_interface_local_ip; // similar to match_local_ip, but using the current 'interface_ipv4_address'
+    bool match_interface_local_ip; // similar to match_local_ip, but using the address of the interface it arrived on
     uint32_t match_local_ip;       // ... whereas this matches one specific IP
     uint32_t match_remote_ip;
     uint16_t match_local_port;
@@ -149,38 +194,98 @@ struct packet_sink_t {
     packet_queue_t queue;
     void (*cb_packet_received)(packet_sink_t *sink, packet_t *packet);
 
+    // optional: called from the driver, before the packet payload has been read. only the
+    // headers and the first NET_PEEK_DATA bytes of packet->data are valid. return a buffer to
+    // receive data[*offset] onwards directly (must be 16-bit aligned), or NULL to receive the
+    // packet normally. do NOT transmit or otherwise re-enter the network stack from here.
+    uint8_t *(*cb_payload_destination)(packet_sink_t *sink, packet_t *packet, int *offset);
+
     timer_t timer;
     void (*cb_timer_expired)(packet_sink_t *sink);
+
+    // UDP transmit template (net.c): the headers of every packet packet_create_for_sink()
+    // makes, built once the route and the next hop's MAC are known
+    uint32_t template_epoch;      // net_template_epoch when built, 0 for none
+    uint8_t template_ifindex;
+    uint16_t template_id;         // IPv4 id of the next packet
+    uint32_t template_ipv4_sum;
+    uint32_t template_udp_sum;
+    uint8_t template_header[sizeof(ethernet_header_t) + sizeof(ipv4_header_t) + sizeof(udp_header_t)];
 };
 
 /* ne2000.c */
 bool eth_init(void); // returns true if card found
 void eth_halt(void);
 void eth_pump(void); // called from net_pump
-bool eth_attempt_tx(packet_t *packet); // returns true if transmission started; caller must free packet.
-int eth_rxbuffer_size(void); // in bytes
+bool eth_attempt_tx(packet_t *packet); // on packet->ifindex; returns true if transmission started; caller must free packet.
+int eth_rxbuffer_size(void); // in bytes, the smallest of the cards
+void eth_set_multicast(const macaddr_t *list, int count); // program the multicast address filter of every card
+// per interface:
+int eth_tx_slots(int ifindex); // transmit buffers on the card
+bool eth_set_tx_slots(int ifindex, int slots); // move the TX/RX split of card memory; restarts the card
+int eth_irq(int ifindex); // bus IRQ used for receive, -1 if polled
+bool eth_set_irq(int ifindex, int irq); // receive on a bus IRQ, or poll if irq < 0
+bool eth_set_media(int ifindex, const char *media); // RTL8019 media/duplex, kept in ne2000_media[N]
+const char *eth_media(int ifindex); // media and duplex in use, NULL if the card cannot say
+
+typedef struct {
+    uint32_t frame_errors;      // card tally: frame alignment errors
+    uint32_t crc_errors;        // card tally: CRC errors
+    uint32_t missed_frames;     // card tally: frames lost, no room in the receive ring
+    uint32_t overflows;         // receive ring overflow recoveries
+    uint32_t rx_too_big;        // oversize frames discarded
+    uint32_t tx_busy;           // eth_attempt_tx() found every transmit buffer full
+    uint32_t irq_overruns;      // IRQ mode: frames dropped, net_pump() fell behind
+    int rx_high_water;          // most receive ring pages seen in use
+} eth_stats_t;
+
+const eth_stats_t *eth_get_stats(void); // totals for all cards; folds in their tally counters first
+void eth_reset_stats(void);
 
 /* net.c -- interface with ne2000.c */
+int net_eth_peek(packet_t *packet, int peek_length);
 void net_eth_push(packet_t *packet);
-packet_t *net_eth_pull(void);
+packet_t *net_eth_pull(int ifindex);
 void net_add_packet_sink(packet_sink_t *c);
 void net_remove_packet_sink(packet_sink_t *c);
 
 /* net.c */
 void net_init(void);
+void net_reset_stats(void); // zero the counters netinfo reports
 void net_pump(void);
 void net_tx(packet_t *packet);
+void net_tx_flush(void); // transmit what is queued, without running sink callbacks
+int net_ipv4_route(uint32_t destination_ip, uint16_t local_port, uint32_t *nexthop); // interface to leave by
+extern uint32_t net_template_epoch;
+void net_templates_invalidate(void); // call when a route, an address or a neighbour's MAC changes
+bool net_sink_template(packet_sink_t *sink); // true if the sink has a current template
 void net_dump_packet_sinks(void);
 
+/* rmem.c */
+bool rmem_start(void); // serve remote memory access (tools/rmem) as a background job
+
+/* netcap.c */
+extern bool netcap_running;
+bool netcap_start(int frames, int snaplen); // 0 for the defaults; frees any earlier capture
+void netcap_stop(void);
+void netcap_frame(packet_t *packet);
+void netcap_status(void);
+bool netcap_pcap(void **image, uint32_t *size); // pcap file of the frames held, in memory to free()
+#define netcap_capture(packet) do { if(netcap_running) netcap_frame(packet); } while(0) /* what net.c calls */
+
 /* packet.c, ipv4.c */
+void packet_pool_init(void);
 packet_t *packet_alloc(int buffer_size);
 packet_t *packet_create_tcp(uint32_t dest_ipv4, uint16_t destination_port, uint16_t source_port, int data_size);
 packet_t *packet_create_udp(uint32_t dest_ipv4, uint16_t destination_port, uint16_t source_port, int data_size);
 packet_t *packet_create_icmp(uint32_t dest_ipv4, int data_size);
-packet_t *packet_create_for_sink(packet_sink_t *sink, int data_size);
+packet_t *packet_create_igmp(uint32_t dest_ipv4);
+packet_t *packet_create_for_sink(packet_sink_t *sink, int data_size); // the caller must not change the headers
 bool packet_data_resize(packet_t *packet, int new_data_length);
 void packet_free(packet_t *packet);
+void packet_reuse_for_tx(packet_t *packet); // turn a received packet around: clears all but the pool flag
 uint32_t net_parse_ipv4(const char *str);
+char *net_format_ipv4(uint32_t ip, char *buffer); // buffer needs 16 bytes
 void packet_set_destination_mac(packet_t *packet, const macaddr_t *mac);
 
 // for dynamically allocated queues
@@ -197,28 +302,82 @@ packet_t *packet_queue_pophead(packet_queue_t *q);
 packet_sink_t *packet_sink_alloc(void);
 void packet_sink_free(packet_sink_t *s);
 
+uint32_t net_checksum_partial(const void *buf, unsigned int len); // cksum.s; buf must be even
 void net_compute_ipv4_checksum(packet_t *packet);
 void net_compute_icmp_checksum(packet_t *packet);
+void net_compute_igmp_checksum(packet_t *packet);
 void net_compute_udp_checksum(packet_t *packet);
 void net_compute_tcp_checksum(packet_t *packet);
+void net_template_sums(packet_sink_t *sink); // of the constant fields in template_header
+void net_compute_templated_checksums(packet_t *packet); // IPv4 and UDP, from the template's sums
 
 bool net_verify_ipv4_checksum(packet_t *packet);
 bool net_verify_icmp_checksum(packet_t *packet);
 bool net_verify_udp_checksum(packet_t *packet);
 bool net_verify_tcp_checksum(packet_t *packet);
 
+/* ipfrag.c */
+extern uint32_t ipfrag_reassembled_count;
+extern uint32_t ipfrag_dropped_count;
+packet_t *net_ipv4_reassemble(packet_t *fragment);
+void net_ipv4_reassembly_pump(void);
+
+/* netcon.c */
+bool netcon_write_byte(char ch); // true if it went to the netconsole only
+bool netcon_write(const char *str, int len); // likewise
+int netcon_read_byte(void); // -1 if nothing waiting
+void netcon_pump(void); // called from net_pump
+void netcon_shutdown(void); // send what is buffered before the network stops
+
 /* dhcp.c */
 void dhcp_init(void);
+bool dhcp_running(void);
+bool dhcp_bound(void); // a server acknowledged our lease, or nobody disputed the cached one
 
 /* icmp.c */
 void net_icmp_init(void);
 
+/* tcp.c -- a single client connection at a time */
+typedef struct tcp_connection_t tcp_connection_t;
+// called with received data, in order; return false to abort the connection
+typedef bool (*tcp_data_callback_t)(void *context, const uint8_t *data, int length);
+tcp_connection_t *tcp_open(uint32_t remote_ip, uint16_t remote_port, tcp_data_callback_t cb_data, void *context);
+bool tcp_write(tcp_connection_t *conn, const void *data, int length); // waits until acknowledged
+bool tcp_wait_close(tcp_connection_t *conn); // receive until the remote end closes
+void tcp_close(tcp_connection_t *conn); // also frees conn
+
+/* http.c */
+bool http_get(const char *url, const char *disk_filename, uint32_t address, uint32_t *size);
+
+/* igmp.c */
+void net_igmp_init(void);
+bool net_multicast_join(uint32_t group);
+void net_multicast_leave(uint32_t group);
+
 /* arp.c */
 typedef enum { arp_okay, arp_wait, arp_fail } arp_result_t;
+extern uint32_t arp_resolved_count;
+extern uint32_t arp_failed_count;
+extern uint32_t arp_wait_ticks;         // total time spent resolving
+extern uint32_t arp_wait_max_ticks;
 void net_arp_init(void);
 arp_result_t net_arp_resolve(packet_t *packet);
+void net_arp_prefetch(uint32_t ip); // start resolving the next hop to ip
+void net_arp_learn(packet_t *packet); // glean the sender's MAC from a received IPv4 packet
+const macaddr_t *net_arp_cached(uint32_t ip); // the MAC if known, without asking
 
 /* tftp.c */
 bool tftp_transfer(uint32_t tftp_server_ip, const char *tftp_filename, const char *disk_filename, bool is_put);
+bool tftp_transfer_background(uint32_t tftp_server_ip, const char *tftp_filename, const char *disk_filename, bool is_put); // returns once started
+#define TFTP_LOAD_HIGH 0xffffffff /* tftp_load() address: as high in free RAM as the file fits */
+bool tftp_load(uint32_t tftp_server_ip, const char *tftp_filename, uint32_t *address, uint32_t *size);
+bool tftp_mget(int count, const uint32_t *tftp_server_ip, char * const *tftp_filename); // saved under the same names
+bool tftp_save(uint32_t tftp_server_ip, const char *tftp_filename, uint32_t address, uint32_t size);
+typedef int (*tftp_source_t)(void *context, void *dest, int len); /* up to len bytes: fewer at the end, -1 on failure */
+bool tftp_stream(uint32_t tftp_server_ip, const char *tftp_filename, tftp_source_t source, void *context);
+bool tftp_raw(uint32_t tftp_server_ip, const char *tftp_filename, int disk, uint32_t sector); // image to consecutive sectors
+bool tftpd_start(bool seed_only); // serve as a background job: fetched files, and unless seed_only the FAT volume
+void tftpd_publish(const char *name, const char *disk_filename, uint32_t address, uint32_t size); // a file, or memory if disk_filename is NULL
+void tftpd_list(void);
 
 #endif
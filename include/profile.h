@@ -0,0 +1,23 @@
+#ifndef __PROFILE_DOT_H__
+#define __PROFILE_DOT_H__
+
+#include <types.h>
+
+/* sampling profiler: the timer interrupt hands profile_sample() the PC it
+ * interrupted, while profile_enabled is set */
+extern volatile bool profile_enabled;
+void profile_sample(uint32_t pc);
+
+void profile_start(void); /* clears the counts */
+void profile_stop(void);
+void profile_report(int top);
+
+/* allocation sites: malloc(), malloc_unchecked() and realloc() hand
+ * profile_heap_record() their caller, while profile_heap_enabled is set */
+extern volatile bool profile_heap_enabled;
+void profile_heap_record(uint32_t caller, uint32_t size);
+void profile_heap_start(void); /* clears the counts */
+void profile_heap_stop(void);
+void profile_heap_report(int top);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __GOGOBOOT_Q40_BUS_DOT_H__
+#define __GOGOBOOT_Q40_BUS_DOT_H__
+
+/* IDE register access for core/ide.c, inline: the ISA window is at a fixed
+ * address, and each controller keeps a pointer to its registers in it, so a
+ * status poll is a single move.b from a constant offset. The UART and NE2000
+ * drivers reach the ISA bus through the same q40/isa.h accessors. */
+
+#include <types.h>
+#include <ide.h>
+#include <q40/isa.h>
+#include <q40/ide.h>
+
+/* ATA register n is every fourth byte of the window from the command block */
+#define Q40_IDE_REG(ctrl, reg) ((ctrl)->regs[(reg) << 2])
+
+static inline uint8_t ide_get_register(disk_controller_t *ctrl, int reg)
+{
+    return Q40_IDE_REG(ctrl, reg);
+}
+
+/* build with IDE_IO_PAUSE for an interface that needs recovery time after
+ * each register write, as the NE2000 driver does for a DP8390 */
+static inline void ide_set_register(disk_controller_t *ctrl, int reg, uint8_t val)
+{
+    Q40_IDE_REG(ctrl, reg) = val;
+#ifdef IDE_IO_PAUSE
+    isa_slow_down();
+#endif
+}
+
+static inline void ide_transfer_sector_read(disk_controller_t *ctrl, void *ptr)
+{
+    q40_ide_sector_xfer_input(ptr, ctrl->data_reg);
+}
+
+static inline void ide_transfer_sector_write(disk_controller_t *ctrl, const void *ptr)
+{
+    q40_ide_sector_xfer_output(ptr, ctrl->data_reg);
+}
+
+#endif
@@ -20,10 +20,11 @@ void    q40_rtc_write_nvram(int offset, uint8_t value);
 
 /* hardware details */
 #define VIDEO_RAM_BASE  0xfe800000
+#define VIDEO_RAM_SIZE  (1024*1024)
 #define MASTER_ADDRESS  0xff000000
 #define RTC_ADDRESS     0xff020000
 
-#define MAX_RAM_SIZE  32                /* in MB; code needs adjusting to support 128MB option boards */
+#define MAX_RAM_SIZE  32                /* in MB, at address 0; other banks are further memory regions */
 #define Q40_ROMSIZE   (96*1024)         /* size of low ROM alias at base of physical memory */
 
 #define Q40_RTC_NVRAM(offset) ((volatile uint8_t *)(RTC_ADDRESS + (4 * offset)))
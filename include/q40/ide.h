@@ -4,7 +4,11 @@
 struct disk_controller_t
 {
     uint16_t base_io;
+    volatile uint8_t *regs;         /* ISA_XLATE_ADDR_BYTE(base_io) */
     volatile uint16_t *data_reg;
 };
 
+void q40_ide_sector_xfer_input(void *buf, volatile uint16_t *data_reg);
+void q40_ide_sector_xfer_output(const void *buf, volatile uint16_t *data_reg);
+
 #endif
@@ -0,0 +1,10 @@
+#ifndef __GOGOBOOT_RAMDUMP_DOT_H__
+#define __GOGOBOOT_RAMDUMP_DOT_H__
+
+/* -- ramdump.c -- sparse, compressed memory dumps; tools/ramdump expands them */
+typedef struct ramdump_t ramdump_t;
+ramdump_t *ramdump_open(uint32_t base, uint32_t size); /* size 0 for every RAM region; NULL on failure */
+int ramdump_read(void *context, void *dest, int len);   /* the next len bytes of the dump: fewer at the end */
+void ramdump_close(ramdump_t *dump);                    /* reports what was dumped */
+
+#endif
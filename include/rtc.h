@@ -14,4 +14,9 @@ void rtc_read_clock(rtc_time_t *buffer);
 void rtc_init(void);
 void report_current_time(void);
 
+/* battery-backed RAM in the RTC; reads outside it return 0xff */
+int rtc_nvram_size(void);
+uint8_t rtc_nvram_read(int offset);
+void rtc_nvram_write(int offset, uint8_t value);
+
 #endif
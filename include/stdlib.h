@@ -22,6 +22,21 @@ void *malloc_unchecked(size_t size);
 void free(void *ptr);
 void *realloc(void *ptr, size_t size); /* halts machine on out of memory */
 
+/* -- arena.c -- scratch memory, released when the command ends */
+
+typedef struct {
+    struct arena_chunk_t *chunk;
+    uint32_t used;
+    uint32_t in_use;
+} arena_mark_t;
+
+void *arena_alloc(size_t size); /* halts machine on out of memory */
+void *arena_realloc(void *ptr, size_t old_size, size_t size);
+char *arena_strdup(const char *s);
+arena_mark_t arena_mark(void);
+void arena_release(arena_mark_t mark);
+void arena_report(void);
+
 /* -- stdlib.c -- */
 
 extern int errno;
@@ -67,6 +82,30 @@ long strtol(const char *nptr, const char **endptr, int base);
 /* -- qsort.c -- */
 void qsort(void *base, size_t nel, size_t width, int (*cmp)(const void *, const void *));
 
+/* -- crc32.c -- */
+uint32_t crc32_update(uint32_t crc, const void *data, uint32_t len); /* start with crc = 0 */
+
+/* -- lz4.c -- */
+#define LZ4_MAX_INPUT   65536
+#define LZ4_BOUND(len)  ((len) + (len) / 255 + 16)     /* worst case output */
+#define LZ4_HASH_BITS   12
+#define LZ4_TABLE_SIZE  (sizeof(uint16_t) << LZ4_HASH_BITS)
+uint32_t lz4_compress(const void *src, uint32_t len, void *dest, uint16_t *table); /* raw LZ4 block */
+
+/* -- sha256.c -- */
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t buffer[64];
+    uint32_t used;
+} sha256_t;
+
+void sha256_init(sha256_t *s);
+void sha256_update(sha256_t *s, const void *data, uint32_t len);
+void sha256_final(sha256_t *s, uint8_t digest[SHA256_DIGEST_SIZE]);
+
 /* limits */
 
 /* Number of bits in a `char'.	*/
@@ -0,0 +1,23 @@
+#ifndef __TASK_DOT_H__
+#define __TASK_DOT_H__
+
+#include <types.h>
+
+/* cooperative tasks (core/task.c): step() does a little work and returns
+ * true while there is more to do. task_pump() steps each task once, then
+ * pumps the network, so call it wherever you would call net_pump(). */
+typedef struct task_t task_t;
+
+struct task_t {
+    const char *name;
+    bool (*step)(task_t *task);
+    void *context;
+    bool done;
+    task_t *next;
+};
+
+void task_start(task_t *task, const char *name, bool (*step)(task_t *task), void *context);
+void task_pump(void);
+void task_wait(task_t *task); /* pump until this one is done */
+
+#endif
@@ -5,6 +5,7 @@
 
 #define TIMER_HZ                200     // Q40 supports only 50 or 200
 #define TIMER_MS_PER_TICK       (1000/TIMER_HZ)
+#define TIMER_US_PER_TICK       (1000000/TIMER_HZ)
 
 /* timers - on Q40, use only after q40_setup_interrupts() called */
 typedef uint32_t timer_t;
@@ -15,6 +16,17 @@ void timer_wait(timer_t timeout);
 #define set_timer_ms(msec) set_timer_ticks(((msec)+TIMER_MS_PER_TICK-1)/TIMER_MS_PER_TICK)
 #define set_timer_sec(sec) set_timer_ms((sec)*1000)
 
+/* microseconds, for timing things shorter than a tick: about 0.5us on the
+ * ECB targets, which can read back the MF/PIC tick counter, and 100us on the
+ * Q40, which counts the 10kHz sample interrupt. it never goes backwards, but
+ * wraps every 71 minutes, so take differences. the Q40 takes that interrupt
+ * only while someone holds fine timing; otherwise it has tick resolution. */
+uint32_t timer_read_fine(void);
+void timer_fine_hold(void);
+void timer_fine_release(void);
+uint32_t timer_sub_tick_us(void); /* target provided: how far we are into this tick */
+void timer_sub_tick_enable(bool on); /* target provided: start or stop whatever timer_sub_tick_us() needs */
+
 /* timer based delays */
 #define delay_sec(sec) timer_wait(set_timer_sec((sec)))
 #define delay_ms(msec) timer_wait(set_timer_ms((msec)))
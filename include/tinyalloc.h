@@ -4,7 +4,19 @@ extern "C" {
 
 #include <types.h>
 
-bool ta_init(const void *base, const void *limit, const size_t heap_blocks, const size_t split_thresh, const size_t alignment);
+#define TA_CLASS_MIN        16      // smallest size class; each class doubles
+#define TA_CLASSES          6       // 16 to 512 bytes
+#define TA_CLASS_PAGE       2048    // size class pages; a power of 2
+#define TA_CLASS_MAX_PAGES  128
+
+typedef struct {
+    size_t size;
+    size_t pages;
+    size_t in_use;
+    size_t allocs;
+} ta_class_info_t;
+
+bool ta_init(const void *base, const void *limit, const size_t heap_blocks, const size_t split_thresh, const size_t alignment, const size_t class_bytes);
 void *ta_alloc(size_t num);
 void *ta_calloc(size_t num, size_t size);
 bool ta_free(void *ptr);
@@ -15,6 +27,13 @@ size_t ta_num_used();
 size_t ta_num_fresh();
 bool ta_check();
 size_t ta_bytes_used();
+size_t ta_bytes_free();
+size_t ta_largest_free();
+size_t ta_compactions();
+bool ta_class_info(int c, ta_class_info_t *info);
+void ta_class_totals(size_t *pages_used, size_t *pages_total, size_t *fallbacks);
+void ta_usage(size_t *in_use, size_t *peak, size_t *largest); // peak and largest since ta_usage_reset()
+void ta_usage_reset();
 
 #ifdef __cplusplus
 }
@@ -5,18 +5,26 @@
 
 typedef signed char		int8_t;
 typedef signed short int	int16_t;
-typedef signed long int		int32_t;
 typedef signed long long	int64_t;
 
 typedef unsigned char		uint8_t;
 typedef unsigned short int	uint16_t;
-typedef unsigned long int	uint32_t;
 typedef unsigned long long	uint64_t;
 
+#ifdef __LP64__
+/* the host build (make bench-host): long and pointers are 64 bits */
+typedef signed int		int32_t;
+typedef unsigned int		uint32_t;
+typedef long                    intptr_t;
+typedef unsigned long           uintptr_t;
+typedef unsigned long           size_t;
+#else
+typedef signed long int		int32_t;
+typedef unsigned long int	uint32_t;
 typedef int                     intptr_t;
 typedef unsigned int            uintptr_t;
-
 typedef uint32_t                size_t;
+#endif
 
 #ifndef NULL
 #define NULL ((void *)0)
@@ -38,10 +46,10 @@ typedef uint32_t                size_t;
 #define be32_to_cpu(x)  ((uint32_t)(x))
 #else
 #if __BYTE_ORDER == __LITTLE_ENDIAN
-#define ntohl(x)        (__builtin_bswap_32((uint32_t)(x)))
-#define ntohs(x)        (__builtin_bswap_16((uint16_t)(x)))
-#define htonl(x)        (__builtin_bswap_32((uint32_t)(x)))
-#define htons(x)        (__builtin_bswap_16((uint16_t)(x)))
+#define ntohl(x)        (__builtin_bswap32((uint32_t)(x)))
+#define ntohs(x)        (__builtin_bswap16((uint16_t)(x)))
+#define htonl(x)        (__builtin_bswap32((uint32_t)(x)))
+#define htons(x)        (__builtin_bswap16((uint16_t)(x)))
 #define cpu_to_le16(x)  ((uint16_t)(x))
 #define le16_to_cpu(x)  ((uint16_t)(x))
 #define cpu_to_le32(x)  ((uint32_t)(x))
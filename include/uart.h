@@ -16,8 +16,10 @@ typedef enum {
 
 void uart_init(void);
 void uart_identify(void);
-void uart_flush(void);
-bool uart_write_ready(void);
+void uart_flush(void); /* wait until everything queued has been sent */
+bool uart_set_baud(uint32_t baud); /* 0 = the default; false if the UART cannot do it */
+bool uart_write_ready(void); /* room to queue a byte */
+void uart_tx_tick(void); /* from the timer interrupt */
 void uart_write_byte(char b);
 int uart_write_string(const char *str);
 
@@ -42,6 +44,7 @@ bool uart_check_cancel_key(void);
 
 /* 16C950 UART hardware register */
 #define UART_ACR        0       /* Additional Control Register */
+#define UART_TCR        2       /* Times Clock Register (samples per bit) */
 #define UART_EFR        2       /* Extended Features Register */
 #define UART_ID1        8       /* UART ID1 */
 #define UART_ID2        9       /* UART ID2 */
@@ -6,6 +6,7 @@
         .globl  loader_bounce_buffer_size
         .globl  loader_bounce_buffer_target
         .globl  loader_scratch_space
+        .globl  loader_entry_caches_off
 
         .section .text
         .align 4
@@ -18,6 +19,7 @@ machine_execute:
         movea.l (loader_bounce_buffer_data), %a1        /* a1 = bounce buffer source addr */
         movea.l (loader_bounce_buffer_target), %a2      /* a2 = bounce buffer target addr */
         move.l (loader_bounce_buffer_size), %d0         /* d0 = bounce buffer size */
+        movea.l (loader_entry_caches_off), %a4          /* a4 = turn the caches off at entry? (read it before the copy) */
         cmp.l #0, %d0                                   /* test size == 0? */
         beq.s runit                                     /* not in use? skip copying */
         addq #3, %d0                                    /* round up size (although it should be in whole dwords already) */
@@ -39,10 +41,20 @@ nextword:
         jmp (%a0)                                       /* continue execution in new location */
 
         /* code below this point is copied to a scratch buffer */
-        /* WARNING: the scratch buffer is only 128 bytes in size! */
+        /* WARNING: the scratch buffer is only 256 bytes in size! */
 
+        /* the copy runs with the caches on, so the movem.l loads burst fill */
 copystart:
-        br.s bounce_copy
+bounce_blocks:
+        subq.l #8, %d0                                  /* 32 bytes per pass */
+        bcs.s bounce_blocks_done
+        movem.l (%a1)+, %d1-%d7/%a0
+        movem.l %d1-%d7/%a0, (%a2)
+        lea.l 32(%a2), %a2
+        bra.s bounce_blocks
+bounce_blocks_done:
+        addq.l #8, %d0
+        bra.s bounce_copy
 bounce_loop:
         move.l (%a1)+,(%a2)+
 bounce_copy:
@@ -55,6 +67,11 @@ runit:
         or.w #(CACR_CI + CACR_CD), %d1
         movec.l %d1, %cacr
         nop
+        move.l %a4, %d1
+        beq.s caches_done
+        move.l #(CACR_CI+CACR_CD), %d1
+        movec %d1, %cacr        /* disable and clear data, instruction caches */
+caches_done:
         jmp %a5@                                        /* ... off we go! */
 copyend:
         .end
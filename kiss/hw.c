@@ -54,5 +54,8 @@ void target_mem_init(void)
 
         heap_base = ram_size - heap_size;
         heap_size -= stack_size;
+
+        /* the SRAM is ours only when we run from it */
+        mem_add_region(KISS68030_SRAM_BASE, KISS68030_SRAM_SIZE, mem_sram);
     }
 }
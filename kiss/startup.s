@@ -46,6 +46,15 @@ _start:
         movec.l %d0, %cacr
         nop
 
+        /* setup the 030 transparent translation registers
+           https://www.nxp.com/docs/en/reference-manual/MC68030UM.pdf section 9.7.3
+           tt0: data accesses to the top 16MB (ROM, SRAM, ECB memory and I/O) =
+                cache inhibited, instruction fetches there can still be cached
+           tt1: disabled */
+        lea.l   %pc@(startup_tt), %a0
+        pmove   (%a0), %tt0
+        pmove   4(%a0), %tt1
+
         /* flush page translation cache */
         pflusha
         nop
@@ -83,6 +92,26 @@ copy_text:
 target_address:
         /* phew ... we're done using only PC-relative addresses */
 
+        /* built to run from ROM (linker-sram.ld): copy .data, with the .fasttext
+           inner loops at its head, into SRAM */
+        lea.l   data_load_start, %a0    /* source address */
+        lea.l   data_start, %a1         /* dest address */
+        cmpa.l  %a0, %a1
+        beq.s   data_in_place           /* linked for RAM: copied above */
+        move.l  #(data_size+3), %d0     /* num bytes to copy; round up */
+        lsr.l   #2, %d0                 /* convert to longwords (div 4) */
+        br.s    copy_data
+copy_data_loop:
+        move.l  (%a0)+,(%a1)+
+copy_data:
+        dbra    %d0,copy_data_loop
+
+        /* flush (and keep enabled) data, instruction caches */
+        move.l #(CACR_EI + CACR_ED + CACR_CI + CACR_CD), %d0
+        movec.l %d0, %cacr
+        nop
+data_in_place:
+
         /* load vector base register */
         lea vector_table, %a0
         movec.l %a0, %vbr
@@ -104,8 +133,14 @@ zap_bss:
 
         /* halt */
 halt:
+        jsr uart_flush                  /* let queued output drain */
 stopped:
         stop #0x2700                    /* all done */
         br.s stopped                    /* loop on NMI */
 
+        .even
+startup_tt:                             /* pmove wants these in memory */
+        .long   0xff008514              /* tt0: base=ff, mask=00, e=1, ci=1, rwm=1, fc=x01 */
+        .long   0                       /* tt1: e=0 */
+
         .end
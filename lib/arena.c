@@ -0,0 +1,151 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <init.h>
+
+// Scratch memory for things that live no longer than the command that made
+// them. Allocation bumps a pointer; execute_cmd() takes an arena_mark() before
+// each command and hands it to arena_release() afterwards, which frees the lot
+// at once. Commands nest (scripts), and each level only releases its own.
+//
+// The first chunk is kept for good, so most commands never touch the heap at
+// all. Anything that doesn't fit gets a chunk of its own from the heap, which
+// goes back when it is released.
+
+#define ARENA_ALIGN             4
+#define ARENA_CHUNK_MIN         (4*1024)
+#define ARENA_CHUNK_MAX         (128*1024)
+#define ARENA_HEAP_FRACTION     16      // first chunk is 1/16th of the heap
+
+typedef struct arena_chunk_t arena_chunk_t;
+
+struct arena_chunk_t {
+    arena_chunk_t *prev;
+    uint32_t size;                      // bytes in data[]
+    uint32_t used;
+    uint8_t data[];
+};
+
+static arena_chunk_t *arena_first = NULL;
+static arena_chunk_t *arena_current = NULL;
+static void *arena_last = NULL;         // most recent allocation, so it can grow in place
+static uint32_t arena_high_water = 0;   // most bytes in use at once
+static uint32_t arena_in_use = 0;
+
+static arena_chunk_t *arena_new_chunk(uint32_t size)
+{
+    arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + size);
+
+    chunk->prev = arena_current;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+static void arena_init(void)
+{
+    uint32_t size = heap_size / ARENA_HEAP_FRACTION;
+
+    if(size > ARENA_CHUNK_MAX)
+        size = ARENA_CHUNK_MAX;
+    if(size < ARENA_CHUNK_MIN)
+        size = ARENA_CHUNK_MIN;
+
+    arena_first = arena_current = arena_new_chunk(size);
+}
+
+void *arena_alloc(size_t size)
+{
+    void *r;
+
+    if(!arena_first)
+        arena_init();
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if(arena_current->used + size > arena_current->size)
+        arena_current = arena_new_chunk(size > ARENA_CHUNK_MIN ? size : ARENA_CHUNK_MIN);
+
+    r = arena_current->data + arena_current->used;
+    arena_current->used += size;
+    arena_last = r;
+
+    arena_in_use += size;
+    if(arena_in_use > arena_high_water)
+        arena_high_water = arena_in_use;
+
+    return r;
+}
+
+// the most recent allocation grows in place if there is room
+void *arena_realloc(void *ptr, size_t old_size, size_t size)
+{
+    void *r;
+    uint32_t offset;
+
+    if(ptr && ptr == arena_last){
+        offset = (uint8_t*)ptr - arena_current->data;
+        size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+        if(offset + size <= arena_current->size){
+            arena_in_use += (offset + size) - arena_current->used;
+            arena_current->used = offset + size;
+            if(arena_in_use > arena_high_water)
+                arena_high_water = arena_in_use;
+            return ptr;
+        }
+    }
+
+    r = arena_alloc(size);
+    if(ptr)
+        memcpy(r, ptr, old_size < size ? old_size : size);
+    return r;
+}
+
+char *arena_strdup(const char *s)
+{
+    int len = strlen(s) + 1;
+    char *r = arena_alloc(len);
+
+    memcpy(r, s, len);
+    return r;
+}
+
+arena_mark_t arena_mark(void)
+{
+    arena_mark_t mark;
+
+    if(!arena_first)
+        arena_init();
+
+    mark.chunk = arena_current;
+    mark.used = arena_current->used;
+    mark.in_use = arena_in_use;
+    return mark;
+}
+
+void arena_release(arena_mark_t mark)
+{
+    arena_chunk_t *chunk;
+
+    while(arena_current != mark.chunk){
+        chunk = arena_current;
+        arena_current = chunk->prev;
+        free(chunk);
+    }
+
+    arena_current->used = mark.used;
+    arena_in_use = mark.in_use;
+    arena_last = NULL;
+}
+
+void arena_report(void)
+{
+    int chunks = 0;
+
+    for(arena_chunk_t *chunk = arena_current; chunk; chunk = chunk->prev)
+        chunks++;
+
+    printf("scratch arena: %ld KB, %ld bytes in use in %d chunk%s, high water %ld bytes\n",
+            arena_first ? arena_first->size >> 10 : 0, arena_in_use, chunks,
+            chunks == 1 ? "" : "s", arena_high_water);
+}
@@ -0,0 +1,61 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <cpu.h>
+
+// The CRC32 of zlib, gzip and Ethernet (reflected polynomial 0xedb88320).
+// Start with crc = 0 and feed it the data in as many pieces as you like.
+
+// slicing-by-4: table[k][n] is the CRC of byte n followed by k zero bytes, so
+// four bytes at a time take four lookups. the words are read big-endian, so
+// the first byte is at the top of the word and meets the bottom of the CRC.
+
+static uint32_t crc32_table[4][256];
+static bool crc32_table_ready = false;
+
+static void crc32_make_table(void)
+{
+    uint32_t c;
+
+    for(int n=0; n<256; n++){
+        c = n;
+        for(int k=0; k<8; k++)
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        crc32_table[0][n] = c;
+    }
+    for(int n=0; n<256; n++){
+        c = crc32_table[0][n];
+        for(int k=1; k<4; k++){
+            c = crc32_table[0][c & 0xff] ^ (c >> 8);
+            crc32_table[k][n] = c;
+        }
+    }
+    crc32_table_ready = true;
+}
+
+FASTTEXT uint32_t crc32_update(uint32_t crc, const void *data, uint32_t len)
+{
+    const uint8_t *p = data;
+    const uint32_t *w;
+    uint32_t x;
+
+    if(!crc32_table_ready)
+        crc32_make_table();
+
+    crc = ~crc;
+    while(len && ((uintptr_t)p & 3)){
+        crc = crc32_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+
+    for(w = (const uint32_t*)p; len >= 4; len -= 4){
+        x = be32_to_cpu(*w++);
+        crc = crc32_table[3][(crc ^ (x >> 24)) & 0xff] ^ crc32_table[2][((crc >> 8) ^ (x >> 16)) & 0xff] ^
+              crc32_table[1][((crc >> 16) ^ (x >> 8)) & 0xff] ^ crc32_table[0][((crc >> 24) ^ x) & 0xff];
+    }
+
+    for(p = (const uint8_t*)w; len--; )
+        crc = crc32_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
@@ -0,0 +1,105 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <cpu.h>
+
+// LZ4 block compression (the raw block format, no frame): a greedy single
+// pass that takes the first 4-byte match its hash table offers. It keeps to
+// the rules decoders rely on: the last five bytes are literals, and no match
+// starts in the last twelve. Blocks are at most LZ4_MAX_INPUT, so positions
+// and offsets both fit 16 bits.
+
+#define MIN_MATCH       4
+#define LAST_LITERALS   5
+#define MF_LIMIT        12
+#define SKIP_TRIGGER    6       // through data that won't compress, step faster the longer it goes on
+
+#ifdef CPU_68020_OR_LATER
+typedef uint32_t __attribute__((may_alias)) unaligned_uint32_t;
+static inline uint32_t lz4_read32(const uint8_t *p)
+{
+    return *(const unaligned_uint32_t*)p; // any alignment will do
+}
+#else
+static inline uint32_t lz4_read32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | (p[2] << 8) | p[3];
+}
+#endif
+
+// shifts rather than a multiply: the 68000 has no 32-bit one
+static inline uint32_t lz4_hash(uint32_t v)
+{
+    return (v ^ (v >> 11) ^ (v >> 21)) & ((1 << LZ4_HASH_BITS) - 1);
+}
+
+static inline uint8_t *lz4_put_length(uint8_t *op, uint32_t n)
+{
+    while(n >= 255){
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+static inline uint8_t *lz4_put_literals(uint8_t *op, const uint8_t *literals, uint32_t n, uint8_t match_nibble)
+{
+    *op++ = ((n < 15 ? n : 15) << 4) | match_nibble;
+    if(n >= 15)
+        op = lz4_put_length(op, n - 15);
+    memcpy(op, literals, n);
+    return op + n;
+}
+
+// len bytes from src, at most LZ4_MAX_INPUT, into dest, which has room for
+// LZ4_BOUND(len); table is scratch for LZ4_TABLE_SIZE bytes. returns the
+// compressed length
+FASTTEXT uint32_t lz4_compress(const void *src, uint32_t len, void *dest, uint16_t *table)
+{
+    const uint8_t *base = src, *ip = src, *anchor = src, *end = base + len;
+    const uint8_t *mf_limit = end - MF_LIMIT, *match_limit = end - LAST_LITERALS;
+    const uint8_t *ref;
+    uint8_t *op = dest;
+    uint32_t seq, h, mlen;
+
+    if(len > MF_LIMIT){
+        memset(table, 0, LZ4_TABLE_SIZE);
+
+        while(ip < mf_limit){
+            seq = lz4_read32(ip);
+            h = lz4_hash(seq);
+            ref = base + table[h];
+            table[h] = ip - base;
+            if(ref >= ip || lz4_read32(ref) != seq){
+                ip += 1 + ((ip - anchor) >> SKIP_TRIGGER);
+                continue;
+            }
+
+            // take the match back over any literals that also match, then on
+            while(ip > anchor && ref > base && ip[-1] == ref[-1]){
+                ip--;
+                ref--;
+            }
+            mlen = MIN_MATCH;
+            while(ip + mlen < match_limit && ip[mlen] == ref[mlen])
+                mlen++;
+
+            mlen -= MIN_MATCH;
+            op = lz4_put_literals(op, anchor, ip - anchor, mlen < 15 ? mlen : 15);
+            *op++ = (ip - ref) & 0xff;
+            *op++ = (ip - ref) >> 8;
+            if(mlen >= 15)
+                op = lz4_put_length(op, mlen - 15);
+
+            ip += mlen + MIN_MATCH;
+            anchor = ip;
+            if(ip < mf_limit) // catches the start of a run that repeats what we just matched
+                table[lz4_hash(lz4_read32(ip - 2))] = ip - 2 - base;
+        }
+    }
+
+    op = lz4_put_literals(op, anchor, end - anchor, 0);
+    return op - (uint8_t*)dest;
+}
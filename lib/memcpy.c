@@ -11,7 +11,7 @@
 #include <types.h>
 #include <cpu.h>
 
-void *memcpy(void *to, const void *from, size_t n)
+FASTTEXT void *memcpy(void *to, const void *from, size_t n)
 {
 	void *xto = to;
 	size_t temp;
@@ -43,10 +43,50 @@ void *memcpy(void *to, const void *from, size_t n)
 		from = sfrom;
 		n -= 2;
 	}
+#if defined(CPU_HAS_MOVE16)
+	/* move16 needs both ends on the same 16-byte line offset */
+	if (n >= CPU_BULK_MIN && (((long)to ^ (long)from) & 15) == 0) {
+		uint32_t *lto = to;
+		const uint32_t *lfrom = from;
+		while ((long)lto & 15) {
+			*lto++ = *lfrom++;
+			n -= 4;
+		}
+		temp = n >> 4;
+		__asm__ volatile (
+			"1:	move16 %0@+,%1@+\n"
+			"	subql #1,%2\n"
+			"	jne   1b"
+			: "=a" (lfrom), "=a" (lto), "=d" (temp)
+			: "0" (lfrom), "1" (lto), "2" (temp)
+			: "memory");
+		n &= 15;
+		to = lto;
+		from = lfrom;
+	}
+#elif defined(CPU_MOVEM_BURST)
+	if (n >= CPU_BULK_MIN) {
+		uint32_t *lto = to;
+		const uint32_t *lfrom = from;
+		temp = n >> 5;
+		__asm__ volatile (
+			"1:	moveml %0@+,%%d1-%%d4/%%a2-%%a5\n"
+			"	moveml %%d1-%%d4/%%a2-%%a5,%1@\n"
+			"	lea   %1@(32),%1\n"
+			"	subql #1,%2\n"
+			"	jne   1b"
+			: "=a" (lfrom), "=a" (lto), "=d" (temp)
+			: "0" (lfrom), "1" (lto), "2" (temp)
+			: "d1", "d2", "d3", "d4", "a2", "a3", "a4", "a5", "memory");
+		n &= 31;
+		to = lto;
+		from = lfrom;
+	}
+#endif
 	temp = n >> 2;
 	if (temp) {
-		long *lto = to;
-		const long *lfrom = from;
+		uint32_t *lto = to;
+		const uint32_t *lfrom = from;
 #if defined(CPU_68010_OR_EARLIER)
 		for (; temp; temp--)
 			*lto++ = *lfrom++;
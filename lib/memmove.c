@@ -9,6 +9,7 @@
 // #include <linux/module.h>
 // #include <linux/string.h>
 #include <types.h>
+#include <stdlib.h>
 
 void *memmove(void *dest, const void *src, size_t n)
 {
@@ -18,6 +19,10 @@ void *memmove(void *dest, const void *src, size_t n)
 	if (!n)
 		return xdest;
 
+	/* no overlap: memcpy has the fast bulk paths */
+	if ((char *)dest + n <= (const char *)src || (const char *)src + n <= (char *)dest)
+		return memcpy(dest, src, n);
+
 	if (dest < src) {
 		if ((long)dest & 1) {
 			char *cdest = dest;
@@ -37,8 +42,8 @@ void *memmove(void *dest, const void *src, size_t n)
 		}
 		temp = n >> 2;
 		if (temp) {
-			long *ldest = dest;
-			const long *lsrc = src;
+			uint32_t *ldest = dest;
+			const uint32_t *lsrc = src;
 			temp--;
 			do
 				*ldest++ = *lsrc++;
@@ -79,8 +84,8 @@ void *memmove(void *dest, const void *src, size_t n)
 		}
 		temp = n >> 2;
 		if (temp) {
-			long *ldest = dest;
-			const long *lsrc = src;
+			uint32_t *ldest = dest;
+			const uint32_t *lsrc = src;
 			temp--;
 			do
 				*--ldest = *--lsrc;
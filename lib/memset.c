@@ -11,7 +11,7 @@
 #include <types.h>
 #include <cpu.h>
 
-void *memset(void *s, int c, size_t count)
+FASTTEXT void *memset(void *s, int c, size_t count)
 {
 	void *xs = s;
 	size_t temp;
@@ -33,9 +33,56 @@ void *memset(void *s, int c, size_t count)
 		s = ss;
 		count -= 2;
 	}
+#if defined(CPU_HAS_MOVE16)
+	/* move16 the same line, holding the pattern, over and over */
+	if (count >= CPU_BULK_MIN) {
+		long line[8];
+		uint32_t *ls = s;
+		long *pattern = (long *)(((long)line + 15) & ~15);
+		pattern[0] = pattern[1] = pattern[2] = pattern[3] = c;
+		while ((long)ls & 15) {
+			*ls++ = c;
+			count -= 4;
+		}
+		temp = count >> 4;
+		__asm__ volatile (
+			"1:	move16 %0@+,%1@+\n"
+			"	lea   %0@(-16),%0\n"
+			"	subql #1,%2\n"
+			"	jne   1b"
+			: "=a" (pattern), "=a" (ls), "=d" (temp)
+			: "0" (pattern), "1" (ls), "2" (temp)
+			: "memory");
+		count &= 15;
+		s = ls;
+	}
+#elif defined(CPU_MOVEM_BURST)
+	if (count >= CPU_BULK_MIN) {
+		uint32_t *ls = s;
+		temp = count >> 5;
+		__asm__ volatile (
+			"	movel %3,%%d1\n"
+			"	movel %3,%%d2\n"
+			"	movel %3,%%d3\n"
+			"	movel %3,%%d4\n"
+			"	moveal %3,%%a2\n"
+			"	moveal %3,%%a3\n"
+			"	moveal %3,%%a4\n"
+			"	moveal %3,%%a5\n"
+			"1:	moveml %%d1-%%d4/%%a2-%%a5,%0@\n"
+			"	lea   %0@(32),%0\n"
+			"	subql #1,%1\n"
+			"	jne   1b"
+			: "=a" (ls), "=d" (temp)
+			: "0" (ls), "d" (c), "1" (temp)
+			: "d1", "d2", "d3", "d4", "a2", "a3", "a4", "a5", "memory");
+		count &= 31;
+		s = ls;
+	}
+#endif
 	temp = count >> 2;
 	if (temp) {
-		long *ls = s;
+		uint32_t *ls = s;
 #if defined(CPU_68010_OR_EARLIER)
 		for (; temp; temp--)
 			*ls++ = c;
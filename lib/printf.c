@@ -21,12 +21,44 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <uart.h>
+#include <net.h>
 
 #define NUMLTH 11
+#define LINELTH 128     /* printf output goes out a line (or this much) at a time */
 static unsigned char * __numout(long i, int base, unsigned char out[]);
 
+typedef struct {
+   int len;
+   char buf[LINELTH+1];
+} line_t;
+
+static void line_flush(line_t *line)
+{
+   if (!line->len)
+      return;
+   line->buf[line->len] = '\0';
+   if (!netcon_write(line->buf, line->len))
+      uart_write_string(line->buf);
+   line->len = 0;
+}
+
+static inline void line_putch(line_t *line, char ch)
+{
+   if (!ch)
+   {
+      line_flush(line);   /* %c of a NUL, which a string cannot hold */
+      putch(ch);
+      return;
+   }
+   line->buf[line->len++] = ch;
+   if (ch == '\n' || line->len == LINELTH)
+      line_flush(line);
+}
+
 int putch(char ch)
 {
+    if (netcon_write_byte(ch))
+        return (int)ch;
     if (ch == '\n') 
         uart_write_byte('\r');
     uart_write_byte(ch);
@@ -40,8 +72,11 @@ int putchar(int ch)
 
 int puts(const char *s)
 {
-    int r;
-    r = uart_write_string(s);
+    int r = 0;
+    while (*s) {
+        putch(*s++);
+        r++;
+    }
     putch('\n');
     return r + 1;
 }
@@ -56,8 +91,11 @@ int printf(const char * fmt, ...)
    char padch=' ';
    int  minsize, maxsize;
    unsigned char out[NUMLTH+1];
+   line_t line;
    va_list ap;
 
+   line.len = 0;
+
    va_start(ap, fmt);
 
    while((c=*fmt++))
@@ -65,7 +103,7 @@ int printf(const char * fmt, ...)
       count++;
       if(c!='%')
       {
-	 putch(c);
+	 line_putch(&line, c);
       }
       else
       {
@@ -133,36 +171,59 @@ int printf(const char * fmt, ...)
 	       if( minsize > 0 )
 	       {
 		  minsize -= c;
-		  while(minsize>0) { putch(padch); count++; minsize--; }
+		  while(minsize>0) { line_putch(&line, padch); count++; minsize--; }
 		  minsize=0;
 	       }
 	       if( minsize < 0 ) minsize= -minsize-c;
 	       while(*cp && maxsize-->0 )
 	       {
-		  putch(*cp++);
+		  line_putch(&line, *cp++);
 		  count++;
 	       }
-	       while(minsize>0) { putch(' '); count++; minsize--; }
+	       while(minsize>0) { line_putch(&line, ' '); count++; minsize--; }
 	       break;
 	    case 'c':
-	       putch(va_arg(ap, int));			/* char is promoted to int by ... */
+	       line_putch(&line, va_arg(ap, int));			/* char is promoted to int by ... */
 	       break;
 	    default:
-	       putch(c);
+	       line_putch(&line, c);
 	       break;
 	 }
       }
    }
+   line_flush(&line);
    va_end(ap);
    return count;
 }
 
 const char nstring[]="0123456789ABCDEF";
 
+/* val / 10 with shifts and adds (Hacker's Delight, divu10): the 68000 has no
+ * 32-bit divide, and this beats the 68020's divu.l too */
+static inline unsigned long __div10(unsigned long val, int *digit)
+{
+   unsigned long q, r;
+
+   q = (val >> 1) + (val >> 2);
+   q += q >> 4;
+   q += q >> 8;
+   q += q >> 16;
+   q >>= 3;
+   r = val - ((q << 3) + (q << 1));     /* val - q * 10, and q may be one short */
+   if (r > 9)
+   {
+      q++;
+      r -= 10;
+   }
+   *digit = r;
+   return q;
+}
+
 static unsigned char *__numout(long i, int base, unsigned char out[])
 {
-   int n;
+   int n, digit;
    int flg = 0;
+   int shift;
    unsigned long val;
 
    if (base<0)
@@ -178,12 +239,25 @@ static unsigned char *__numout(long i, int base, unsigned char out[])
 
    out[NUMLTH] = '\0';
    n = NUMLTH-1;
-   do
+   if (base == 10)
    {
-      out[n--] = nstring[val % base];
-      val /= base;
+      do
+      {
+	 val = __div10(val, &digit);
+	 out[n--] = nstring[digit];
+      }
+      while(val);
+   }
+   else
+   {
+      shift = (base == 16) ? 4 : 3;
+      do
+      {
+	 out[n--] = nstring[val & (base-1)];
+	 val >>= shift;
+      }
+      while(val);
    }
-   while(val);
    if(flg) out[n--] = '-';
    return &out[n+1];
 }
@@ -58,11 +58,11 @@ static void _wqsort(void *basep, int lo, int hi,
    }
 }
 
-static void _lqsort(long *base, int lo, int hi, int (*cmp)(const void *, const void *))
+static void _lqsort(int32_t *base, int lo, int hi, int (*cmp)(const void *, const void *))
 {
-   long  k;
+   int32_t k;
    register int i, j, t;
-   register long *p = &k;
+   register int32_t *p = &k;
 
    while (hi > lo)
    {
@@ -0,0 +1,131 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <cpu.h>
+
+// SHA-256 (FIPS 180-4). sha256_init(), then sha256_update() with the data in
+// as many pieces as you like, then sha256_final() for the digest.
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+#define ROR(x, n)       (((x) >> (n)) | ((x) << (32 - (n))))
+#define S0(a)           (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22))
+#define S1(e)           (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25))
+#define s0(x)           (ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
+#define s1(x)           (ROR(x, 17) ^ ROR(x, 19) ^ ((x) >> 10))
+#define CH(e, f, g)     ((g) ^ ((e) & ((f) ^ (g))))
+#define MAJ(a, b, c)    (((a) & (b)) | ((c) & ((a) | (b))))
+
+// the message schedule is kept as a ring of the last 16 words, extended as
+// the rounds use them
+#define LOADED(i)       w[i]
+#define SCHEDULE(i)     (w[(i) & 15] += s1(w[((i) - 2) & 15]) + w[((i) - 7) & 15] + s0(w[((i) - 15) & 15]))
+
+// a round renames the working variables instead of moving them along, so
+// eight rounds in a row bring the names back to where they started
+#define ROUND(a, b, c, d, e, f, g, h, i, W) do { \
+        t1 = h + S1(e) + CH(e, f, g) + sha256_k[i] + W(i); \
+        d += t1; \
+        h = t1 + S0(a) + MAJ(a, b, c); \
+    } while(0)
+
+#define ROUNDS8(i, W) do { \
+        ROUND(a, b, c, d, e, f, g, h, (i)+0, W); \
+        ROUND(h, a, b, c, d, e, f, g, (i)+1, W); \
+        ROUND(g, h, a, b, c, d, e, f, (i)+2, W); \
+        ROUND(f, g, h, a, b, c, d, e, (i)+3, W); \
+        ROUND(e, f, g, h, a, b, c, d, (i)+4, W); \
+        ROUND(d, e, f, g, h, a, b, c, (i)+5, W); \
+        ROUND(c, d, e, f, g, h, a, b, (i)+6, W); \
+        ROUND(b, c, d, e, f, g, h, a, (i)+7, W); \
+    } while(0)
+
+FASTTEXT static void sha256_block(sha256_t *s, const uint8_t *p)
+{
+    uint32_t w[16], a, b, c, d, e, f, g, h, t1;
+    int i;
+
+    for(i=0; i<16; i++, p+=4)
+        w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | (p[2] << 8) | p[3];
+
+    a = s->state[0]; b = s->state[1]; c = s->state[2]; d = s->state[3];
+    e = s->state[4]; f = s->state[5]; g = s->state[6]; h = s->state[7];
+
+    for(i=0; i<16; i+=8)
+        ROUNDS8(i, LOADED);
+    for(; i<64; i+=8)
+        ROUNDS8(i, SCHEDULE);
+
+    s->state[0] += a; s->state[1] += b; s->state[2] += c; s->state[3] += d;
+    s->state[4] += e; s->state[5] += f; s->state[6] += g; s->state[7] += h;
+}
+
+void sha256_init(sha256_t *s)
+{
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+    memcpy(s->state, initial, sizeof(initial));
+    s->length = 0;
+    s->used = 0;
+}
+
+void sha256_update(sha256_t *s, const void *data, uint32_t len)
+{
+    const uint8_t *p = data;
+    uint32_t n;
+
+    s->length += len;
+
+    if(s->used){
+        n = 64 - s->used;
+        if(n > len)
+            n = len;
+        memcpy(s->buffer + s->used, p, n);
+        s->used += n;
+        p += n;
+        len -= n;
+        if(s->used < 64)
+            return;
+        sha256_block(s, s->buffer);
+        s->used = 0;
+    }
+
+    for(; len >= 64; len -= 64, p += 64)
+        sha256_block(s, p);
+
+    memcpy(s->buffer, p, len);
+    s->used = len;
+}
+
+void sha256_final(sha256_t *s, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint64_t bits = s->length << 3;
+
+    s->buffer[s->used++] = 0x80;
+    if(s->used > 56){
+        memset(s->buffer + s->used, 0, 64 - s->used);
+        sha256_block(s, s->buffer);
+        s->used = 0;
+    }
+    memset(s->buffer + s->used, 0, 56 - s->used);
+    for(int i=0; i<8; i++)
+        s->buffer[56+i] = bits >> (56 - 8*i);
+    sha256_block(s, s->buffer);
+
+    for(int i=0; i<8; i++){
+        digest[4*i+0] = s->state[i] >> 24;
+        digest[4*i+1] = s->state[i] >> 16;
+        digest[4*i+2] = s->state[i] >> 8;
+        digest[4*i+3] = s->state[i];
+    }
+}
@@ -2,6 +2,7 @@
 
 #include <stdlib.h>
 #include <tinyalloc.h>
+#include <profile.h>
 
 /*
  * A minimal implementation of selected standard C library functions
@@ -254,9 +255,16 @@ size_t strlen(const char *t)
         return ct;
 }
 
+/* for "profile heap": who asked */
+#define note_caller(size) do { \
+        if(profile_heap_enabled) \
+            profile_heap_record((uintptr_t)__builtin_return_address(0), size); \
+    } while(0)
+
 void *realloc(void *ptr, size_t size)
 {
     void *r;
+    note_caller(size);
     if(ptr == 0)
         r = ta_alloc(size);
     else
@@ -270,12 +278,15 @@ void *realloc(void *ptr, size_t size)
 
 void *malloc_unchecked(size_t size)
 {
+    note_caller(size);
     return ta_alloc(size);
 }
 
 void *malloc(size_t size)
 {
-    void *r = ta_alloc(size);
+    void *r;
+    note_caller(size);
+    r = ta_alloc(size);
     if(!r){
         printf("malloc(%ld): out of memory!\n", size);
         halt();
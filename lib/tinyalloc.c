@@ -1,5 +1,6 @@
 #include <tinyalloc.h>
 #include <types.h>
+#include <stdlib.h>
 
 #ifdef TA_DEBUG
 extern void print_s(char *);
@@ -30,6 +31,52 @@ static size_t heap_split_thresh;
 static size_t heap_alignment;
 static size_t heap_max_blocks;
 
+/**
+ * Small allocations come from power-of-two size classes, carved
+ * from fixed-size pages at the top of the heap. Each class has an
+ * intrusive free list and a bump pointer into its newest page, so
+ * allocating and freeing are O(1) and never touch the block list.
+ * A page belongs to its class for good; when the pages run out,
+ * small allocations fall back to the block list.
+ */
+typedef struct Chunk Chunk;
+
+struct Chunk {
+    Chunk *next;
+};
+
+typedef struct {
+    Chunk *free;     // freed chunks
+    size_t bump;     // next never-used chunk in the newest page
+    size_t bump_end; // end of the newest page
+    size_t pages;
+    size_t in_use;
+    size_t allocs;
+} SizeClass;
+
+static SizeClass size_class[TA_CLASSES];
+static uint8_t class_of_page[TA_CLASS_MAX_PAGES];
+static size_t class_base;       // first page
+static size_t class_top;        // next unassigned page
+static size_t class_limit;      // end of the pages
+static size_t class_fallbacks;  // small allocations that found no page
+
+// bytes handed out (whole chunks and blocks), the most there have ever been,
+// and the largest single request
+static size_t bytes_in_use;
+static size_t bytes_peak;
+static size_t largest_request;
+
+static void note_alloc(size_t num, size_t size) {
+    bytes_in_use += size;
+    if (bytes_in_use > bytes_peak) {
+        bytes_peak = bytes_in_use;
+    }
+    if (num > largest_request) {
+        largest_request = num;
+    }
+}
+
 /**
  * If compaction is enabled, inserts block
  * into free list, sorted by addr.
@@ -66,6 +113,8 @@ static void insert_block(Block *block) {
 }
 
 #ifndef TA_DISABLE_COMPACT
+static size_t compactions;
+
 static void release_blocks(Block *scan, Block *to) {
     Block *scan_next;
     while (scan != to) {
@@ -84,6 +133,7 @@ static void compact() {
     Block *ptr = heap->free;
     Block *prev;
     Block *scan;
+    compactions++;
     while (ptr != NULL) {
         prev = ptr;
         scan = ptr->next;
@@ -111,9 +161,83 @@ static void compact() {
 }
 #endif
 
-bool ta_init(const void *base, const void *limit, const size_t heap_blocks, const size_t split_thresh, const size_t alignment) {
+static void class_init(size_t limit, size_t bytes) {
+    if (bytes > TA_CLASS_MAX_PAGES * TA_CLASS_PAGE) {
+        bytes = TA_CLASS_MAX_PAGES * TA_CLASS_PAGE;
+    }
+    class_limit = limit & -TA_CLASS_PAGE;
+    class_base  = (limit - bytes + TA_CLASS_PAGE - 1) & -TA_CLASS_PAGE;
+    if (class_base > class_limit) {
+        class_base = class_limit;
+    }
+    class_top = class_base;
+    memset(size_class, 0, sizeof(size_class));
+}
+
+// smallest class holding num bytes, or -1 if it is too big for any
+static int class_index(size_t num) {
+    int c       = 0;
+    size_t size = TA_CLASS_MIN;
+    while (size < num) {
+        if (++c == TA_CLASSES) {
+            return -1;
+        }
+        size <<= 1;
+    }
+    return c;
+}
+
+static void *class_alloc(size_t num) {
+    int c = class_index(num);
+    SizeClass *sc;
+    Chunk *chunk;
+    if (c < 0) {
+        return NULL;
+    }
+    sc = &size_class[c];
+    if (sc->free != NULL) {
+        chunk    = sc->free;
+        sc->free = chunk->next;
+    } else {
+        if (sc->bump == sc->bump_end) {
+            if (class_top == class_limit) {
+                class_fallbacks++;
+                return NULL;
+            }
+            class_of_page[(class_top - class_base) / TA_CLASS_PAGE] = c;
+            sc->bump     = class_top;
+            sc->bump_end = class_top + TA_CLASS_PAGE;
+            class_top   += TA_CLASS_PAGE;
+            sc->pages++;
+        }
+        chunk     = (Chunk *)sc->bump;
+        sc->bump += TA_CLASS_MIN << c;
+    }
+    sc->in_use++;
+    sc->allocs++;
+    return chunk;
+}
+
+static bool is_class_chunk(const void *ptr) {
+    return (size_t)ptr >= class_base && (size_t)ptr < class_top;
+}
+
+static size_t class_chunk_size(const void *ptr) {
+    return TA_CLASS_MIN << class_of_page[((size_t)ptr - class_base) / TA_CLASS_PAGE];
+}
+
+static void class_free(void *ptr) {
+    SizeClass *sc = &size_class[class_of_page[((size_t)ptr - class_base) / TA_CLASS_PAGE]];
+    Chunk *chunk  = ptr;
+    chunk->next   = sc->free;
+    sc->free      = chunk;
+    sc->in_use--;
+}
+
+bool ta_init(const void *base, const void *limit, const size_t heap_blocks, const size_t split_thresh, const size_t alignment, const size_t class_bytes) {
+    class_init((size_t)limit, class_bytes);
     heap = (Heap *)base;
-    heap_limit = limit;
+    heap_limit = (void *)class_base;
     heap_split_thresh = split_thresh;
     heap_alignment = alignment;
     heap_max_blocks = heap_blocks;
@@ -136,6 +260,11 @@ bool ta_init(const void *base, const void *limit, const size_t heap_blocks, cons
 bool ta_free(void *free) {
     Block *block = heap->used;
     Block *prev  = NULL;
+    if (is_class_chunk(free)) {
+        bytes_in_use -= class_chunk_size(free);
+        class_free(free);
+        return true;
+    }
     while (block != NULL) {
         if (free == block->addr) {
             if (prev) {
@@ -143,10 +272,9 @@ bool ta_free(void *free) {
             } else {
                 heap->used = block->next;
             }
+            bytes_in_use -= block->size;
+            // coalescing waits until an allocation needs it
             insert_block(block);
-#ifndef TA_DISABLE_COMPACT
-            compact();
-#endif
             return true;
         }
         prev  = block;
@@ -155,7 +283,7 @@ bool ta_free(void *free) {
     return false;
 }
 
-static Block *alloc_block(size_t num) {
+static Block *find_block(size_t num) {
     Block *ptr  = heap->free;
     Block *prev = NULL;
     size_t top  = heap->top;
@@ -186,9 +314,6 @@ static Block *alloc_block(size_t num) {
                     print_i((size_t)split->addr);
                     split->size = excess;
                     insert_block(split);
-#ifndef TA_DISABLE_COMPACT
-                    compact();
-#endif
                 }
 #endif
             }
@@ -213,9 +338,36 @@ static Block *alloc_block(size_t num) {
     return NULL;
 }
 
+/**
+ * Freed blocks are merged only when an allocation fails, or
+ * when we are out of blank blocks to split with.
+ */
+static Block *alloc_block(size_t num) {
+    Block *block;
+#ifndef TA_DISABLE_COMPACT
+    if (heap->fresh == NULL) {
+        compact();
+    }
+#endif
+    block = find_block(num);
+#ifndef TA_DISABLE_COMPACT
+    if (block == NULL) {
+        compact();
+        block = find_block(num);
+    }
+#endif
+    return block;
+}
+
 void *ta_alloc(size_t num) {
+    void *ptr = class_alloc(num);
+    if (ptr != NULL) {
+        note_alloc(num, class_chunk_size(ptr));
+        return ptr;
+    }
     Block *block = alloc_block(num);
     if (block != NULL) {
+        note_alloc(num, block->size);
         return block->addr;
     }
     return NULL;
@@ -236,12 +388,11 @@ static void memclear(void *ptr, size_t num) {
 
 void *ta_calloc(size_t num, size_t size) {
     num *= size;
-    Block *block = alloc_block(num);
-    if (block != NULL) {
-        memclear(block->addr, num);
-        return block->addr;
+    void *ptr = ta_alloc(num);
+    if (ptr != NULL) {
+        memclear(ptr, num);
     }
-    return NULL;
+    return ptr;
 }
 
 static size_t count_blocks(Block *ptr) {
@@ -282,6 +433,63 @@ bool ta_check() {
     return heap_max_blocks == ta_num_free() + ta_num_used() + ta_num_fresh();
 }
 
+size_t ta_bytes_free() {
+    return count_blocks_size(heap->free) + ((size_t)heap_limit - heap->top);
+}
+
+size_t ta_largest_free() {
+    size_t largest = (size_t)heap_limit - heap->top;
+    Block *ptr     = heap->free;
+    while (ptr != NULL) {
+        // a free block ending at the top can grow into the space above it
+        size_t size = ptr->size;
+        if ((size_t)ptr->addr + size >= heap->top) {
+            size = (size_t)heap_limit - (size_t)ptr->addr;
+        }
+        if (size > largest) {
+            largest = size;
+        }
+        ptr = ptr->next;
+    }
+    return largest;
+}
+
+size_t ta_compactions() {
+#ifndef TA_DISABLE_COMPACT
+    return compactions;
+#else
+    return 0;
+#endif
+}
+
+bool ta_class_info(int c, ta_class_info_t *info) {
+    if (c < 0 || c >= TA_CLASSES) {
+        return false;
+    }
+    info->size   = TA_CLASS_MIN << c;
+    info->pages  = size_class[c].pages;
+    info->in_use = size_class[c].in_use;
+    info->allocs = size_class[c].allocs;
+    return true;
+}
+
+void ta_usage(size_t *in_use, size_t *peak, size_t *largest) {
+    *in_use  = bytes_in_use;
+    *peak    = bytes_peak;
+    *largest = largest_request;
+}
+
+void ta_usage_reset() {
+    bytes_peak      = bytes_in_use;
+    largest_request = 0;
+}
+
+void ta_class_totals(size_t *pages_used, size_t *pages_total, size_t *fallbacks) {
+    *pages_used  = (class_top - class_base) / TA_CLASS_PAGE;
+    *pages_total = (class_limit - class_base) / TA_CLASS_PAGE;
+    *fallbacks   = class_fallbacks;
+}
+
 static size_t ta_getsize(void *ptr)
 {
   Block *block = heap->used;
@@ -299,17 +507,20 @@ void *ta_realloc(void *ptr,size_t num) {
     size_t ptrsize;
     uint8_t* ptrn;
     uint8_t* ptro;
-    ptrsize=ta_getsize(ptr);
+    if(is_class_chunk(ptr)){
+     ptrsize=class_chunk_size(ptr);
+     if(num<=ptrsize) return ptr;
+    }else
+     ptrsize=ta_getsize(ptr);
     if(ptrsize>0){
-     Block *block = alloc_block(num);
-     if (block != NULL) {
+     ptrn = ta_alloc(num);
+     if (ptrn != NULL) {
          ptro=(uint8_t*)ptr;
-         ptrn=(uint8_t*)block->addr;
          if(ptrsize>num) ptrsize=num;
          for(c=0;c<ptrsize;c++)
           *(ptrn+c)=*(ptro+c);
          ta_free(ptr);
-         return block->addr;
+         return ptrn;
      }
     }
     return NULL;
@@ -0,0 +1,140 @@
+        /* WRS: 32-bit divide and modulus for the 68000, which only has a 32/16
+           divu.w. The algorithm is the one in gcc-12.3.0's
+           libgcc/config/m68k/lb1sf68.S, rearranged so one pass gives both the
+           quotient and the remainder. */
+
+        .globl  __udivsi3
+        .globl  __umodsi3
+        .globl  __divsi3
+        .globl  __modsi3
+
+        .section .fasttext, "ax"      /* inner loops: in RAM on ROM builds */
+        .even
+
+/* %d0 = %d0 / %d1, %d1 = %d0 % %d1, unsigned. Clobbers %d2, %a0, %a1.
+   A divisor that fits in 16 bits (printf's 10, sector and cluster sizes) is
+   two divu.w, high word then low word with the first remainder on top. A
+   larger one shifts both down until the divisor fits, divides for a
+   quotient that is right or one too big, and checks it by multiplying
+   back. Divide by zero traps, as divu.w does. */
+udivmod:
+    cmpl #0x10000,%d1
+    jcc udivmod_big
+    movel %d0,%d2
+    clrw %d2
+    swap %d2                    /* high word of the dividend */
+    divu %d1,%d2                /* remainder : high quotient */
+    swap %d0
+    movew %d2,%d0
+    swap %d0                    /* high quotient : low dividend */
+    movew %d0,%d2               /* remainder : low dividend */
+    divu %d1,%d2                /* remainder : low quotient */
+    movew %d2,%d0
+    clrw %d2
+    swap %d2
+    movel %d2,%d1
+    rts
+
+udivmod_big:
+    moveal %d1,%a0              /* divisor */
+    moveal %d0,%a1              /* dividend */
+udivmod_shift:
+    lsrl #1,%d1
+    lsrl #1,%d0
+    cmpl #0x10000,%d1
+    jcc udivmod_shift
+    divu %d1,%d0
+    andl #0xffff,%d0            /* tentative quotient, 16 bits */
+
+    movel %a0,%d1
+    movel %d1,%d2
+    mulu %d0,%d1                /* quotient * divisor low word */
+    swap %d2
+    mulu %d0,%d2                /* quotient * divisor high word: up to 17 bits */
+    swap %d2
+    tstw %d2
+    jne udivmod_over            /* product has 33 bits or more */
+    addl %d2,%d1
+    jcs udivmod_over
+    cmpl %a1,%d1
+    jls udivmod_rem             /* product <= dividend: quotient is right */
+udivmod_over:
+    subql #1,%d0
+udivmod_rem:
+    movel %a0,%d1               /* remainder = dividend - quotient * divisor */
+    movel %d1,%d2
+    mulu %d0,%d1
+    swap %d2
+    mulu %d0,%d2
+    swap %d2
+    clrw %d2
+    addl %d2,%d1
+    movel %a1,%d2
+    subl %d1,%d2
+    movel %d2,%d1
+    rts
+
+__udivsi3:
+    movel %d2,%sp@-
+    movel %sp@(8),%d0
+    movel %sp@(12),%d1
+    bsr udivmod
+    movel %sp@+,%d2
+    rts
+
+__umodsi3:
+    movel %d2,%sp@-
+    movel %sp@(8),%d0
+    movel %sp@(12),%d1
+    bsr udivmod
+    movel %d1,%d0
+    movel %sp@+,%d2
+    rts
+
+/* the quotient is negative when the signs differ */
+__divsi3:
+    movel %d2,%sp@-
+    movel %sp@(8),%d0
+    movel %sp@(12),%d1
+    movel %d0,%d2
+    eorl %d1,%d2
+    movel %d2,%sp@-             /* sign of the quotient in bit 31 */
+    tstl %d0
+    jpl divsi3_num
+    negl %d0
+divsi3_num:
+    tstl %d1
+    jpl divsi3_den
+    negl %d1
+divsi3_den:
+    bsr udivmod
+    tstl %sp@+
+    jpl divsi3_done
+    negl %d0
+divsi3_done:
+    movel %sp@+,%d2
+    rts
+
+/* the remainder takes the sign of the dividend */
+__modsi3:
+    movel %d2,%sp@-
+    movel %sp@(8),%d0
+    movel %sp@(12),%d1
+    movel %d0,%sp@-             /* sign of the remainder in bit 31 */
+    jpl modsi3_num
+    negl %d0
+modsi3_num:
+    tstl %d1
+    jpl modsi3_den
+    negl %d1
+modsi3_den:
+    bsr udivmod
+    movel %d1,%d0
+    tstl %sp@+
+    jpl modsi3_done
+    negl %d0
+modsi3_done:
+    movel %sp@+,%d2
+    rts
+
+        .end
@@ -0,0 +1,80 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+/* 64-bit helpers gcc calls for FatFs's exFAT file sizes (FSIZE_t is 64 bits
+ * when exFAT is enabled). Almost every value fits in 32 bits, and those go
+ * straight to the CPU's own 32-bit divide and multiply. */
+
+typedef unsigned long long UDItype;
+typedef long long DItype;
+typedef unsigned long USItype;
+
+UDItype __udivmoddi4(UDItype num, UDItype den, UDItype *rem)
+{
+    UDItype bit = 1;
+    UDItype res = 0;
+
+    if(!(num >> 32) && !(den >> 32)){
+        if(rem)
+            *rem = (USItype)num % (USItype)den;
+        return (USItype)num / (USItype)den;
+    }
+
+    while(den < num && bit && !(den & (1ULL << 63))){
+        den <<= 1;
+        bit <<= 1;
+    }
+    while(bit){
+        if(num >= den){
+            num -= den;
+            res |= bit;
+        }
+        bit >>= 1;
+        den >>= 1;
+    }
+
+    if(rem)
+        *rem = num;
+    return res;
+}
+
+UDItype __udivdi3(UDItype a, UDItype b)
+{
+    return __udivmoddi4(a, b, 0);
+}
+
+UDItype __umoddi3(UDItype a, UDItype b)
+{
+    UDItype r;
+
+    __udivmoddi4(a, b, &r);
+    return r;
+}
+
+/* 32x32->64 from 16-bit pieces, so this never calls itself */
+static UDItype mul_32x32(USItype a, USItype b)
+{
+    USItype al = a & 0xffff, ah = a >> 16;
+    USItype bl = b & 0xffff, bh = b >> 16;
+    USItype lo = al * bl, mid1 = ah * bl, mid2 = al * bh, hi = ah * bh;
+    USItype mid = mid1 + mid2;
+
+    if(mid < mid1)
+        hi += 0x10000;
+    hi += mid >> 16;
+    mid <<= 16;
+    lo += mid;
+    if(lo < mid)
+        hi++;
+
+    return ((UDItype)hi << 32) | lo;
+}
+
+DItype __muldi3(DItype u, DItype v)
+{
+    USItype ul = u, uh = (UDItype)u >> 32;
+    USItype vl = v, vh = (UDItype)v >> 32;
+    UDItype w = mul_32x32(ul, vl);
+
+    w += (UDItype)(ul * vh + uh * vl) << 32;
+    return w;
+}
@@ -27,10 +27,24 @@ nextword:
         jmp (%a0)                                       /* continue execution in new location */
 
         /* code below this point is copied to a scratch buffer */
-        /* WARNING: the scratch buffer is only 128 bytes in size! */
+        /* WARNING: the scratch buffer is only 256 bytes in size! */
 
 copystart:
-        br.s bounce_copy
+bounce_blocks:
+        subq.l #8, %d0                                  /* 32 bytes per pass */
+        bcs.s bounce_blocks_done
+        move.l (%a1)+,(%a2)+
+        move.l (%a1)+,(%a2)+
+        move.l (%a1)+,(%a2)+
+        move.l (%a1)+,(%a2)+
+        move.l (%a1)+,(%a2)+
+        move.l (%a1)+,(%a2)+
+        move.l (%a1)+,(%a2)+
+        move.l (%a1)+,(%a2)+
+        bra.s bounce_blocks
+bounce_blocks_done:
+        addq.l #8, %d0
+        bra.s bounce_copy
 bounce_loop:
         move.l (%a1)+,(%a2)+
 bounce_copy:
@@ -39,9 +39,10 @@ void target_mem_init(void)
      * will result in the bounce buffer being employed */
     bounce_below_addr = (((uint32_t)&bss_end) + 3) & ~3; /* round to longword */
 
-    heap_size = ram_size / 4;  /* not more than 25% of RAM */
-    if(heap_size > MAXHEAP)    /* and not too much */
-        heap_size = MAXHEAP;
+    /* enough to bounce a load over all of our own image, and to work in */
+    heap_size = bounce_below_addr + HEAP_WORKING_SIZE + stack_size;
+    if(heap_size > ram_size / 4) /* not more than 25% of RAM */
+        heap_size = ram_size / 4;
 
     heap_base = ram_size - heap_size;
     heap_size -= stack_size;
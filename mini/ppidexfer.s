@@ -0,0 +1,56 @@
+        .globl  ide_sector_xfer_input
+        .globl  ide_sector_xfer_output
+
+/* 68008 variant of ecb/ppidexfer.s. The 68008 fetches opcodes one byte at a
+   time, so instruction fetch dominates: each IDE word is moved memory to
+   memory with a single two byte opcode, the whole sector is unrolled so there
+   is no loop overhead, and the strobe values are kept in registers. A word
+   move to the 8255 accesses port A (LSB) then port B (MSB), which matches the
+   order the bytes appear on disk. */
+
+        .section .fasttext, "ax"      /* inner loops: in RAM on ROM builds */
+        .even
+
+ide_sector_xfer_input:
+    moveal %sp@(4),%a0          /* void *buf */
+    moveal %sp@(8),%a1          /* 8255 base address */
+
+    /* save registers */
+    movem.l %d2-%d3/%a2,-(%sp)
+
+    lea %a1@(3),%a2             /* 8255 control register */
+    moveq #13, %d2
+    moveq #12, %d3
+
+    .rept 256
+    moveb %d2, %a2@             /* begin /RD pulse */
+    movew %a1@, %a0@+           /* LSB then MSB, straight to memory */
+    moveb %d3, %a2@             /* end /RD pulse */
+    .endr
+
+    /* restore registers, return */
+    movem.l (%sp)+,%d2-%d3/%a2
+    rts
+
+
+ide_sector_xfer_output:
+    moveal %sp@(4),%a0          /* void *buf */
+    moveal %sp@(8),%a1          /* 8255 base address */
+
+    /* save registers */
+    movem.l %d2-%d3/%a2,-(%sp)
+
+    lea %a1@(3),%a2             /* 8255 control register */
+    moveq #11, %d2
+    moveq #10, %d3
+
+    .rept 256
+    movew %a0@+, %a1@           /* set up data lines, LSB then MSB */
+    moveb %d2, %a2@             /* begin /WR pulse */
+    moveb %d3, %a2@             /* end /WR pulse */
+    .endr
+
+    /* restore registers, return */
+    movem.l (%sp)+,%d2-%d3/%a2
+    rts
+        .end
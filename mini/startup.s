@@ -64,6 +64,7 @@ zap_bss:
 
         /* halt */
 halt:
+        jsr uart_flush                  /* let queued output drain */
 stopped:
         stop #0x2700                    /* all done */
         br.s stopped                    /* loop on NMI */
@@ -5,6 +5,8 @@
         .globl  uart_write_byte
         .globl  report_exception
         .globl  timer_ticks
+        .globl  profile_enabled
+        .globl  profile_sample
         .globl  halt
 
         .section .vectors
@@ -127,56 +129,56 @@ interrupt_level_7:
         bra bad_interrupt
 
 ns202_irq_0:
-        pea '0'
-        bra bad_ns202_irq
+        pea 0
+        bra ns202_irq
 
 ns202_irq_1:
-        pea '1'
-        bra bad_ns202_irq
+        pea 1
+        bra ns202_irq
 
 ns202_irq_2:
-        pea '2'
-        bra bad_ns202_irq
+        pea 2
+        bra ns202_irq
 
 ns202_irq_3:
-        pea '3'
-        bra bad_ns202_irq
+        pea 3
+        bra ns202_irq
 
 ns202_irq_4:
-        pea '4'
-        bra bad_ns202_irq
+        pea 4
+        bra ns202_irq
 
 ns202_irq_5:
-        pea '5'
-        bra bad_ns202_irq
+        pea 5
+        bra ns202_irq
 
 ns202_irq_6:
-        pea '6'
-        bra bad_ns202_irq
+        pea 6
+        bra ns202_irq
 
 ns202_irq_7:
-        pea '7'
-        bra bad_ns202_irq
+        pea 7
+        bra ns202_irq
 
 ns202_irq_8:
-        pea '8'
-        bra bad_ns202_irq
+        pea 8
+        bra ns202_irq
 
 ns202_irq_9:
-        pea '9'
-        bra bad_ns202_irq
+        pea 9
+        bra ns202_irq
 
 ns202_irq_a:
-        pea 'A'
-        bra bad_ns202_irq
+        pea 10
+        bra ns202_irq
 
 ns202_irq_b:
-        pea 'B'
-        bra bad_ns202_irq
+        pea 11
+        bra ns202_irq
 
 ns202_irq_c:
-        pea 'C'
-        bra bad_ns202_irq
+        pea 12
+        bra ns202_irq
 
 ns202_irq_d:
         /* this is our timer interrupt */
@@ -185,16 +187,26 @@ ns202_irq_d:
         move.b (MINI68K_ECBIO_BASE + MINI68K_MFPIC_ADDR + (NS32202_EOI << 8)), %d0
         /* increment timer tick counter */
         addq.l #1,(timer_ticks) 
+        /* send more queued console output */
+        movem.l %d1/%a0-%a1, -(%sp)
+        jsr uart_tx_tick
+        tst.b (profile_enabled)         /* profiling? */
+        beq.s timer_noprofile
+        move.l 18(%sp), -(%sp)          /* the PC we interrupted, above SR and 16 bytes of registers */
+        jsr profile_sample
+        addq.l #4, %sp
+timer_noprofile:
+        movem.l (%sp)+, %d1/%a0-%a1
         move.l (%sp)+, %d0
         rte
 
 ns202_irq_e:
-        pea 'E'
-        bra bad_ns202_irq
+        pea 14
+        bra ns202_irq
 
 ns202_irq_f:
-        pea 'F'
-        bra bad_ns202_irq
+        pea 15
+        bra ns202_irq
 
 /* for bad interrupts we just report the interupt number and halt */
 bad_interrupt:
@@ -204,12 +216,15 @@ bad_interrupt:
         jsr uart_write_byte
         bra halt
 
-bad_ns202_irq:
-        pea bad_ns202_irq_message
-        jsr uart_write_string
-        move.l (%sp)+, %d0
-        jsr uart_write_byte
-        bra halt
+/* other NS32202 IRQs go to the handler attached with target_irq_attach() */
+ns202_irq:                              /* IRQ number on the stack */
+        movem.l %d0-%d1/%a0-%a1, -(%sp) /* registers C code may clobber */
+        move.l 16(%sp), -(%sp)
+        jsr ecb_irq_dispatch            /* does the EOI, or halts if unexpected */
+        addq.l #4, %sp
+        movem.l (%sp)+, %d0-%d1/%a0-%a1
+        addq.l #4, %sp                  /* drop IRQ number */
+        rte
 
 /* for exceptions we call a routine that reports the machine state before halting */
 unhandled_exception:
@@ -218,8 +233,6 @@ unhandled_exception:
         bra halt
 
         .section .rodata
-bad_ns202_irq_message:
-        .ascii ":( UNEXPECTED NS32202 IRQ \0"
 bad_interrupt_message:
         .ascii ":( UNEXPECTED INT \0"
 
@@ -11,31 +11,85 @@
 #define CACHE_FLUSH_INTERVAL 15
 #define MAX_RESOLVE_ATTEMPTS 10
 #define QUERY_INTERVAL 500
+#define CACHE_SIZE      16      // entries; power of two
+#define CACHE_PROBE     4       // entries searched from the hash position
 
 #define HARDWARE_TYPE_ETHERNET 1
 #define PROTOCOL_TYPE_IPV4 0x800
 
 static packet_sink_t *sink;
 
-typedef struct arp_cache_entry_t arp_cache_entry_t;
-
-struct arp_cache_entry_t {
-    arp_cache_entry_t *next;
-    uint32_t ipv4_address;
+typedef struct {
+    uint32_t ipv4_address;      // 0 for a free entry
     macaddr_t mac_address;
+    uint8_t ifindex;            // interface we ask on
     bool valid;
     int resolve_attempts;
     timer_t next_event;
-};
+    timer_t query_start;        // when we first asked, if !valid
+} arp_cache_entry_t;
+
+static arp_cache_entry_t arp_cache[CACHE_SIZE];
+
+uint32_t arp_resolved_count = 0;
+uint32_t arp_failed_count = 0;
+uint32_t arp_wait_ticks = 0;
+uint32_t arp_wait_max_ticks = 0;
+
+static inline int arp_cache_hash(uint32_t ip)
+{
+    // hosts on one subnet mostly differ in the low byte
+    return (ip ^ (ip >> 8)) & (CACHE_SIZE - 1);
+}
+
+static arp_cache_entry_t *arp_cache_find(uint32_t ip)
+{
+    int h = arp_cache_hash(ip);
+
+    for(int i=0; i<CACHE_PROBE; i++){
+        arp_cache_entry_t *entry = &arp_cache[(h + i) & (CACHE_SIZE - 1)];
+        if(entry->ipv4_address == ip)
+            return entry;
+    }
+
+    return NULL;
+}
 
-static arp_cache_entry_t *cache_list_head;
+// take a free entry near the hash position, else evict the valid entry closest
+// to expiry, else (all unresolved) the first one
+static arp_cache_entry_t *arp_cache_insert(uint32_t ip)
+{
+    int h = arp_cache_hash(ip);
+    arp_cache_entry_t *entry, *victim = NULL;
 
-static packet_t *packet_create_arp(void)
+    for(int i=0; i<CACHE_PROBE; i++){
+        entry = &arp_cache[(h + i) & (CACHE_SIZE - 1)];
+        if(!entry->ipv4_address){
+            victim = entry;
+            break;
+        }
+        if(entry->valid && (!victim || !victim->valid ||
+                    (int32_t)(entry->next_event - victim->next_event) < 0))
+            victim = entry;
+    }
+    if(!victim)
+        victim = &arp_cache[h];
+    if(victim->valid)
+        net_templates_invalidate(); // a template may have its MAC
+
+    memset(victim, 0, sizeof(arp_cache_entry_t));
+    victim->ipv4_address = ip;
+    return victim;
+}
+
+static packet_t *packet_create_arp(int ifindex)
 {
     packet_t *p = packet_alloc(sizeof(ethernet_header_t) + sizeof(arp_header_t));
+    net_interface_t *iface = &net_interface[ifindex];
 
     // set up ethernet header
-    memcpy(&p->eth->source_mac, interface_macaddr, sizeof(macaddr_t));
+    p->ifindex = ifindex;
+    memcpy(&p->eth->source_mac, iface->macaddr, sizeof(macaddr_t));
     p->eth->ethertype = htons(ethertype_arp);
 
     // set up arp header
@@ -44,22 +98,15 @@ static packet_t *packet_create_arp(void)
     p->arp->protocol_type = htons(PROTOCOL_TYPE_IPV4);
     p->arp->hardware_length = sizeof(macaddr_t);
     p->arp->protocol_length = sizeof(uint32_t);
-    memcpy(&p->arp->sender_mac, interface_macaddr, sizeof(macaddr_t));
-    p->arp->sender_ip = htonl(interface_ipv4_address);
+    memcpy(&p->arp->sender_mac, iface->macaddr, sizeof(macaddr_t));
+    p->arp->sender_ip = htonl(iface->ipv4_address);
 
     return p;
 }
 
 static void update_arp_cache(uint32_t ip, macaddr_t *mac, bool add_entry)
 {
-    arp_cache_entry_t *entry = cache_list_head;
-
-    while(entry){
-        if(entry->ipv4_address == ip)
-            break;
-        else
-            entry = entry->next;
-    }
+    arp_cache_entry_t *entry = arp_cache_find(ip);
 
     if(entry == NULL){
 #ifdef ARP_DEBUG
@@ -70,15 +117,21 @@ static void update_arp_cache(uint32_t ip, macaddr_t *mac, bool add_entry)
 #ifdef ARP_DEBUG
         printf("arp: creating entry for ip 0x%08lx\n", ip);
 #endif
-        entry = malloc(sizeof(arp_cache_entry_t));
-        entry->next = cache_list_head;
-        cache_list_head = entry;
+        entry = arp_cache_insert(ip);
+    }else if(!entry->valid){
+        // an answer to our query: how long did the packets wait?
+        timer_t waited = gogoboot_read_timer() - entry->query_start;
+        arp_resolved_count++;
+        arp_wait_ticks += waited;
+        if(waited > arp_wait_max_ticks)
+            arp_wait_max_ticks = waited;
     }
 
 #ifdef ARP_DEBUG
     printf("arp: updating entry for ip 0x%08lx\n", ip);
 #endif
-    entry->ipv4_address = ip;
+    if(entry->valid && memcmp(entry->mac_address, mac, sizeof(macaddr_t)))
+        net_templates_invalidate(); // it moved
     memcpy(entry->mac_address, mac, sizeof(macaddr_t));
     entry->valid = true;
     entry->resolve_attempts = 0;
@@ -88,24 +141,27 @@ static void update_arp_cache(uint32_t ip, macaddr_t *mac, bool add_entry)
 static void arp_process_packet(packet_sink_t *sink, packet_t *packet)
 {
     bool add_entry = false;
+    uint32_t local_ip = net_interface[packet->ifindex].ipv4_address;
 
     if(packet->arp->hardware_type   == htons(HARDWARE_TYPE_ETHERNET) && 
        packet->arp->protocol_type   == htons(PROTOCOL_TYPE_IPV4) &&
-       packet->arp->hardware_length == htons(sizeof(macaddr_t)) && 
-       packet->arp->protocol_length == htons(sizeof(uint32_t))){
+       packet->arp->hardware_length == sizeof(macaddr_t) && 
+       packet->arp->protocol_length == sizeof(uint32_t)){
         switch(ntohs(packet->arp->operation)){
             case arp_op_request: // who has <ip>?
 #ifdef ARP_DEBUG
                 printf("arp request:\n");
                 pretty_dump_memory(packet->arp, sizeof(arp_header_t));
 #endif
-                if(interface_ipv4_address && packet->arp->target_ip == htonl(interface_ipv4_address)){
+                // answer only for the address of the interface it came in on:
+                // with two cards on a subnet, each answers for itself
+                if(local_ip && packet->arp->target_ip == htonl(local_ip)){
 #ifdef ARP_DEBUG
                     printf("arp: replying to ip 0x%08lx\n", ntohl(packet->arp->sender_ip));
 #endif
                     // this was for us; generate an ARP reply
-                    packet_t *reply = packet_create_arp();
-                    reply->arp->operation = arp_op_reply;
+                    packet_t *reply = packet_create_arp(packet->ifindex);
+                    reply->arp->operation = htons(arp_op_reply);
                     reply->arp->target_ip = packet->arp->sender_ip;
                     memcpy(reply->arp->target_mac, packet->arp->sender_mac, sizeof(macaddr_t));
                     packet_set_destination_mac(reply, &reply->arp->target_mac);
@@ -136,13 +192,14 @@ static void arp_process_packet(packet_sink_t *sink, packet_t *packet)
 static void arp_cache_flush(packet_sink_t *sink)
 {
     int total = 0, expired = 0;
-
-    arp_cache_entry_t *entry = cache_list_head, *next;
-    arp_cache_entry_t **entry_ptr = &cache_list_head;
+    arp_cache_entry_t *entry;
 
     sink->timer = set_timer_sec(CACHE_FLUSH_INTERVAL);
 
-    while(entry){
+    for(int i=0; i<CACHE_SIZE; i++){
+        entry = &arp_cache[i];
+        if(!entry->ipv4_address)
+            continue;
         total++;
         if((entry->valid && timer_expired(entry->next_event)) || // valid but timed out
            (!entry->valid && entry->resolve_attempts >= MAX_RESOLVE_ATTEMPTS)){ // resolve failed
@@ -152,15 +209,11 @@ static void arp_cache_flush(packet_sink_t *sink)
                     entry->valid ? "":"in", entry->ipv4_address);
 #endif
             expired++;
-            next = entry->next; // stash this now, before we free this entry
-            *entry_ptr = entry->next;
-            free(entry);
-            entry = next;
-            // do not update entry_ptr
-        }else{
-            // walk list
-            entry_ptr = &entry->next;
-            entry = entry->next;
+            if(!entry->valid)
+                arp_failed_count++;
+            else
+                net_templates_invalidate();
+            entry->ipv4_address = 0;
         }
     }
 
@@ -174,8 +227,8 @@ static void arp_transmit_query(arp_cache_entry_t *entry)
     entry->resolve_attempts++;
     entry->next_event = set_timer_ms(QUERY_INTERVAL);
 
-    packet_t *query = packet_create_arp();
-    query->arp->operation = arp_op_request;
+    packet_t *query = packet_create_arp(entry->ifindex);
+    query->arp->operation = htons(arp_op_request);
     query->arp->target_ip = htonl(entry->ipv4_address);
     memset(query->arp->target_mac, 0, sizeof(macaddr_t));
     packet_set_destination_mac(query, &broadcast_macaddr);
@@ -186,36 +239,36 @@ static void arp_transmit_query(arp_cache_entry_t *entry)
     net_tx(query);
 }
 
+// find the entry for ip, starting resolution on ifindex if we have none. the
+// cache is shared: a host reached through two cards has the same MAC on both
+static arp_cache_entry_t *arp_lookup(uint32_t ip, int ifindex)
+{
+    arp_cache_entry_t *entry = arp_cache_find(ip);
+
+    if(!entry){
+        entry = arp_cache_insert(ip);
+        entry->ifindex = ifindex;
+        entry->query_start = gogoboot_read_timer();
+        arp_transmit_query(entry);
+    }
+
+    return entry;
+}
+
 arp_result_t net_arp_resolve(packet_t *packet)
 {
-    arp_cache_entry_t *entry = cache_list_head;
+    arp_cache_entry_t *entry;
+    net_interface_t *iface = &net_interface[packet->ifindex];
 
     // no ARP required for broadcast
     if(packet->ipv4 && (
        packet->ipv4->destination_ip == htonl(ipv4_broadcast) ||
-       packet->ipv4->destination_ip == htonl(interface_ipv4_address | (~interface_subnet_mask)))){
+       packet->ipv4->destination_ip == htonl(iface->ipv4_address | (~iface->subnet_mask)))){
         packet_set_destination_mac(packet, &broadcast_macaddr);
         return arp_okay;
     }
 
-    while(entry){
-        if(entry->ipv4_address == packet->ipv4_nexthop)
-            break;
-        entry = entry->next;
-    }
-
-    if(!entry){
-        // allocate a new entry and begin resolution
-        entry = malloc(sizeof(arp_cache_entry_t));
-        memset(entry->mac_address, 0, sizeof(macaddr_t));
-        entry->next = cache_list_head;
-        cache_list_head = entry;
-        entry->ipv4_address = packet->ipv4_nexthop;
-        entry->valid = false;
-        entry->resolve_attempts = 0;
-        arp_transmit_query(entry);
-        return arp_wait;
-    }
+    entry = arp_lookup(packet->ipv4_nexthop, packet->ifindex);
 
     if(entry->valid){
         packet_set_destination_mac(packet, &entry->mac_address);
@@ -232,9 +285,44 @@ arp_result_t net_arp_resolve(packet_t *packet)
     return arp_wait;
 }
 
+// start resolving the next hop towards ip now, so the first packet need not wait
+void net_arp_prefetch(uint32_t ip)
+{
+    int ifindex;
+
+    if(!ip || !interface_ipv4_address)
+        return;
+    ifindex = net_ipv4_route(ip, 0, &ip);
+    if(ip)
+        arp_lookup(ip, ifindex);
+}
+
+const macaddr_t *net_arp_cached(uint32_t ip)
+{
+    arp_cache_entry_t *entry = arp_cache_find(ip);
+
+    return (entry && entry->valid) ? (const macaddr_t*)&entry->mac_address : NULL;
+}
+
+// called for each IPv4 packet received for us: on-link senders
+// tell us their MAC address without being asked
+void net_arp_learn(packet_t *packet)
+{
+    uint32_t ip = ntohl(packet->ipv4->source_ip);
+    net_interface_t *iface = &net_interface[packet->ifindex];
+
+    if(!iface->ipv4_address || !ip || ip == ipv4_broadcast ||
+       packet->ipv4->destination_ip != htonl(iface->ipv4_address) ||
+       (ip & iface->subnet_mask) != (iface->ipv4_address & iface->subnet_mask) ||
+       (packet->eth->source_mac[0] & 1))
+        return;
+
+    update_arp_cache(ip, &packet->eth->source_mac, true);
+}
+
 void net_arp_init(void)
 {
-    cache_list_head = NULL;
+    memset(arp_cache, 0, sizeof(arp_cache));
     sink = packet_sink_alloc();
     sink->match_ethertype = ethertype_arp;
     sink->cb_packet_received = arp_process_packet;
@@ -0,0 +1,83 @@
+        .globl  net_checksum_partial
+
+        .section .fasttext, "ax"      /* inner loops: in RAM on ROM builds */
+        .even
+
+/* uint32_t net_checksum_partial(const void *buf, unsigned int len)
+
+   Internet (ones-complement) checksum of an even-aligned buffer, returned
+   folded to 16 bits but not complemented. Longwords are summed with addx so
+   the carry out of each add feeds into the next; in ones-complement
+   arithmetic a carry out of bit 31 (or 15) is worth exactly 1, so it never
+   needs to be anything other than added back in at the bottom. The bulk is
+   done 32 bytes per loop, with the 1, 2 and 4 longword remainders peeled
+   off first, then a trailing word and/or byte. 68000 safe: only word
+   alignment is required. */
+
+net_checksum_partial:
+    moveal %sp@(4),%a0          /* const void *buf */
+    movel %sp@(8),%d1           /* unsigned int len */
+    moveml %d2-%d3,%sp@-        /* len is now at %sp@(16), low byte at %sp@(19) */
+
+    moveq #0,%d0                /* sum */
+    moveq #0,%d3                /* zero, for folding in the final carry */
+    movel %d1,%d2
+    lsrl #5,%d2                 /* 32 byte blocks */
+    addl %d3,%d0                /* clear X before we start the chain */
+
+    btst #2,%sp@(19)
+    beq cksum_l2
+    movel %a0@+,%d1
+    addxl %d1,%d0
+cksum_l2:
+    btst #3,%sp@(19)
+    beq cksum_l4
+    .rept 2
+    movel %a0@+,%d1
+    addxl %d1,%d0
+    .endr
+cksum_l4:
+    btst #4,%sp@(19)
+    beq cksum_bulk
+    .rept 4
+    movel %a0@+,%d1
+    addxl %d1,%d0
+    .endr
+cksum_bulk:
+    bra cksum_loop
+
+cksum_nextblock:
+    .rept 8
+    movel %a0@+,%d1
+    addxl %d1,%d0
+    .endr
+cksum_loop:
+    dbra %d2,cksum_nextblock
+    addxl %d3,%d0               /* final carry ... */
+    addxl %d3,%d0               /* ... which may itself carry if the sum was 0xffffffff */
+
+    btst #1,%sp@(19)            /* trailing word? */
+    beq cksum_byte
+    moveq #0,%d1
+    movew %a0@+,%d1
+    addl %d1,%d0
+    addxl %d3,%d0
+cksum_byte:
+    btst #0,%sp@(19)            /* trailing byte? it is the high half of a word */
+    beq cksum_fold
+    moveq #0,%d1
+    moveb %a0@,%d1
+    lslw #8,%d1
+    addl %d1,%d0
+    addxl %d3,%d0
+
+cksum_fold:
+    movel %d0,%d1               /* fold 32 bits down to 16 */
+    swap %d1
+    addw %d1,%d0
+    addxw %d3,%d0
+    andil #0xffff,%d0
+
+    moveml %sp@+,%d2-%d3
+    rts
+        .end
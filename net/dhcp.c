@@ -5,6 +5,8 @@
 #include <timers.h>
 #include <cli.h>
 #include <net.h>
+#include <rtc.h>
+#include <init.h>
 #include "dhcp_internals.h"
 
 #undef DHCP_DEBUG
@@ -18,24 +20,155 @@ static uint32_t dhcp_offer_subnet_mask;
 static uint32_t dhcp_offer_gateway;
 static uint32_t dhcp_offer_dns_server;
 static uint32_t dhcp_offer_lease_time;
+static uint32_t dhcp_offer_next_server;
+static char dhcp_offer_bootfile[128];
 int renew_retry_remaining;
+int reboot_retry_remaining;
 
 static dhcp_state_t dhcp_state;
 static packet_sink_t *sink;
 
+// the last lease is kept at the top of the RTC's battery-backed RAM, so the
+// next boot can go straight to INIT-REBOOT (RFC 2131 section 3.2) and skip the
+// DISCOVER/OFFER exchange.
+#define DHCP_LEASE_MAGIC 0x4c
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint32_t address;
+    uint32_t subnet_mask;
+    uint32_t gateway;
+    uint32_t dns_server;
+    uint32_t server_id;
+    uint32_t next_server;
+    uint32_t expiry;        // dhcp_clock_seconds() when the lease runs out, 0 if unknown
+    uint8_t check;
+} dhcp_lease_record_t;      // 30 bytes, so it fits in the DS1302's 31
+
+static dhcp_lease_record_t dhcp_cached_lease;
+
 /* see https://www.rfc-editor.org/rfc/rfc1533 in particular section 9 */
 uint8_t const discover_options[] = {
     // DHCP message type - DHCPDISCOVER
     dhcp_opt_message_type,  0x01, dhcp_type_discover,
-    // DHCP parameter request list (1=subnet mask, 3=router, 6=nameserver, 15=domain name)
-    dhcp_opt_param_request, 0x04, 0x01, 0x03, 0x06, 0x0f,
 };
 
 uint8_t const dhcp_always_options[] = {
     // maximum DHCP message size - 1400 bytes (0x0578)
     dhcp_opt_max_size,      0x02, 0x05, 0x78,
+    // DHCP parameter request list (1=subnet mask, 3=router, 6=nameserver, 15=domain name,
+    // 66=TFTP server name, 67=boot file name). servers answer a REQUEST by its own list.
+    dhcp_opt_param_request, 0x06, 0x01, 0x03, 0x06, 0x0f, 0x42, 0x43,
 };
 
+// seconds since 2000-01-01 by the RTC, or 0 if the clock is not plausible
+static uint32_t dhcp_clock_seconds(void)
+{
+    static const uint16_t month_days[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+    rtc_time_t now;
+    uint32_t days;
+
+    rtc_read_clock(&now);
+    if(now.year < 2000 || now.month < 1 || now.month > 12 || now.day < 1)
+        return 0;
+
+    days = (now.year - 2000) * 365 + (now.year - 1997) / 4 + month_days[now.month-1] + now.day - 1;
+    if(now.month > 2 && (now.year & 3) == 0)
+        days++;
+
+    return ((days * 24 + now.hour) * 60 + now.minute) * 60 + now.second;
+}
+
+static uint8_t dhcp_lease_check(const dhcp_lease_record_t *lease)
+{
+    const uint8_t *p = (const uint8_t*)lease;
+    uint8_t sum = 0x5a;
+
+    for(int i=0; i<sizeof(dhcp_lease_record_t)-1; i++)
+        sum = ((sum << 1) | (sum >> 7)) ^ p[i];
+
+    return sum;
+}
+
+static int dhcp_lease_nvram_offset(void)
+{
+    return rtc_nvram_size() - (int)sizeof(dhcp_lease_record_t);
+}
+
+static bool dhcp_lease_load(void)
+{
+    uint8_t *p = (uint8_t*)&dhcp_cached_lease;
+    int offset = dhcp_lease_nvram_offset();
+
+    if(offset < 0)
+        return false;
+
+    for(int i=0; i<sizeof(dhcp_lease_record_t); i++)
+        p[i] = rtc_nvram_read(offset + i);
+
+    return dhcp_cached_lease.magic == DHCP_LEASE_MAGIC &&
+           dhcp_cached_lease.check == dhcp_lease_check(&dhcp_cached_lease) &&
+           dhcp_cached_lease.address;
+}
+
+static void dhcp_lease_save(void)
+{
+    uint8_t *p = (uint8_t*)&dhcp_cached_lease;
+    int offset = dhcp_lease_nvram_offset();
+    uint32_t now;
+
+    if(offset < 0)
+        return;
+
+    now = dhcp_clock_seconds();
+    dhcp_cached_lease.magic = DHCP_LEASE_MAGIC;
+    dhcp_cached_lease.address = dhcp_offer_ipv4_address;
+    dhcp_cached_lease.subnet_mask = dhcp_offer_subnet_mask;
+    dhcp_cached_lease.gateway = dhcp_offer_gateway;
+    dhcp_cached_lease.dns_server = dhcp_offer_dns_server;
+    dhcp_cached_lease.server_id = dhcp_server_id;
+    dhcp_cached_lease.next_server = dhcp_offer_next_server;
+    dhcp_cached_lease.expiry = now ? now + dhcp_offer_lease_time : 0;
+    dhcp_cached_lease.check = dhcp_lease_check(&dhcp_cached_lease);
+
+    // on a RENEW usually only the expiry changes; the DS1302 is slow to write
+    for(int i=0; i<sizeof(dhcp_lease_record_t); i++)
+        if(rtc_nvram_read(offset + i) != p[i])
+            rtc_nvram_write(offset + i, p[i]);
+}
+
+static void dhcp_lease_forget(void)
+{
+    int offset = dhcp_lease_nvram_offset();
+
+    dhcp_cached_lease.magic = 0;
+    if(offset >= 0)
+        rtc_nvram_write(offset, 0);
+}
+
+// seconds left on the cached lease, or 0 if it is too close to expiry to use
+static uint32_t dhcp_lease_remaining(void)
+{
+    uint32_t now = dhcp_clock_seconds();
+
+    if(!now || !dhcp_cached_lease.expiry ||
+       dhcp_cached_lease.expiry <= now + (renew_retry_count * short_wait_time) + 60)
+        return 0;
+
+    return dhcp_cached_lease.expiry - now;
+}
+
+static void dhcp_offer_from_lease(void)
+{
+    dhcp_offer_ipv4_address = dhcp_cached_lease.address;
+    dhcp_offer_subnet_mask = dhcp_cached_lease.subnet_mask;
+    dhcp_offer_gateway = dhcp_cached_lease.gateway;
+    dhcp_offer_dns_server = dhcp_cached_lease.dns_server;
+    dhcp_server_id = dhcp_cached_lease.server_id;
+    dhcp_offer_next_server = dhcp_cached_lease.next_server;
+    dhcp_offer_lease_time = dhcp_lease_remaining();
+}
+
 static packet_t *packet_create_dhcp(uint32_t target_ipv4, uint8_t message_type,
         const uint8_t *extra_options, int extra_options_len)
 {
@@ -105,6 +238,49 @@ static void dhcp_send_request(void)
     net_tx(req);
 }
 
+// INIT-REBOOT: a requested address but no server id, sent from 0.0.0.0
+static void dhcp_send_reboot_request(void)
+{
+    unsigned char req_opt[6];
+    uint32_t address = interface_ipv4_address;
+    packet_t *req;
+
+    req_opt[0] = dhcp_opt_requested_ip;
+    req_opt[1] = 4;
+    *((uint32_t*)(req_opt+2)) = htonl(dhcp_cached_lease.address);
+
+    interface_ipv4_address = 0; // even if we are already using the cached lease
+    req = packet_create_dhcp(ipv4_broadcast, dhcp_type_request, req_opt, sizeof(req_opt));
+    interface_ipv4_address = address;
+
+    net_tx(req);
+}
+
+static void dhcp_use_offer(void)
+{
+    interface_ipv4_address = dhcp_offer_ipv4_address;
+    interface_subnet_mask = dhcp_offer_subnet_mask;
+    interface_ipv4_gateway = dhcp_offer_gateway;
+    interface_dns_server = dhcp_offer_dns_server;
+    net_templates_invalidate();
+}
+
+// tell the CLI where to boot from (see netboot); an explicit tftp_server wins
+static void dhcp_set_boot_environment(void)
+{
+    char server[16];
+
+    if(dhcp_offer_bootfile[0])
+        set_environment_variable("bootfile", dhcp_offer_bootfile);
+
+    if(dhcp_offer_next_server){
+        net_format_ipv4(dhcp_offer_next_server, server);
+        set_environment_variable("next_server", server);
+        if(!get_environment_variable("tftp_server"))
+            set_environment_variable("tftp_server", server);
+    }
+}
+
 bool process_dhcp_reply(packet_t *packet, uint8_t expected_dhcp_type)
 {
     int offset, length;
@@ -118,6 +294,9 @@ bool process_dhcp_reply(packet_t *packet, uint8_t expected_dhcp_type)
     if(d->op != 2) // check for BOOTREPLY
         return false;
 
+    if(memcmp(d->chaddr, interface_macaddr, 6)) // replies to other clients are broadcast too
+        return false;
+
     // parse DHCP options
     offset = 4; // skip over magic cookie
     length = packet->data_length - sizeof(dhcp_message_t);
@@ -141,6 +320,8 @@ bool process_dhcp_reply(packet_t *packet, uint8_t expected_dhcp_type)
     dhcp_offer_gateway = 0;
     dhcp_offer_dns_server = 0;
     dhcp_offer_ipv4_address = ntohl(d->yiaddr);
+    dhcp_offer_next_server = ntohl(d->siaddr);
+    dhcp_offer_bootfile[0] = 0;
 
     // process DHCP options
     while(offset < length){
@@ -193,6 +374,21 @@ bool process_dhcp_reply(packet_t *packet, uint8_t expected_dhcp_type)
                         return false;
                     dhcp_offer_dns_server = ntohl(*((uint32_t*)opt_data));
                     break;
+                case dhcp_opt_tftp_server: // a name, but we have no resolver: use it if it is an address
+                    if(opt_len < 16){
+                        char server[16];
+                        memcpy(server, opt_data, opt_len);
+                        server[opt_len] = 0;
+                        if(net_parse_ipv4(server))
+                            dhcp_offer_next_server = net_parse_ipv4(server);
+                    }
+                    break;
+                case dhcp_opt_bootfile:
+                    if(opt_len >= sizeof(dhcp_offer_bootfile))
+                        return false;
+                    memcpy(dhcp_offer_bootfile, opt_data, opt_len);
+                    dhcp_offer_bootfile[opt_len] = 0;
+                    break;
                 default:
                     break;
             }
@@ -200,6 +396,12 @@ bool process_dhcp_reply(packet_t *packet, uint8_t expected_dhcp_type)
         offset += 2 + opt_len;
     }
 
+    // without option 67 the BOOTP file field may name one
+    if(!dhcp_offer_bootfile[0]){
+        memcpy(dhcp_offer_bootfile, d->file, sizeof(dhcp_offer_bootfile)-1);
+        dhcp_offer_bootfile[sizeof(dhcp_offer_bootfile)-1] = 0;
+    }
+
 #ifdef DHCP_DEBUG
     printf("process_dhcp_reply: message_type=%d OK!\n", expected_dhcp_type);
 #endif
@@ -228,6 +430,7 @@ static void dhcp_enter_state(dhcp_state_t state)
             interface_ipv4_gateway = 0;
             interface_ipv4_address = 0;
             interface_subnet_mask = 0;
+            net_templates_invalidate();
             // create and send a DHCPDISCOVER message
             net_tx(packet_create_dhcp(ipv4_broadcast, dhcp_type_discover,
                         discover_options, sizeof(discover_options)));
@@ -246,6 +449,7 @@ static void dhcp_enter_state(dhcp_state_t state)
             sink->timer = set_timer_sec(short_wait_time);
             break;
         case DHCP_BOUND:
+            boot_stage_mark("dhcp bound");
             // relax and wait for our lease to near expiry
             sink->timer = set_timer_sec(dhcp_offer_lease_time - (renew_retry_count * short_wait_time));
             break;
@@ -255,6 +459,21 @@ static void dhcp_enter_state(dhcp_state_t state)
             sink->timer = set_timer_sec(short_wait_time);
             dhcp_send_request();
             break;
+        case DHCP_REBOOT:
+            reboot_retry_remaining = reboot_retry_count;
+            sink->timer = set_timer_sec(reboot_wait_time);
+            dhcp_send_reboot_request();
+            // if the lease has life left in it, use it while the server confirms
+            dhcp_offer_from_lease();
+            if(dhcp_offer_lease_time){
+                dhcp_use_offer();
+                printf("DHCP using cached lease (%d.%d.%d.%d)\n",
+                        (int)(interface_ipv4_address >> 24 & 0xff),
+                        (int)(interface_ipv4_address >> 16 & 0xff),
+                        (int)(interface_ipv4_address >>  8 & 0xff),
+                        (int)(interface_ipv4_address       & 0xff));
+            }
+            break;
     }
 }
 
@@ -290,6 +509,20 @@ static void dhcp_timer(packet_sink_t *sink)
             }else
                 dhcp_enter_state(DHCP_DISCOVER); // lease expired -- start over
             break;
+        case DHCP_REBOOT:
+            reboot_retry_remaining--;
+            if(reboot_retry_remaining > 0){
+                dhcp_send_reboot_request();
+                sink->timer = set_timer_sec(reboot_wait_time);
+                break;
+            }
+            // no answer, but if the lease has not run out we may keep using it
+            dhcp_offer_from_lease();
+            if(interface_ipv4_address && dhcp_offer_lease_time)
+                dhcp_enter_state(DHCP_BOUND);
+            else
+                dhcp_enter_state(DHCP_DISCOVER); // a server that does not know us stays silent
+            break;
     }
 }
 
@@ -313,20 +546,21 @@ static void dhcp_pump(packet_sink_t *s, packet_t *packet)
             break;
         case DHCP_REQUEST:
         case DHCP_RENEW:
+        case DHCP_REBOOT:
             if(process_dhcp_reply(packet, dhcp_type_nack)){
+                dhcp_lease_forget();
                 dhcp_enter_state(DHCP_DISCOVER); // start over again on any NACK
             }else if(process_dhcp_reply(packet, dhcp_type_ack)){
                 int prefixlen = 0;
-                uint32_t mask;
-                interface_ipv4_address = dhcp_offer_ipv4_address;
-                interface_subnet_mask = mask = dhcp_offer_subnet_mask;
-                interface_ipv4_gateway = dhcp_offer_gateway;
-                interface_dns_server = dhcp_offer_dns_server;
+                uint32_t mask = dhcp_offer_subnet_mask;
+                dhcp_use_offer();
+                dhcp_lease_save();
+                dhcp_set_boot_environment();
                 while(mask){
                     prefixlen++;
                     mask <<= 1;
                 }
-                if(dhcp_state == DHCP_REQUEST){ // don't print this on every RENEW
+                if(dhcp_state != DHCP_RENEW){ // don't print this on every RENEW
                     printf("DHCP lease acquired (%d.%d.%d.%d/%d, %dh %dm)\n",
                             (int)(interface_ipv4_address >> 24 & 0xff),
                             (int)(interface_ipv4_address >> 16 & 0xff),
@@ -337,12 +571,25 @@ static void dhcp_pump(packet_sink_t *s, packet_t *packet)
                             (int)(dhcp_offer_lease_time % 3600)/60);
                 }
                 dhcp_enter_state(DHCP_BOUND);
+                // have the MAC addresses ready before anyone asks for them
+                net_arp_prefetch(interface_ipv4_gateway);
+                net_arp_prefetch(dhcp_offer_next_server);
             }
             break;
     }
     packet_free(packet);
 }
 
+bool dhcp_running(void)
+{
+    return sink != NULL;
+}
+
+bool dhcp_bound(void)
+{
+    return sink && (dhcp_state == DHCP_BOUND || dhcp_state == DHCP_RENEW);
+}
+
 void dhcp_init(void)
 {
     sink = packet_sink_alloc();
@@ -352,5 +599,5 @@ void dhcp_init(void)
     sink->cb_packet_received = dhcp_pump;     // called when packets received
     sink->cb_timer_expired = dhcp_timer; // called on timer expiry
     net_add_packet_sink(sink);
-    dhcp_enter_state(DHCP_DISCOVER);
+    dhcp_enter_state(dhcp_lease_load() ? DHCP_REBOOT : DHCP_DISCOVER);
 }
@@ -4,6 +4,8 @@
 #include <types.h>
 
 static const int short_wait_time = 5; // seconds
+static const int reboot_wait_time = 2; // seconds, per REQUEST in INIT-REBOOT
+static const int reboot_retry_count = 2;
 
 typedef enum { // start in DHCP_INIT
     DHCP_DISCOVER, // create and send a DISCOVER message, start timer, go to SELECTING
@@ -11,6 +13,7 @@ typedef enum { // start in DHCP_INIT
     DHCP_REQUEST,  // receive ACK, start timer, go to BOUND; on NACK or timeout go to init
     DHCP_BOUND,    // wait for timer, go to RENEWING
     DHCP_RENEW,    // periodically send REQUESTs; transitions as per REQUESTING
+    DHCP_REBOOT,   // REQUEST the cached lease; ACK goes to BOUND, NACK or timeout to DISCOVER
 } dhcp_state_t;
 
 typedef struct __attribute__((packed, aligned(2))) {
@@ -44,6 +47,8 @@ static const uint8_t dhcp_opt_message_type  = 0x35;
 static const uint8_t dhcp_opt_server_id     = 0x36;
 static const uint8_t dhcp_opt_param_request = 0x37;
 static const uint8_t dhcp_opt_max_size      = 0x39;
+static const uint8_t dhcp_opt_tftp_server   = 0x42;
+static const uint8_t dhcp_opt_bootfile      = 0x43;
 static const uint8_t dhcp_opt_terminator    = 0xff;
 
 static const uint8_t dhcp_type_discover = 1;
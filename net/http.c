@@ -0,0 +1,263 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <fatfs/ff.h>
+#include <init.h>
+#include <loader.h>
+#include <cli.h>
+#include <net.h>
+
+// HTTP/1.0 GET over tcp.c, saving the body to a file or straight into memory.
+// URLs are http://a.b.c.d[:port]/path -- there is no DNS resolver.
+
+#define HTTP_MAX_HEADER 1024
+
+typedef struct {
+    char header[HTTP_MAX_HEADER+1];
+    int header_length;
+    bool in_body;
+    int status;
+    uint32_t content_length;    // 0 if not given
+    uint32_t received;          // body bytes
+    FIL *file;                  // either write to here
+    uint32_t address;           // ... or to memory here
+    bool memory_ready;          // whole range checked (we know the length)
+    bool failed;
+} http_get_t;
+
+static bool http_write_body(http_get_t *get, const uint8_t *data, int length)
+{
+    FRESULT fr;
+
+    if(!length)
+        return true;
+
+    if(get->file){
+        fr = f_write(get->file, data, length, NULL);
+        if(fr != FR_OK){
+            printf("http: write failed: %s\n", f_errmsg(fr));
+            return false;
+        }
+    }else{
+        if((!get->memory_ready || get->received + length > get->content_length) &&
+           !load_target_prepare(get->address + get->received, length))
+            return false;
+        load_target_write(get->address + get->received, data, length);
+    }
+
+    get->received += length;
+    return true;
+}
+
+// we have the whole header: check the status and look for the length
+static bool http_parse_header(http_get_t *get)
+{
+    char *line, *next;
+
+    if(strncmp(get->header, "HTTP/1.", 7) || get->header_length < 12){
+        printf("http: bad response\n");
+        return false;
+    }
+
+    get->status = atoi(get->header + 9);
+    if(get->status != 200){
+        line = strchr(get->header, '\r');
+        if(line)
+            *line = 0;
+        printf("http: %s\n", get->header);
+        return false;
+    }
+
+    for(line = get->header; line; line = next){
+        next = strchr(line, '\n');
+        if(next)
+            *next++ = 0;
+        if(!strncasecmp(line, "Content-Length:", 15))
+            get->content_length = atoi(line + 15);
+    }
+
+    if(get->content_length){
+        printf("http: %ld bytes\n", get->content_length);
+        if(!get->file){
+            if(!load_target_prepare(get->address, get->content_length))
+                return false;
+            get->memory_ready = true;
+        }
+    }
+
+    return true;
+}
+
+// the header ends at the first blank line; only search the part just added
+static char *http_header_end(http_get_t *get, int from)
+{
+    if(from < 0)
+        from = 0;
+
+    for(int i=from; i + 4 <= get->header_length; i++)
+        if(!memcmp(get->header + i, "\r\n\r\n", 4))
+            return get->header + i;
+
+    return NULL;
+}
+
+static bool http_received(void *context, const uint8_t *data, int length)
+{
+    http_get_t *get = context;
+    int take;
+    char *end;
+
+    if(get->in_body){
+        if(!http_write_body(get, data, length)){
+            get->failed = true;
+            return false;
+        }
+        return true;
+    }
+
+    // gather the header; the body starts after the first blank line
+    take = HTTP_MAX_HEADER - get->header_length;
+    if(take > length)
+        take = length;
+    memcpy(get->header + get->header_length, data, take);
+    get->header_length += take;
+    get->header[get->header_length] = 0;
+
+    end = http_header_end(get, get->header_length - take - 3);
+    if(!end){
+        if(get->header_length < HTTP_MAX_HEADER)
+            return true;
+        printf("http: response header too long\n");
+        get->failed = true;
+        return false;
+    }
+
+    // the part of this segment beyond the header is body
+    take -= get->header_length - ((end + 4) - get->header);
+    *(end + 2) = 0;
+    get->in_body = true;
+
+    if(!http_parse_header(get) || !http_write_body(get, data + take, length - take)){
+        get->failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+// parse "http://a.b.c.d[:port]/path"
+static bool http_parse_url(const char *url, uint32_t *ip, uint16_t *port, const char **path, const char **host_end)
+{
+    char host[16];
+    const char *p;
+    int len;
+
+    if(strncasecmp(url, "http://", 7)){
+        printf("http: only http:// URLs are supported\n");
+        return false;
+    }
+    url += 7;
+
+    for(p = url; *p && *p != ':' && *p != '/'; p++);
+    len = p - url;
+    if(len >= sizeof(host)){
+        printf("http: host must be an IPv4 address\n");
+        return false;
+    }
+    memcpy(host, url, len);
+    host[len] = 0;
+
+    *ip = net_parse_ipv4(host);
+    if(!*ip){
+        printf("http: cannot parse IPv4 address \"%s\"\n", host);
+        return false;
+    }
+
+    *port = 80;
+    if(*p == ':'){
+        *port = atoi(p+1);
+        while(*p && *p != '/')
+            p++;
+    }
+
+    *host_end = p; // host[:port] ends here, whether or not a path follows
+    *path = *p ? p : "/";
+    return true;
+}
+
+bool http_get(const char *url, const char *disk_filename, uint32_t address, uint32_t *size)
+{
+    uint32_t ip, start, taken, rate;
+    uint16_t port;
+    const char *path, *host_end;
+    char *request;
+    http_get_t *get;
+    tcp_connection_t *conn;
+    FIL file;
+    FRESULT fr;
+    bool ok = false;
+
+    if(!http_parse_url(url, &ip, &port, &path, &host_end))
+        return false;
+
+    get = malloc(sizeof(http_get_t));
+    memset(get, 0, sizeof(http_get_t));
+    get->address = address;
+
+    if(disk_filename){
+        fr = f_open(&file, disk_filename, FA_WRITE | FA_CREATE_ALWAYS);
+        if(fr != FR_OK){
+            printf("http: failed to open \"%s\": %s\n", disk_filename, f_errmsg(fr));
+            free(get);
+            return false;
+        }
+        get->file = &file;
+    }
+
+    request = malloc(strlen(path) + strlen(url) + 64);
+    strcpy(request, "GET ");
+    strcat(request, path);
+    strcat(request, " HTTP/1.0\r\nHost: ");
+    strncat(request, url + 7, host_end - (url + 7));
+    strcat(request, "\r\nConnection: close\r\n\r\n");
+
+    printf("http: connecting to %d.%d.%d.%d port %d: Press Q to abort\n",
+            (int)(ip >> 24 & 0xff), (int)(ip >> 16 & 0xff),
+            (int)(ip >>  8 & 0xff), (int)(ip       & 0xff), port);
+
+    start = gogoboot_read_timer();
+    conn = tcp_open(ip, port, http_received, get);
+    if(conn){
+        if(tcp_write(conn, request, strlen(request)) && tcp_wait_close(conn) && !get->failed){
+            if(!get->in_body)
+                printf("http: no response\n");
+            else if(get->content_length && get->received != get->content_length)
+                printf("http: short body (%ld of %ld bytes)\n", get->received, get->content_length);
+            else
+                ok = true;
+        }
+        tcp_close(conn);
+    }else
+        printf("http: cannot connect\n");
+
+    if(ok){
+        taken = (gogoboot_read_timer() - start) / (TIMER_HZ/10);
+        if(taken == 0)
+            taken = 1;
+        rate = ((get->received / taken)*8) / 1000;
+        printf("Transferred %ld bytes in %ld.%lds (%ld.%02ld Mbit/sec)\n",
+                get->received, taken/10, taken%10, rate/100, rate%100);
+    }else
+        printf("Transfer FAILED!\n");
+
+    if(disk_filename)
+        f_close(&file);
+
+    *size = get->received;
+    free(request);
+    free(get);
+
+    return ok;
+}
@@ -38,15 +38,15 @@ static void icmp_received(packet_sink_t *sink, packet_t *packet)
         packet->icmp->type = 0; // echo reply
 
         // reset flags for retransmission
-        packet->flags = 0;
+        packet_reuse_for_tx(packet);
 
         // swap source to target
+        uint32_t local_ip = packet->ipv4->destination_ip;
         packet->ipv4->destination_ip = packet->ipv4->source_ip;
         packet_set_destination_mac(packet, &packet->eth->source_mac);
 
-        // fill in new source based on our interface addresses
-        packet->ipv4->source_ip = ntohl(interface_ipv4_address);
-        memcpy(packet->eth->source_mac, interface_macaddr, sizeof(macaddr_t));
+        // reply from the address that was pinged; net_tx() picks the interface
+        packet->ipv4->source_ip = local_ip;
 
         net_tx(packet);
         // do NOT free received packet since it is now being re-used for transmission
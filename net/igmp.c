@@ -0,0 +1,131 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <net.h>
+
+// IGMPv2 host side (RFC 2236), just enough for multicast TFTP: we report when
+// joining a group, answer queries for the groups we are in, and leave when done.
+// we answer queries at once rather than after a random delay.
+
+#define NET_MULTICAST_MAX 4
+
+static const uint8_t igmp_type_query = 0x11;
+static const uint8_t igmp_type_report = 0x16; // v2 membership report
+static const uint8_t igmp_type_leave = 0x17;
+static const uint32_t igmp_all_hosts = 0xe0000001;   // 224.0.0.1, where queries go
+static const uint32_t igmp_all_routers = 0xe0000002; // 224.0.0.2, where leaves go
+
+static packet_sink_t *igmp_sink;
+static uint32_t igmp_group[NET_MULTICAST_MAX];
+static int igmp_refcount[NET_MULTICAST_MAX];
+
+// RFC 1112: the low 23 bits of the group address go into 01:00:5e:00:00:00
+static void igmp_group_macaddr(uint32_t group, macaddr_t mac)
+{
+    mac[0] = 0x01;
+    mac[1] = 0x00;
+    mac[2] = 0x5e;
+    mac[3] = (group >> 16) & 0x7f;
+    mac[4] = (group >> 8) & 0xff;
+    mac[5] = group & 0xff;
+}
+
+static void igmp_update_filter(void)
+{
+    macaddr_t list[NET_MULTICAST_MAX+1];
+    int count = 0;
+
+    for(int i=0; i<NET_MULTICAST_MAX; i++)
+        if(igmp_refcount[i])
+            igmp_group_macaddr(igmp_group[i], list[count++]);
+
+    if(count) // so that we hear the queries
+        igmp_group_macaddr(igmp_all_hosts, list[count++]);
+
+    eth_set_multicast(list, count);
+}
+
+static void igmp_send(uint8_t type, uint32_t group, uint32_t destination)
+{
+    macaddr_t mac;
+    packet_t *packet = packet_create_igmp(destination);
+    igmp_header_t *igmp = (igmp_header_t*)packet->data;
+
+    igmp->type = type;
+    igmp->max_response_time = 0;
+    igmp->group = htonl(group);
+
+    // multicast destinations are not resolved with ARP
+    igmp_group_macaddr(destination, mac);
+    packet_set_destination_mac(packet, (const macaddr_t*)&mac);
+
+    net_tx(packet);
+}
+
+bool net_multicast_join(uint32_t group)
+{
+    int i, slot = -1;
+
+    for(i=0; i<NET_MULTICAST_MAX; i++){
+        if(igmp_refcount[i] && igmp_group[i] == group){
+            igmp_refcount[i]++;
+            return true;
+        }
+        if(!igmp_refcount[i] && slot < 0)
+            slot = i;
+    }
+
+    if(slot < 0){
+        printf("igmp: too many multicast groups\n");
+        return false;
+    }
+
+    igmp_group[slot] = group;
+    igmp_refcount[slot] = 1;
+    igmp_update_filter();
+
+    // RFC 2236 suggests repeating the unsolicited report in case it is lost
+    igmp_send(igmp_type_report, group, group);
+    igmp_send(igmp_type_report, group, group);
+
+    return true;
+}
+
+void net_multicast_leave(uint32_t group)
+{
+    for(int i=0; i<NET_MULTICAST_MAX; i++){
+        if(igmp_refcount[i] && igmp_group[i] == group){
+            if(--igmp_refcount[i] == 0){
+                igmp_send(igmp_type_leave, group, igmp_all_routers);
+                igmp_update_filter();
+            }
+            return;
+        }
+    }
+}
+
+static void igmp_received(packet_sink_t *sink, packet_t *packet)
+{
+    igmp_header_t *igmp = (igmp_header_t*)packet->ipv4->payload;
+    uint32_t group;
+
+    if(igmp->type == igmp_type_query){
+        group = ntohl(igmp->group); // 0 for a general query
+        for(int i=0; i<NET_MULTICAST_MAX; i++)
+            if(igmp_refcount[i] && (!group || group == igmp_group[i]))
+                igmp_send(igmp_type_report, igmp_group[i], igmp_group[i]);
+    }
+
+    packet_free(packet);
+}
+
+void net_igmp_init(void)
+{
+    igmp_sink = packet_sink_alloc();
+    igmp_sink->match_ethertype = ethertype_ipv4;
+    igmp_sink->match_ipv4_protocol = ip_proto_igmp;
+    igmp_sink->cb_packet_received = igmp_received;
+    net_add_packet_sink(igmp_sink);
+}
@@ -8,18 +8,21 @@
 
 static uint32_t checksum_update(uint32_t sum, uint16_t *addr, unsigned int count)
 {
-    // sum words
-    while(count >= 2){
-        sum += *(addr++);
-        count-=2;
+    uint8_t *p = (uint8_t*)addr;
+    uint32_t s;
+
+    if(!count)
+        return sum;
+
+    if((uintptr_t)p & 1){
+        // odd address: sum the rest from an even address, so every byte lands
+        // in the wrong half of its word, then byte swap the result to fix it
+        s = net_checksum_partial(p+1, count-1);
+        s = ((s << 8) | (s >> 8)) & 0xffff;
+        return sum + s + (p[0] << 8);
     }
 
-    //if any bytes left, pad the bytes and add
-    if(count > 0) {
-        sum += ((*addr)&htons(0xFF00));
-    }
-
-    return sum;
+    return sum + net_checksum_partial(p, count);
 }
 
 static uint16_t checksum_complete(uint32_t sum)
@@ -56,6 +59,14 @@ void net_compute_icmp_checksum(packet_t *packet)
                 ntohs(packet->ipv4->length) - sizeof(ipv4_header_t)));
 }
 
+void net_compute_igmp_checksum(packet_t *packet)
+{
+    igmp_header_t *igmp = (igmp_header_t*)packet->ipv4->payload;
+
+    igmp->checksum = 0;
+    igmp->checksum = htons(checksum_compute((uint16_t*)igmp, sizeof(igmp_header_t)));
+}
+
 bool net_verify_icmp_checksum(packet_t *packet)
 {
     return (checksum_compute((uint16_t*)packet->icmp, ntohs(packet->ipv4->length) - sizeof(ipv4_header_t)) == 0);
@@ -67,10 +78,20 @@ static uint16_t udp_checksum_pseudoheader(packet_t *packet)
     // we have to sum a "pseudo-header"
     sum = checksum_update(0, (uint16_t*)&packet->ipv4->source_ip, sizeof(uint32_t)*2);
     sum += packet->ipv4->protocol;
-    sum += packet->udp->length; // yes, this field is summed twice!
+    sum += ntohs(packet->udp->length); // yes, this field is summed twice!
                                 // ... then the real udp header + data
-    sum = checksum_update(sum, (uint16_t*)packet->udp, ntohs(packet->udp->length));
-    return htons(checksum_complete(sum));
+    if(packet->flags & packet_flag_csum_partial){
+        // the driver summed everything past csum_offset as it read the packet
+        sum = checksum_update(sum, (uint16_t*)packet->udp, packet->csum_offset);
+        sum += packet->csum_partial;
+    }else if(packet->placed_data){
+        // data received directly into a sink buffer; header part is always an even length
+        int head = (packet->data + packet->placed_offset) - (uint8_t*)packet->udp;
+        sum = checksum_update(sum, (uint16_t*)packet->udp, head);
+        sum = checksum_update(sum, (uint16_t*)packet->placed_data, ntohs(packet->udp->length) - head);
+    }else
+        sum = checksum_update(sum, (uint16_t*)packet->udp, ntohs(packet->udp->length));
+    return checksum_complete(sum);
 }
 
 bool net_verify_udp_checksum(packet_t *packet)
@@ -81,6 +102,7 @@ bool net_verify_udp_checksum(packet_t *packet)
 void net_compute_udp_checksum(packet_t *packet)
 {
     uint16_t cs;
+    packet->flags &= ~packet_flag_csum_partial;
     packet->udp->checksum = 0;
     cs = udp_checksum_pseudoheader(packet);
     if(cs == 0) 
@@ -88,14 +110,59 @@ void net_compute_udp_checksum(packet_t *packet)
     packet->udp->checksum = htons(cs);
 }
 
+static uint16_t tcp_checksum_pseudoheader(packet_t *packet)
+{
+    uint32_t sum;
+    uint16_t length = ntohs(packet->ipv4->length) - sizeof(ipv4_header_t);
+
+    // same pseudo-header as UDP, but TCP has no length field of its own
+    sum = checksum_update(0, (uint16_t*)&packet->ipv4->source_ip, sizeof(uint32_t)*2);
+    sum += packet->ipv4->protocol;
+    sum += length;
+    sum = checksum_update(sum, (uint16_t*)packet->tcp, length);
+    return checksum_complete(sum);
+}
+
 bool net_verify_tcp_checksum(packet_t *packet)
 {
-    // printf("write net_verify_tcp_checksum!\n");
-    return true;
+    return tcp_checksum_pseudoheader(packet) == 0;
 }
 
 void net_compute_tcp_checksum(packet_t *packet)
 {
-    printf("write net_compute_tcp_checksum!\n");
+    packet->tcp->checksum = 0;
+    packet->tcp->checksum = htons(tcp_checksum_pseudoheader(packet));
+}
+
+
+// a transmit template's fixed fields: its IPv4 header, with the length, id and
+// checksum left zero, and the UDP pseudo-header and ports, with no length
+void net_template_sums(packet_sink_t *sink)
+{
+    ipv4_header_t *ipv4 = (ipv4_header_t*)((ethernet_header_t*)sink->template_header)->payload;
+    uint32_t sum;
+
+    sink->template_ipv4_sum = checksum_update(0, (uint16_t*)ipv4, sizeof(ipv4_header_t));
+
+    sum = checksum_update(0, (uint16_t*)&ipv4->source_ip, sizeof(uint32_t)*2);
+    sum += ipv4->protocol;
+    sink->template_udp_sum = checksum_update(sum, (uint16_t*)ipv4->payload, sizeof(udp_header_t));
 }
 
+// the rest of the sums: the lengths (the UDP one twice, as the pseudo-header has
+// it too), the id and the payload
+void net_compute_templated_checksums(packet_t *packet)
+{
+    uint16_t cs;
+    uint32_t sum;
+
+    sum = packet->csum_ipv4_partial + ntohs(packet->ipv4->length) + ntohs(packet->ipv4->id);
+    packet->ipv4->checksum = htons(checksum_complete(sum));
+
+    sum = packet->csum_partial + 2 * ntohs(packet->udp->length);
+    sum = checksum_update(sum, (uint16_t*)packet->data, packet->data_length);
+    cs = checksum_complete(sum);
+    if(cs == 0)
+        cs = 0xffff; // per RFC768
+    packet->udp->checksum = htons(cs);
+}
@@ -0,0 +1,177 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <net.h>
+#include <init.h>
+
+// IPv4 fragment reassembly, using the hole descriptor list from RFC 815. Each
+// datagram being reassembled gets a slot, with a buffer that becomes the
+// reassembled packet. Slots time out, and the buffers share a memory cap.
+
+#define IPFRAG_SLOTS            4       // datagrams in reassembly at once
+#define IPFRAG_MAX_HOLES        8       // per datagram; more and we give up on it
+#define IPFRAG_MEMORY_MAX       (40*1024)
+#define IPFRAG_HEAP_FRACTION    8       // and never more than 1/8th of the heap
+#define IPFRAG_TIMEOUT_MS       2000
+#define IPFRAG_HEADER_SIZE      (sizeof(ethernet_header_t) + sizeof(ipv4_header_t))
+#define IPFRAG_INFINITY         0xffff
+
+typedef struct {
+    uint16_t first, last;               // byte offsets in the datagram payload, inclusive
+} ipfrag_hole_t;
+
+typedef struct {
+    packet_t *packet;                   // NULL for a free slot
+    uint8_t ifindex;                    // the card the fragments arrive on
+    uint32_t source_ip;                 // network byte order, as are id and protocol
+    uint32_t destination_ip;
+    uint16_t id;
+    uint8_t protocol;
+    uint16_t size;                      // payload space in packet
+    timer_t timeout;
+    int holes;
+    ipfrag_hole_t hole[IPFRAG_MAX_HOLES];
+} ipfrag_slot_t;
+
+static ipfrag_slot_t ipfrag_slot[IPFRAG_SLOTS];
+static uint32_t ipfrag_memory = 0;      // buffer space in use
+
+uint32_t ipfrag_reassembled_count = 0;
+uint32_t ipfrag_dropped_count = 0;      // datagrams abandoned: timeout, too big, out of memory
+
+static void ipfrag_release(ipfrag_slot_t *slot, bool dropped)
+{
+    if(dropped){
+        packet_free(slot->packet);
+        ipfrag_dropped_count++;
+    }
+    ipfrag_memory -= slot->size;
+    slot->packet = NULL;
+}
+
+void net_ipv4_reassembly_pump(void)
+{
+    for(int i=0; i<IPFRAG_SLOTS; i++)
+        if(ipfrag_slot[i].packet && timer_expired(ipfrag_slot[i].timeout))
+            ipfrag_release(&ipfrag_slot[i], true);
+}
+
+static ipfrag_slot_t *ipfrag_find_slot(int ifindex, ipv4_header_t *ipv4, int size)
+{
+    ipfrag_slot_t *slot, *free_slot = NULL;
+
+    for(int i=0; i<IPFRAG_SLOTS; i++){
+        slot = &ipfrag_slot[i];
+        if(!slot->packet){
+            if(!free_slot)
+                free_slot = slot;
+        }else if(slot->id == ipv4->id && slot->ifindex == ifindex && slot->source_ip == ipv4->source_ip &&
+                 slot->destination_ip == ipv4->destination_ip && slot->protocol == ipv4->protocol)
+            return slot;
+    }
+
+    if(!free_slot || ipfrag_memory + size > IPFRAG_MEMORY_MAX ||
+       ipfrag_memory + size > heap_size / IPFRAG_HEAP_FRACTION)
+        return NULL;
+
+    slot = free_slot;
+    slot->packet = packet_alloc(IPFRAG_HEADER_SIZE + size);
+    slot->ifindex = ifindex;
+    slot->source_ip = ipv4->source_ip;
+    slot->destination_ip = ipv4->destination_ip;
+    slot->id = ipv4->id;
+    slot->protocol = ipv4->protocol;
+    slot->size = size;
+    slot->timeout = set_timer_ms(IPFRAG_TIMEOUT_MS);
+    slot->holes = 1;
+    slot->hole[0].first = 0;
+    slot->hole[0].last = IPFRAG_INFINITY;
+    ipfrag_memory += size;
+
+    return slot;
+}
+
+// takes a fragment (which is consumed) and returns the whole datagram once all
+// of it has arrived, otherwise NULL. the ipv4 header checksum is already verified.
+packet_t *net_ipv4_reassemble(packet_t *fragment)
+{
+    ipv4_header_t *ipv4 = fragment->ipv4;
+    uint16_t frags = ntohs(ipv4->flags_and_frags);
+    bool more = frags & 0x2000;
+    int first = (frags & 0x1fff) << 3;
+    int length = ntohs(ipv4->length) - sizeof(ipv4_header_t);
+    int last = first + length - 1;
+    ipfrag_slot_t *slot;
+    ipfrag_hole_t *hole, old;
+    packet_t *packet;
+    int h, size;
+
+    if(ipv4->version_length != 0x45 || length <= 0 || last >= NET_MAX_DATAGRAM ||
+       (more && (length & 7))){
+        ipfrag_dropped_count++;
+        packet_free(fragment);
+        return NULL;
+    }
+
+    // a last fragment tells us the size; otherwise allow for the largest datagram
+    size = more ? NET_MAX_DATAGRAM : last + 1;
+    slot = ipfrag_find_slot(fragment->ifindex, ipv4, size);
+    if(!slot || last >= slot->size){
+        if(slot)
+            ipfrag_release(slot, true);
+        else
+            ipfrag_dropped_count++;
+        packet_free(fragment);
+        return NULL;
+    }
+
+    // fill the holes this fragment covers (RFC 815 section 3)
+    for(h=0; h<slot->holes; ){
+        hole = &slot->hole[h];
+        if(first > hole->last || last < hole->first){
+            h++;
+            continue;
+        }
+        old = *hole;
+        *hole = slot->hole[--slot->holes]; // delete it; re-examine whatever moved into its place
+        if(first > old.first || (last < old.last && more)){
+            if(slot->holes + (first > old.first) + (last < old.last && more) > IPFRAG_MAX_HOLES){
+                ipfrag_release(slot, true);
+                packet_free(fragment);
+                return NULL;
+            }
+            if(first > old.first){
+                slot->hole[slot->holes].first = old.first;
+                slot->hole[slot->holes++].last = first - 1;
+            }
+            if(last < old.last && more){
+                slot->hole[slot->holes].first = last + 1;
+                slot->hole[slot->holes++].last = old.last;
+            }
+        }
+    }
+
+    packet = slot->packet;
+    memcpy(packet->buffer + IPFRAG_HEADER_SIZE + first, ipv4->payload, length);
+    if(first == 0) // the first fragment's headers become those of the datagram
+        memcpy(packet->buffer, fragment->buffer, IPFRAG_HEADER_SIZE);
+    if(!more) // now we know where it ends
+        packet->buffer_length = IPFRAG_HEADER_SIZE + last + 1;
+    packet_free(fragment);
+
+    if(slot->holes)
+        return NULL;
+
+    // complete: make it look like it arrived in one piece
+    packet->ifindex = slot->ifindex;
+    ipfrag_release(slot, false);
+    packet->ipv4 = (ipv4_header_t*)packet->eth->payload;
+    packet->ipv4->flags_and_frags = 0;
+    packet->ipv4->length = htons(packet->buffer_length - sizeof(ethernet_header_t));
+    net_compute_ipv4_checksum(packet);
+    ipfrag_reassembled_count++;
+
+    return packet;
+}
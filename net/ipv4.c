@@ -38,19 +38,32 @@ packet_t *packet_create_icmp(uint32_t dest_ipv4, int data_size)
     return p;
 }
 
-packet_t *packet_create_tcp(uint32_t dest_ipv4, uint16_t destination_port, uint16_t source_port, int data_size)
+packet_t *packet_create_igmp(uint32_t dest_ipv4)
 {
-    packet_t *p = packet_create_ipv4(dest_ipv4, data_size + sizeof(tcp_header_t), ip_proto_udp);
-    p->tcp = (tcp_header_t*)p->ipv4->payload;
-    p->data = (uint8_t*)p->tcp->options; // + options_size
-    p->data_length = data_size;          // - options_size
+    packet_t *p = packet_create_ipv4(dest_ipv4, sizeof(igmp_header_t), ip_proto_igmp);
+    p->ipv4->ttl = 1; // IGMP never leaves the local network
+    p->data = p->ipv4->payload;
+    p->data_length = sizeof(igmp_header_t);
+    return p;
+}
 
-    printf("packet_create_tcp is incomplete!\n");
+packet_t *packet_create_tcp(uint32_t dest_ipv4, uint16_t destination_port, uint16_t source_port, int data_size)
+{
+    packet_t *p = packet_create_ipv4(dest_ipv4, data_size + sizeof(tcp_header_t), ip_proto_tcp);
 
-    // set up tcp header
-    // p->tcp->... = ...;
+    // set up tcp header, without options; the caller fills in sequence numbers and flags
+    p->tcp = (tcp_header_t*)p->ipv4->payload;
+    p->data = (uint8_t*)p->tcp->options;
+    p->data_length = data_size;
 
-    // p->data needs to be computed depending on tcp option headers present.
+    p->tcp->source_port = htons(source_port);
+    p->tcp->destination_port = htons(destination_port);
+    p->tcp->sequence = 0;
+    p->tcp->ack = 0;
+    p->tcp->data_offset = (sizeof(tcp_header_t) / 4) << 4;
+    p->tcp->flags = 0;
+    p->tcp->window_size = 0;
+    p->tcp->urgent_pointer = 0;
 
     return p;
 }
@@ -108,10 +121,35 @@ bool packet_data_resize(packet_t *packet, int new_data_length)
     return true;
 }
 
+// copy the headers from the sink's template, and patch in what varies
+static packet_t *packet_create_from_template(packet_sink_t *sink, int data_size)
+{
+    packet_t *p = packet_alloc(sizeof(sink->template_header) + data_size);
+
+    memcpy(p->buffer, sink->template_header, sizeof(sink->template_header));
+    p->ipv4 = (ipv4_header_t*)p->eth->payload;
+    p->udp = (udp_header_t*)p->ipv4->payload;
+    p->data = p->udp->payload;
+    p->data_length = data_size;
+
+    p->ipv4->length = htons(sizeof(ipv4_header_t) + sizeof(udp_header_t) + data_size);
+    p->ipv4->id = htons(sink->template_id++);
+    p->udp->length = htons(sizeof(udp_header_t) + data_size);
+
+    p->ifindex = sink->template_ifindex;
+    p->csum_ipv4_partial = sink->template_ipv4_sum;
+    p->csum_partial = sink->template_udp_sum;
+    p->flags |= packet_flag_templated | packet_flag_destination_mac_valid;
+
+    return p;
+}
+
 packet_t *packet_create_for_sink(packet_sink_t *sink, int data_size)
 {
     switch(sink->match_ipv4_protocol) {
         case ip_proto_udp:
+            if(net_sink_template(sink))
+                return packet_create_from_template(sink, data_size);
             return packet_create_udp(sink->match_remote_ip, sink->match_remote_port, sink->match_local_port, data_size);
         case ip_proto_tcp:
             return packet_create_tcp(sink->match_remote_ip, sink->match_remote_port, sink->match_local_port, data_size);
@@ -136,3 +174,24 @@ uint32_t net_parse_ipv4(const char *input)
 
     return result;
 }
+
+// writes "a.b.c.d" to buffer, which needs room for 16 bytes
+char *net_format_ipv4(uint32_t ip, char *buffer)
+{
+    char *p = buffer;
+    int octet;
+
+    for(int i=24; i>=0; i-=8){
+        octet = (ip >> i) & 0xff;
+        if(octet >= 100)
+            *(p++) = '0' + octet / 100;
+        if(octet >= 10)
+            *(p++) = '0' + (octet / 10) % 10;
+        *(p++) = '0' + octet % 10;
+        if(i)
+            *(p++) = '.';
+    }
+    *p = 0;
+
+    return buffer;
+}
@@ -15,32 +15,47 @@
 #include <q40/hw.h>
 #include <net.h>
 #include <cli.h>
+#include <cpu.h>
+#include <init.h>
 
 /* forward definition of function used for the uboot interface */
 static void push_packet_ready(int len);
 
 #undef  DEBUG                   /* extra-chatty mode */
 
+/* bytes read before offering the packet to net_eth_peek(); must be even */
+#define RX_PEEK_LENGTH (sizeof(ethernet_header_t) + sizeof(ipv4_header_t) + sizeof(udp_header_t) + NET_PEEK_DATA)
+
 #if defined(TARGET_Q40)
     /* 16-bit bus targets: Q40 */
     #include <q40/isa.h>
     #define NE2000_16BIT_PIO        /* use 16-bit PIO data transfer */
     static uint16_t const portlist[] = { 0x300, 0x280, 0x320, 0x340, 0x360, 0x380, 0 };
-    static inline void    write_port_byte_pause(uint16_t port, uint8_t val) { isa_write_byte_pause(port, val); }
+    #define NE2000_MAX_NICS NET_MAX_INTERFACES
     static inline void    write_port_byte(uint16_t port, uint8_t val)       { isa_write_byte(port, val); }
     static inline void    write_port_word(uint16_t port, uint16_t val)      { isa_write_word(port, val); }
     static inline uint8_t  read_port_byte(uint16_t port)             { return isa_read_byte(port); }
     static inline uint16_t read_port_word(uint16_t port)             { return isa_read_word(port); }
-    static inline void     io_slow_down(void)                               { isa_slow_down(); }
+    static inline void     bus_slow_down(void)                              { isa_slow_down(); }
+    /* q40/ne2000xfer.s */
+    void ne2000_pio_input(void *buf, volatile uint16_t *port, int len);
+    void ne2000_pio_output(const void *buf, volatile uint16_t *port, int len);
+    uint32_t ne2000_pio_input_csum(void *buf, volatile uint16_t *port, int len);
+    #define data_port() ISA_XLATE_ADDR_WORD(nic->data)
 #elif defined(TARGET_KISS) || defined(TARGET_MINI)
     /* 8-bit bus targets: KISS-68030 */
     #include <ecb/ecb.h>
     #undef NE2000_16BIT_PIO         /* use 8-bit PIO data transfer */
     static uint16_t const portlist[] = { 0 };
-    static inline void    write_port_byte_pause(uint16_t port, uint8_t val) { ecb_write_byte_pause(port, val); }
+    #define NE2000_MAX_NICS 1
     static inline void    write_port_byte(uint16_t port, uint8_t val)       { ecb_write_byte(port, val); }
     static inline uint8_t  read_port_byte(uint16_t port)             { return ecb_read_byte(port); }
-    static inline void     io_slow_down(void)                               { ecb_slow_down(); }
+    static inline void     bus_slow_down(void)                              { ecb_slow_down(); }
+    /* ecb/ne2000xfer.s */
+    void ne2000_pio_input(void *buf, volatile uint8_t *port, int len);
+    void ne2000_pio_output(const void *buf, volatile uint8_t *port, int len);
+    uint32_t ne2000_pio_input_csum(void *buf, volatile uint8_t *port, int len);
+    #define data_port() (&ECB_DEVICE_IO[nic->data])
 #else
     #pragma error update ne2000.c for your target
 #endif
@@ -53,32 +68,147 @@ static void push_packet_ready(int len);
 #define debug_printf(args...)
 #endif
 
-static dp83902a_priv_data_t nic;                /* just one instance of the card supported */
+/* one entry per card found; the driver works on the card 'nic' points at,
+   which eth_*() take from the interface index they are given */
+static dp83902a_priv_data_t nic_table[NE2000_MAX_NICS];
+static int nic_count = 0;
+static dp83902a_priv_data_t *nic = &nic_table[0];
+static int nic_irq_count = 0;   /* cards receiving on an interrupt */
+static eth_stats_t stats_total;
+
+/* A genuine DP8390 needs a bus cycle of recovery after each register write;
+   the RTL8019 does not, and on the per-packet paths the pauses add up. The
+   probe runs with them on and eth_init() picks the profile once it knows the
+   chip. Build with NE2000_IO_PAUSE to keep them for every chip. */
+static inline void io_slow_down(void)
+{
+    if(nic->io_pause)
+        bus_slow_down();
+}
+
+static inline void write_port_byte_pause(uint16_t port, uint8_t val)
+{
+    write_port_byte(port, val);
+    io_slow_down();
+}
+
+/* In IRQ mode the interrupt handler copies frames from the card into a ring
+   of preallocated packets (nic->rxq_*), and eth_pump() passes them up the
+   stack. The handler only moves rxq_head, eth_pump() only moves rxq_tail. */
+#define RXQ_SLOTS_MIN   4
+#define RXQ_HEAP_FRACTION 8     /* use at most 1/8th of the heap */
+
+/* with any card interrupting, the rest of the driver must not touch a card
+   unguarded: the handler services them all */
+static inline void dp83902a_lock(void)
+{
+    if(nic_irq_count)
+        cpu_interrupts_off();
+}
+
+static inline void dp83902a_unlock(void)
+{
+    if(nic_irq_count)
+        cpu_interrupts_on();
+}
+
+/* make the card behind an interface current */
+static bool nic_select(int ifindex)
+{
+    if(ifindex < 0 || ifindex >= nic_count)
+        return false;
+    nic = &nic_table[ifindex];
+    return true;
+}
 
 #ifdef DEBUG
 static void ne2000_dump_regs(void)
 {
     uint8_t start, stop, current, boundary;
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_PAGE2 | DP_CR_NODMA | DP_CR_START);
-    start = read_port_byte(nic.base + DP_P2_PSTART);
-    stop = read_port_byte(nic.base + DP_P2_PSTOP);
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_PAGE1 | DP_CR_NODMA | DP_CR_START);
-    current = read_port_byte(nic.base + DP_P1_CURP);
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
-    boundary = read_port_byte(nic.base + DP_BNDRY);
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE2 | DP_CR_NODMA | DP_CR_START);
+    start = read_port_byte(nic->base + DP_P2_PSTART);
+    stop = read_port_byte(nic->base + DP_P2_PSTOP);
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE1 | DP_CR_NODMA | DP_CR_START);
+    current = read_port_byte(nic->base + DP_P1_CURP);
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
+    boundary = read_port_byte(nic->base + DP_BNDRY);
 
     printf("ne2000: start=0x%02x, stop=0x%02x, current/w=0x%02x, boundary/r=0x%02x, rxnext=0x%02x\n",
-            start, stop, current, boundary, nic.rx_next);
+            start, stop, current, boundary, nic->rx_next);
 }
 #endif
 
 static void dp83902a_stop(void)
 {
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_STOP);  /* Brutal */
-    write_port_byte_pause(nic.base + DP_ISR, 0xFF);             /* Clear any pending interrupts */
-    write_port_byte_pause(nic.base + DP_IMR, 0x00);             /* Disable all interrupts */
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_STOP);  /* Brutal */
+    write_port_byte_pause(nic->base + DP_ISR, 0xFF);             /* Clear any pending interrupts */
+    write_port_byte_pause(nic->base + DP_IMR, 0x00);             /* Disable all interrupts */
+
+    nic->running = false;
+}
+
+/* accept multicast frames only when some group is in the filter */
+static uint8_t dp83902a_rcr(void)
+{
+    for(int i=0; i<8; i++)
+        if(nic->mar[i])
+            return DP_RCR_AB | DP_RCR_AM;
+    return DP_RCR_AB;
+}
+
+/* RTL8019 media settings for the ne2000_media environment variable. Unset
+   leaves whatever the EEPROM and jumpers chose. On a switched network full
+   duplex stops a TFTP window colliding with its own ACKs; LED0 then shows the
+   link, as there are no collisions to show. */
+static const struct {
+    const char *name;
+    uint8_t config2, config3;
+} rtl8019_media[] = {
+    { "auto",    RTL_CONFIG2_PL_AUTO,    0 },
+    { "10t",     RTL_CONFIG2_PL_10BASET, 0 },
+    { "10t-fd",  RTL_CONFIG2_PL_10BASET, RTL_CONFIG3_FUDUP | RTL_CONFIG3_LEDS0 },
+    { "10base2", RTL_CONFIG2_PL_10BASE2, 0 },
+    { "aui",     RTL_CONFIG2_PL_10BASE5, 0 },
+};
+#define RTL8019_MEDIA_COUNT (sizeof(rtl8019_media)/sizeof(rtl8019_media[0]))
+
+/* ne2000_media for eth0, ne2000_media1 and so on for the others */
+static const char *rtl8019_media_variable(void)
+{
+    static char name[sizeof("ne2000_media") + 1] = "ne2000_media";
 
-    nic.running = false;
+    name[sizeof("ne2000_media") - 1] = nic->ifindex ? '0' + nic->ifindex : 0;
+    return name;
+}
+
+static int rtl8019_find_media(const char *name)
+{
+    for(int i=0; i<RTL8019_MEDIA_COUNT; i++)
+        if(!strcasecmp(name, rtl8019_media[i].name))
+            return i;
+    return -1;
+}
+
+/* called with the card stopped; leaves it on page 0 */
+static void rtl8019_configure(void)
+{
+    const char *setting = get_environment_variable(rtl8019_media_variable());
+    int m = setting ? rtl8019_find_media(setting) : -1;
+
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE3 | DP_CR_NODMA | DP_CR_STOP);
+    if(m >= 0){
+        /* lift the write protect on CONFIG1-3; the EEPROM itself is not written */
+        write_port_byte_pause(nic->base + RTL_P3_9346CR, RTL_9346CR_CONFIG);
+        write_port_byte_pause(nic->base + RTL_P3_CONFIG2,
+                (read_port_byte(nic->base + RTL_P3_CONFIG2) & ~RTL_CONFIG2_PL_MASK) | rtl8019_media[m].config2);
+        write_port_byte_pause(nic->base + RTL_P3_CONFIG3,
+                (read_port_byte(nic->base + RTL_P3_CONFIG3) & ~(RTL_CONFIG3_FUDUP | RTL_CONFIG3_LEDS0)) | rtl8019_media[m].config3);
+        write_port_byte_pause(nic->base + RTL_P3_9346CR, RTL_9346CR_NORMAL);
+    }else if(setting)
+        printf("ne2000: unknown ne2000_media \"%s\"\n", setting);
+    nic->rtl_config2 = read_port_byte(nic->base + RTL_P3_CONFIG2);
+    nic->rtl_config3 = read_port_byte(nic->base + RTL_P3_CONFIG3);
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_STOP);
 }
 
 /*
@@ -91,40 +221,44 @@ static void dp83902a_start(macaddr_t enaddr)
 {
     int i;
 
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_STOP); /* Brutal */
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_STOP); /* Brutal */
+    if(nic->rtl8019)
+        rtl8019_configure();
 #ifdef NE2000_16BIT_PIO
     // WRS: DP_DCR_BOS does not seem to affect the actual byte order the card uses ...
     // RTL8019AS datasheet confirms Byte Order Select as Not Implemented - presumably
     // many clones do the same -- http://realtek.info/pdf/rtl8019as.pdf page 13
-    write_port_byte_pause(nic.base + DP_DCR, DP_DCR_LS | DP_DCR_FIFO_4 | DP_DCR_WTS);
+    write_port_byte_pause(nic->base + DP_DCR, DP_DCR_LS | DP_DCR_FIFO_4 | DP_DCR_WTS);
 #else
-    write_port_byte_pause(nic.base + DP_DCR, DP_DCR_LS | DP_DCR_FIFO_4);
+    write_port_byte_pause(nic->base + DP_DCR, DP_DCR_LS | DP_DCR_FIFO_4);
 #endif
-    write_port_byte_pause(nic.base + DP_RBCH, 0);               /* Remote byte count */
-    write_port_byte_pause(nic.base + DP_RBCL, 0);
-    write_port_byte_pause(nic.base + DP_RCR, DP_RCR_MON);       /* Accept no packets */
-    write_port_byte_pause(nic.base + DP_TCR, DP_TCR_LOCAL);     /* Transmitter [virtually] off */
-    write_port_byte_pause(nic.base + DP_TPSR, nic.tx_buf1);     /* Transmitter start page */
-    nic.tx1 = nic.tx2 = 0;
-    nic.tx_next = nic.tx_buf1;
-    nic.tx_started = false;
-
-    write_port_byte_pause(nic.base + DP_PSTART, nic.rx_buf_start); /* Receive ring start page */
-    write_port_byte_pause(nic.base + DP_PSTOP, nic.rx_buf_end);    /* Receive ring end page */
-    write_port_byte_pause(nic.base + DP_BNDRY, nic.rx_buf_start);  /* Receive ring boundary (= host read pointer) */
-    write_port_byte_pause(nic.base + DP_ISR, 0xFF);             /* Clear any pending interrupts */
-    write_port_byte_pause(nic.base + DP_IMR, DP_IMR_All);       /* Enable all interrupts */
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_NODMA | DP_CR_PAGE1 | DP_CR_STOP);  /* Select page 1 */
-    write_port_byte_pause(nic.base + DP_P1_CURP, nic.rx_buf_start+1); /* Current page (= receiver write pointer) */
-    nic.rx_next = nic.rx_buf_start+1;
+    write_port_byte_pause(nic->base + DP_RBCH, 0);               /* Remote byte count */
+    write_port_byte_pause(nic->base + DP_RBCL, 0);
+    write_port_byte_pause(nic->base + DP_RCR, DP_RCR_MON);       /* Accept no packets */
+    write_port_byte_pause(nic->base + DP_TCR, DP_TCR_LOCAL);     /* Transmitter [virtually] off */
+    write_port_byte_pause(nic->base + DP_TPSR, nic->tx_buf_start); /* Transmitter start page */
+    nic->tx_first = nic->tx_count = 0;
+    nic->tx_started = false;
+
+    write_port_byte_pause(nic->base + DP_PSTART, nic->rx_buf_start); /* Receive ring start page */
+    write_port_byte_pause(nic->base + DP_PSTOP, nic->rx_buf_end);    /* Receive ring end page */
+    write_port_byte_pause(nic->base + DP_BNDRY, nic->rx_buf_start);  /* Receive ring boundary (= host read pointer) */
+    write_port_byte_pause(nic->base + DP_ISR, 0xFF);             /* Clear any pending interrupts */
+    write_port_byte_pause(nic->base + DP_IMR, DP_IMR_All);       /* Enable all interrupts */
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_NODMA | DP_CR_PAGE1 | DP_CR_STOP);  /* Select page 1 */
+    write_port_byte_pause(nic->base + DP_P1_CURP, nic->rx_buf_start+1); /* Current page (= receiver write pointer) */
+    nic->rx_next = nic->rx_buf_start+1;
     for (i = 0;  i < 6;  i++) {
-        write_port_byte_pause(nic.base + DP_P1_PAR0+i, enaddr[i]);
+        write_port_byte_pause(nic->base + DP_P1_PAR0+i, enaddr[i]);
+    }
+    for (i = 0;  i < 8;  i++) {
+        write_port_byte_pause(nic->base + DP_P1_MAR0+i, nic->mar[i]);
     }
     /* Enable and start device */
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
-    write_port_byte_pause(nic.base + DP_TCR, DP_TCR_NORMAL); /* Normal transmit operations */
-    write_port_byte_pause(nic.base + DP_RCR, DP_RCR_AB);  /* Accept broadcast, no errors, no multicast */
-    nic.running = true;
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
+    write_port_byte_pause(nic->base + DP_TCR, DP_TCR_NORMAL); /* Normal transmit operations */
+    write_port_byte_pause(nic->base + DP_RCR, dp83902a_rcr());  /* Accept broadcast, no errors, multicast if filtered */
+    nic->running = true;
 
 #ifdef DEBUG
     printf("ne2000: init complete\n");
@@ -141,66 +275,67 @@ static void dp83902a_start_xmit(int start_page, int len)
 {
 #ifdef DEBUG
     printf("Tx pkt %d len %d\n", start_page, len);
-    if (nic.tx_started)
+    if (nic->tx_started)
         printf("TX already started?!?\n");
 #endif
 
-    write_port_byte_pause(nic.base + DP_ISR, (DP_ISR_TxP | DP_ISR_TxE));
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
-    write_port_byte_pause(nic.base + DP_TBCL, len & 0xFF);
-    write_port_byte_pause(nic.base + DP_TBCH, len >> 8);
-    write_port_byte_pause(nic.base + DP_TPSR, start_page);
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_NODMA | DP_CR_TXPKT | DP_CR_START);
+    write_port_byte_pause(nic->base + DP_ISR, (DP_ISR_TxP | DP_ISR_TxE));
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
+    write_port_byte_pause(nic->base + DP_TBCL, len & 0xFF);
+    write_port_byte_pause(nic->base + DP_TBCH, len >> 8);
+    write_port_byte_pause(nic->base + DP_TPSR, start_page);
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_NODMA | DP_CR_TXPKT | DP_CR_START);
 
-    nic.tx_started = true;
+    nic->tx_started = true;
+}
+
+static inline int dp83902a_tx_page(int slot)
+{
+    return nic->tx_buf_start + slot * NE2000_TX_SLOT_PAGES;
 }
 
 /*
    This routine is called to send data to the hardware.  It is known a-priori
-   that there is free buffer space (nic.tx_next).
+   that there is a free Tx buffer (nic->tx_count < nic->tx_slots).
    */
 static void dp83902a_send(void *data, int total_len)
 {
-    int len, start_page, pkt_len, i, isr;
+    int len, slot, start_page, pkt_len, isr;
 
     len = pkt_len = total_len;
     if (pkt_len < IEEE_8023_MIN_FRAME)
         pkt_len = IEEE_8023_MIN_FRAME;
 
-    start_page = nic.tx_next;
-    if (nic.tx_next == nic.tx_buf1) {
-        debug_printf("tx1 ");
-        nic.tx1 = start_page;
-        nic.tx1_len = pkt_len;
-        nic.tx_next = nic.tx_buf2;
-    } else {
-        debug_printf("tx2 ");
-        nic.tx2 = start_page;
-        nic.tx2_len = pkt_len;
-        nic.tx_next = nic.tx_buf1;
-    }
+    /* Tx buffers are used in turn, the frames queue behind the one being sent */
+    slot = nic->tx_first + nic->tx_count;
+    if (slot >= nic->tx_slots)
+        slot -= nic->tx_slots;
+    start_page = dp83902a_tx_page(slot);
+    nic->tx_len[slot] = pkt_len;
+    nic->tx_count++;
+    debug_printf("tx%d ", slot);
 
     debug_printf("total_len=%d pkt_len=%d ", total_len, pkt_len);
 
-    write_port_byte_pause(nic.base + DP_ISR, DP_ISR_RDC);  /* Clear end of DMA */
+    write_port_byte_pause(nic->base + DP_ISR, DP_ISR_RDC);  /* Clear end of DMA */
 
     /* Dummy read. The manual says something slightly different, */
     /* but the code is extended a bit to do what Hitachi's monitor */
     /* does (i.e., also read data). */
     uint16_t __attribute__((unused)) tmp;
-    write_port_byte_pause(nic.base + DP_RSAL, 0x100-1);
-    write_port_byte_pause(nic.base + DP_RSAH, (start_page-1) & 0xff);
+    write_port_byte_pause(nic->base + DP_RSAL, 0x100-1);
+    write_port_byte_pause(nic->base + DP_RSAH, (start_page-1) & 0xff);
 #ifdef NE2000_16BIT_PIO
-    write_port_byte_pause(nic.base + DP_RBCL, 2);
+    write_port_byte_pause(nic->base + DP_RBCL, 2);
 #else
-    write_port_byte_pause(nic.base + DP_RBCL, 1);
+    write_port_byte_pause(nic->base + DP_RBCL, 1);
 #endif
-    write_port_byte_pause(nic.base + DP_RBCH, 0);
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_PAGE0 | DP_CR_RDMA | DP_CR_START);
+    write_port_byte_pause(nic->base + DP_RBCH, 0);
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE0 | DP_CR_RDMA | DP_CR_START);
 #ifdef NE2000_16BIT_PIO
-    tmp = read_port_word(nic.data);
+    tmp = read_port_word(nic->data);
 #else
-    tmp = read_port_byte(nic.data);
+    tmp = read_port_byte(nic->data);
 #endif
 
 #ifdef NE2000_16BIT_PIO
@@ -210,69 +345,34 @@ static void dp83902a_send(void *data, int total_len)
 #endif
 
     /* Send data to device buffer(s) */
-    write_port_byte_pause(nic.base + DP_RSAL, 0);
-    write_port_byte_pause(nic.base + DP_RSAH, start_page);
-    write_port_byte_pause(nic.base + DP_RBCL, pkt_len & 0xFF);
-    write_port_byte_pause(nic.base + DP_RBCH, pkt_len >> 8);
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_WDMA | DP_CR_START);
+    write_port_byte_pause(nic->base + DP_RSAL, 0);
+    write_port_byte_pause(nic->base + DP_RSAH, start_page);
+    write_port_byte_pause(nic->base + DP_RBCL, pkt_len & 0xFF);
+    write_port_byte_pause(nic->base + DP_RBCH, pkt_len >> 8);
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_WDMA | DP_CR_START);
 
     /* Put data into buffer */
-#ifdef NE2000_16BIT_PIO
-    uint16_t *txptr = (uint16_t*)data;
-    if(len & 1)
-        len++;
-    len = len >> 1;
-#else
-    uint8_t *txptr = (uint8_t*)data;
-#endif
-    for(i=0; i<len; i++){
-#ifdef NE2000_16BIT_PIO
-        write_port_word(nic.data, __builtin_bswap16(*(txptr++)));
-#else
-        write_port_byte(nic.data, *(txptr++));
-#endif
-    }
-
-    /* pad with zeroes if required */
-    if (total_len < pkt_len) {
-#ifdef NE2000_16BIT_PIO
-        len = len << 1;
-#endif
-        len = pkt_len - len;
-#ifdef DEBUG
-        printf("  + %d bytes of padding\n", pkt_len - total_len);
-#endif
-#ifdef NE2000_16BIT_PIO
-        len = len >> 1;
-#else
-#endif
-        /* Padding to 802.3 length was required */
-        for(i=0; i<len; i++){
-#ifdef NE2000_16BIT_PIO
-            write_port_word(nic.data, 0);
-#else
-            write_port_byte(nic.data, 0);
-#endif
-        }
+    if (len < IEEE_8023_MIN_FRAME) {
+        /* Padding to 802.3 length is required */
+        uint8_t padded[IEEE_8023_MIN_FRAME];
+        memcpy(padded, data, len);
+        memset(padded + len, 0, sizeof(padded) - len);
+        ne2000_pio_output(padded, data_port(), sizeof(padded));
+    } else {
+        ne2000_pio_output(data, data_port(), len);
     }
 
     /* Wait for DMA to complete */
     do {
-        isr = read_port_byte(nic.base + DP_ISR);
+        isr = read_port_byte(nic->base + DP_ISR);
     } while ((isr & DP_ISR_RDC) == 0);
 
     /* Then disable DMA */
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
 
-    /* Start transmit if not already going */
-    if (!nic.tx_started) {
-        if (start_page == nic.tx1) {
-            nic.tx_int = 1;  /* Expecting interrupt from BUF1 */
-        } else {
-            nic.tx_int = 2;  /* Expecting interrupt from BUF2 */
-        }
-        dp83902a_start_xmit(start_page, pkt_len);
-    }
+    /* Start transmit if not already going; otherwise dp83902a_TxEvent() will */
+    if (!nic->tx_started)
+        dp83902a_start_xmit(dp83902a_tx_page(nic->tx_first), nic->tx_len[nic->tx_first]);
 }
 
 /*
@@ -280,12 +380,12 @@ static void dp83902a_send(void *data, int total_len)
    to prepare to unload the packet from the hardware.  Once the length of
    the packet is known, the upper layer of the driver can be told.  When
    the upper layer is ready to unload the packet, the internal function
-   'dp83902a_recv' will be called to actually fetch it from the hardware.
+   'dp83902a_recv_start' will be called to actually fetch it from the hardware.
    */
 static void dp83902a_RxEvent(void)
 {
     uint8_t rcv_hdr[4];
-    int i, len, cur;
+    int len, cur, used;
 
     while (true) {
 #ifdef DEBUG
@@ -293,31 +393,29 @@ static void dp83902a_RxEvent(void)
         ne2000_dump_regs();
 #endif
         /* Read incoming packet header */
-        write_port_byte_pause(nic.base + DP_CR, DP_CR_PAGE1 | DP_CR_NODMA | DP_CR_START);
-        cur = read_port_byte(nic.base + DP_P1_CURP);
-        write_port_byte_pause(nic.base + DP_P1_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
+        write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE1 | DP_CR_NODMA | DP_CR_START);
+        cur = read_port_byte(nic->base + DP_P1_CURP);
+        write_port_byte_pause(nic->base + DP_P1_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
 
-        if(nic.rx_next == cur) // done reading packets?
+        if(nic->rx_next == cur) // done reading packets?
             break;
 
-        write_port_byte_pause(nic.base + DP_RBCL, sizeof(rcv_hdr));
-        write_port_byte_pause(nic.base + DP_RBCH, 0);
-        write_port_byte_pause(nic.base + DP_RSAL, 0);
-        write_port_byte_pause(nic.base + DP_RSAH, nic.rx_next);
-        write_port_byte_pause(nic.base + DP_ISR, DP_ISR_RDC); /* Clear end of DMA */
+        used = cur - nic->rx_next;
+        if(used < 0)
+            used += nic->rx_buf_end - nic->rx_buf_start;
+        if(used > nic->stats.rx_high_water)
+            nic->stats.rx_high_water = used;
+
+        write_port_byte_pause(nic->base + DP_RBCL, sizeof(rcv_hdr));
+        write_port_byte_pause(nic->base + DP_RBCH, 0);
+        write_port_byte_pause(nic->base + DP_RSAL, 0);
+        write_port_byte_pause(nic->base + DP_RSAH, nic->rx_next);
+        write_port_byte_pause(nic->base + DP_ISR, DP_ISR_RDC); /* Clear end of DMA */
         io_slow_down();
-        write_port_byte_pause(nic.base + DP_CR, DP_CR_RDMA | DP_CR_START);
+        write_port_byte_pause(nic->base + DP_CR, DP_CR_RDMA | DP_CR_START);
         io_slow_down();
 
-#ifdef NE2000_16BIT_PIO
-        for (i = 0;  i < sizeof(rcv_hdr)/2; i++) {
-            ((uint16_t*)rcv_hdr)[i] = __builtin_bswap16(read_port_word(nic.data));
-        }
-#else
-        for (i = 0;  i < sizeof(rcv_hdr);) {
-            rcv_hdr[i++] = read_port_byte(nic.data);
-        }
-#endif
+        ne2000_pio_input(rcv_hdr, data_port(), sizeof(rcv_hdr));
 
 #ifdef DEBUG
         printf("ne2000: rx header %02x %02x %02x %02x\n",
@@ -326,16 +424,17 @@ static void dp83902a_RxEvent(void)
 
         len = ((rcv_hdr[3] << 8) | rcv_hdr[2]) - sizeof(rcv_hdr);
         if (len>=PACKET_MAXLEN) {
+            nic->stats.rx_too_big++;
             printf("ne2000: rx too big\n");
         }else{
             push_packet_ready(len);
         }
 
-        nic.rx_next = rcv_hdr[1];
-        if(nic.rx_next - 1 < nic.rx_buf_start)
-            write_port_byte_pause(nic.base + DP_BNDRY, nic.rx_buf_end - 1);
+        nic->rx_next = rcv_hdr[1];
+        if(nic->rx_next - 1 < nic->rx_buf_start)
+            write_port_byte_pause(nic->base + DP_BNDRY, nic->rx_buf_end - 1);
         else
-            write_port_byte_pause(nic.base + DP_BNDRY, nic.rx_next - 1);
+            write_port_byte_pause(nic->base + DP_BNDRY, nic->rx_next - 1);
 #ifdef DEBUG
         printf("ne2000: update pointers\n");
         ne2000_dump_regs();
@@ -345,75 +444,70 @@ static void dp83902a_RxEvent(void)
 
 /*
    This function is called as a result of the "eth_drv_recv()" call above.
-   It's job is to actually fetch data for a packet from the hardware once
-   memory buffers have been allocated for the packet.
+   It's job is to set up the hardware to fetch data for a packet once
+   memory buffers have been allocated for the packet; the data is then
+   read in one or more pieces with dp83902a_recv_data().
    */
-static void dp83902a_recv(uint8_t *data, int len)
+static void dp83902a_recv_start(int len)
 {
     /* Read incoming packet data */
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
-    write_port_byte_pause(nic.base + DP_RBCL, len & 0xFF);
-    write_port_byte_pause(nic.base + DP_RBCH, len >> 8);
-    write_port_byte_pause(nic.base + DP_RSAL, 4);         /* Past header */
-    write_port_byte_pause(nic.base + DP_RSAH, nic.rx_next);
-    write_port_byte_pause(nic.base + DP_ISR, DP_ISR_RDC); /* Clear end of DMA */
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
+    write_port_byte_pause(nic->base + DP_RBCL, len & 0xFF);
+    write_port_byte_pause(nic->base + DP_RBCH, len >> 8);
+    write_port_byte_pause(nic->base + DP_RSAL, 4);         /* Past header */
+    write_port_byte_pause(nic->base + DP_RSAH, nic->rx_next);
+    write_port_byte_pause(nic->base + DP_ISR, DP_ISR_RDC); /* Clear end of DMA */
     io_slow_down();
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_RDMA | DP_CR_START);
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_RDMA | DP_CR_START);
     io_slow_down();
+}
 
+/* Returns the number of bytes consumed from the card, which in 16-bit mode
+   includes the extra byte fetched when len is odd (this is not stored). */
+static int dp83902a_recv_data(uint8_t *data, int len)
+{
+    ne2000_pio_input(data, data_port(), len);
 #ifdef NE2000_16BIT_PIO
-    uint16_t *dptr = (uint16_t*)data;
-    len = (len+1) >> 1;
-#else
-    uint8_t *dptr = data;
+    len = (len + 1) & ~1;
 #endif
+    return len;
+}
 
-    for(int i=0; i<len; i++){
+/* As dp83902a_recv_data, also summing the data for the UDP checksum */
+static int dp83902a_recv_data_csum(uint8_t *data, int len, uint32_t *sum)
+{
+    *sum = ne2000_pio_input_csum(data, data_port(), len);
 #ifdef NE2000_16BIT_PIO
-        *(dptr++) = __builtin_bswap16(read_port_word(nic.data));
-#else
-        *(dptr++) = read_port_byte(nic.data);
+    len = (len + 1) & ~1;
 #endif
-    }
+    return len;
 }
 
 static void dp83902a_TxEvent(void)
 {
     uint8_t __attribute__((unused)) tsr;
 
-    tsr = read_port_byte(nic.base + DP_TSR);
-    if (nic.tx_int == 1) {
-        debug_printf("f1 ");
-        nic.tx1 = 0;
-    } else {
-        debug_printf("f2 ");
-        nic.tx2 = 0;
-    }
+    tsr = read_port_byte(nic->base + DP_TSR);
+    debug_printf("f%d ", nic->tx_first);
+    if (++nic->tx_first == nic->tx_slots)
+        nic->tx_first = 0;
+    nic->tx_count--;
 
-    /* Start next packet if one is ready */
-    nic.tx_started = false;
+    /* Start next packet straight away, if one is queued */
+    nic->tx_started = false;
 
-    if (nic.tx1) {
-        dp83902a_start_xmit(nic.tx1, nic.tx1_len);
-        nic.tx_int = 1;
-    } else if (nic.tx2) {
-        dp83902a_start_xmit(nic.tx2, nic.tx2_len);
-        nic.tx_int = 2;
-    } else {
-        nic.tx_int = 0;
-    }
+    if (nic->tx_count)
+        dp83902a_start_xmit(dp83902a_tx_page(nic->tx_first), nic->tx_len[nic->tx_first]);
 }
 
-/* Read the tally counters to clear them.  Called in response to a CNT */
-/* interrupt. */
+/* Read the tally counters, which clears them, into our totals.  Called in */
+/* response to a CNT interrupt, and before reporting. */
 static void dp83902a_ClearCounters(void)
 {
-    uint8_t __attribute__((unused)) cnt1, cnt2, cnt3;
-
-    cnt1 = read_port_byte(nic.base + DP_FER);
-    cnt2 = read_port_byte(nic.base + DP_CER);
-    cnt3 = read_port_byte(nic.base + DP_MISSED);
-    write_port_byte_pause(nic.base + DP_ISR, DP_ISR_CNT);
+    nic->stats.frame_errors += read_port_byte(nic->base + DP_FER);
+    nic->stats.crc_errors += read_port_byte(nic->base + DP_CER);
+    nic->stats.missed_frames += read_port_byte(nic->base + DP_MISSED);
+    write_port_byte_pause(nic->base + DP_ISR, DP_ISR_CNT);
 }
 
 /* Deal with an overflow condition.  This code follows the procedure set */
@@ -422,34 +516,35 @@ static void dp83902a_Overflow(void)
 {
     uint8_t isr;
 
+    nic->stats.overflows++;
     printf("ne2000: overflow\n");
 
     /* Issue a stop command and wait 1.6ms for it to complete. */
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_STOP | DP_CR_NODMA);
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_STOP | DP_CR_NODMA);
 
     /* Clear the remote byte counter registers. */
-    write_port_byte_pause(nic.base + DP_RBCL, 0);
-    write_port_byte_pause(nic.base + DP_RBCH, 0);
+    write_port_byte_pause(nic->base + DP_RBCL, 0);
+    write_port_byte_pause(nic->base + DP_RBCH, 0);
 
     /* Enter loopback mode while we clear the buffer. */
-    write_port_byte_pause(nic.base + DP_TCR, DP_TCR_LOCAL);
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_START | DP_CR_NODMA);
+    write_port_byte_pause(nic->base + DP_TCR, DP_TCR_LOCAL);
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_START | DP_CR_NODMA);
 
     /* Read in as many packets as we can and acknowledge any and receive */
     /* interrupts.  Since the buffer has overflowed, a receive event of */
     /* some kind will have occured. */
     dp83902a_RxEvent();
-    write_port_byte_pause(nic.base + DP_ISR, DP_ISR_RxP|DP_ISR_RxE);
+    write_port_byte_pause(nic->base + DP_ISR, DP_ISR_RxP|DP_ISR_RxE);
 
     /* Clear the overflow condition and leave loopback mode. */
-    write_port_byte_pause(nic.base + DP_ISR, DP_ISR_OFLW);
-    write_port_byte_pause(nic.base + DP_TCR, DP_TCR_NORMAL);
+    write_port_byte_pause(nic->base + DP_ISR, DP_ISR_OFLW);
+    write_port_byte_pause(nic->base + DP_TCR, DP_TCR_NORMAL);
 
     /* If a transmit command was issued, but no transmit event has occured, */
     /* restart it here. */
-    isr = read_port_byte(nic.base + DP_ISR);
-    if (nic.tx_started && !(isr & (DP_ISR_TxP|DP_ISR_TxE))) {
-        write_port_byte_pause(nic.base + DP_CR, DP_CR_NODMA | DP_CR_TXPKT | DP_CR_START);
+    isr = read_port_byte(nic->base + DP_ISR);
+    if (nic->tx_started && !(isr & (DP_ISR_TxP|DP_ISR_TxE))) {
+        write_port_byte_pause(nic->base + DP_CR, DP_CR_NODMA | DP_CR_TXPKT | DP_CR_START);
     }
 }
 
@@ -457,9 +552,9 @@ static void dp83902a_poll(void)
 {
     uint8_t isr;
 
-    write_port_byte_pause(nic.base + DP_CR, DP_CR_NODMA | DP_CR_PAGE0 | DP_CR_START);
+    write_port_byte_pause(nic->base + DP_CR, DP_CR_NODMA | DP_CR_PAGE0 | DP_CR_START);
     do{
-        isr = read_port_byte(nic.base + DP_ISR);
+        isr = read_port_byte(nic->base + DP_ISR);
         /* The CNT interrupt triggers when the MSB of one of the error */
         /* counters is set.  We don't much care about these counters, but */
         /* we should read their values to reset them. */
@@ -475,12 +570,12 @@ static void dp83902a_poll(void)
             /* Other kinds of interrupts can be acknowledged simply by */
             /* clearing the relevant bits of the ISR.  Do that now, then */
             /* handle the interrupts we care about. */
-            write_port_byte_pause(nic.base + DP_ISR, isr);      /* Clear set bits */
-            if (!nic.running)
+            write_port_byte_pause(nic->base + DP_ISR, isr);      /* Clear set bits */
+            if (!nic->running)
                 break;        /* Is this necessary? */
             /* Check for tx_started on TX event since these may happen */
             /* spuriously it seems. */
-            if (isr & (DP_ISR_TxP|DP_ISR_TxE) && nic.tx_started) {
+            if (isr & (DP_ISR_TxP|DP_ISR_TxE) && nic->tx_started) {
                 dp83902a_TxEvent();
             }
             if (isr & (DP_ISR_RxP|DP_ISR_RxE)) {
@@ -494,22 +589,22 @@ static void pcnet_reset_8390(void)
 {
     int i, r;
 
-    debug_printf("nic base is 0x%x\n", (int)nic.base);
+    debug_printf("nic base is 0x%x\n", (int)nic->base);
 
-    write_port_byte_pause(nic.base + E8390_CMD, E8390_NODMA+E8390_PAGE0+E8390_STOP);
-    write_port_byte_pause(nic.base + E8390_CMD, E8390_NODMA+E8390_PAGE1+E8390_STOP);
-    write_port_byte_pause(nic.base + E8390_CMD, E8390_NODMA+E8390_PAGE0+E8390_STOP);
-    write_port_byte_pause(nic.base + E8390_CMD, E8390_NODMA+E8390_PAGE0+E8390_STOP);
+    write_port_byte_pause(nic->base + E8390_CMD, E8390_NODMA+E8390_PAGE0+E8390_STOP);
+    write_port_byte_pause(nic->base + E8390_CMD, E8390_NODMA+E8390_PAGE1+E8390_STOP);
+    write_port_byte_pause(nic->base + E8390_CMD, E8390_NODMA+E8390_PAGE0+E8390_STOP);
+    write_port_byte_pause(nic->base + E8390_CMD, E8390_NODMA+E8390_PAGE0+E8390_STOP);
 
     // set (read) and clear (write) reset line
-    write_port_byte_pause(nic.base + PCNET_RESET, read_port_byte(nic.base + PCNET_RESET));
+    write_port_byte_pause(nic->base + PCNET_RESET, read_port_byte(nic->base + PCNET_RESET));
 
     for (i = 0; i < 100; i++) {
         delay_ms(5);
-        if ((r = (read_port_byte(nic.base + EN0_ISR) & ENISR_RESET)) != 0)
+        if ((r = (read_port_byte(nic->base + EN0_ISR) & ENISR_RESET)) != 0)
             break;
     }
-    write_port_byte_pause(nic.base + EN0_ISR, 0xff); /* Ack all interrupts */
+    write_port_byte_pause(nic->base + EN0_ISR, 0xff); /* Ack all interrupts */
 }
 
 static const struct {
@@ -543,11 +638,11 @@ static bool get_prom(void)
     delay_ms(10);
 
     for (i = 0; i < sizeof(get_prom_program_seq)/sizeof(get_prom_program_seq[0]); i++)
-        write_port_byte_pause(nic.base + get_prom_program_seq[i].offset, get_prom_program_seq[i].value);
+        write_port_byte_pause(nic->base + get_prom_program_seq[i].offset, get_prom_program_seq[i].value);
 
     debug_printf("PROM:");
     for (i = 0; i < 32; i++) {
-        prom[i] = read_port_byte(nic.data);
+        prom[i] = read_port_byte(nic->data);
         debug_printf(" %02x", prom[i]);
     }
     debug_printf("\n");
@@ -557,10 +652,10 @@ static bool get_prom(void)
      * check that the MAC address is not all 0 or 1 bits
      */
     for (j = 0; j < 6; j++){
-        interface_macaddr[j] = prom[j<<1];
-        if(interface_macaddr[j] != 0xff)
+        nic->esa[j] = prom[j<<1];
+        if(nic->esa[j] != 0xff)
             all_ones = false;
-        if(interface_macaddr[j] != 0x00)
+        if(nic->esa[j] != 0x00)
             all_zero = false;
     }
 
@@ -568,97 +663,446 @@ static bool get_prom(void)
         return false;
 
     /* check for RTL8019 */
-    nic.rtl8019 = (read_port_byte(nic.base + EN0_RCNTLO) == 0x50 &&
-                   read_port_byte(nic.base + EN0_RCNTHI) == 0x70);
+    nic->rtl8019 = (read_port_byte(nic->base + EN0_RCNTLO) == 0x50 &&
+                   read_port_byte(nic->base + EN0_RCNTHI) == 0x70);
 
     return true;
 }
 
+/* interrupt context: copy a frame into the next free slot */
+static void dp83902a_rxq_put(int len)
+{
+    int head = nic->rxq_head, next = (head + 1) & (nic->rxq_slots - 1);
+
+    if(next == nic->rxq_tail){
+        nic->stats.irq_overruns++;
+        return;
+    }
+
+    dp83902a_recv_start(len);
+    dp83902a_recv_data(nic->rxq_packet[head]->buffer, len);
+    nic->rxq_length[head] = len;
+    __asm__ volatile("" ::: "memory"); /* frame is in place before we publish it */
+    nic->rxq_head = next;
+}
+
+/* net_pump() context: hand queued frames to the stack, replacing each packet */
+static void dp83902a_rxq_drain(void)
+{
+    packet_t *packet;
+    int tail = nic->rxq_tail;
+
+    while(tail != nic->rxq_head){
+        packet = nic->rxq_packet[tail];
+        packet->buffer_length = nic->rxq_length[tail];
+        nic->rxq_packet[tail] = packet_alloc(PACKET_MAXLEN);
+        tail = (tail + 1) & (nic->rxq_slots - 1);
+        nic->rxq_tail = tail;
+        packet->ifindex = nic->ifindex;
+        net_eth_push(packet);
+    }
+}
+
+/* one handler for every card on an interrupt; a card with nothing to say
+   costs a read of its ISR */
+static void dp83902a_interrupt(void)
+{
+    dp83902a_priv_data_t *interrupted = nic;
+
+    for(nic = nic_table; nic < nic_table + nic_count; nic++)
+        if(nic->irq >= 0)
+            dp83902a_poll();
+    nic = interrupted;
+}
+
 static void push_packet_ready(int len)
 {
+    int offset, placed, done, end;
+
     debug_printf("pushed len = %d\n", len);
 
+    if(nic->irq >= 0){
+        dp83902a_rxq_put(len);
+        return;
+    }
+
     packet_t *packet = packet_alloc(len);
     if(!packet){
         printf("ne2000: no free rx buffer\n");
         return;
     }
-    dp83902a_recv(packet->buffer, packet->buffer_length);
+
+    packet->ifindex = nic->ifindex;
+    dp83902a_recv_start(len);
+    if(len <= RX_PEEK_LENGTH){
+        dp83902a_recv_data(packet->buffer, len);
+    }else{
+        /* read the headers, then ask if a sink wants the payload delivered elsewhere */
+        done = dp83902a_recv_data(packet->buffer, RX_PEEK_LENGTH);
+        offset = net_eth_peek(packet, RX_PEEK_LENGTH);
+        if(offset){
+            placed = packet->data_length - packet->placed_offset;
+            memcpy(packet->placed_data, packet->buffer + offset, done - offset);
+            done += dp83902a_recv_data_csum(packet->placed_data + (done - offset),
+                    placed - (done - offset), &packet->csum_partial);
+            packet->flags |= packet_flag_csum_partial;
+        }else if(packet->udp && (end = (packet->data + packet->data_length) - packet->buffer) > done){
+            /* sum the rest of the UDP datagram as we read it */
+            done += dp83902a_recv_data_csum(packet->buffer + done, end - done, &packet->csum_partial);
+            packet->flags |= packet_flag_csum_partial;
+        }
+        if(packet->flags & packet_flag_csum_partial)
+            packet->csum_offset = RX_PEEK_LENGTH - ((uint8_t*)packet->udp - packet->buffer);
+        /* anything left over (ethernet padding, FCS, non-UDP payload) is read into the packet buffer */
+        if(done < len)
+            dp83902a_recv_data(packet->buffer + done, len - done);
+    }
     net_eth_push(packet);
 }
 
+#define NE2000_TX_SLOTS_DEFAULT 4       /* enough to keep a TFTP put window streaming */
+#define NE2000_TX_SLOTS_SMALL   2       /* when card memory is tight */
+
+/* split the card memory: Tx buffers first, the rest is the receive ring */
+static bool dp83902a_layout(int slots)
+{
+    int rx_start = nic->tx_buf_start + slots * NE2000_TX_SLOT_PAGES;
+
+    if(slots < 1 || slots > NE2000_TX_SLOTS_MAX || nic->rx_buf_end - rx_start < NE2000_RX_MIN_PAGES)
+        return false;
+
+    nic->tx_slots = slots;
+    nic->rx_buf_start = rx_start;
+    return true;
+}
+
 bool eth_init(void)
 {
-    for(int i=0; portlist[i]; i++){
-        nic.base = portlist[i];
-        nic.data = nic.base + DP_DATAPORT;
+    for(int i=0; portlist[i] && nic_count < NE2000_MAX_NICS; i++){
+        nic = &nic_table[nic_count];
+        nic->base = portlist[i];
+        nic->data = nic->base + DP_DATAPORT;
+        nic->irq = -1;
+        nic->io_pause = true;
+
+        /* an empty slot floats high; don't wait for it to come out of reset */
+        if(read_port_byte(nic->base + E8390_CMD) == 0xff)
+            continue;
 
         if(!get_prom())
             continue;
 
-        nic.tx_buf1 = 0x40; /* 6x256=1.5KB */
-        nic.tx_buf2 = 0x46; /* 6x256=1.5KB */
-        nic.rx_buf_start = 0x4C;
+#ifndef NE2000_IO_PAUSE
+        nic->io_pause = !nic->rtl8019;
+#endif
+
+        nic->tx_buf_start = 0x40;
 #ifndef NE2000_16BIT_PIO
         /* 8 bit IO */
-        if(nic.rtl8019){
+        if(nic->rtl8019){
             /* RTL8019 in 8-bit mode requires that we not exceed page 0x60 */
-            nic.rx_buf_end = 0x60; /* 20x256=5KB */
+            nic->rx_buf_end = 0x60;
+            dp83902a_layout(NE2000_TX_SLOTS_SMALL); /* 20x256=5KB receive */
         }else
 #endif
-            nic.rx_buf_end = 0x80; /* 52x256=13KB */
+        {
+            nic->rx_buf_end = 0x80;
+            dp83902a_layout(NE2000_TX_SLOTS_DEFAULT); /* 40x256=10KB receive */
+        }
+
+        nic->ifindex = nic_count++;
+        memcpy(net_interface[nic->ifindex].macaddr, nic->esa, sizeof(macaddr_t));
+        net_interface_count = nic_count;
 
-        printf("%s at 0x%x, MAC %02x:%02x:%02x:%02x:%02x:%02x\n",
-                nic.rtl8019 ? "RTL8019" : "NE2000",
-                nic.base,
-                interface_macaddr[0], interface_macaddr[1], interface_macaddr[2],
-                interface_macaddr[3], interface_macaddr[4], interface_macaddr[5]);
+        if(nic->ifindex)
+            printf("eth%d: ", nic->ifindex);
+        printf("%s at 0x%x%s, MAC %02x:%02x:%02x:%02x:%02x:%02x\n",
+                nic->rtl8019 ? "RTL8019" : "NE2000",
+                nic->base, nic->io_pause ? " (slow I/O)" : "",
+                nic->esa[0], nic->esa[1], nic->esa[2],
+                nic->esa[3], nic->esa[4], nic->esa[5]);
 
-        dp83902a_start(interface_macaddr);
+        dp83902a_start(nic->esa);
+    }
 
+    if(nic_count){
+        nic = &nic_table[0];
         return true;
     }
 
     printf("No NE2000 card found\n");
-    nic.base = nic.data = 0;
+    nic->base = nic->data = 0;
 
     return false;
 }
 
+/* the smallest of the cards' receive rings, so a window sized to it fits any */
 int eth_rxbuffer_size(void)
 {
-    int r;
-    if(!nic.base)
-        return 0;
-    r = (nic.rx_buf_end - nic.rx_buf_start) << 8; // 256 byte pages
-    return r;
+    int r, smallest = 0;
+
+    for(int i=0; i<nic_count; i++){
+        r = (nic_table[i].rx_buf_end - nic_table[i].rx_buf_start) << 8; // 256 byte pages
+        if(!smallest || r < smallest)
+            smallest = r;
+    }
+    return smallest;
+}
+
+int eth_tx_slots(int ifindex)
+{
+    return nic_select(ifindex) ? nic->tx_slots : 0;
+}
+
+/* let queued frames go first */
+static void dp83902a_tx_drain(void)
+{
+    timer_t timeout = set_timer_ms(100);
+
+    while(nic->tx_count && !timer_expired(timeout)){
+        dp83902a_lock();
+        dp83902a_poll();
+        dp83902a_unlock();
+    }
+}
+
+static void dp83902a_restart(void)
+{
+    dp83902a_lock();
+    dp83902a_start(nic->esa);
+    dp83902a_unlock();
+}
+
+/* re-split the card memory and restart it; frames in the receive ring are lost */
+bool eth_set_tx_slots(int ifindex, int slots)
+{
+    if(!nic_select(ifindex))
+        return false;
+
+    dp83902a_tx_drain();
+
+    if(!dp83902a_layout(slots)){
+        printf("ne2000: cannot fit %d transmit buffers (max %d, leaving %d pages to receive)\n",
+                slots, NE2000_TX_SLOTS_MAX, NE2000_RX_MIN_PAGES);
+        return false;
+    }
+
+    dp83902a_restart();
+    return true;
+}
+
+/* RTL8019 only: store the setting in ne2000_media and restart the card with it */
+bool eth_set_media(int ifindex, const char *media)
+{
+    if(!nic_select(ifindex) || !nic->rtl8019){
+        printf("ne2000: media can only be set on an RTL8019\n");
+        return false;
+    }
+
+    if(rtl8019_find_media(media) < 0){
+        printf("ne2000: unknown media \"%s\" (try", media);
+        for(int i=0; i<RTL8019_MEDIA_COUNT; i++)
+            printf(" %s", rtl8019_media[i].name);
+        printf(")\n");
+        return false;
+    }
+
+    set_environment_variable(rtl8019_media_variable(), media);
+    dp83902a_tx_drain();
+    dp83902a_restart();
+    return true;
+}
+
+/* what the card reports it is using, NULL if it cannot say */
+const char *eth_media(int ifindex)
+{
+    static const char *media_name[] = { "auto media", "10BaseT", "10Base5", "10Base2" };
+    static char description[40];
+
+    if(!nic_select(ifindex) || !nic->rtl8019)
+        return NULL;
+
+    strcpy(description, media_name[(nic->rtl_config2 & RTL_CONFIG2_PL_MASK) >> 6]);
+    strcat(description, (nic->rtl_config3 & RTL_CONFIG3_FUDUP) ? ", full duplex" : ", half duplex");
+    strcat(description, (nic->rtl_config3 & RTL_CONFIG3_LEDS0) ? ", LED0 link" : ", LED0 collision");
+    return description;
+}
+
+int eth_irq(int ifindex)
+{
+    return nic_select(ifindex) ? nic->irq : -1;
+}
+
+/* the totals over every card; the high water mark is the worst of them */
+const eth_stats_t *eth_get_stats(void)
+{
+    eth_stats_t *s;
+
+    memset(&stats_total, 0, sizeof(stats_total));
+    for(nic = nic_table; nic < nic_table + nic_count; nic++){
+        dp83902a_lock();
+        write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
+        dp83902a_ClearCounters();
+        dp83902a_unlock();
+        s = &nic->stats;
+        stats_total.frame_errors += s->frame_errors;
+        stats_total.crc_errors += s->crc_errors;
+        stats_total.missed_frames += s->missed_frames;
+        stats_total.overflows += s->overflows;
+        stats_total.rx_too_big += s->rx_too_big;
+        stats_total.tx_busy += s->tx_busy;
+        stats_total.irq_overruns += s->irq_overruns;
+        if(s->rx_high_water > stats_total.rx_high_water)
+            stats_total.rx_high_water = s->rx_high_water;
+    }
+    nic = &nic_table[0];
+    return &stats_total;
+}
+
+void eth_reset_stats(void)
+{
+    eth_get_stats(); /* discard what the cards have counted so far */
+    dp83902a_lock();
+    for(int i=0; i<nic_count; i++)
+        memset(&nic_table[i].stats, 0, sizeof(eth_stats_t));
+    dp83902a_unlock();
+}
+
+static bool nic_irq_in_use(int irq)
+{
+    for(int i=0; i<nic_count; i++)
+        if(nic_table[i].irq == irq)
+            return true;
+    return false;
+}
+
+/* receive on a bus interrupt, or go back to polling if irq < 0 */
+bool eth_set_irq(int ifindex, int irq)
+{
+    int old_irq;
+
+    if(!nic_select(ifindex))
+        return false;
+
+    if(nic->irq >= 0){
+        old_irq = nic->irq;
+        dp83902a_lock();
+        nic->irq = -1;
+        nic_irq_count--;
+        cpu_interrupts_on();
+        /* cards may share a line, and there is one handler for them all */
+        if(!nic_irq_in_use(old_irq))
+            target_irq_detach(old_irq);
+        dp83902a_rxq_drain();
+        for(int i=0; i<nic->rxq_slots; i++)
+            packet_free(nic->rxq_packet[i]);
+        nic->rxq_slots = 0;
+    }
+
+    if(irq < 0)
+        return true;
+
+    nic->rxq_slots = NE2000_RXQ_SLOTS_MAX;
+    while(nic->rxq_slots > RXQ_SLOTS_MIN && nic->rxq_slots * PACKET_MAXLEN > heap_size / RXQ_HEAP_FRACTION)
+        nic->rxq_slots >>= 1;
+    for(int i=0; i<nic->rxq_slots; i++)
+        nic->rxq_packet[i] = packet_alloc(PACKET_MAXLEN);
+    nic->rxq_head = nic->rxq_tail = 0;
+
+    /* the handler runs as soon as we attach, so be in IRQ mode first */
+    nic->irq = irq;
+    nic_irq_count++;
+    if(!target_irq_attach(irq, dp83902a_interrupt)){
+        nic->irq = -1;
+        nic_irq_count--;
+        for(int i=0; i<nic->rxq_slots; i++)
+            packet_free(nic->rxq_packet[i]);
+        nic->rxq_slots = 0;
+        return false;
+    }
+
+    return true;
+}
+
+/* the 8390 hashes each destination address with the ethernet CRC, and uses
+   the top 6 bits to index its 64-bit multicast address filter */
+static uint32_t ether_crc(const uint8_t *data, int length)
+{
+    uint32_t crc = 0xffffffff;
+    uint8_t octet;
+
+    while(length--){
+        octet = *data++;
+        for(int bit=0; bit<8; bit++, octet >>= 1)
+            crc = (crc << 1) ^ ((((crc >> 31) ^ octet) & 1) ? 0x04c11db7 : 0);
+    }
+
+    return crc;
+}
+
+/* every card gets the same filter: a group may be reached through any of them */
+void eth_set_multicast(const macaddr_t *list, int count)
+{
+    int i, bits;
+    uint8_t mar[8];
+
+    memset(mar, 0, sizeof(mar));
+    for(i=0; i<count; i++){
+        bits = ether_crc(list[i], sizeof(macaddr_t)) >> 26;
+        mar[bits >> 3] |= 1 << (bits & 7);
+    }
+
+    for(nic = nic_table; nic < nic_table + nic_count; nic++){
+        memcpy(nic->mar, mar, sizeof(mar));
+
+        if(!nic->running)
+            continue; /* dp83902a_start() will program the filter */
+
+        /* the MAR registers can be changed while the receiver runs */
+        dp83902a_lock();
+        write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE1 | DP_CR_NODMA | DP_CR_START);
+        for(i=0; i<8; i++)
+            write_port_byte_pause(nic->base + DP_P1_MAR0+i, nic->mar[i]);
+        write_port_byte_pause(nic->base + DP_CR, DP_CR_PAGE0 | DP_CR_NODMA | DP_CR_START);
+        write_port_byte_pause(nic->base + DP_RCR, dp83902a_rcr());
+        dp83902a_unlock();
+    }
+    nic = &nic_table[0];
 }
 
 void eth_halt(void)
 {
-    if(nic.base)
+    for(int i=0; i<nic_count; i++){
+        eth_set_irq(i, -1);
         dp83902a_stop();
+    }
 }
 
 static bool eth_tx(uint8_t *packet, int length)
 {
-    if(!nic.base){
+    if(!nic->base){
         return false;
     }
     if (length >= PACKET_MAXLEN) {
         printf("ne2000: tx too big\n");
         return false;
     }
-    if(nic.tx1 && nic.tx2){
+    if(nic->tx_count >= nic->tx_slots){
+        nic->stats.tx_busy++;
         return false;
     }else{
+        dp83902a_lock();
         dp83902a_send(packet, length);
+        dp83902a_unlock();
         return true;
     }
 }
 
+/* sends on the card behind packet->ifindex */
 bool eth_attempt_tx(packet_t *packet)
 {
+    if(!nic_select(packet->ifindex))
+        return false;
     return eth_tx(packet->buffer, packet->buffer_length);
 }
 
@@ -666,17 +1110,23 @@ void eth_pump(void)
 {
     packet_t *packet;
 
-    if(!nic.base)
-        return;
+    for(int i=0; i<nic_count; i++){
+        nic = &nic_table[i];
 
-    dp83902a_poll();
+        dp83902a_lock();
+        dp83902a_poll();
+        dp83902a_unlock();
 
-    while(!(nic.tx1 && nic.tx2)){
-        packet = net_eth_pull();
-        if(!packet)
-            break;
-        if(!eth_attempt_tx(packet))
-            printf("ne2000: eth_tx failed\n");
-        packet_free(packet);
+        if(nic->irq >= 0)
+            dp83902a_rxq_drain();
+
+        while(nic->tx_count < nic->tx_slots){
+            packet = net_eth_pull(i);
+            if(!packet)
+                break;
+            if(!eth_tx(packet->buffer, packet->buffer_length))
+                printf("ne2000: eth_tx failed\n");
+            packet_free(packet);
+        }
     }
 }
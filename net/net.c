@@ -7,16 +7,21 @@
 #include <net.h>
 
 macaddr_t const broadcast_macaddr = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
-macaddr_t interface_macaddr; // MAC address of our interface
+net_interface_t net_interface[NET_MAX_INTERFACES]; // MAC and IPv4 address of each interface
+int net_interface_count = 0;
 
-uint32_t interface_ipv4_address = 0; // IPv4 address of our interface
-uint32_t interface_subnet_mask = 0;
-uint32_t interface_ipv4_gateway = 0;
+uint32_t interface_ipv4_gateway = 0; // default route, through eth0
 uint32_t interface_dns_server = 0;
 
-static packet_sink_t *net_packet_sink_head = NULL;
-static packet_queue_t *net_txqueue = NULL;
+// sinks matching an exact ipv4 protocol and local port are kept in a small hash
+// table keyed on those; the rest are on the wildcard list, tested after the table
+#define NET_SINK_HASH_SIZE 16
+static packet_sink_t *net_sink_hash[NET_SINK_HASH_SIZE];
+static packet_sink_t *net_packet_sink_head = NULL; // wildcard list
+static int net_payload_sink_count = 0; // sinks with a cb_payload_destination
+static packet_queue_t *net_txqueue[NET_MAX_INTERFACES]; // resolved, waiting for room on the card
 static packet_t *net_arp_lookup_list_head = NULL;
+uint32_t net_template_epoch = 1; // sink templates built before a change are stale
 
 uint32_t packet_alive_count = 0;
 uint32_t packet_discard_count = 0;
@@ -24,12 +29,27 @@ uint32_t packet_bad_cksum_count = 0;
 uint32_t packet_rx_count = 0;
 uint32_t packet_tx_count = 0;
 
+void net_reset_stats(void)
+{
+    packet_discard_count = packet_bad_cksum_count = 0;
+    packet_rx_count = packet_tx_count = 0;
+    packet_pool_low_water = packet_pool_free;
+    packet_pool_exhausted = 0;
+    ipfrag_reassembled_count = ipfrag_dropped_count = 0;
+    arp_resolved_count = arp_failed_count = 0;
+    arp_wait_ticks = arp_wait_max_ticks = 0;
+    eth_reset_stats();
+}
+
 void net_init(void)
 {
-    net_txqueue = packet_queue_alloc();
+    packet_pool_init();
+    for(int i=0; i<NET_MAX_INTERFACES; i++)
+        net_txqueue[i] = packet_queue_alloc();
     net_arp_lookup_list_head = NULL;
     net_arp_init();
     net_icmp_init();
+    net_igmp_init();
 }
 
 static void net_arp_resolver_pump(void)
@@ -53,7 +73,8 @@ static void net_arp_resolver_pump(void)
 
             if(r == arp_okay){
                 // move it onto the transmit queue
-                packet_queue_addtail(net_txqueue, packet);
+                netcap_capture(packet);
+                packet_queue_addtail(net_txqueue[packet->ifindex], packet);
             }else{ // r == arp_fail
                 // we couldn't resolve it
                 packet_free(packet);
@@ -66,32 +87,64 @@ static void net_arp_resolver_pump(void)
     }
 }
 
+static bool net_tx_flushing = false;
+
+// get queued packets onto the wire without running any sink callbacks, so it
+// is safe from inside one (the netconsole calls this from printf)
+void net_tx_flush(void)
+{
+    if(net_tx_flushing)
+        return;
+    net_tx_flushing = true;
+    net_arp_resolver_pump();
+    eth_pump();
+    net_tx_flushing = false;
+}
+
 void net_pump(void)
 {
     packet_t *packet;
 
-    // progress any queued ARP lookups
-    net_arp_resolver_pump();
+    // send any console output
+    netcon_pump();
+
+    // give up on stale fragments
+    net_ipv4_reassembly_pump();
 
-    // pump the hardware driver
-    eth_pump(); // calls net_eth_push, net_eth_pull
+    // progress any queued ARP lookups, pump the hardware driver
+    net_tx_flush(); // eth_pump() calls net_eth_push, net_eth_pull
 
     // pump each sink with data waiting or an expired timer
-    packet_sink_t *sink = net_packet_sink_head;
-    while(sink){
-        if(sink->cb_packet_received){
-            while((packet = packet_queue_pophead(&sink->queue)))
-                sink->cb_packet_received(sink, packet);
-        }
-        if(sink->cb_timer_expired && sink->timer && timer_expired(sink->timer)){
-            sink->timer = 0; // disable timer
-            sink->cb_timer_expired(sink);
+    for(int i=-1; i<NET_SINK_HASH_SIZE; i++){
+        packet_sink_t *sink = (i < 0) ? net_packet_sink_head : net_sink_hash[i];
+        while(sink){
+            if(sink->cb_packet_received){
+                while((packet = packet_queue_pophead(&sink->queue)))
+                    sink->cb_packet_received(sink, packet);
+            }
+            if(sink->cb_timer_expired && sink->timer && timer_expired(sink->timer)){
+                sink->timer = 0; // disable timer
+                sink->cb_timer_expired(sink);
+            }
+            // walk linked list
+            sink = sink->next;
         }
-        // walk linked list
-        sink = sink->next;
     }
 }
 
+static inline int net_sink_hash_index(uint8_t protocol, uint16_t local_port)
+{
+    return (local_port ^ (local_port >> 8) ^ protocol) & (NET_SINK_HASH_SIZE-1);
+}
+
+// which list does this sink belong on?
+static packet_sink_t **net_sink_list(packet_sink_t *sink)
+{
+    if(sink->match_ipv4_protocol && sink->match_local_port)
+        return &net_sink_hash[net_sink_hash_index(sink->match_ipv4_protocol, sink->match_local_port)];
+    return &net_packet_sink_head;
+}
+
 static int score_sink(packet_sink_t *sink)
 {
     int matches = 0;
@@ -113,6 +166,7 @@ static int score_sink(packet_sink_t *sink)
 void net_add_packet_sink(packet_sink_t *sink)
 {
     int score;
+    packet_sink_t **list;
     packet_sink_t **ptr;
     packet_sink_t *entry;
 
@@ -121,9 +175,16 @@ void net_add_packet_sink(packet_sink_t *sink)
         return;
     }
 
+    sink->template_epoch = 0; // its match fields may have changed
+
+    if(sink->cb_payload_destination)
+        net_payload_sink_count++;
+
+    list = net_sink_list(sink);
+
     // first sink?
-    if(net_packet_sink_head == NULL){
-        net_packet_sink_head = sink;
+    if(*list == NULL){
+        *list = sink;
         return;
     }
 
@@ -132,8 +193,8 @@ void net_add_packet_sink(packet_sink_t *sink)
 
     // place it in the list in sorted order: we want to test
     // the most specific sinks first
-    ptr = &net_packet_sink_head;
-    entry = net_packet_sink_head;
+    ptr = list;
+    entry = *list;
     while(entry){
         if(score_sink(entry) <= score){
             // insert
@@ -156,14 +217,16 @@ void net_remove_packet_sink(packet_sink_t *sink)
     packet_sink_t **ptr;
     packet_sink_t *entry;
 
-    ptr = &net_packet_sink_head;
-    entry = net_packet_sink_head;
+    ptr = net_sink_list(sink);
+    entry = *ptr;
 
     while(entry){
         if(entry == sink){
             // we got it!
             *ptr = entry->next;
             entry->next = NULL;
+            if(sink->cb_payload_destination)
+                net_payload_sink_count--;
             return;
         }else{
             // walk list
@@ -177,29 +240,144 @@ void net_remove_packet_sink(packet_sink_t *sink)
 
 void net_dump_packet_sinks(void) // used by "netinfo" command
 {
-    packet_sink_t *sink = net_packet_sink_head;
+    for(int i=-1; i<NET_SINK_HASH_SIZE; i++){
+        packet_sink_t *sink = (i < 0) ? net_packet_sink_head : net_sink_hash[i];
+        while(sink){
+            printf("packet_sink @ 0x%lx:\n  ipv4_protocol=0x%x, local_ip=0x%lx, if_ip=%s, remote_ip=0x%lx, local_port=%d, remote_port=%d\n  ethertype=0x%x, queue_len=%d, packets_queued=%ld, timer=%ld, callbacks:%s%s%s\n",
+                    (long)sink,
+                    sink->match_ipv4_protocol,
+                    sink->match_local_ip,
+                    sink->match_interface_local_ip ? "true":"false",
+                    sink->match_remote_ip,
+                    sink->match_local_port,
+                    sink->match_remote_port,
+                    sink->match_ethertype,
+                    packet_queue_length(&sink->queue),
+                    sink->packets_queued,
+                    sink->timer ? sink->timer - gogoboot_read_timer() : -1,
+                    sink->cb_timer_expired ? " timer":"",
+                    sink->cb_packet_received ? " packet":"",
+                    sink->cb_payload_destination ? " payload":""
+                    );
+            sink = sink->next;
+        }
+    }
+}
+
+// --- receive pipe ---
+
+typedef struct {
+    uint16_t ethertype;
+    uint8_t  protocol;
+    uint32_t destination_ip;
+    uint32_t source_ip;
+    uint16_t destination_port;
+    uint16_t source_port;
+    uint8_t ifindex;
+    bool ipv4, ports;
+} sink_key_t;
+
+static inline bool net_sink_matches(packet_sink_t *sink, const sink_key_t *k)
+{
+    return (sink->match_ethertype == 0      || (sink->match_ethertype == k->ethertype)) &&
+           (sink->match_ipv4_protocol == 0  || (k->ipv4 && sink->match_ipv4_protocol == k->protocol)) &&
+           (sink->match_local_ip == 0       || (k->ipv4 && sink->match_local_ip == k->destination_ip)) &&
+           (!sink->match_interface_local_ip || (k->ipv4 && net_interface[k->ifindex].ipv4_address &&
+                                                net_interface[k->ifindex].ipv4_address == k->destination_ip)) &&
+           (sink->match_remote_ip == 0      || (k->ipv4 && sink->match_remote_ip == k->source_ip)) &&
+           (sink->match_local_port == 0     || (k->ports && sink->match_local_port == k->destination_port)) &&
+           (sink->match_remote_port == 0    || (k->ports && sink->match_remote_port == k->source_port));
+}
+
+static packet_sink_t *net_match_sink(packet_t *packet)
+{
+    sink_key_t k;
+    packet_sink_t *sink;
+
+    // convert key fields to cpu byte order (avoids doing this for every sink)
+    k.ethertype        = ntohs(packet->eth->ethertype);
+    k.ifindex          = packet->ifindex;
+    k.ipv4             = (packet->ipv4 != NULL);
+    k.ports            = (packet->tcp || packet->udp);
+    k.protocol         = k.ipv4 ? packet->ipv4->protocol : 0;
+    k.destination_ip   = k.ipv4 ? ntohl(packet->ipv4->destination_ip) : 0;
+    k.source_ip        = k.ipv4 ? ntohl(packet->ipv4->source_ip) : 0;
+    k.destination_port = packet->tcp ? ntohs(packet->tcp->destination_port) : (packet->udp ? ntohs(packet->udp->destination_port) : 0);
+    k.source_port      = packet->tcp ? ntohs(packet->tcp->source_port)      : (packet->udp ? ntohs(packet->udp->source_port)      : 0);
+
+    // exact match on protocol and local port first
+    if(k.ports){
+        sink = net_sink_hash[net_sink_hash_index(k.protocol, k.destination_port)];
+        while(sink){
+            if(net_sink_matches(sink, &k))
+                return sink;
+            sink = sink->next;
+        }
+    }
+
+    // then the wildcard sinks
+    sink = net_packet_sink_head;
     while(sink){
-        printf("packet_sink @ 0x%lx:\n  ipv4_protocol=0x%x, local_ip=0x%lx, if_ip=%s, remote_ip=0x%lx, local_port=%d, remote_port=%d\n  ethertype=0x%x, queue_len=%d, packets_queued=%ld, timer=%ld, callbacks:%s%s\n",
-                (long)sink,
-                sink->match_ipv4_protocol,
-                sink->match_local_ip,
-                sink->match_interface_local_ip ? "true":"false",
-                sink->match_remote_ip,
-                sink->match_local_port,
-                sink->match_remote_port,
-                sink->match_ethertype,
-                packet_queue_length(&sink->queue),
-                sink->packets_queued,
-                sink->timer ? sink->timer - gogoboot_read_timer() : -1,
-                sink->cb_timer_expired ? " timer":"",
-                sink->cb_packet_received ? " packet":""
-                );
+        if(net_sink_matches(sink, &k))
+            return sink;
         sink = sink->next;
     }
 
+    return NULL;
 }
 
-// --- receive pipe ---
+// called by ne2000.c via eth_pump() when only the first peek_length bytes of a
+// packet have been read. for a UDP datagram, packet->udp, data and data_length
+// are set so the driver can checksum the payload as it reads it. if a sink wants
+// the UDP payload received directly into its own buffer we also set
+// packet->placed_data and return the offset in the frame at which the placed
+// data starts; the driver then reads the rest of the datagram there. returns 0
+// to read the packet normally. net_eth_push() follows either way.
+int net_eth_peek(packet_t *packet, int peek_length)
+{
+    packet_sink_t *sink;
+    uint8_t *dest;
+    int offset, frame_offset;
+
+    if(peek_length < sizeof(ethernet_header_t) + sizeof(ipv4_header_t) + sizeof(udp_header_t) + NET_PEEK_DATA ||
+       ntohs(packet->eth->ethertype) != ethertype_ipv4 ||
+       (memcmp(packet->eth->destination_mac, net_interface[packet->ifindex].macaddr, sizeof(macaddr_t)) != 0 &&
+        !(packet->eth->destination_mac[0] & 1)))
+        return 0;
+
+    packet->ipv4 = (ipv4_header_t*)packet->eth->payload;
+    packet->udp = (udp_header_t*)packet->ipv4->payload;
+    packet->data = packet->udp->payload;
+    packet->data_length = ntohs(packet->udp->length) - sizeof(udp_header_t);
+    if(packet->ipv4->version_length != 0x45 || // no options
+       (ntohs(packet->ipv4->flags_and_frags) & 0x3fff) || // no fragments
+       packet->ipv4->protocol != ip_proto_udp ||
+       packet->data + packet->data_length > packet->buffer + packet->buffer_length){
+        packet->ipv4 = NULL;
+        packet->udp = NULL;
+        packet->data = NULL;
+        packet->data_length = 0;
+        return 0;
+    }
+
+    if(!net_payload_sink_count || packet->data_length <= NET_PEEK_DATA)
+        return 0;
+
+    sink = net_match_sink(packet);
+    if(!sink || !sink->cb_payload_destination)
+        return 0;
+
+    offset = 0;
+    dest = sink->cb_payload_destination(sink, packet, &offset);
+    frame_offset = (packet->data + offset) - packet->buffer;
+    if(!dest || offset >= packet->data_length || frame_offset > peek_length ||
+       ((frame_offset | (uintptr_t)dest) & 1))
+        return 0;
+
+    packet->placed_data = dest;
+    packet->placed_offset = offset;
+    return frame_offset;
+}
 
 // called by ne2000.c via eth_pump()
 // this function should check and queue a packet for later delivery
@@ -209,9 +387,10 @@ void net_eth_push(packet_t *packet)
     int header_size;
 
     packet_rx_count++;
+    netcap_capture(packet);
 
     // check that the destination MAC is either our MAC, or a multicast MAC
-    if(memcmp(packet->eth->destination_mac, interface_macaddr, sizeof(macaddr_t)) == 0 ||
+    if(memcmp(packet->eth->destination_mac, net_interface[packet->ifindex].macaddr, sizeof(macaddr_t)) == 0 ||
        packet->eth->destination_mac[0] & 1){ // test multicast bit
         // determine protocol and verify checksums
         switch(ntohs(packet->eth->ethertype)){
@@ -219,12 +398,20 @@ void net_eth_push(packet_t *packet)
                 packet->ipv4 = (ipv4_header_t*)packet->eth->payload;
                 if(!net_verify_ipv4_checksum(packet))
                     goto bad_cksum;
+                if(ntohs(packet->ipv4->flags_and_frags) & 0x3fff){ // MF, or an offset
+                    packet = net_ipv4_reassemble(packet);
+                    if(!packet)
+                        return; // held until the rest arrives
+                }
                 switch(packet->ipv4->protocol){
                     case ip_proto_tcp:
-                        header_size = ((packet->tcp->data_offset & 0x0F) << 2);
                         packet->tcp = (tcp_header_t*)packet->ipv4->payload;
+                        header_size = ((packet->tcp->data_offset >> 4) << 2);
+                        if(header_size < (int)sizeof(tcp_header_t) ||
+                           header_size > ntohs(packet->ipv4->length) - (int)sizeof(ipv4_header_t))
+                            goto discard; // the data would start outside the segment
                         packet->data = packet->ipv4->payload + header_size;
-                        packet->data_length = ntohs(packet->ipv4->length) - header_size;
+                        packet->data_length = ntohs(packet->ipv4->length) - sizeof(ipv4_header_t) - header_size;
                         if(!net_verify_tcp_checksum(packet))
                             goto bad_cksum;
                         break;
@@ -246,6 +433,7 @@ void net_eth_push(packet_t *packet)
                         // unhandled ipv4 protocol
                         break;
                 }
+                net_arp_learn(packet);
                 break;
             case ethertype_arp:
                 packet->arp = (arp_header_t*)packet->eth->payload;
@@ -256,32 +444,17 @@ void net_eth_push(packet_t *packet)
         }
 
         // figure out the best matching queue to put it into
-        // convert key fields to cpu byte order (avoids doing this for every sink)
-        uint16_t ethertype        = ntohs(packet->eth->ethertype);
-        uint16_t protocol         = ntohs(packet->ipv4->protocol);
-        uint32_t destination_ip   = ntohl(packet->ipv4->destination_ip);
-        uint32_t source_ip        = ntohl(packet->ipv4->source_ip);
-        uint16_t destination_port = packet->tcp ? ntohs(packet->tcp->destination_port) : (packet->udp ? ntohs(packet->udp->destination_port) : 0);
-        uint16_t source_port      = packet->tcp ? ntohs(packet->tcp->source_port)      : (packet->udp ? ntohs(packet->udp->source_port)      : 0);
-        packet_sink_t *sink = net_packet_sink_head;
-        while(sink){
-            if( (sink->match_ethertype == 0      || (sink->match_ethertype == ethertype)) &&
-                (sink->match_ipv4_protocol == 0  || (packet->ipv4 && sink->match_ipv4_protocol == protocol)) &&
-                (sink->match_local_ip == 0       || (packet->ipv4 && sink->match_local_ip == destination_ip)) &&
-                (!sink->match_interface_local_ip || (packet->ipv4 && interface_ipv4_address && interface_ipv4_address == destination_ip)) &&
-                (sink->match_remote_ip == 0      || (packet->ipv4 && sink->match_remote_ip == source_ip)) &&
-                (sink->match_local_port == 0     || ((packet->tcp || packet->udp) && sink->match_local_port == destination_port)) &&
-                (sink->match_remote_port == 0    || ((packet->tcp || packet->udp) && sink->match_remote_port == source_port)) ){
-                // enqueue the packet for later processing
-                packet_queue_addtail(&sink->queue, packet);
-                sink->packets_queued++;
-                return;
-            }
-            sink = sink->next;
+        packet_sink_t *sink = net_match_sink(packet);
+        if(sink){
+            // enqueue the packet for later processing
+            packet_queue_addtail(&sink->queue, packet);
+            sink->packets_queued++;
+            return;
         }
     }
 
     // if we didn't find a queue, discard it.
+discard:
     packet_discard_count++;
     packet_free(packet);
     return;
@@ -294,31 +467,157 @@ bad_cksum:
 
 // --- transmit pipe ---
 
-static void net_ipv4_route(packet_t *packet)
+// on-link destinations go out of an interface on their subnet; when several
+// share it, the local port picks one, so concurrent sessions spread across the
+// cards while each keeps to its own. everything else goes to eth0's gateway.
+int net_ipv4_route(uint32_t destination_ip, uint16_t local_port, uint32_t *nexthop)
+{
+    int candidate[NET_MAX_INTERFACES], count = 0;
+    net_interface_t *iface;
+
+    for(int i=0; i<net_interface_count; i++){
+        iface = &net_interface[i];
+        if(iface->ipv4_address && (destination_ip & iface->subnet_mask) == (iface->ipv4_address & iface->subnet_mask))
+            candidate[count++] = i;
+    }
+
+    if(count){
+        *nexthop = destination_ip;
+        return candidate[local_port % count];
+    }
+
+    // until DHCP configures eth0 everything is sent straight there
+    *nexthop = interface_ipv4_address ? interface_ipv4_gateway : destination_ip;
+    return 0;
+}
+
+void net_templates_invalidate(void)
 {
-    if(!packet->ipv4)
+    if(++net_template_epoch == 0)
+        net_template_epoch = 1;
+}
+
+// a UDP sink talking to one unicast peer sends every packet with the same
+// headers but for the lengths, the id and the checksums: once net_tx_route()
+// would give the same answer and the next hop's MAC is in the ARP cache, keep
+// a copy of them for packet_create_for_sink(), with the sums of what is fixed.
+// no ARP query is started here: the first packets go the long way, and ask.
+bool net_sink_template(packet_sink_t *sink)
+{
+    ethernet_header_t *eth = (ethernet_header_t*)sink->template_header;
+    ipv4_header_t *ipv4 = (ipv4_header_t*)eth->payload;
+    udp_header_t *udp = (udp_header_t*)ipv4->payload;
+    net_interface_t *iface;
+    const macaddr_t *mac;
+    uint32_t nexthop;
+    int ifindex;
+
+    if(sink->template_epoch == net_template_epoch)
+        return true;
+
+    if(sink->match_ipv4_protocol != ip_proto_udp || !sink->match_remote_port || !sink->match_local_port ||
+       !sink->match_remote_ip || sink->match_remote_ip == ipv4_broadcast || (sink->match_remote_ip >> 28) == 0xe)
+        return false;
+
+    ifindex = net_ipv4_route(sink->match_remote_ip, sink->match_local_port, &nexthop);
+    iface = &net_interface[ifindex];
+    if(!iface->ipv4_address || sink->match_remote_ip == (iface->ipv4_address | ~iface->subnet_mask))
+        return false; // not configured yet, or a directed broadcast
+    mac = net_arp_cached(nexthop);
+    if(!mac)
+        return false;
+
+    memcpy(eth->destination_mac, mac, sizeof(macaddr_t));
+    memcpy(eth->source_mac, iface->macaddr, sizeof(macaddr_t));
+    eth->ethertype = htons(ethertype_ipv4);
+
+    ipv4->version_length = 0x45;
+    ipv4->diffserv_ecn = 0;
+    ipv4->length = 0;                  // per packet
+    ipv4->id = 0;                      // per packet
+    ipv4->flags_and_frags = htons(0x4000); // don't fragment
+    ipv4->ttl = DEFAULT_TTL;
+    ipv4->protocol = ip_proto_udp;
+    ipv4->checksum = 0;
+    ipv4->source_ip = htonl(iface->ipv4_address);
+    ipv4->destination_ip = htonl(sink->match_remote_ip);
+
+    udp->source_port = htons(sink->match_local_port);
+    udp->destination_port = htons(sink->match_remote_port);
+    udp->length = 0;                   // per packet
+    udp->checksum = 0;
+
+    net_template_sums(sink);
+    sink->template_ifindex = ifindex;
+    if(!sink->template_id)
+        sink->template_id = gogoboot_read_timer();
+    sink->template_epoch = net_template_epoch;
+
+    return true;
+}
+
+// pick the interface; a source address left as eth0's (the packet_create_*()
+// default) becomes that of the interface the packet leaves by
+static void net_tx_route(packet_t *packet)
+{
+    uint16_t local_port;
+    uint32_t source_ip;
+
+    if(!packet->ipv4){
+        // ARP: the creator chose the interface
+        memcpy(packet->eth->source_mac, net_interface[packet->ifindex].macaddr, sizeof(macaddr_t));
         return;
+    }
 
-    if((htonl(packet->ipv4->destination_ip) & interface_subnet_mask) == 
-            (interface_ipv4_address & interface_subnet_mask)){
-        packet->ipv4_nexthop = htonl(packet->ipv4->destination_ip);
-    }else{
-        packet->ipv4_nexthop = interface_ipv4_gateway;
+    local_port = packet->udp ? ntohs(packet->udp->source_port) : (packet->tcp ? ntohs(packet->tcp->source_port) : 0);
+    source_ip = ntohl(packet->ipv4->source_ip);
+    packet->ifindex = 0;
+
+    // a reply from one of the other interfaces' addresses leaves by that interface
+    for(int i=1; i<net_interface_count; i++)
+        if(source_ip && source_ip == net_interface[i].ipv4_address &&
+           (ntohl(packet->ipv4->destination_ip) & net_interface[i].subnet_mask) == (source_ip & net_interface[i].subnet_mask)){
+            packet->ifindex = i;
+            packet->ipv4_nexthop = ntohl(packet->ipv4->destination_ip);
+            break;
+        }
+
+    if(!packet->ifindex){
+        packet->ifindex = net_ipv4_route(ntohl(packet->ipv4->destination_ip), local_port, &packet->ipv4_nexthop);
+        if(packet->ifindex && source_ip == interface_ipv4_address)
+            packet->ipv4->source_ip = htonl(net_interface[packet->ifindex].ipv4_address);
     }
+
+    memcpy(packet->eth->source_mac, net_interface[packet->ifindex].macaddr, sizeof(macaddr_t));
 }
 
 void net_tx(packet_t *packet)
 {
+    if(packet->flags & packet_flag_templated){
+        // routed and resolved when the template was made
+        net_compute_templated_checksums(packet);
+        packet_tx_count++;
+        netcap_capture(packet);
+        if(eth_attempt_tx(packet))
+            packet_free(packet);
+        else
+            packet_queue_addtail(net_txqueue[packet->ifindex], packet);
+        return;
+    }
+
+    // choose the interface first: it can change the source address, which the checksums cover
+    net_tx_route(packet);
+
     // don't transmit from 0.0.0.0 unless it's DHCP
     if(packet->ipv4 && packet->ipv4->source_ip == htonl(0) &&
-            !(packet->udp && packet->udp->source_port == 68 && packet->udp->destination_port == 67)){
+            !(packet->udp && packet->udp->source_port == htons(68) && packet->udp->destination_port == htons(67))){
         packet_free(packet);
         printf("net_tx: no ipv4 address!\n");
         return;
     }
 
     // compute checksums
-    if(packet->eth->ethertype == ethertype_ipv4){
+    if(packet->eth->ethertype == htons(ethertype_ipv4)){
         net_compute_ipv4_checksum(packet);
         switch(packet->ipv4->protocol){
             case ip_proto_tcp:
@@ -330,20 +629,22 @@ void net_tx(packet_t *packet)
             case ip_proto_icmp:
                 net_compute_icmp_checksum(packet);
                 break;
+            case ip_proto_igmp:
+                net_compute_igmp_checksum(packet);
+                break;
         }
     }
 
-    net_ipv4_route(packet);
-
     packet_tx_count++;
 
     if(packet->flags & packet_flag_destination_mac_valid || net_arp_resolve(packet) == arp_okay){
         // we want to start the transmission immediately if we have buffer space on the card,
         // otherwise we have to queue the packet for transmission later
+        netcap_capture(packet);
         if(eth_attempt_tx(packet))
             packet_free(packet);
         else
-            packet_queue_addtail(net_txqueue, packet);
+            packet_queue_addtail(net_txqueue[packet->ifindex], packet);
     }else{
         // add to the list of packets awaiting ARP resolution
         packet->next = net_arp_lookup_list_head;
@@ -354,8 +655,8 @@ void net_tx(packet_t *packet)
 // called by ne2000.c via eth_pump()
 // this function should dequeue a packet for delivery
 // to prevent potential re-entrancy, do NOT make any callbacks to sinks in here
-packet_t *net_eth_pull(void)
+packet_t *net_eth_pull(int ifindex)
 {
-    packet_t *p = packet_queue_pophead(net_txqueue);
+    packet_t *p = packet_queue_pophead(net_txqueue[ifindex]);
     return p;
 }
@@ -0,0 +1,206 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <net.h>
+
+// packet capture: each frame received (as net_eth_push() gets it) and sent (as
+// it is handed on for the card) is copied, up to the snap length, into a ring
+// of fixed size slots allocated when the capture starts. once the ring is full
+// the oldest frames are overwritten, so it holds the run up to whatever went
+// wrong. netcap_pcap() turns it into a pcap file image.
+
+#define NETCAP_FRAMES_DEFAULT  1024
+#define NETCAP_SNAPLEN_DEFAULT   96 // ethernet, IPv4, UDP or TCP, and the TFTP header
+#define PCAP_LINKTYPE_ETHERNET    1
+
+typedef struct {
+    uint32_t time;              // timer_read_fine()
+    uint16_t length;            // of the whole frame
+    uint16_t captured;          // bytes held, up to the snap length
+    uint8_t data[];
+} netcap_record_t;
+
+bool netcap_running = false;
+static uint8_t *netcap_ring;
+static int netcap_slot_size;
+static int netcap_slots;
+static int netcap_snaplen;
+static int netcap_next;         // slot the next frame goes into
+static uint32_t netcap_seen;    // frames captured since the start
+
+typedef struct __attribute__((packed, aligned(2))) {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} pcap_header_t;
+
+typedef struct __attribute__((packed, aligned(2))) {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_record_t;
+
+bool netcap_start(int frames, int snaplen)
+{
+    if(frames <= 0)
+        frames = NETCAP_FRAMES_DEFAULT;
+    if(snaplen <= 0)
+        snaplen = NETCAP_SNAPLEN_DEFAULT;
+    if(snaplen > PACKET_MAXLEN)
+        snaplen = PACKET_MAXLEN;
+
+    netcap_stop();
+    free(netcap_ring);
+    netcap_slot_size = (sizeof(netcap_record_t) + snaplen + 1) & ~1;
+    netcap_ring = malloc_unchecked(frames * netcap_slot_size);
+    if(!netcap_ring){
+        printf("netcap: no memory for %d frames of %d bytes\n", frames, snaplen);
+        netcap_slots = 0;
+        return false;
+    }
+
+    netcap_slots = frames;
+    netcap_snaplen = snaplen;
+    netcap_next = 0;
+    netcap_seen = 0;
+    netcap_running = true;
+    timer_fine_hold(); // for the timestamps
+    return true;
+}
+
+void netcap_stop(void)
+{
+    if(netcap_running)
+        timer_fine_release();
+    netcap_running = false;
+}
+
+// the frame as it is on the wire: a payload the driver placed straight into a
+// sink's buffer is copied from there
+static void netcap_copy(uint8_t *dest, packet_t *packet, int length)
+{
+    const uint8_t *placed;
+    int hole, gap, n;
+
+    if(!packet->placed_data){
+        memcpy(dest, packet->buffer, length);
+        return;
+    }
+
+    hole = (packet->data + packet->placed_offset) - packet->buffer;
+    if(length <= hole){
+        memcpy(dest, packet->buffer, length);
+        return;
+    }
+    memcpy(dest, packet->buffer, hole);
+
+    placed = packet->placed_data;
+    gap = packet->data_length - packet->placed_offset;
+    n = (length - hole < gap) ? length - hole : gap;
+    memcpy(dest + hole, placed, n);
+
+    if(length > hole + gap)
+        memcpy(dest + hole + gap, packet->buffer + hole + gap, length - hole - gap);
+}
+
+void netcap_frame(packet_t *packet)
+{
+    netcap_record_t *record = (netcap_record_t*)(netcap_ring + netcap_next * netcap_slot_size);
+
+    record->time = timer_read_fine();
+    record->length = packet->buffer_length;
+    record->captured = (packet->buffer_length < netcap_snaplen) ? packet->buffer_length : netcap_snaplen;
+    netcap_copy(record->data, packet, record->captured);
+
+    if(++netcap_next == netcap_slots)
+        netcap_next = 0;
+    netcap_seen++;
+}
+
+void netcap_status(void)
+{
+    int held = (netcap_seen < netcap_slots) ? netcap_seen : netcap_slots;
+
+    if(!netcap_ring){
+        printf("netcap: no capture\n");
+        return;
+    }
+
+    printf("netcap: %s, %d of %d frames held (%ld captured), %d bytes each\n",
+            netcap_running ? "running" : "stopped", held, netcap_slots, netcap_seen, netcap_snaplen);
+}
+
+// the frames held, oldest first, as a pcap file in memory the caller frees.
+// timestamps count from the oldest frame; the fine timer wraps, so each is
+// taken as a difference from the one before
+bool netcap_pcap(void **image, uint32_t *size)
+{
+    int held = (netcap_seen < netcap_slots) ? netcap_seen : netcap_slots;
+    int slot = (netcap_seen < netcap_slots) ? 0 : netcap_next;
+    uint32_t length, sec = 0, usec = 0, last = 0;
+    netcap_record_t *record;
+    pcap_header_t *header;
+    pcap_record_t out;
+    uint8_t *ptr;
+
+    if(!netcap_ring || !held){
+        printf("netcap: nothing captured\n");
+        return false;
+    }
+
+    length = sizeof(pcap_header_t);
+    for(int i=0, s=slot; i<held; i++){
+        record = (netcap_record_t*)(netcap_ring + s * netcap_slot_size);
+        length += sizeof(pcap_record_t) + record->captured;
+        if(++s == netcap_slots)
+            s = 0;
+    }
+
+    ptr = malloc_unchecked(length);
+    if(!ptr){
+        printf("netcap: no memory for a %ld byte file\n", length);
+        return false;
+    }
+    *image = ptr;
+    *size = length;
+
+    // written in our own byte order; the magic number tells readers which
+    header = (pcap_header_t*)ptr;
+    header->magic = 0xa1b2c3d4;
+    header->version_major = 2;
+    header->version_minor = 4;
+    header->thiszone = 0;
+    header->sigfigs = 0;
+    header->snaplen = netcap_snaplen;
+    header->network = PCAP_LINKTYPE_ETHERNET;
+    ptr += sizeof(pcap_header_t);
+
+    for(int i=0; i<held; i++){
+        record = (netcap_record_t*)(netcap_ring + slot * netcap_slot_size);
+        if(i)
+            usec += record->time - last;
+        last = record->time;
+        sec += usec / 1000000;
+        usec %= 1000000;
+
+        out.ts_sec = sec;
+        out.ts_usec = usec;
+        out.incl_len = record->captured;
+        out.orig_len = record->length;
+        memcpy(ptr, &out, sizeof(pcap_record_t)); // odd captured lengths leave ptr unaligned
+        memcpy(ptr + sizeof(pcap_record_t), record->data, record->captured);
+        ptr += sizeof(pcap_record_t) + record->captured;
+
+        if(++slot == netcap_slots)
+            slot = 0;
+    }
+
+    return true;
+}
@@ -0,0 +1,200 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <cli.h>
+#include <init.h>
+#include <net.h>
+
+// UDP network console. While the "netconsole" variable names a host
+// (a.b.c.d[:port]) console output is gathered into datagrams sent there, one
+// whenever a datagram fills and another from net_pump() for whatever is left.
+// Datagrams that host sends to our port are console input. The serial port
+// gets no console output meanwhile, unless netconsole_uart is set, which is
+// most of the point: a memory dump goes at network speed, not 115200 baud.
+// Output from an interrupt handler always goes to the UART: we cannot build
+// and send a packet from inside the NIC driver or the allocator.
+
+#define NETCON_PORT             6666    // local port, and the default remote one
+#define NETCON_DATAGRAM         1024    // console output per datagram
+#define NETCON_INPUT_SIZE       256     // must be a power of 2
+#define NETCON_CHECK_MS         500     // how often we look at the variables
+
+static packet_sink_t *netcon_sink = NULL;
+static uint32_t netcon_ip = 0;          // 0 when off
+static uint16_t netcon_port;
+static bool netcon_uart;
+static bool netcon_sending = false;     // output while we send goes to the UART
+static timer_t netcon_check = 0;
+
+static char netcon_output[NETCON_DATAGRAM];
+static int netcon_length = 0;
+
+static uint8_t netcon_input[NETCON_INPUT_SIZE];
+static int netcon_input_head = 0, netcon_input_tail = 0;
+
+static void netcon_flush(void)
+{
+    packet_t *packet;
+
+    if(!netcon_length)
+        return;
+
+    netcon_sending = true;
+    packet = packet_create_udp(netcon_ip, netcon_port, NETCON_PORT, netcon_length);
+    memcpy(packet->data, netcon_output, netcon_length);
+    net_tx(packet);
+    net_tx_flush(); // we may be deep inside a long printf loop that never pumps
+    netcon_length = 0;
+    netcon_sending = false;
+}
+
+// returns true if the character was taken, false if it should go to the UART
+bool netcon_write_byte(char ch)
+{
+    if(!netcon_ip || netcon_sending || !interface_ipv4_address || target_irq_depth)
+        return false;
+
+    netcon_output[netcon_length++] = ch;
+    if(netcon_length == NETCON_DATAGRAM)
+        netcon_flush();
+
+    return !netcon_uart;
+}
+
+// as netcon_write_byte(), for a run of characters
+bool netcon_write(const char *str, int len)
+{
+    int chunk;
+
+    if(!netcon_ip || netcon_sending || !interface_ipv4_address || target_irq_depth)
+        return false;
+
+    while(len){
+        chunk = NETCON_DATAGRAM - netcon_length;
+        if(chunk > len)
+            chunk = len;
+        memcpy(netcon_output + netcon_length, str, chunk);
+        netcon_length += chunk;
+        str += chunk;
+        len -= chunk;
+        if(netcon_length == NETCON_DATAGRAM)
+            netcon_flush();
+    }
+
+    return !netcon_uart;
+}
+
+int netcon_read_byte(void)
+{
+    int ch;
+
+    if(netcon_input_head == netcon_input_tail)
+        return -1;
+
+    ch = netcon_input[netcon_input_tail];
+    netcon_input_tail = (netcon_input_tail + 1) & (NETCON_INPUT_SIZE-1);
+    return ch;
+}
+
+static void netcon_received(packet_sink_t *sink, packet_t *packet)
+{
+    int next;
+
+    for(int i=0; i<packet->data_length; i++){
+        next = (netcon_input_head + 1) & (NETCON_INPUT_SIZE-1);
+        if(next == netcon_input_tail)
+            break; // full; drop the rest
+        netcon_input[netcon_input_head] = packet->data[i];
+        netcon_input_head = next;
+    }
+
+    packet_free(packet);
+}
+
+static void netcon_stop(void)
+{
+    netcon_flush();
+    net_remove_packet_sink(netcon_sink);
+    packet_sink_free(netcon_sink);
+    netcon_sink = NULL;
+    netcon_ip = 0;
+}
+
+static void netcon_start(uint32_t ip, uint16_t port)
+{
+    char host[16];
+
+    printf("netconsole: console on %s:%d\n", net_format_ipv4(ip, host), port);
+
+    netcon_sink = packet_sink_alloc();
+    netcon_sink->match_ethertype = ethertype_ipv4;
+    netcon_sink->match_ipv4_protocol = ip_proto_udp;
+    netcon_sink->match_local_port = NETCON_PORT;
+    netcon_sink->match_remote_ip = ip;
+    netcon_sink->cb_packet_received = netcon_received;
+    net_add_packet_sink(netcon_sink);
+    netcon_input_head = netcon_input_tail = 0;
+
+    netcon_ip = ip;
+    netcon_port = port;
+}
+
+// (re)read the settings; the console needs our own address before it can work
+static void netcon_configure(void)
+{
+    const char *setting = get_environment_variable("netconsole");
+    const char *colon;
+    uint32_t ip = 0;
+    uint16_t port = NETCON_PORT;
+    char host[16];
+    int len;
+
+    netcon_uart = get_environment_variable_int("netconsole_uart", 0);
+
+    if(setting && interface_ipv4_address){
+        colon = strchr(setting, ':');
+        len = colon ? colon - setting : strlen(setting);
+        if(len < sizeof(host)){
+            memcpy(host, setting, len);
+            host[len] = 0;
+            ip = net_parse_ipv4(host);
+        }
+        if(colon && atoi(colon + 1) > 0)
+            port = atoi(colon + 1);
+    }
+
+    if(ip == netcon_ip && (!ip || port == netcon_port))
+        return;
+
+    if(netcon_ip)
+        netcon_stop();
+    if(ip)
+        netcon_start(ip, port);
+}
+
+void netcon_pump(void)
+{
+    if(timer_expired(netcon_check)){
+        netcon_check = set_timer_ms(NETCON_CHECK_MS);
+        netcon_configure();
+    }
+
+    if(netcon_length && !netcon_sending)
+        netcon_flush();
+}
+
+// get everything out before the network goes away
+void netcon_shutdown(void)
+{
+    timer_t timeout;
+
+    if(!netcon_ip)
+        return;
+
+    netcon_flush();
+    timeout = set_timer_ms(100);
+    while(!timer_expired(timeout))
+        net_tx_flush();
+}
@@ -5,6 +5,52 @@
 #include <timers.h>
 #include <cli.h>
 #include <net.h>
+#include <init.h>
+
+#ifdef MEMORY_PROFILE_SMALL
+#define PACKET_POOL_MAX         8       // a fixed pool, whatever the heap
+#define PACKET_ALIVE_WARN       12
+#else
+#define PACKET_POOL_MAX         32      // buffers in the pool
+#define PACKET_ALIVE_WARN       20
+#endif
+#define PACKET_POOL_MIN         4
+#define PACKET_POOL_HEAP_FRACTION 16    // use at most 1/16th of the heap
+
+// pool of preallocated PACKET_MAXLEN buffers, linked through packet->next
+static packet_t *packet_pool_head = NULL;
+uint32_t packet_pool_size = 0;
+uint32_t packet_pool_free = 0;
+uint32_t packet_pool_low_water = 0;     // fewest free buffers seen
+uint32_t packet_pool_exhausted = 0;     // allocations that fell back to the heap
+
+void packet_pool_init(void)
+{
+    int count, bufsize = (sizeof(packet_t) + PACKET_MAXLEN + 3) & ~3;
+    uint8_t *slab;
+
+#ifdef MEMORY_PROFILE_SMALL
+    count = PACKET_POOL_MAX;
+#else
+    count = heap_size / PACKET_POOL_HEAP_FRACTION / bufsize;
+#endif
+    if(count > PACKET_POOL_MAX)
+        count = PACKET_POOL_MAX;
+    if(count < PACKET_POOL_MIN)
+        return; // small heap: every packet comes from malloc()
+
+    slab = malloc_unchecked(count * bufsize);
+    if(!slab)
+        return;
+
+    for(int i=0; i<count; i++){
+        packet_t *p = (packet_t*)(slab + i * bufsize);
+        p->next = packet_pool_head;
+        packet_pool_head = p;
+    }
+
+    packet_pool_size = packet_pool_free = packet_pool_low_water = count;
+}
 
 packet_sink_t *packet_sink_alloc(void)
 {
@@ -109,15 +155,33 @@ packet_t *packet_queue_pophead(packet_queue_t *q)
 
 packet_t *packet_alloc(int data_size)
 {
-    if(data_size >= PACKET_MAXLEN)
+    if(data_size > sizeof(ethernet_header_t) + sizeof(ipv4_header_t) + NET_MAX_DATAGRAM)
         printf("net: packet_alloc(%d): too big!\n", data_size);
 
     packet_alive_count++;
-    if(packet_alive_count > 20)
+    if(packet_alive_count > PACKET_ALIVE_WARN)
         printf("packet_alive_count=%ld\n", packet_alive_count);
 
-    packet_t *p=malloc(sizeof(packet_t) + data_size);
+    packet_t *p;
+    bool pooled = false;
+
+    if(packet_pool_head && data_size <= PACKET_MAXLEN){
+        // O(1) from the pool
+        p = packet_pool_head;
+        packet_pool_head = p->next;
+        packet_pool_free--;
+        if(packet_pool_free < packet_pool_low_water)
+            packet_pool_low_water = packet_pool_free;
+        pooled = true;
+    }else{
+        if(packet_pool_size)
+            packet_pool_exhausted++;
+        p = malloc(sizeof(packet_t) + data_size);
+    }
+
     memset(p, 0, sizeof(packet_t)); // do not zero out the data, just the header
+    if(pooled)
+        p->flags = packet_flag_pooled;
     p->buffer_length_alloc = p->buffer_length = data_size;
     p->eth = (ethernet_header_t*)p->buffer;
     return p;
@@ -129,8 +193,21 @@ void packet_set_destination_mac(packet_t *packet, const macaddr_t *mac)
     packet->flags |= packet_flag_destination_mac_valid;
 }
 
+void packet_reuse_for_tx(packet_t *packet)
+{
+    // the routing and checksum state belonged to the received frame; where the
+    // buffer came from did not change
+    packet->flags &= packet_flag_pooled;
+}
+
 void packet_free(packet_t *packet)
 {
-    free(packet);
+    if(packet->flags & packet_flag_pooled){
+        packet->next = packet_pool_head;
+        packet_pool_head = packet;
+        packet_pool_free++;
+    }else{
+        free(packet);
+    }
     packet_alive_count--;
 }
@@ -0,0 +1,311 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <cli.h>
+#include <init.h>
+#include <job.h>
+#include <net.h>
+
+// remote memory access: a host reads, writes, fills, checks and runs memory
+// over UDP (tools/rmem is the client). every request is answered, carrying its
+// sequence number back, and each one stands alone: a write sent twice does no
+// harm, so the host keeps a window of them in flight and resends any that go
+// unanswered. a session starts with the host proving it knows rmem_key: we
+// send a random challenge, it returns HMAC-SHA256(key, challenge), and gets a
+// session number that every later request must carry. that keeps out hosts
+// without the key; it is no defence against one that can see the traffic.
+
+#define RMEM_PORT_DEFAULT 3002
+#define RMEM_MAX_DATA     1440 // a request or reply fits an unfragmented frame
+#define RMEM_MAX_RANGE    (64*1024) // fill and crc32 run inside the network pump: keep each short
+#define RMEM_CHALLENGE_SIZE 16
+
+typedef struct __attribute__((packed, aligned(2))) {
+    uint16_t op;
+    uint16_t status;            // replies
+    uint32_t session;
+    uint32_t sequence;          // chosen by the host, echoed in the reply
+    uint32_t address;
+    uint32_t length;
+    uint8_t data[];
+} rmem_header_t;
+
+static const uint16_t rmem_op_hello = 1;   // reply: challenge
+static const uint16_t rmem_op_auth = 2;    // data: HMAC of the challenge; reply: session
+static const uint16_t rmem_op_read = 3;    // reply: length bytes from address
+static const uint16_t rmem_op_write = 4;   // data: length bytes for address
+static const uint16_t rmem_op_fill = 5;    // data: one byte, repeated over length bytes
+static const uint16_t rmem_op_crc32 = 6;   // data: none, or the crc32 so far; reply: address = crc32 of the range
+static const uint16_t rmem_op_exec = 7;    // run from address, once the reply has gone
+
+static const uint16_t rmem_ok = 0;
+static const uint16_t rmem_bad_session = 1;
+static const uint16_t rmem_bad_range = 2;
+static const uint16_t rmem_bad_request = 3;
+static const uint16_t rmem_auth_failed = 4;
+
+static packet_sink_t *rmem_sink = NULL;
+static uint8_t rmem_challenge[RMEM_CHALLENGE_SIZE];
+static bool rmem_challenge_valid;
+static uint32_t rmem_session;           // 0 when there is none
+static uint32_t rmem_client_ip;
+static uint16_t rmem_client_port;
+static uint32_t rmem_exec_address;      // 0, or where to go when the job next steps
+static uint32_t rmem_requests, rmem_bytes_written;
+
+#define HMAC_BLOCK 64
+
+static void hmac_sha256(const char *key, const void *data, uint32_t len, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint8_t pad[HMAC_BLOCK], inner[SHA256_DIGEST_SIZE];
+    uint32_t key_len = strlen(key);
+    sha256_t s;
+
+    memset(pad, 0, sizeof(pad));
+    if(key_len > HMAC_BLOCK){
+        sha256_init(&s);
+        sha256_update(&s, key, key_len);
+        sha256_final(&s, pad);
+    }else
+        memcpy(pad, key, key_len);
+
+    for(int i=0; i<HMAC_BLOCK; i++)
+        pad[i] ^= 0x36;
+    sha256_init(&s);
+    sha256_update(&s, pad, HMAC_BLOCK);
+    sha256_update(&s, data, len);
+    sha256_final(&s, inner);
+
+    for(int i=0; i<HMAC_BLOCK; i++)
+        pad[i] ^= 0x36 ^ 0x5c;
+    sha256_init(&s);
+    sha256_update(&s, pad, HMAC_BLOCK);
+    sha256_update(&s, inner, SHA256_DIGEST_SIZE);
+    sha256_final(&s, digest);
+}
+
+// no hardware random source: stir the timers into the last challenge
+static void rmem_new_challenge(void)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint32_t noise[4];
+    sha256_t s;
+
+    noise[0] = timer_read_fine();
+    noise[1] = gogoboot_read_timer();
+    noise[2] = packet_rx_count;
+    noise[3] = rmem_requests;
+
+    sha256_init(&s);
+    sha256_update(&s, rmem_challenge, sizeof(rmem_challenge));
+    sha256_update(&s, noise, sizeof(noise));
+    sha256_final(&s, digest);
+    memcpy(rmem_challenge, digest, RMEM_CHALLENGE_SIZE);
+    rmem_challenge_valid = true;
+}
+
+static packet_t *rmem_reply(packet_t *request, uint16_t status, int data_length)
+{
+    rmem_header_t *req = (rmem_header_t*)request->data;
+    packet_t *packet = packet_create_udp(ntohl(request->ipv4->source_ip), ntohs(request->udp->source_port),
+            rmem_sink->match_local_port, sizeof(rmem_header_t) + data_length);
+    rmem_header_t *reply = (rmem_header_t*)packet->data;
+
+    memcpy(reply, req, sizeof(rmem_header_t));
+    reply->status = htons(status);
+    return packet;
+}
+
+// every byte, whatever the first difference, so the time taken gives nothing away
+static bool rmem_digest_equal(const uint8_t *a, const uint8_t *b)
+{
+    uint8_t diff = 0;
+
+    for(int i=0; i<SHA256_DIGEST_SIZE; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+static void rmem_auth(packet_t *request, rmem_header_t *req, int data_length)
+{
+    const char *key = get_environment_variable("rmem_key");
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    packet_t *reply;
+
+    if(!key || !rmem_challenge_valid || data_length != SHA256_DIGEST_SIZE){
+        net_tx(rmem_reply(request, rmem_auth_failed, 0));
+        return;
+    }
+
+    hmac_sha256(key, rmem_challenge, RMEM_CHALLENGE_SIZE, digest);
+    rmem_challenge_valid = false; // one guess per challenge
+    if(!rmem_digest_equal(digest, req->data)){
+        printf("rmem: authentication failed\n");
+        net_tx(rmem_reply(request, rmem_auth_failed, 0));
+        return;
+    }
+
+    do {
+        rmem_session = ((uint32_t)digest[0] << 24) ^ ((uint32_t)digest[1] << 16) ^
+                       ((uint32_t)digest[2] << 8) ^ digest[3] ^ timer_read_fine();
+    } while(!rmem_session);
+    rmem_client_ip = ntohl(request->ipv4->source_ip);
+    rmem_client_port = ntohs(request->udp->source_port);
+
+    reply = rmem_reply(request, rmem_ok, 0);
+    ((rmem_header_t*)reply->data)->session = htonl(rmem_session);
+    net_tx(reply);
+}
+
+// one request, checked and carried out; returns the reply status
+static uint16_t rmem_request(packet_t *request, rmem_header_t *req, int data_length, packet_t **reply)
+{
+    uint32_t address = ntohl(req->address), length = ntohl(req->length), crc;
+    const char *err;
+
+    switch(ntohs(req->op)){
+        case rmem_op_read:
+            if(length > RMEM_MAX_DATA)
+                return rmem_bad_request;
+            if(!mem_find_region(address, length))
+                return rmem_bad_range;
+            *reply = rmem_reply(request, rmem_ok, length);
+            memcpy(((rmem_header_t*)(*reply)->data)->data, (void*)address, length);
+            return rmem_ok;
+        case rmem_op_write:
+            if(length != data_length || length > RMEM_MAX_DATA)
+                return rmem_bad_request;
+            err = check_writable_range(address, length, false);
+            if(err)
+                break;
+            memcpy((void*)address, req->data, length);
+            rmem_bytes_written += length;
+            return rmem_ok;
+        case rmem_op_fill:
+            if(data_length != 1 || length > RMEM_MAX_RANGE)
+                return rmem_bad_request;
+            err = check_writable_range(address, length, false);
+            if(err)
+                break;
+            memset((void*)address, req->data[0], length);
+            rmem_bytes_written += length;
+            return rmem_ok;
+        case rmem_op_crc32:
+            if((data_length != 0 && data_length != 4) || length > RMEM_MAX_RANGE)
+                return rmem_bad_request;
+            if(!mem_find_region(address, length))
+                return rmem_bad_range;
+            crc = data_length ? ((uint32_t)req->data[0] << 24) | ((uint32_t)req->data[1] << 16) |
+                                ((uint32_t)req->data[2] << 8) | req->data[3] : 0;
+            *reply = rmem_reply(request, rmem_ok, 0);
+            ((rmem_header_t*)(*reply)->data)->address = htonl(crc32_update(crc, (void*)address, length));
+            return rmem_ok;
+        case rmem_op_exec:
+            if(!mem_find_region(address, 2) || (address & 1))
+                return rmem_bad_range;
+            rmem_exec_address = address;
+            return rmem_ok;
+        default:
+            return rmem_bad_request;
+    }
+
+    printf("rmem: 0x%lx length 0x%lx: %s\n", address, length, err);
+    return rmem_bad_range;
+}
+
+static void rmem_packet_received(packet_sink_t *sink, packet_t *packet)
+{
+    rmem_header_t *req = (rmem_header_t*)packet->data;
+    int data_length = packet->data_length - sizeof(rmem_header_t);
+    packet_t *reply = NULL;
+    uint16_t status;
+
+    if(data_length < 0){
+        packet_free(packet);
+        return;
+    }
+    rmem_requests++;
+
+    if(ntohs(req->op) == rmem_op_hello){
+        rmem_new_challenge();
+        reply = rmem_reply(packet, rmem_ok, RMEM_CHALLENGE_SIZE);
+        memcpy(((rmem_header_t*)reply->data)->data, rmem_challenge, RMEM_CHALLENGE_SIZE);
+        net_tx(reply);
+    }else if(ntohs(req->op) == rmem_op_auth){
+        rmem_auth(packet, req, data_length);
+    }else if(!rmem_session || ntohl(req->session) != rmem_session ||
+             ntohl(packet->ipv4->source_ip) != rmem_client_ip || ntohs(packet->udp->source_port) != rmem_client_port){
+        net_tx(rmem_reply(packet, rmem_bad_session, 0));
+    }else{
+        status = rmem_request(packet, req, data_length, &reply);
+        net_tx(reply ? reply : rmem_reply(packet, status, 0));
+    }
+
+    packet_free(packet);
+}
+
+// requests are answered from the sink; the job only waits to run something
+static bool rmem_job_step(job_t *job)
+{
+    uint32_t address = rmem_exec_address;
+
+    if(address){
+        rmem_exec_address = 0;
+        net_tx_flush(); // see the reply off first
+        printf("rmem: running code at 0x%lx\n", address);
+        execute((void*)address, 0, NULL);
+    }
+
+    return true; // until killed
+}
+
+static void rmem_job_status(job_t *job)
+{
+    printf("%ld requests, %ld bytes written", rmem_requests, rmem_bytes_written);
+}
+
+static void rmem_job_kill(job_t *job)
+{
+    net_remove_packet_sink(rmem_sink);
+    packet_sink_free(rmem_sink);
+    rmem_sink = NULL;
+    rmem_session = 0;
+    timer_fine_release();
+}
+
+bool rmem_start(void)
+{
+    job_t *job;
+
+    if(rmem_sink){
+        printf("rmem: already running\n");
+        return false;
+    }
+
+    if(!get_environment_variable("rmem_key")){
+        printf("rmem: set rmem_key first\n");
+        return false;
+    }
+
+    rmem_sink = packet_sink_alloc();
+    rmem_sink->match_interface_local_ip = true;
+    rmem_sink->match_ipv4_protocol = ip_proto_udp;
+    rmem_sink->match_local_port = get_environment_variable_int("rmem_port", RMEM_PORT_DEFAULT);
+    rmem_sink->cb_packet_received = rmem_packet_received;
+    net_add_packet_sink(rmem_sink);
+    rmem_session = 0;
+    rmem_challenge_valid = false;
+    timer_fine_hold(); // challenges and sessions take noise from it
+
+    job = job_alloc("rmem", "serve");
+    job->cb_step = rmem_job_step;
+    job->cb_status = rmem_job_status;
+    job->cb_kill = rmem_job_kill;
+    job_add(job);
+
+    printf("rmem: serving memory on UDP port %d; \"kill %d\" to stop\n", rmem_sink->match_local_port, job->id);
+
+    return true;
+}
@@ -0,0 +1,371 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <uart.h>
+#include <timers.h>
+#include <net.h>
+
+// A minimal TCP client, enough to download a file: one active open at a time,
+// in-order receive only (out of order segments are dropped and re-ACKed, the
+// sender's fast retransmit recovers), a receive window sized to the NE2000
+// receive ring, delayed ACKs, and a fixed retransmission timeout for the few
+// segments we send ourselves.
+//
+// https://www.rfc-editor.org/rfc/rfc9293 - Transmission Control Protocol
+
+#define TCP_MSS             1460    // largest segment in a 1500 byte MTU frame
+#define TCP_TICK_MS          100    // timer granularity
+#define TCP_ACK_DELAY_MS     200    // longest we sit on an ACK
+#define TCP_RTO_MS          1000
+#define TCP_MAX_RETRIES        8
+#define TCP_CLOSE_WAIT_MS   2000    // how long tcp_close() waits for the remote end
+
+typedef enum {
+    tcp_closed,
+    tcp_syn_sent,
+    tcp_established,
+    tcp_close_wait,     // remote end has closed; we may still send
+    tcp_fin_wait,       // we have closed; remote end may still send
+    tcp_last_ack,       // both closed, waiting for the ACK of our FIN
+} tcp_state_t;
+
+struct tcp_connection_t {
+    packet_sink_t *sink;
+    tcp_state_t state;
+    uint32_t snd_una;           // oldest unacknowledged sequence number
+    uint32_t snd_nxt;           // next sequence number we send
+    uint32_t rcv_nxt;           // next sequence number we expect
+    uint16_t snd_mss;           // largest segment the remote end will take
+    uint16_t rcv_window;
+    const uint8_t *tx_data;     // tcp_write() data not yet acknowledged, starting at snd_una
+    int tx_length;
+    bool fin_queued;            // send a FIN after tx_data
+    int ack_pending;            // segments received but not yet ACKed
+    timer_t ack_deadline;
+    timer_t rto_deadline;
+    int retransmits;
+    bool reset;                 // connection reset or timed out
+    tcp_data_callback_t cb_data;
+    void *context;
+};
+
+static inline bool seq_after(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) > 0;
+}
+
+static int tcp_segment_size(tcp_connection_t *conn)
+{
+    return conn->tx_length > conn->snd_mss ? conn->snd_mss : conn->tx_length;
+}
+
+static void tcp_send_segment(tcp_connection_t *conn, uint8_t flags, uint32_t sequence, const uint8_t *data, int length)
+{
+    packet_t *packet;
+    int options = (flags & tcp_flag_syn) ? 4 : 0;
+
+    packet = packet_create_for_sink(conn->sink, options + length);
+    packet->tcp->sequence = htonl(sequence);
+    packet->tcp->flags = flags;
+    packet->tcp->window_size = htons(conn->rcv_window);
+    if(conn->state != tcp_syn_sent){
+        packet->tcp->flags |= tcp_flag_ack;
+        packet->tcp->ack = htonl(conn->rcv_nxt);
+        conn->ack_pending = 0;
+    }
+
+    if(options){
+        // maximum segment size
+        packet->tcp->options[0] = 2;
+        packet->tcp->options[1] = 4;
+        packet->tcp->options[2] = TCP_MSS >> 8;
+        packet->tcp->options[3] = TCP_MSS & 0xff;
+        packet->tcp->data_offset = ((sizeof(tcp_header_t) + options) / 4) << 4;
+        packet->data += options;
+        packet->data_length -= options;
+    }
+
+    if(length)
+        memcpy(packet->data, data, length);
+
+    net_tx(packet);
+}
+
+static void tcp_send_ack(tcp_connection_t *conn)
+{
+    tcp_send_segment(conn, 0, conn->snd_nxt, NULL, 0);
+}
+
+// (re)send everything from snd_una: the SYN, one segment of data, or the FIN
+static void tcp_transmit(tcp_connection_t *conn)
+{
+    int length;
+
+    if(conn->state == tcp_syn_sent){
+        tcp_send_segment(conn, tcp_flag_syn, conn->snd_una, NULL, 0);
+        conn->snd_nxt = conn->snd_una + 1;
+    }else if(conn->tx_length){
+        length = tcp_segment_size(conn);
+        tcp_send_segment(conn, tcp_flag_psh, conn->snd_una, conn->tx_data, length);
+        conn->snd_nxt = conn->snd_una + length;
+    }else if(conn->fin_queued){
+        tcp_send_segment(conn, tcp_flag_fin, conn->snd_una, NULL, 0);
+        conn->snd_nxt = conn->snd_una + 1;
+    }else
+        return;
+
+    conn->rto_deadline = set_timer_ms(TCP_RTO_MS);
+}
+
+static void tcp_process_ack(tcp_connection_t *conn, uint32_t ack)
+{
+    uint32_t acked;
+
+    if(!seq_after(ack, conn->snd_una) || seq_after(ack, conn->snd_nxt))
+        return; // old or bogus
+
+    acked = ack - conn->snd_una;
+    conn->snd_una = ack;
+    conn->retransmits = 0;
+
+    if(conn->tx_length){
+        conn->tx_data += acked;
+        conn->tx_length -= acked;
+    }else if(conn->fin_queued){
+        conn->fin_queued = false; // our FIN has been acknowledged
+        if(conn->state == tcp_last_ack)
+            conn->state = tcp_closed;
+    }
+
+    if(conn->snd_una == conn->snd_nxt)
+        tcp_transmit(conn); // next segment, if any
+}
+
+static void tcp_packet_received(packet_sink_t *sink, packet_t *packet)
+{
+    tcp_connection_t *conn = sink->sink_private;
+    tcp_header_t *tcp = packet->tcp;
+    uint32_t sequence = ntohl(tcp->sequence);
+    uint8_t *opt, *end;
+
+    if(tcp->flags & tcp_flag_rst){
+        if(conn->state != tcp_syn_sent || ((tcp->flags & tcp_flag_ack) && ntohl(tcp->ack) == conn->snd_nxt)){
+            printf("tcp: connection reset\n");
+            conn->state = tcp_closed;
+            conn->reset = true;
+        }
+        packet_free(packet);
+        return;
+    }
+
+    if(conn->state == tcp_syn_sent){
+        if((tcp->flags & (tcp_flag_syn | tcp_flag_ack)) == (tcp_flag_syn | tcp_flag_ack) &&
+           ntohl(tcp->ack) == conn->snd_nxt){
+            // look for the remote end's MSS
+            opt = tcp->options;
+            end = (uint8_t*)tcp + ((tcp->data_offset >> 4) << 2);
+            while(opt < end && *opt){
+                if(*opt == 2 && opt + 4 <= end){
+                    conn->snd_mss = (opt[2] << 8) | opt[3];
+                    if(conn->snd_mss > TCP_MSS)
+                        conn->snd_mss = TCP_MSS;
+                }
+                opt += (*opt == 1) ? 1 : (opt[1] ? opt[1] : 1);
+            }
+            conn->rcv_nxt = sequence + 1;
+            conn->snd_una = conn->snd_nxt;
+            conn->state = tcp_established;
+            conn->retransmits = 0;
+            tcp_send_ack(conn);
+        }
+        packet_free(packet);
+        return;
+    }
+
+    if(tcp->flags & tcp_flag_ack)
+        tcp_process_ack(conn, ntohl(tcp->ack));
+
+    if(packet->data_length || (tcp->flags & tcp_flag_fin)){
+        if(sequence != conn->rcv_nxt){
+            // out of order or a retransmission: tell the sender what we want next
+            tcp_send_ack(conn);
+            packet_free(packet);
+            return;
+        }
+
+        if(packet->data_length){
+            conn->rcv_nxt += packet->data_length;
+            if(conn->cb_data && !conn->cb_data(conn->context, packet->data, packet->data_length)){
+                // consumer gave up; tell the remote end to stop sending
+                tcp_send_segment(conn, tcp_flag_rst, conn->snd_nxt, NULL, 0);
+                conn->state = tcp_closed;
+                conn->reset = true;
+                packet_free(packet);
+                return;
+            }
+            // ACK every second segment at once, otherwise after a short delay
+            if(conn->ack_pending++ == 0)
+                conn->ack_deadline = set_timer_ms(TCP_ACK_DELAY_MS);
+        }
+
+        if(tcp->flags & tcp_flag_fin){
+            conn->rcv_nxt++;
+            if(conn->state == tcp_established)
+                conn->state = tcp_close_wait;
+            else if(conn->state == tcp_fin_wait)
+                conn->state = conn->fin_queued ? tcp_last_ack : tcp_closed;
+            tcp_send_ack(conn);
+        }else if(conn->ack_pending >= 2)
+            tcp_send_ack(conn);
+    }
+
+    packet_free(packet);
+}
+
+static void tcp_timer_expired(packet_sink_t *sink)
+{
+    tcp_connection_t *conn = sink->sink_private;
+
+    if(conn->state == tcp_closed)
+        return;
+
+    sink->timer = set_timer_ms(TCP_TICK_MS);
+
+    if(conn->ack_pending && timer_expired(conn->ack_deadline))
+        tcp_send_ack(conn);
+
+    if(conn->snd_una != conn->snd_nxt && timer_expired(conn->rto_deadline)){
+        if(++conn->retransmits > TCP_MAX_RETRIES){
+            printf("tcp: connection timed out\n");
+            conn->state = tcp_closed;
+            conn->reset = true;
+            return;
+        }
+        tcp_transmit(conn);
+    }
+}
+
+// pump the network until done() or the user presses Q
+static bool tcp_wait(tcp_connection_t *conn, bool (*done)(tcp_connection_t *conn))
+{
+    int uart_byte;
+
+    while(!done(conn)){
+        if(conn->reset)
+            return false;
+        net_pump();
+        uart_byte = uart_read_byte();
+        if(uart_byte == 'q' || uart_byte == 'Q'){
+            printf("Aborted.\n");
+            return false;
+        }
+    }
+
+    return !conn->reset;
+}
+
+static bool tcp_is_established(tcp_connection_t *conn)
+{
+    return conn->state != tcp_syn_sent;
+}
+
+static bool tcp_is_sent(tcp_connection_t *conn)
+{
+    return conn->state == tcp_closed || (!conn->tx_length && conn->snd_una == conn->snd_nxt);
+}
+
+static bool tcp_is_remote_closed(tcp_connection_t *conn)
+{
+    return conn->state == tcp_close_wait || conn->state == tcp_last_ack || conn->state == tcp_closed;
+}
+
+static bool tcp_is_closed(tcp_connection_t *conn)
+{
+    return conn->state == tcp_closed;
+}
+
+tcp_connection_t *tcp_open(uint32_t remote_ip, uint16_t remote_port, tcp_data_callback_t cb_data, void *context)
+{
+    tcp_connection_t *conn = malloc(sizeof(tcp_connection_t));
+    packet_sink_t *sink = packet_sink_alloc();
+    int window;
+
+    memset(conn, 0, sizeof(tcp_connection_t));
+    conn->sink = sink;
+    conn->cb_data = cb_data;
+    conn->context = context;
+    conn->snd_mss = 536; // RFC 9293 default, until the SYN-ACK tells us otherwise
+    conn->snd_una = conn->snd_nxt = gogoboot_read_timer() * 64000;
+
+    // advertise no more than the NE2000 can buffer while we are busy elsewhere
+    window = eth_rxbuffer_size() - PACKET_MAXLEN;
+    if(window < TCP_MSS)
+        window = TCP_MSS;
+    if(window > 0xffff)
+        window = 0xffff;
+    conn->rcv_window = window;
+
+    sink->match_interface_local_ip = true;
+    sink->match_ipv4_protocol = ip_proto_tcp;
+    sink->match_remote_ip = remote_ip;
+    sink->match_remote_port = remote_port;
+    sink->match_local_port = 49152 + (gogoboot_read_timer() & 0x3fff);
+    sink->sink_private = conn;
+    sink->cb_packet_received = tcp_packet_received;
+    sink->cb_timer_expired = tcp_timer_expired;
+    net_add_packet_sink(sink);
+
+    conn->state = tcp_syn_sent;
+    tcp_transmit(conn);
+    sink->timer = set_timer_ms(TCP_TICK_MS);
+
+    if(!tcp_wait(conn, tcp_is_established)){
+        tcp_close(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+bool tcp_write(tcp_connection_t *conn, const void *data, int length)
+{
+    if(conn->state != tcp_established && conn->state != tcp_close_wait)
+        return false;
+
+    conn->tx_data = data;
+    conn->tx_length = length;
+    if(conn->snd_una == conn->snd_nxt)
+        tcp_transmit(conn);
+
+    return tcp_wait(conn, tcp_is_sent);
+}
+
+bool tcp_wait_close(tcp_connection_t *conn)
+{
+    return tcp_wait(conn, tcp_is_remote_closed);
+}
+
+void tcp_close(tcp_connection_t *conn)
+{
+    timer_t timeout;
+
+    if(conn->state == tcp_established || conn->state == tcp_close_wait){
+        conn->tx_length = 0;
+        conn->fin_queued = true;
+        conn->state = (conn->state == tcp_established) ? tcp_fin_wait : tcp_last_ack;
+        if(conn->snd_una == conn->snd_nxt)
+            tcp_transmit(conn);
+
+        // give the remote end a moment to acknowledge, but don't hang about
+        timeout = set_timer_ms(TCP_CLOSE_WAIT_MS);
+        while(!tcp_is_closed(conn) && !conn->reset && !timer_expired(timeout))
+            net_pump();
+    }else if(conn->state == tcp_syn_sent){
+        tcp_send_segment(conn, tcp_flag_rst, conn->snd_nxt, NULL, 0);
+    }
+
+    net_remove_packet_sink(conn->sink);
+    packet_sink_free(conn->sink);
+    free(conn);
+}
@@ -3,18 +3,31 @@
 #include <uart.h>
 #include <timers.h>
 #include <fatfs/ff.h>
+#include <init.h>
+#include <loader.h>
 #include <cli.h>
 #include <net.h>
+#include <job.h>
+#include <disk.h>
+#include <task.h>
 
 // documentation:
 // https://www.rfc-editor.org/rfc/rfc1350 - TFTP Protocol (Revision 2)
 // https://www.rfc-editor.org/rfc/rfc2347 - TFTP Option Extension
+// https://www.rfc-editor.org/rfc/rfc2090 - TFTP Multicast Option
 // https://www.rfc-editor.org/rfc/rfc2349 - TFTP Timeout Interval and Transfer Size Options
 // https://www.rfc-editor.org/rfc/rfc7440 - TFTP Windowsize Option
 // https://www.compuphase.com/tftp.htm - Extending TFTP
 
 #define REQUEST_TIMEOUT 1500 // ms
 #define DATA_TIMEOUT     250 // ms
+#define MAX_BLOCK_SIZE  1468 // largest payload in an unfragmented 1500 byte MTU frame
+#define FRAG_BLOCK_SIZE 8192 // gets: reassembled from fragments, if the receive ring holds one
+#define MAX_WINDOW_SIZE   16
+#define MC_QUIET_TIMEOUTS  4 // passive multicast client: re-request after this many quiet timeouts
+#define MGET_MAX_SESSIONS  4 // transfers an mget runs at once
+#define BATCH_SECTORS    128 // gets to raw sectors or a preallocated file: written a batch at a time
+#define TFTP_STREAM_SIZE 0x7fffffff // total_size of a stream put, until it ends
 
 typedef struct tftp_transfer_t tftp_transfer_t;
 
@@ -30,12 +43,59 @@ struct tftp_transfer_t {
     uint16_t rollover_value;
     int bytes_transferred;
     int total_size;
-    int window_size;
+    int window_size;             // current window, adjusted as we go
+    int window_max;              // window agreed with the server
+    int window_share;            // get: most window our share of the receive ring allows
+    int asked_block_size;        // what the request offered: the most an OACK may agree to
+    int asked_window;            // ... 0 if we did not offer a window
+    int in_flight;               // put: blocks sent in the current window
     bool started;
     bool completed;
     bool success;
     int timeouts;
     int retransmits_this_block;
+    uint32_t block_seq;          // blocks received, without 16-bit wrap
+    uint8_t *staging;            // get: payloads are received directly into here
+    uint32_t *staging_seq;       // block_seq held in each staging slot
+    int staging_slots;
+    bool to_memory;              // get: load into RAM at memory_address instead of disk_file;
+                                 // put: send total_size bytes from memory_address
+    bool memory_ready;           // memory_address range has been checked, bounce buffer set up
+    uint32_t memory_address;
+    uint32_t placed_seq;         // to_memory: highest block_seq received in place
+    uint8_t *ring;               // put: read-ahead of the file, ring_slots blocks
+    int ring_slots;
+    uint32_t ring_first;         // index of the first block held (file offset / block_size)
+    int ring_count;              // blocks held
+    packet_sink_t *sink;         // unicast sink, talking to the server
+    bool want_multicast;         // get: ask for the RFC 2090 multicast option
+    bool multicast;              // ... which the server accepted
+    bool master_client;          // we are the multicast client that ACKs
+    uint32_t mc_group;
+    uint16_t mc_port;
+    packet_sink_t *mc_sink;      // receives DATA sent to the group
+    uint8_t *mc_received;        // bitmap of blocks received, bit n = block_seq n+1
+    uint32_t mc_blocks;          // blocks in the file, including any zero length final block
+    int mc_quiet;                // timeouts waited as a passive client
+    int ring_share;              // get: sessions sharing the card's receive ring
+    tftp_transfer_t *next_receiving; // get: the next of them
+    uint32_t start_time;
+    int reported_transferred;    // progress last printed
+    bool background;             // a job: allocated from the heap, not the arena
+    bool to_disk;                // get: write to consecutive sectors of raw_disk, bypassing FatFs
+    int raw_disk;
+    uint32_t raw_sector;         // next sector to write
+    uint32_t raw_limit;          // sectors on the disk
+    bool expanded;               // get: disk_file was preallocated from tsize
+    uint8_t *batch;              // BATCH_SECTORS, filled from the payloads, or NULL
+    int batch_fill;              // bytes in batch
+    uint8_t *batch_spare;        // the other half of the double buffer, or NULL
+    disk_request_t batch_req;    // the last batch, on its way to the disk
+    bool batch_pending;          // batch_req has been submitted
+    bool serving;                // server session: sending to a client that sent us an RRQ
+    uint8_t oack_options;        // ... options it asked for, acknowledged until it ACKs block 0
+    tftp_source_t source;        // put: produces the data as it is sent; total_size is
+    void *source_context;        // ... TFTP_STREAM_SIZE until it runs dry
 };
 
 typedef struct tftp_header_t tftp_header_t;
@@ -65,6 +125,8 @@ static const uint16_t tftp_op_ack = 4;
 static const uint16_t tftp_op_err = 5;
 static const uint16_t tftp_op_options_ack = 6;
 
+static void tftp_client_packet_received(packet_sink_t *sink, packet_t *packet);
+
 static uint16_t expected_block_number(tftp_transfer_t *tftp, int count)
 {
     int expected_block;
@@ -94,29 +156,130 @@ static int options_append(char *options, int offset, char *extra)
     return offset + extra_len;
 }
 
+static int options_append_int(char *options, int offset, uint32_t n)
+{
+    char buf[12];
+    char *t = buf+sizeof(buf);
+    *--t = 0;
+    do {
+        *--t = (n % 10)+'0';
+        n/=10;
+    } while(n);
+    return options_append(options, offset, t);
+}
+
+// AIMD: halve the window on loss, grow it by one block for each window that gets through.
+// only the receiver adapts, by ACKing sooner: it waits for a whole window before it
+// ACKs, so a sender that sent less would stall it until it timed out, every window
+static void tftp_window_adapt(tftp_transfer_t *tftp, bool loss)
+{
+    if(tftp->is_put)
+        return;
+
+    if(loss){
+        tftp->window_size >>= 1;
+        if(tftp->window_size < 1)
+            tftp->window_size = 1;
+    }else if(tftp->window_size < tftp->window_max && tftp->window_size < tftp->window_share){
+        tftp->window_size++;
+    }
+}
+
+// receive ring space taken by a DATA packet of this size, fragmented to fit a 1500 byte MTU
+static int tftp_ring_bytes(int block_size)
+{
+    int frames = (block_size + 4 + sizeof(udp_header_t) + 1479) / 1480;
+    return frames * (256 * 6); // 6 * 256 = 1536 bytes per frame
+}
+
+// enough window to keep our share of the ethernet device receive buffer busy,
+// ie a couple of buffers' worth of full size frames
+static int tftp_ring_window(tftp_transfer_t *tftp, int blksize)
+{
+    int windowsize = 2 * (eth_rxbuffer_size() / tftp_ring_bytes(blksize)) / tftp->ring_share;
+
+    if(windowsize > MAX_WINDOW_SIZE)
+        windowsize = MAX_WINDOW_SIZE;
+    if(windowsize < 1) /* need at least 1 */
+        windowsize = 1;
+    return windowsize;
+}
+
+static tftp_transfer_t *tftp_receiving = NULL; // gets in progress, sharing the receive ring
+
+// whenever a get starts or ends, the others' shares change: a window already
+// agreed with a server can't grow, but we can ACK sooner
+static void tftp_reshare(void)
+{
+    tftp_transfer_t *tftp;
+    int sessions = 0;
+
+    for(tftp = tftp_receiving; tftp; tftp = tftp->next_receiving)
+        sessions++;
+
+    for(tftp = tftp_receiving; tftp; tftp = tftp->next_receiving){
+        tftp->ring_share = sessions;
+        tftp->window_share = tftp_ring_window(tftp, tftp->block_size);
+        if(tftp->window_size > tftp->window_share)
+            tftp->window_size = tftp->window_share;
+    }
+}
+
+static void tftp_receiving_join(tftp_transfer_t *tftp)
+{
+    tftp->next_receiving = tftp_receiving;
+    tftp_receiving = tftp;
+    tftp_reshare();
+}
+
+static void tftp_receiving_leave(tftp_transfer_t *tftp)
+{
+    for(tftp_transfer_t **p = &tftp_receiving; *p; p = &(*p)->next_receiving)
+        if(*p == tftp){
+            *p = tftp->next_receiving;
+            tftp_reshare();
+            return;
+        }
+}
+
+// block size to ask for: we can't fragment on transmit, so puts use one frame per block
+static int tftp_request_block_size(tftp_transfer_t *tftp)
+{
+    int size;
+
+    if(tftp->is_put)
+        return MAX_BLOCK_SIZE;
+
+    size = get_environment_variable_int("tftp_blksize", 0);
+    if(size){
+        if(size < 8)
+            size = 8;
+        if(size > NET_MAX_DATAGRAM - 4 - sizeof(udp_header_t))
+            size = NET_MAX_DATAGRAM - 4 - sizeof(udp_header_t);
+        return size;
+    }
+
+    return (eth_rxbuffer_size() >= tftp_ring_bytes(FRAG_BLOCK_SIZE)) ? FRAG_BLOCK_SIZE : MAX_BLOCK_SIZE;
+}
+
 static packet_t *tftp_create_request(packet_sink_t *sink)
 {
     tftp_transfer_t *tftp = sink->sink_private;
     char options[MAXOPT];
     int offset = 0;
-    int windowsize;
-    char wsize[2];
+    int windowsize, blksize;
+
+    blksize = tftp_request_block_size(tftp);
 
-    /* when receiving, try to avoid overflowing ethernet device receive buffer */
-    /* no issue on transmit path */
-    /* 5 * 256 = 1280 bytes; allows 1024 byte payload + up to 210 headers etc */
+    /* when receiving, ask for our share of the ethernet device receive buffer;
+       we back off at runtime if packets are lost, or if more gets start. no
+       issue on transmit path. */
     if(tftp->is_put)
-        windowsize = 8;
+        windowsize = MAX_WINDOW_SIZE;
     else
-        windowsize = eth_rxbuffer_size() / (256 * 5); 
-
-    if(windowsize > 8) /* 8 works really well */
-        windowsize = 8;
-    if(windowsize < 1) /* need at least 1 */
-        windowsize = 1;
-
-    wsize[0] = '0' + windowsize;
-    wsize[1] = 0;
+        windowsize = tftp_ring_window(tftp, blksize);
+    tftp->asked_block_size = blksize;
+    tftp->asked_window = tftp->want_multicast ? 0 : windowsize;
 
     offset = options_append(options, offset, tftp->tftp_filename);
     offset = options_append(options, offset, "octet");
@@ -124,27 +287,23 @@ static packet_t *tftp_create_request(packet_sink_t *sink)
     offset = options_append(options, offset, "rollover");
     offset = options_append(options, offset, "0");
 
-    offset = options_append(options, offset, "tsize");
-    if(tftp->is_put){
-        uint32_t n = tftp->total_size;
-        char sizebuf[12];
-        char *t = sizebuf+sizeof(sizebuf);  
-        *--t = 0; 
-        do { 
-            *--t = (n % 10)+'0'; 
-            n/=10; 
-        } while(n);
-        offset = options_append(options, offset, t);
-    }else{
-        /* get request: 0 = please tell me total file size */
-        offset = options_append(options, offset, "0");
+    /* get request: 0 = please tell me total file size; a stream's isn't known yet */
+    if(!tftp->source){
+        offset = options_append(options, offset, "tsize");
+        offset = options_append_int(options, offset, tftp->is_put ? tftp->total_size : 0);
     }
 
     offset = options_append(options, offset, "blksize");
-    offset = options_append(options, offset, "1024");
+    offset = options_append_int(options, offset, blksize);
 
-    offset = options_append(options, offset, "windowsize");
-    offset = options_append(options, offset, wsize);
+    if(tftp->want_multicast){
+        // RFC 2090 is lock-step; the master client ACKs every block
+        offset = options_append(options, offset, "multicast");
+        offset = options_append(options, offset, "");
+    }else{
+        offset = options_append(options, offset, "windowsize");
+        offset = options_append_int(options, offset, windowsize);
+    }
 
     packet_t *packet = packet_create_for_sink(sink, offset + 2);
     packet->udp->destination_port = htons(69); // RRQ/WRQ always goes to server port 69
@@ -182,25 +341,154 @@ static packet_t *tftp_create_data(packet_sink_t *sink, uint16_t block_number)
     return packet;
 }
 
+// the read-ahead ring holds two windows of the file, starting at the oldest
+// unacknowledged block: enough to retransmit the window in flight and send the
+// next one without touching the disk, refilled with large reads while we wait.
+static void tftp_put_alloc_ring(tftp_transfer_t *tftp)
+{
+    int slots = 2 * tftp->window_max;
+
+    tftp->ring = malloc_unchecked(slots * tftp->block_size);
+    if(tftp->ring) // else fall back to reading each block as we send it
+        tftp->ring_slots = slots;
+}
+
+static bool tftp_put_read_failed(tftp_transfer_t *tftp, FRESULT fr)
+{
+    printf("tftp: failed to read from \"%s\": %s\n", tftp->disk_filename, f_errmsg(fr));
+    tftp->completed = true;
+    tftp->success = false;
+    return false;
+}
+
+static bool tftp_put_source_failed(tftp_transfer_t *tftp, const char *why)
+{
+    printf("tftp: %s\n", why);
+    tftp->completed = true;
+    tftp->success = false;
+    return false;
+}
+
+static bool tftp_put_fill_ring(tftp_transfer_t *tftp)
+{
+    uint32_t first = tftp->bytes_transferred / tftp->block_size;
+    uint32_t offset, want;
+    int slot, blocks, n;
+    FRESULT fr;
+    UINT size;
+
+    // discard blocks that have been acknowledged
+    if(first - tftp->ring_first >= tftp->ring_count)
+        tftp->ring_count = 0;
+    else
+        tftp->ring_count -= first - tftp->ring_first;
+    tftp->ring_first = first;
+
+    while(tftp->ring_count < tftp->ring_slots){
+        offset = (tftp->ring_first + tftp->ring_count) * tftp->block_size;
+        if(offset >= tftp->total_size)
+            break;
+
+        // as many blocks as will fit before the ring wraps
+        slot = (tftp->ring_first + tftp->ring_count) % tftp->ring_slots;
+        blocks = tftp->ring_slots - tftp->ring_count;
+        if(blocks > tftp->ring_slots - slot)
+            blocks = tftp->ring_slots - slot;
+        want = blocks * tftp->block_size;
+        if(want > tftp->total_size - offset)
+            want = tftp->total_size - offset;
+
+        if(tftp->source){
+            // a stream only moves forwards: the ring holds everything not yet acknowledged
+            n = tftp->source(tftp->source_context, tftp->ring + slot * tftp->block_size, want);
+            if(n < 0)
+                return tftp_put_source_failed(tftp, "failed to produce the data to send");
+            if(n < want){
+                tftp->total_size = offset + n; // now we know
+                want = n;
+            }
+        }else{
+            if(f_tell(&tftp->disk_file) != offset){
+                fr = f_lseek(&tftp->disk_file, offset);
+                if(fr != FR_OK)
+                    return tftp_put_read_failed(tftp, fr);
+            }
+            fr = f_read(&tftp->disk_file, tftp->ring + slot * tftp->block_size, want, &size);
+            if(fr == FR_OK && size != want)
+                fr = FR_DISK_ERR; // file shrank underneath us
+            if(fr != FR_OK)
+                return tftp_put_read_failed(tftp, fr);
+        }
+
+        tftp->ring_count += (want + tftp->block_size - 1) / tftp->block_size;
+    }
+
+    return true;
+}
+
+// fetch the block at file offset 'offset' into dest, returning its length
+static bool tftp_put_read_block(tftp_transfer_t *tftp, uint32_t offset, uint8_t *dest, UINT *size)
+{
+    uint32_t block = offset / tftp->block_size;
+    FRESULT fr;
+
+    *size = 0;
+    if(offset >= tftp->total_size)
+        return true; // zero length final block
+
+    if(tftp->to_memory){
+        *size = tftp->total_size - offset;
+        if(*size > tftp->block_size)
+            *size = tftp->block_size;
+        memcpy(dest, (void*)(uintptr_t)(tftp->memory_address + offset), *size);
+        return true;
+    }
+
+    if(!tftp->ring && tftp->source){
+        tftp_put_alloc_ring(tftp); // a server that sent no OACK, so none yet
+        if(!tftp->ring)
+            return tftp_put_source_failed(tftp, "no memory to send from");
+    }
+
+    if(!tftp->ring){
+        if(f_tell(&tftp->disk_file) != offset){
+            fr = f_lseek(&tftp->disk_file, offset);
+            if(fr != FR_OK)
+                return tftp_put_read_failed(tftp, fr);
+        }
+        fr = f_read(&tftp->disk_file, dest, tftp->block_size, size);
+        if(fr != FR_OK)
+            return tftp_put_read_failed(tftp, fr);
+        return true;
+    }
+
+    if(block - tftp->ring_first >= tftp->ring_count && !tftp_put_fill_ring(tftp))
+        return false;
+    if(offset >= tftp->total_size)
+        return true; // a stream that ended on a block boundary
+
+    *size = tftp->total_size - offset;
+    if(*size > tftp->block_size)
+        *size = tftp->block_size;
+    memcpy(dest, tftp->ring + (block % tftp->ring_slots) * tftp->block_size, *size);
+    return true;
+}
+
 static void tftp_put_send_data(packet_sink_t *sink, int count)
 {
     tftp_transfer_t *tftp = sink->sink_private;
     bool last_block = false;
     packet_t *packet;
     tftp_header_t *message;
-    FRESULT fr;
     UINT size;
 
-    f_lseek(&tftp->disk_file, tftp->bytes_transferred);
+    tftp->in_flight = 0;
 
     for(int n=0; !last_block && n < count; n++){
         packet = tftp_create_data(sink, expected_block_number(tftp, n + 1));
         message = (tftp_header_t*)packet->data;
-        fr = f_read(&tftp->disk_file, message->payload.data.data, tftp->block_size, &size);
-        if(fr != FR_OK){
-            printf("tftp: failed to read from \"%s\": %s\n", tftp->disk_filename, f_errmsg(fr));
-            tftp->completed = true;
-            tftp->success = false;
+        if(!tftp_put_read_block(tftp, tftp->bytes_transferred + n * tftp->block_size,
+                                message->payload.data.data, &size)){
             packet_free(packet);
             return;
         }
@@ -213,9 +501,14 @@ static void tftp_put_send_data(packet_sink_t *sink, int count)
             last_block = true;
         }
         net_tx(packet);
+        tftp->in_flight++;
     }
 
     sink->timer = set_timer_ms(DATA_TIMEOUT);
+
+    // read ahead while the window is on the wire
+    if(tftp->ring)
+        tftp_put_fill_ring(tftp);
 }
 
 static void tftp_put_process_ack(packet_sink_t *sink, packet_t *packet)
@@ -227,7 +520,7 @@ static void tftp_put_process_ack(packet_sink_t *sink, packet_t *packet)
 
     block = ntohs(message->payload.ack.block_number);
 
-    for(blocks_transferred = tftp->window_size; blocks_transferred >= 0; blocks_transferred--){
+    for(blocks_transferred = tftp->window_max; blocks_transferred >= 0; blocks_transferred--){
         if(block == expected_block_number(tftp, blocks_transferred))
             break;
     }
@@ -248,8 +541,9 @@ static void tftp_put_process_ack(packet_sink_t *sink, packet_t *packet)
         tftp->completed = true;
         tftp->success = true;
     }else{
-        // send more
-        tftp_put_send_data(sink, (blocks_transferred == tftp->window_size) ? tftp->window_size : 1);
+        // send more; a partial ack means the receiver lost some of the window
+        tftp_window_adapt(tftp, blocks_transferred < tftp->in_flight);
+        tftp_put_send_data(sink, tftp->window_size);
     }
 }
 
@@ -259,6 +553,216 @@ static void tftp_get_send_ack(packet_sink_t *sink)
     sink->timer = set_timer_ms(DATA_TIMEOUT);
 }
 
+// received blocks are placed in a ring of 2 x window_size slots, indexed by the
+// unwrapped block sequence number: this covers both the accepted-but-unflushed
+// blocks and those still to arrive, so a slot is never reused while in use.
+static void tftp_get_alloc_staging(tftp_transfer_t *tftp)
+{
+    int slots = 2 * tftp->window_max;
+
+    if(tftp->staging || (tftp->block_size & 1) || tftp->block_size > MAX_BLOCK_SIZE)
+        return; // fragmented blocks are reassembled into packet buffers anyway
+
+    tftp->staging = malloc_unchecked(slots * (tftp->block_size + sizeof(uint32_t)));
+    if(!tftp->staging)
+        return; // fall back to receiving into packet buffers
+
+    tftp->staging_seq = (uint32_t*)(tftp->staging + slots * tftp->block_size);
+    memset(tftp->staging_seq, 0, slots * sizeof(uint32_t));
+    tftp->staging_slots = slots;
+}
+
+// loading to memory, blocks go straight to their final place. a block we have already
+// received in place is declined, so a corrupt duplicate cannot overwrite a good copy;
+// any block not placed is copied there when it is accepted.
+static uint8_t *tftp_get_memory_destination(tftp_transfer_t *tftp, uint32_t seq, int size)
+{
+    uint32_t offset = (seq - 1) * tftp->block_size;
+    uint8_t *dest;
+
+    if(seq <= tftp->placed_seq || (size & 1) || offset + size > tftp->total_size)
+        return NULL; // odd lengths would have the driver store a byte past the end
+
+    dest = load_target_pointer(tftp->memory_address + offset, size);
+    if(!dest || ((uintptr_t)dest & 1))
+        return NULL;
+
+    tftp->placed_seq = seq;
+    return dest;
+}
+
+// called from the driver while the packet is still in the NE2000 buffer memory
+static uint8_t *tftp_get_payload_destination(packet_sink_t *sink, packet_t *packet, int *offset)
+{
+    tftp_transfer_t *tftp = sink->sink_private;
+    tftp_header_t *message = (tftp_header_t*)packet->data;
+    uint32_t seq;
+    uint16_t block;
+    int k, slot;
+
+    if((!tftp->staging && !tftp->memory_ready) || tftp->completed || tftp->multicast ||
+       ntohs(message->opcode) != tftp_op_data || packet->data_length - 4 > tftp->block_size)
+        return NULL;
+
+    block = ntohs(message->payload.data.block_number);
+    for(k=1; k<=tftp->window_max; k++)
+        if(block == expected_block_number(tftp, k))
+            break;
+    if(k > tftp->window_max)
+        return NULL;
+
+    seq = tftp->block_seq + k;
+    *offset = 4; // keep the TFTP header in the packet
+
+    if(tftp->to_memory)
+        return tftp_get_memory_destination(tftp, seq, packet->data_length - 4);
+
+    slot = seq % tftp->staging_slots;
+    if(tftp->staging_seq[slot] == seq)
+        return NULL; // duplicate; do not overwrite a copy we may have accepted
+    tftp->staging_seq[slot] = seq;
+
+    return tftp->staging + slot * tftp->block_size;
+}
+
+// with the size known, check (and bounce buffer) the whole range once up front
+static bool tftp_get_prepare_memory(tftp_transfer_t *tftp)
+{
+    if(tftp->memory_address == TFTP_LOAD_HIGH){
+        if(!tftp->total_size){
+            printf("tftp: server did not report the file size\n");
+            tftp->completed = true;
+            return false;
+        }
+        // as high as possible, leaving low memory free for whatever gets loaded from it
+        tftp->memory_address = (free_ram_top - tftp->total_size) & ~0xfff;
+        printf("tftp: loading to memory at 0x%lx\n", tftp->memory_address);
+    }
+
+    if(tftp->total_size){
+        if(!load_target_prepare(tftp->memory_address, tftp->total_size)){
+            tftp->completed = true;
+            return false;
+        }
+        tftp->memory_ready = true;
+    }
+
+    return true;
+}
+
+// with the size known, give the file all its clusters in one contiguous run up
+// front, and write it in whole batches: no FAT updates as it grows, and the
+// file is quicker to load later. multicast blocks arrive out of order, so those
+// still go in one at a time, but into the space set aside
+static void tftp_get_prepare_file(tftp_transfer_t *tftp)
+{
+    if(!tftp->total_size || tftp->expanded)
+        return;
+
+    if(f_expand(&tftp->disk_file, tftp->total_size, 1) != FR_OK)
+        return; // no contiguous space: let it grow as before
+
+    tftp->expanded = true;
+    if(!tftp->multicast){
+        tftp->batch = malloc_unchecked(BATCH_SECTORS * 512);
+        if(tftp->batch)
+            tftp->batch_spare = malloc_unchecked(BATCH_SECTORS * 512);
+    }
+}
+
+// value is "addr,port,mc"; addr and port may be empty in later OACKs
+static void tftp_mc_parse_option(tftp_transfer_t *tftp, char *val)
+{
+    char *port, *mc;
+
+    port = strchr(val, ',');
+    if(!port)
+        return;
+    *port++ = 0;
+    mc = strchr(port, ',');
+    if(!mc)
+        return;
+    *mc++ = 0;
+
+    if(*val)
+        tftp->mc_group = net_parse_ipv4(val);
+    if(*port)
+        tftp->mc_port = atoi(port);
+    tftp->master_client = (atoi(mc) == 1);
+    tftp->multicast = true;
+}
+
+// blocks can now arrive in any order and with gaps, so we track each one in a bitmap
+static bool tftp_mc_start(tftp_transfer_t *tftp)
+{
+    packet_sink_t *mc_sink;
+
+    if(tftp->mc_sink)
+        return true; // already running, we have just been made master
+
+    if(!tftp->total_size || !tftp->mc_group || !tftp->mc_port){
+        printf("tftp: multicast requires the file size, group and port\n");
+        tftp->completed = true;
+        return false;
+    }
+
+    tftp->mc_blocks = tftp->total_size / tftp->block_size + 1;
+    tftp->mc_received = malloc_unchecked((tftp->mc_blocks + 7) / 8);
+    if(!tftp->mc_received){
+        printf("tftp: insufficient memory\n");
+        tftp->completed = true;
+        return false;
+    }
+    memset(tftp->mc_received, 0, (tftp->mc_blocks + 7) / 8);
+
+    if(!net_multicast_join(tftp->mc_group)){
+        tftp->completed = true;
+        return false;
+    }
+
+    mc_sink = packet_sink_alloc();
+    mc_sink->match_local_ip = tftp->mc_group;
+    mc_sink->match_local_port = tftp->mc_port;
+    mc_sink->match_remote_ip = tftp->sink->match_remote_ip;
+    mc_sink->match_ipv4_protocol = ip_proto_udp;
+    mc_sink->sink_private = tftp;
+    mc_sink->cb_packet_received = tftp_client_packet_received;
+    net_add_packet_sink(mc_sink);
+    tftp->mc_sink = mc_sink;
+
+    printf("tftp: multicast %d.%d.%d.%d port %d\n",
+            (int)(tftp->mc_group >> 24 & 0xff),
+            (int)(tftp->mc_group >> 16 & 0xff),
+            (int)(tftp->mc_group >>  8 & 0xff),
+            (int)(tftp->mc_group       & 0xff),
+            tftp->mc_port);
+
+    return true;
+}
+
+static void tftp_mc_stop(tftp_transfer_t *tftp)
+{
+    if(!tftp->mc_sink)
+        return;
+
+    net_remove_packet_sink(tftp->mc_sink);
+    packet_sink_free(tftp->mc_sink);
+    tftp->mc_sink = NULL;
+    net_multicast_leave(tftp->mc_group);
+}
+
+static void tftp_send_error(packet_sink_t *sink, uint16_t code, const char *text)
+{
+    int len = strlen(text) + 1;
+    packet_t *packet = packet_create_for_sink(sink, len + 4);
+    tftp_header_t *message = (tftp_header_t*)packet->data;
+
+    message->opcode = htons(tftp_op_err);
+    message->payload.error.error_code = htons(code);
+    memcpy(message->payload.error.error_message, text, len);
+    net_tx(packet);
+}
+
 static void tftp_process_options_ack(packet_sink_t *sink, tftp_header_t *message, int message_len)
 {
     tftp_transfer_t *tftp = sink->sink_private;
@@ -288,6 +792,11 @@ static void tftp_process_options_ack(packet_sink_t *sink, tftp_header_t *message
             break;
         ptr++;
         // process option + value
+        if(!strcmp(opt, "multicast")){
+            printf(" %s=%s", opt, val);
+            tftp_mc_parse_option(tftp, val);
+            continue;
+        }
         val_int = atoi(val);
         if(!strcmp(opt, "rollover") && (val_int == 0 || val_int == 1)){
             tftp->rollover_value = val_int;
@@ -295,22 +804,213 @@ static void tftp_process_options_ack(packet_sink_t *sink, tftp_header_t *message
             if(!tftp->is_put)
                 tftp->total_size = val_int;
         }else if(!strcmp(opt, "blksize")){
+            if(val_int < 8 || val_int > tftp->asked_block_size)
+                goto refuse;
             tftp->block_size = val_int;
         }else if(!strcmp(opt, "windowsize")){
-            tftp->window_size = val_int;
+            if(val_int < 1 || val_int > tftp->asked_window)
+                goto refuse;
+            tftp->window_size = tftp->window_max = val_int;
         }
         printf(" %s=%d", opt, val_int);
     }
 
     putchar('\n');
+    tftp_reshare(); // the block size it agreed to changes our share of the ring
+
+    if(tftp->is_put){
+        // nothing to prepare
+    }else if(tftp->to_memory){
+        if(!tftp_get_prepare_memory(tftp))
+            return;
+    }else{
+        if(!tftp->to_disk)
+            tftp_get_prepare_file(tftp);
+        if(!tftp->multicast)
+            tftp_get_alloc_staging(tftp);
+    }
+
+    if(tftp->multicast){
+        if(!tftp_mc_start(tftp))
+            return;
+        tftp->mc_quiet = 0;
+        if(tftp->master_client) // ACK the last block we have in sequence, the server sends the next
+            tftp_get_send_ack(sink);
+        else                    // listen only, until the server makes us master
+            sink->timer = set_timer_ms(REQUEST_TIMEOUT);
+        return;
+    }
 
     if(tftp->is_put){
         // for sending files, send our first DATA packets to agree to the options
+        if(!tftp->to_memory)
+            tftp_put_alloc_ring(tftp);
         tftp_put_send_data(sink, tftp->window_size);
     }else{
         // for receiving files, send an ACK with block=0 to agree to the options
         tftp_get_send_ack(sink);
     }
+    return;
+
+refuse: // RFC 2347: the server may only agree to what we offered, or less
+    printf(" %s=%d refused\n", opt, val_int);
+    tftp_send_error(sink, 8, "option refused");
+    tftp->completed = true;
+    tftp->success = false;
+}
+
+// wait for the last batch submitted to reach the disk
+static bool tftp_batch_wait(tftp_transfer_t *tftp)
+{
+    if(!tftp->batch_pending)
+        return true;
+
+    tftp->batch_pending = false;
+    if(!disk_request_wait(&tftp->batch_req)){
+        printf("tftp: write to disk %d failed at sector %lu\n", tftp->batch_req.disk, tftp->batch_req.sector);
+        return false;
+    }
+    return true;
+}
+
+// queue the batch for the disk and carry on filling the other buffer; the
+// disk takes it while we are receiving the next one
+static bool tftp_batch_submit(tftp_transfer_t *tftp, int disk, uint32_t sector, int sectors)
+{
+    uint8_t *full = tftp->batch;
+
+    if(!tftp_batch_wait(tftp))
+        return false;
+
+    tftp->batch_req.disk = disk;
+    tftp->batch_req.buff = full;
+    tftp->batch_req.sector = sector;
+    tftp->batch_req.count = sectors;
+    tftp->batch_req.is_write = true;
+    if(tftp->to_disk)
+        disk_submit(&tftp->batch_req);
+    else
+        disk_cache_submit(&tftp->batch_req);
+    tftp->batch_pending = true;
+
+    tftp->batch = tftp->batch_spare;
+    tftp->batch_spare = full;
+    tftp->batch_fill = 0;
+    return true;
+}
+
+// write the batch out. to a file it starts sector aligned, so FatFs writes it
+// straight from the batch, and a whole batch goes to the file's contiguous
+// run as one disk write; to raw sectors a short final batch is padded. with
+// a spare buffer the write is queued rather than waited for
+static bool tftp_batch_flush(tftp_transfer_t *tftp)
+{
+    int sectors = (tftp->batch_fill + 511) >> 9;
+    LBA_t sector;
+    FRESULT fr;
+
+    if(!sectors)
+        return true;
+
+    if(!tftp->to_disk){
+        fr = FR_DENIED;
+        if(!(tftp->batch_fill & 511)){
+            if(tftp->batch_spare){
+                fr = f_contiguous_sector(&tftp->disk_file, sectors, &sector);
+                if(fr == FR_OK)
+                    return tftp_batch_submit(tftp, tftp->disk_file.obj.fs->pdrv, sector, sectors);
+            }else
+                fr = f_write_contiguous(&tftp->disk_file, tftp->batch, sectors);
+        }
+        if(fr == FR_DENIED){
+            if(!tftp_batch_wait(tftp))
+                return false;
+            fr = f_write(&tftp->disk_file, tftp->batch, tftp->batch_fill, NULL);
+        }
+        if(fr != FR_OK){
+            printf("tftp: failed to write to \"%s\": %s\n", tftp->disk_filename, f_errmsg(fr));
+            return false;
+        }
+        tftp->batch_fill = 0;
+        return true;
+    }
+
+    memset(tftp->batch + tftp->batch_fill, 0, (sectors << 9) - tftp->batch_fill);
+
+    if(sectors > tftp->raw_limit - tftp->raw_sector){
+        printf("tftp: image does not fit on disk %d\n", tftp->raw_disk);
+        return false;
+    }
+    if(tftp->batch_spare){
+        tftp->raw_sector += sectors;
+        return tftp_batch_submit(tftp, tftp->raw_disk, tftp->raw_sector - sectors, sectors);
+    }
+    if(!disk_data_write(tftp->raw_disk, tftp->batch, tftp->raw_sector, sectors)){
+        printf("tftp: write to disk %d failed at sector %lu\n", tftp->raw_disk, tftp->raw_sector);
+        return false;
+    }
+
+    tftp->raw_sector += sectors;
+    tftp->batch_fill = 0;
+    return true;
+}
+
+static void tftp_batch_write(tftp_transfer_t *tftp, uint8_t *data, int size)
+{
+    int chunk;
+
+    while(size){
+        chunk = BATCH_SECTORS * 512 - tftp->batch_fill;
+        if(chunk > size)
+            chunk = size;
+        memcpy(tftp->batch + tftp->batch_fill, data, chunk);
+        tftp->batch_fill += chunk;
+        data += chunk;
+        size -= chunk;
+        if(tftp->batch_fill == BATCH_SECTORS * 512 && !tftp_batch_flush(tftp)){
+            tftp->completed = true;
+            tftp->success = false;
+            return;
+        }
+    }
+}
+
+static void tftp_get_write(tftp_transfer_t *tftp, uint8_t *data, int size)
+{
+    FRESULT fr;
+    uint32_t paddr;
+
+    if(size <= 0 || (tftp->completed && !tftp->success))
+        return;
+
+    if(tftp->batch){
+        tftp->bytes_transferred += size;
+        tftp_batch_write(tftp, data, size);
+        return;
+    }
+
+    if(tftp->to_memory){
+        paddr = tftp->memory_address + tftp->bytes_transferred;
+        // no tsize, or the server sent more than it told us: check as we go
+        if((!tftp->memory_ready || tftp->bytes_transferred + size > tftp->total_size) &&
+           !load_target_prepare(paddr, size)){
+            tftp->completed = true;
+            tftp->success = false;
+            return;
+        }
+        if(data) // NULL: already received in place
+            load_target_write(paddr, data, size);
+        tftp->bytes_transferred += size;
+        return;
+    }
+
+    fr = f_write(&tftp->disk_file, data, size, NULL);
+    tftp->bytes_transferred += size;
+    if(fr != FR_OK){
+        printf("tftp: failed to write to \"%s\": %s\n", tftp->disk_filename, f_errmsg(fr));
+        tftp->completed = true;
+        tftp->success = false;
+    }
 }
 
 static void tftp_get_flush_data_and_ack(packet_sink_t *sink)
@@ -318,8 +1018,8 @@ static void tftp_get_flush_data_and_ack(packet_sink_t *sink)
     tftp_transfer_t *tftp = sink->sink_private;
     packet_t *packet;
     tftp_header_t *message;
-    int size;
-    FRESULT fr;
+    uint8_t *run = NULL;
+    int size, run_size = 0;
 
     // send this FIRST so we can overlap receiving more data with writing to disk
     tftp_get_send_ack(sink);
@@ -329,17 +1029,26 @@ static void tftp_get_flush_data_and_ack(packet_sink_t *sink)
         message = (tftp_header_t*)packet->data;
         size = packet->data_length - 4;
 
-        if(size > 0){
-            fr = f_write(&tftp->disk_file, message->payload.data.data, size, NULL);
-            tftp->bytes_transferred += size;
-            if(fr != FR_OK){
-                printf("tftp: failed to write to \"%s\": %s\n", tftp->disk_filename, f_errmsg(fr));
-                tftp->completed = true;
-                tftp->success = false;
+        if(packet->placed_data && tftp->to_memory){
+            tftp_get_write(tftp, NULL, size);
+        }else if(packet->placed_data){
+            // payload is already in the staging buffer; merge adjacent slots into one write
+            if(run && run + run_size == packet->placed_data){
+                run_size += size;
+            }else{
+                tftp_get_write(tftp, run, run_size);
+                run = packet->placed_data;
+                run_size = size;
             }
+        }else{
+            tftp_get_write(tftp, run, run_size);
+            run = NULL;
+            tftp_get_write(tftp, message->payload.data.data, size);
         }
         packet_free(packet);
     }
+
+    tftp_get_write(tftp, run, run_size);
 }
 
 static bool tftp_get_process_data(packet_sink_t *sink, packet_t *packet)
@@ -355,6 +1064,7 @@ static bool tftp_get_process_data(packet_sink_t *sink, packet_t *packet)
 
     if(rxblock == expected_block_number(tftp, 1)){ // is it the block we are expecting?
         tftp->last_block = rxblock;
+        tftp->block_seq++;
         tftp->retransmits_this_block = 0;
 
         packet_queue_addtail(&tftp->data_queue, packet);
@@ -368,19 +1078,91 @@ static bool tftp_get_process_data(packet_sink_t *sink, packet_t *packet)
         }
     }
 
-    if(tftp->last_block == ((tftp->last_ack + tftp->window_size) & 0xffff))
+    // >=, not ==: the window may have shrunk under a window already in flight
+    if((uint16_t)(tftp->last_block - tftp->last_ack) >= tftp->window_size){
+        tftp_window_adapt(tftp, false);
         tftp_get_flush_data_and_ack(sink);
+    }
 
     return free_packet;
 }
 
-static void tftp_client_packet_received(packet_sink_t *sink, packet_t *packet)
+static inline bool tftp_mc_have_block(tftp_transfer_t *tftp, uint32_t seq)
 {
-    bool free_packet = true;
-    tftp_transfer_t *tftp = sink->sink_private;
-    tftp_header_t *message = (tftp_header_t*)packet->data;
+    return tftp->mc_received[(seq - 1) >> 3] & (1 << ((seq - 1) & 7));
+}
 
-    if(!tftp->started){
+static void tftp_mc_write(tftp_transfer_t *tftp, uint32_t offset, uint8_t *data, int size)
+{
+    FRESULT fr;
+
+    if(tftp->to_memory){
+        load_target_write(tftp->memory_address + offset, data, size); // range prepared from tsize
+        return;
+    }
+
+    fr = f_lseek(&tftp->disk_file, offset);
+    if(fr == FR_OK)
+        fr = f_write(&tftp->disk_file, data, size, NULL);
+    if(fr != FR_OK){
+        printf("tftp: failed to write to \"%s\": %s\n", tftp->disk_filename, f_errmsg(fr));
+        tftp->completed = true;
+        tftp->success = false;
+    }
+}
+
+// multicast DATA, from the group or sent directly to us
+static void tftp_mc_process_data(tftp_transfer_t *tftp, packet_t *packet)
+{
+    tftp_header_t *message = (tftp_header_t*)packet->data;
+    int size = packet->data_length - 4;
+    uint32_t seq, offset;
+    int expect;
+
+    // block numbers are 16 bits; place this one relative to the last block we have in sequence
+    seq = tftp->block_seq + 1 + (int16_t)(ntohs(message->payload.data.block_number) - expected_block_number(tftp, 1));
+    if(seq < 1 || seq > tftp->mc_blocks || tftp_mc_have_block(tftp, seq))
+        return; // a duplicate, or not from this file
+
+    offset = (seq - 1) * tftp->block_size;
+    expect = tftp->total_size - offset;
+    if(expect > tftp->block_size)
+        expect = tftp->block_size;
+    if(size != expect)
+        return;
+
+    tftp_mc_write(tftp, offset, message->payload.data.data, size);
+    tftp->mc_received[(seq - 1) >> 3] |= 1 << ((seq - 1) & 7);
+    tftp->bytes_transferred += size;
+    tftp->retransmits_this_block = 0;
+    tftp->mc_quiet = 0;
+
+    while(tftp->block_seq < tftp->mc_blocks && tftp_mc_have_block(tftp, tftp->block_seq + 1)){
+        tftp->last_block = expected_block_number(tftp, 1);
+        tftp->block_seq++;
+    }
+
+    if(tftp->completed)
+        return; // write failed
+
+    if(tftp->block_seq == tftp->mc_blocks){
+        tftp->completed = true;
+        tftp->success = true;
+        tftp_get_send_ack(tftp->sink); // passive clients too, so the server can drop us from its list
+    }else if(tftp->master_client){
+        tftp_get_send_ack(tftp->sink); // asks for the block after the last we have in sequence
+    }else{
+        tftp->sink->timer = set_timer_ms(REQUEST_TIMEOUT);
+    }
+}
+
+static void tftp_client_packet_received(packet_sink_t *sink, packet_t *packet)
+{
+    bool free_packet = true;
+    tftp_transfer_t *tftp = sink->sink_private;
+    tftp_header_t *message = (tftp_header_t*)packet->data;
+
+    if(!tftp->started && sink == tftp->sink){
         // lock on to the server's source port
         net_remove_packet_sink(sink);
         sink->match_remote_port = ntohs(packet->udp->source_port);
@@ -402,6 +1184,8 @@ static void tftp_client_packet_received(packet_sink_t *sink, packet_t *packet)
         case tftp_op_data:
             if(tftp->is_put)
                 printf("tftp: unexpected DATA packet during put?\n");
+            else if(tftp->multicast)
+                tftp_mc_process_data(tftp, packet);
             else
                 free_packet = tftp_get_process_data(sink, packet);
             break;
@@ -437,10 +1221,26 @@ static void tftp_client_timer_expired(packet_sink_t *sink)
     if(tftp->completed)
         return;
 
+    if(tftp->multicast && !tftp->master_client && ++tftp->mc_quiet < MC_QUIET_TIMEOUTS){
+        // the group is quiet; keep listening for a while
+        sink->timer = set_timer_ms(REQUEST_TIMEOUT);
+        return;
+    }
+
+    if(tftp->multicast && !tftp->master_client){
+        // still nothing: ask again, the server may make us master this time
+        tftp->mc_quiet = 0;
+        tftp->started = false;
+        net_remove_packet_sink(sink);
+        sink->match_remote_port = 0;
+        net_add_packet_sink(sink);
+    }
+
     if(!tftp->started){
         sink->timer = set_timer_ms(REQUEST_TIMEOUT);
         net_tx(tftp_create_request(sink));
     }else{
+        tftp_window_adapt(tftp, true);
         if(tftp->is_put)
             tftp_put_send_data(sink, 1);
         else
@@ -451,28 +1251,190 @@ static void tftp_client_timer_expired(packet_sink_t *sink)
     tftp->retransmits_this_block++;
 }
 
-bool tftp_transfer(uint32_t tftp_server_ip, const char *tftp_filename, 
-        const char *disk_filename, bool is_put)
+static tftp_transfer_t *tftp_alloc(const char *tftp_filename, bool is_put, bool background)
 {
-    FRESULT fr;
-    uint32_t start, taken, rate;
-    int uart_byte, reported_transferred;
-    packet_sink_t *sink = packet_sink_alloc();
-    tftp_transfer_t *tftp = malloc(sizeof(tftp_transfer_t));
+    tftp_transfer_t *tftp = background ? malloc(sizeof(tftp_transfer_t)) : arena_alloc(sizeof(tftp_transfer_t));
     memset(tftp, 0, sizeof(tftp_transfer_t));
     packet_queue_init(&tftp->data_queue);
 
-    sink->match_interface_local_ip = true;
-    sink->match_ipv4_protocol = ip_proto_udp;
-    sink->match_remote_ip = tftp_server_ip;
-    sink->match_local_port = 8192 + (gogoboot_read_timer() & 0x7fff);
-    sink->sink_private = tftp;
     tftp->last_block = 0;
     tftp->block_size = 512;
     tftp->window_size = 1;
+    tftp->window_max = 1;
+    tftp->ring_share = 1;
+    tftp->window_share = MAX_WINDOW_SIZE;
     tftp->is_put = is_put;
-    tftp->tftp_filename = strdup(tftp_filename);
-    tftp->disk_filename = strdup(disk_filename);
+    tftp->background = background;
+    tftp->tftp_filename = background ? strdup(tftp_filename) : arena_strdup(tftp_filename);
+    tftp->want_multicast = !is_put && get_environment_variable_int("tftp_multicast", 0);
+
+    return tftp;
+}
+
+/* the transfer itself and its names are scratch memory, gone when the command
+ * ends, unless it is running in the background */
+static void tftp_free(tftp_transfer_t *tftp)
+{
+    tftp_receiving_leave(tftp);
+    packet_queue_drain(&tftp->data_queue);
+    tftp_batch_wait(tftp);
+    free(tftp->batch);
+    free(tftp->batch_spare);
+    free(tftp->staging);
+    free(tftp->ring);
+    free(tftp->mc_received);
+    if(tftp->background){
+        free(tftp->tftp_filename);
+        free(tftp->disk_filename);
+        free(tftp);
+    }
+}
+
+static void tftp_print_server(uint32_t tftp_server_ip, const char *what, const char *tftp_filename)
+{
+    printf("tftp: %s %d.%d.%d.%d:%s", what,
+            (int)(tftp_server_ip >> 24 & 0xff),
+            (int)(tftp_server_ip >> 16 & 0xff),
+            (int)(tftp_server_ip >>  8 & 0xff),
+            (int)(tftp_server_ip       & 0xff),
+            tftp_filename);
+}
+
+// sessions running at once (mget, the server) each need their own port
+static uint16_t tftp_next_port(void)
+{
+    static uint16_t next_port = 0;
+
+    if(!next_port)
+        next_port = gogoboot_read_timer();
+    next_port++;
+
+    return 8192 + (next_port & 0x7fff);
+}
+
+// register a sink for the transfer and send the RRQ/WRQ
+static void tftp_start(tftp_transfer_t *tftp, uint32_t tftp_server_ip)
+{
+    packet_sink_t *sink = packet_sink_alloc();
+
+    sink->match_interface_local_ip = true;
+    sink->match_ipv4_protocol = ip_proto_udp;
+    sink->match_remote_ip = tftp_server_ip;
+    sink->match_local_port = tftp_next_port();
+    sink->sink_private = tftp;
+    tftp->sink = sink;
+
+    tftp->start_time = gogoboot_read_timer();
+    sink->cb_packet_received = tftp_client_packet_received;
+    sink->cb_timer_expired = tftp_client_timer_expired;
+    if(!tftp->is_put){
+        sink->cb_payload_destination = tftp_get_payload_destination;
+        tftp_receiving_join(tftp);
+    }
+    net_add_packet_sink(sink);
+    tftp_client_timer_expired(sink); // synthesise a timeout; triggers transmission of RRQ/WRQ
+    tftp->timeouts = 0; // fixup counts, since our "timeout" was synthetic
+    tftp->retransmits_this_block = 0; 
+}
+
+// total_size, or 0 while a stream is still running
+static int tftp_known_size(tftp_transfer_t *tftp)
+{
+    return (tftp->total_size == TFTP_STREAM_SIZE) ? 0 : tftp->total_size;
+}
+
+static void tftp_report_progress(tftp_transfer_t *tftp)
+{
+    int transferred, total = tftp_known_size(tftp);
+
+    if((tftp->bytes_transferred - tftp->reported_transferred) >= (256*1024) || 
+       (total && tftp->bytes_transferred >= total && tftp->reported_transferred < total)){
+        tftp->reported_transferred = transferred = tftp->bytes_transferred;
+        if(total){
+            if(transferred > total)
+                transferred = total;
+            printf("tftp: %d/%d KB", transferred >> 10, total >> 10);
+        }else
+            printf("tftp: %d KB", transferred >> 10);
+        if(tftp->timeouts)
+            printf(" (%d timeouts)", tftp->timeouts);
+        printf("\n");
+    }
+}
+
+static void tftp_print_rate(int bytes, uint32_t start)
+{
+    uint32_t taken, rate;
+
+    taken = gogoboot_read_timer() - start;
+    taken /= (TIMER_HZ/10); // taken is now in 10ths of a second
+    if(taken == 0)
+        taken = 1; // avoid div 0
+    rate = ((bytes / taken)*8) / 1000;
+    printf("Transferred %d bytes in %ld.%lds (%ld.%02ld Mbit/sec)\n",
+            bytes, taken/10, taken%10, rate/100, rate%100);
+}
+
+// report how it went, and unregister the sinks
+static void tftp_finish(tftp_transfer_t *tftp)
+{
+    if(tftp->batch && tftp->success && !tftp_batch_flush(tftp))
+        tftp->success = false;
+    if(!tftp_batch_wait(tftp))
+        tftp->success = false;
+
+    // a preallocated file that came up short (or failed) is cut back to what arrived
+    if(tftp->expanded && f_size(&tftp->disk_file) > tftp->bytes_transferred - tftp->batch_fill){
+        if(f_lseek(&tftp->disk_file, tftp->bytes_transferred - tftp->batch_fill) == FR_OK)
+            f_truncate(&tftp->disk_file);
+    }
+
+    // what we fetched, the server can hand on in seed mode
+    if(tftp->success && !tftp->is_put && !tftp->to_disk)
+        tftpd_publish(tftp->tftp_filename, tftp->to_memory ? NULL : tftp->disk_filename,
+                tftp->memory_address, tftp->bytes_transferred);
+
+    if(tftp->success){
+        printf("Transfer success.\n");
+        tftp_print_rate(tftp->bytes_transferred, tftp->start_time);
+        if(tftp->window_max > 1)
+            printf("Final window %d blocks (of %d)\n", tftp->window_size, tftp->window_max);
+    }else{
+        printf("Transfer FAILED!\n");
+    }
+
+    tftp_mc_stop(tftp);
+    net_remove_packet_sink(tftp->sink);
+    packet_sink_free(tftp->sink);
+    tftp->sink = NULL;
+    tftp_receiving_leave(tftp); // the others can have its share of the ring
+}
+
+// run the transfer to completion (or until the user aborts it)
+static void tftp_run(tftp_transfer_t *tftp, uint32_t tftp_server_ip)
+{
+    tftp_start(tftp, tftp_server_ip);
+    printf("Transfer started: Press Q to abort\n");
+
+    while(!tftp->completed){
+        task_pump(); // the network calls our callbacks to make the transfer go; the disk queue takes the batches
+        if(uart_check_cancel_key()){
+            printf("Aborted.\n");
+            break;
+        }
+        tftp_report_progress(tftp);
+    }
+
+    tftp_finish(tftp);
+}
+
+// a transfer between the server and a local file, or NULL if the file won't open
+static tftp_transfer_t *tftp_open_file(const char *tftp_filename, const char *disk_filename, bool is_put, bool background)
+{
+    FRESULT fr;
+    tftp_transfer_t *tftp = tftp_alloc(tftp_filename, is_put, background);
+
+    tftp->disk_filename = background ? strdup(disk_filename) : arena_strdup(disk_filename);
 
     if(is_put){
         fr = f_open(&tftp->disk_file, tftp->disk_filename, FA_READ);
@@ -482,78 +1444,676 @@ bool tftp_transfer(uint32_t tftp_server_ip, const char *tftp_filename,
 
     if(fr != FR_OK){
         printf("tftp: failed to open \"%s\": %s\n", tftp->disk_filename, f_errmsg(fr));
-    }else{
-        printf("tftp: %s %d.%d.%d.%d:%s %s local file \"%s\"",
-                is_put ? "put" : "get",
-                (int)(tftp_server_ip >> 24 & 0xff),
-                (int)(tftp_server_ip >> 16 & 0xff),
-                (int)(tftp_server_ip >>  8 & 0xff),
-                (int)(tftp_server_ip       & 0xff),
-                tftp->tftp_filename,
-                is_put ? "from" : "to",
-                tftp->disk_filename);
-        if(is_put)
-            printf(" %d bytes", tftp->total_size);
-        putchar('\n');
+        tftp_free(tftp);
+        return NULL;
+    }
 
-        start = gogoboot_read_timer();
-        sink->cb_packet_received = tftp_client_packet_received;
-        sink->cb_timer_expired = tftp_client_timer_expired;
-        net_add_packet_sink(sink);
-        tftp_client_timer_expired(sink); // synthesise a timeout; triggers transmission of RRQ/WRQ
-        tftp->timeouts = 0; // fixup counts, since our "timeout" was synthetic
-        tftp->retransmits_this_block = 0; 
+    return tftp;
+}
 
-        printf("Transfer started: Press Q to abort\n");
+static void tftp_print_file(tftp_transfer_t *tftp, uint32_t tftp_server_ip)
+{
+    tftp_print_server(tftp_server_ip, tftp->is_put ? "put" : "get", tftp->tftp_filename);
+    printf(" %s local file \"%s\"", tftp->is_put ? "from" : "to", tftp->disk_filename);
+    if(tftp->is_put)
+        printf(" %d bytes", tftp->total_size);
+    putchar('\n');
+}
 
-        reported_transferred = 0;
-        while(!tftp->completed){
-            net_pump(); // this calls our callsbacks to make the transfer go
-            uart_byte = uart_read_byte();
-            if(uart_byte == 'q' || uart_byte == 'Q'){
-                printf("Aborted.\n");
-                break;
-            }
-            if((tftp->bytes_transferred - reported_transferred) >= (256*1024) || 
-               (tftp->total_size && tftp->bytes_transferred >= tftp->total_size)){
-                reported_transferred = tftp->bytes_transferred;
-                if(tftp->total_size){
-                    if(reported_transferred > tftp->total_size)
-                        reported_transferred = tftp->total_size;
-                    printf("tftp: %d/%d KB", reported_transferred >> 10, tftp->total_size >> 10);
-                }else
-                    printf("tftp: %d KB", reported_transferred >> 10);
-                if(tftp->timeouts)
-                    printf(" (%d timeouts)", tftp->timeouts);
-                printf("\n");
+bool tftp_transfer(uint32_t tftp_server_ip, const char *tftp_filename, 
+        const char *disk_filename, bool is_put)
+{
+    tftp_transfer_t *tftp = tftp_open_file(tftp_filename, disk_filename, is_put, false);
+
+    if(tftp){
+        tftp_print_file(tftp, tftp_server_ip);
+        tftp_run(tftp, tftp_server_ip);
+        f_close(&tftp->disk_file);
+        tftp_free(tftp);
+    }
+
+    return true;
+}
+
+// the callbacks make the transfer go whenever anything pumps the network; the
+// job only has to notice when it has finished
+static bool tftp_job_step(job_t *job)
+{
+    tftp_transfer_t *tftp = job->context;
+
+    if(!tftp->completed)
+        return true;
+
+    printf("tftp: %s: ", tftp->tftp_filename);
+    tftp_finish(tftp);
+    f_close(&tftp->disk_file);
+    tftp_free(tftp);
+    return false;
+}
+
+static void tftp_job_status(job_t *job)
+{
+    tftp_transfer_t *tftp = job->context;
+
+    if(tftp_known_size(tftp))
+        printf("%d/%d KB", tftp->bytes_transferred >> 10, tftp->total_size >> 10);
+    else
+        printf("%d KB", tftp->bytes_transferred >> 10);
+    if(tftp->timeouts)
+        printf(" (%d timeouts)", tftp->timeouts);
+}
+
+static void tftp_job_kill(job_t *job)
+{
+    tftp_transfer_t *tftp = job->context;
+
+    printf("tftp: %s: ", tftp->tftp_filename);
+    tftp_finish(tftp);
+    f_close(&tftp->disk_file);
+    tftp_free(tftp);
+}
+
+bool tftp_transfer_background(uint32_t tftp_server_ip, const char *tftp_filename,
+        const char *disk_filename, bool is_put)
+{
+    tftp_transfer_t *tftp = tftp_open_file(tftp_filename, disk_filename, is_put, true);
+    job_t *job;
+
+    if(!tftp)
+        return false;
+
+    tftp_print_file(tftp, tftp_server_ip);
+    tftp_start(tftp, tftp_server_ip);
+
+    job = job_alloc(is_put ? "tftp put" : "tftp get", tftp->tftp_filename);
+    job->context = tftp;
+    job->cb_step = tftp_job_step;
+    job->cb_status = tftp_job_status;
+    job->cb_kill = tftp_job_kill;
+    job_add(job);
+
+    return true;
+}
+
+// several gets at once, each saved under its own name, all driven by one pump
+// loop so one file's start and finish overlap another's data
+bool tftp_mget(int count, const uint32_t *tftp_server_ip, char * const *tftp_filename)
+{
+    tftp_transfer_t *session[MGET_MAX_SESSIONS], *tftp;
+    int sessions, active = 0, next = 0, failed = 0, total = 0;
+    uint32_t start;
+
+    sessions = (count < MGET_MAX_SESSIONS) ? count : MGET_MAX_SESSIONS;
+    printf("tftp: mget %d files, %d at a time: Press Q to abort\n", count, sessions);
+    start = gogoboot_read_timer();
+
+    while(next < count || active){
+        while(active < sessions && next < count){
+            tftp = tftp_open_file(tftp_filename[next], tftp_filename[next], false, false);
+            if(tftp){
+                tftp_print_file(tftp, tftp_server_ip[next]);
+                tftp_start(tftp, tftp_server_ip[next]);
+                session[active++] = tftp;
+            }else
+                failed++;
+            next++;
+        }
+
+        task_pump();
+        if(uart_check_cancel_key()){
+            printf("Aborted.\n");
+            break;
+        }
+
+        for(int i=0; i<active; ){
+            tftp = session[i];
+            if(!tftp->completed){
+                i++;
+                continue;
             }
+            printf("tftp: %s: ", tftp->tftp_filename);
+            tftp_finish(tftp);
+            if(tftp->success)
+                total += tftp->bytes_transferred;
+            else
+                failed++;
+            f_close(&tftp->disk_file);
+            tftp_free(tftp);
+            session[i] = session[--active];
         }
+    }
 
-        if(tftp->success){
-            printf("Transfer success.\n");
-            taken = gogoboot_read_timer() - start;
-            taken /= (TIMER_HZ/10); // taken is now in 10ths of a second
-            if(taken == 0)
-                taken = 1; // avoid div 0
-            rate = ((tftp->bytes_transferred / taken)*8) / 1000;
-            printf("Transferred %d bytes in %ld.%lds (%ld.%02ld Mbit/sec)\n",
-                    tftp->bytes_transferred, taken/10, taken%10, rate/100, rate%100);
-        }else{
-            printf("Transfer FAILED!\n");
+    // after an abort
+    for(int i=0; i<active; i++){
+        printf("tftp: %s: ", session[i]->tftp_filename);
+        tftp_finish(session[i]);
+        f_close(&session[i]->disk_file);
+        tftp_free(session[i]);
+        failed++;
+    }
+    failed += count - next;
+
+    printf("tftp: mget %d of %d files. ", count - failed, count);
+    tftp_print_rate(total, start);
+
+    return failed == 0;
+}
+
+bool tftp_load(uint32_t tftp_server_ip, const char *tftp_filename, uint32_t *address, uint32_t *size)
+{
+    bool success;
+    tftp_transfer_t *tftp = tftp_alloc(tftp_filename, false, false);
+
+    tftp->to_memory = true;
+    tftp->memory_address = *address;
+
+    tftp_print_server(tftp_server_ip, "get", tftp->tftp_filename);
+    if(*address != TFTP_LOAD_HIGH)
+        printf(" to memory at 0x%lx", *address);
+    putchar('\n');
+
+    tftp_run(tftp, tftp_server_ip);
+
+    success = tftp->success;
+    *address = tftp->memory_address;
+    *size = tftp->bytes_transferred;
+
+    tftp_free(tftp);
+
+    return success;
+}
+
+// a disk image straight onto consecutive sectors, from 'sector' on
+bool tftp_raw(uint32_t tftp_server_ip, const char *tftp_filename, int disknr, uint32_t sector)
+{
+    bool success;
+    disk_t *disk = disk_get_info(disknr);
+    tftp_transfer_t *tftp;
+
+    if(!disk || sector >= disk->sectors){
+        printf("tftp: no disk %d, or sector %lu is past its end\n", disknr, sector);
+        return false;
+    }
+
+    // fresh data under FatFs's feet: write back what it has first
+    if(!disk_cache_sync(-1))
+        return false;
+
+    tftp = tftp_alloc(tftp_filename, false, false);
+    tftp->to_disk = true;
+    tftp->want_multicast = false; // blocks must arrive in order
+    tftp->raw_disk = disknr;
+    tftp->raw_sector = sector;
+    tftp->raw_limit = disk->sectors;
+    tftp->batch = malloc(BATCH_SECTORS * 512);
+    tftp->batch_spare = malloc_unchecked(BATCH_SECTORS * 512);
+
+    tftp_print_server(tftp_server_ip, "get", tftp->tftp_filename);
+    printf(" to disk %d from sector %lu\n", disknr, sector);
+
+    tftp_run(tftp, tftp_server_ip);
+
+    success = tftp->success;
+    if(success)
+        printf("Wrote sectors %lu to %lu\n", sector, tftp->raw_sector - 1);
+
+    tftp_free(tftp);
+    disk_remount(disknr);
+
+    return success;
+}
+
+bool tftp_save(uint32_t tftp_server_ip, const char *tftp_filename, uint32_t address, uint32_t size)
+{
+    bool success;
+    tftp_transfer_t *tftp = tftp_alloc(tftp_filename, true, false);
+
+    tftp->to_memory = true;
+    tftp->memory_address = address;
+    tftp->total_size = size;
+
+    tftp_print_server(tftp_server_ip, "put", tftp->tftp_filename);
+    printf(" from memory at 0x%lx %ld bytes\n", address, size);
+
+    tftp_run(tftp, tftp_server_ip);
+
+    success = tftp->success;
+    tftp_free(tftp);
+
+    return success;
+}
+
+// send what source produces, as it produces it: the size need not be known
+// beforehand, and the data is read once, into the send ring
+bool tftp_stream(uint32_t tftp_server_ip, const char *tftp_filename, tftp_source_t source, void *context)
+{
+    bool success;
+    tftp_transfer_t *tftp = tftp_alloc(tftp_filename, true, false);
+
+    tftp->source = source;
+    tftp->source_context = context;
+    tftp->total_size = TFTP_STREAM_SIZE;
+
+    tftp_print_server(tftp_server_ip, "put", tftp->tftp_filename);
+    printf(" as a stream\n");
+
+    tftp_run(tftp, tftp_server_ip);
+
+    success = tftp->success;
+    tftp_free(tftp);
+
+    return success;
+}
+
+/* the server: read-only, answering RRQs on port 69 with the same sending path
+ * a put uses. Files come from the FAT volume, or from the images in the table
+ * below: everything this node fetched with a get or a load, under the name it
+ * asked for, and any memory published with tftpd_publish(). In seed mode only
+ * the table is served. */
+
+#define TFTPD_MAX_SESSIONS  4   // clients served at once; the rest retry their RRQ
+#define TFTPD_MAX_IMAGES   16   // fetched or published files remembered
+
+// options a client asked for that we acknowledge
+#define OACK_BLKSIZE    0x01
+#define OACK_WINDOWSIZE 0x02
+#define OACK_TSIZE      0x04
+#define OACK_ROLLOVER   0x08
+
+typedef struct {
+    char *name;                 // as clients ask for it
+    char *disk_filename;        // on the FAT volume, or NULL for memory
+    uint32_t address;
+    uint32_t size;
+    uint32_t crc;               // memory: as published, so we notice if it is overwritten
+} tftpd_image_t;
+
+static tftpd_image_t tftpd_image[TFTPD_MAX_IMAGES];
+static int tftpd_image_count = 0;
+static packet_sink_t *tftpd_sink = NULL; // port 69, while serving
+static bool tftpd_seed_only;
+static tftp_transfer_t *tftpd_session[TFTPD_MAX_SESSIONS];
+static int tftpd_session_count = 0;
+static uint32_t tftpd_files_sent, tftpd_requests_deferred;
+
+static void tftpd_forget(int i)
+{
+    free(tftpd_image[i].name);
+    free(tftpd_image[i].disk_filename);
+    tftpd_image_count--;
+    memmove(&tftpd_image[i], &tftpd_image[i+1], (tftpd_image_count - i) * sizeof(tftpd_image_t));
+}
+
+void tftpd_publish(const char *name, const char *disk_filename, uint32_t address, uint32_t size)
+{
+    tftpd_image_t *image;
+
+    for(int i=tftpd_image_count-1; i>=0; i--){
+        image = &tftpd_image[i];
+        if(!strcmp(image->name, name) || (!disk_filename && !image->disk_filename &&
+           image->address < address + size && address < image->address + image->size))
+            tftpd_forget(i); // replaced, or overwritten in memory
+    }
+
+    if(tftpd_image_count == TFTPD_MAX_IMAGES)
+        tftpd_forget(0); // the oldest
+
+    image = &tftpd_image[tftpd_image_count++];
+    image->name = strdup(name);
+    image->disk_filename = disk_filename ? strdup(disk_filename) : NULL;
+    image->address = address;
+    image->size = size;
+    image->crc = disk_filename ? 0 : crc32_update(0, (void*)address, size);
+}
+
+void tftpd_list(void)
+{
+    tftpd_image_t *image;
+
+    if(tftpd_sink)
+        printf("tftpd: serving %s: %d sending, %ld files sent, %ld requests deferred\n",
+                tftpd_seed_only ? "fetched files" : "the FAT volume and fetched files",
+                tftpd_session_count, tftpd_files_sent, tftpd_requests_deferred);
+    else
+        printf("tftpd: not running\n");
+
+    for(int i=0; i<tftpd_image_count; i++){
+        image = &tftpd_image[i];
+        if(image->disk_filename)
+            printf("  %s: file \"%s\"\n", image->name, image->disk_filename);
+        else
+            printf("  %s: memory at 0x%lx, %ld bytes\n", image->name, image->address, image->size);
+    }
+}
+
+static tftpd_image_t *tftpd_find(const char *name)
+{
+    for(int i=0; i<tftpd_image_count; i++)
+        if(!strcmp(tftpd_image[i].name, name))
+            return &tftpd_image[i];
+    return NULL;
+}
+
+// the next NUL terminated string in a request, or NULL if it runs off the end
+static char *tftpd_next_string(char **ptr, char *end)
+{
+    char *str = *ptr, *p = str;
+
+    while(p < end && *p)
+        p++;
+    if(p >= end)
+        return NULL;
+    *ptr = p + 1;
+
+    return str;
+}
+
+static void tftpd_send_error(uint32_t ip, uint16_t port, uint16_t local_port, uint16_t code, const char *text)
+{
+    int len = strlen(text) + 1;
+    packet_t *packet = packet_create_udp(ip, port, local_port, len + 4);
+    tftp_header_t *message = (tftp_header_t*)packet->data;
+
+    message->opcode = htons(tftp_op_err);
+    message->payload.error.error_code = htons(code);
+    memcpy(message->payload.error.error_message, text, len);
+    net_tx(packet);
+}
+
+static void tftpd_send_options_ack(packet_sink_t *sink)
+{
+    tftp_transfer_t *tftp = sink->sink_private;
+    char options[MAXOPT];
+    int offset = 0;
+
+    if(tftp->oack_options & OACK_ROLLOVER){
+        offset = options_append(options, offset, "rollover");
+        offset = options_append_int(options, offset, tftp->rollover_value);
+    }
+    if(tftp->oack_options & OACK_TSIZE){
+        offset = options_append(options, offset, "tsize");
+        offset = options_append_int(options, offset, tftp->total_size);
+    }
+    if(tftp->oack_options & OACK_BLKSIZE){
+        offset = options_append(options, offset, "blksize");
+        offset = options_append_int(options, offset, tftp->block_size);
+    }
+    if(tftp->oack_options & OACK_WINDOWSIZE){
+        offset = options_append(options, offset, "windowsize");
+        offset = options_append_int(options, offset, tftp->window_max);
+    }
+
+    packet_t *packet = packet_create_for_sink(sink, offset + 2);
+    tftp_header_t *message = (tftp_header_t*)packet->data;
+    message->opcode = htons(tftp_op_options_ack);
+    memcpy(message->payload.raw, options, offset);
+    net_tx(packet);
+
+    // the client may have a file to create before it ACKs
+    sink->timer = set_timer_ms(REQUEST_TIMEOUT);
+}
+
+static void tftpd_session_packet_received(packet_sink_t *sink, packet_t *packet)
+{
+    tftp_transfer_t *tftp = sink->sink_private;
+    tftp_header_t *message = (tftp_header_t*)packet->data;
+
+    if(packet->data_length >= 4 && !tftp->completed){
+        switch(ntohs(message->opcode)){
+            case tftp_op_ack:
+                tftp->oack_options = 0; // ACK 0 agrees to the options
+                tftp_put_process_ack(sink, packet);
+                break;
+            case tftp_op_err:
+                tftp->completed = true; // the client gave up
+                tftp->success = false;
+                break;
+            default:
+                break;
         }
+    }
+
+    packet_free(packet);
+}
 
-        // close the file
+static void tftpd_session_timer_expired(packet_sink_t *sink)
+{
+    tftp_transfer_t *tftp = sink->sink_private;
+
+    if(tftp->completed)
+        return;
+
+    if(tftp->retransmits_this_block > 20){
+        tftp->completed = true;
+        tftp->success = false;
+        return;
+    }
+
+    if(tftp->oack_options)
+        tftpd_send_options_ack(sink);
+    else{
+        tftp_window_adapt(tftp, true);
+        tftp_put_send_data(sink, 1);
+    }
+
+    tftp->timeouts++;
+    tftp->retransmits_this_block++;
+}
+
+// the file a client asked for, opened; false after sending it the error
+static bool tftpd_open(tftp_transfer_t *tftp, uint32_t ip, uint16_t port)
+{
+    tftpd_image_t *image = tftpd_find(tftp->tftp_filename);
+    FRESULT fr;
+
+    if(!image && tftpd_seed_only){
+        tftpd_send_error(ip, port, 69, 1, "file not found");
+        return false;
+    }
+
+    if(image && !image->disk_filename){
+        // a load, rmem, writemem or memtest may have written over it since
+        if(crc32_update(0, (void*)image->address, image->size) != image->crc){
+            printf("tftpd: %s at 0x%lx has been overwritten; no longer serving it\n", image->name, image->address);
+            tftpd_send_error(ip, port, 69, 1, "image overwritten");
+            tftpd_forget(image - tftpd_image);
+            return false;
+        }
+        tftp->to_memory = true;
+        tftp->memory_address = image->address;
+        tftp->total_size = image->size;
+        return true;
+    }
+
+    tftp->disk_filename = strdup(image ? image->disk_filename : tftp->tftp_filename);
+    fr = f_open(&tftp->disk_file, tftp->disk_filename, FA_READ);
+    if(fr != FR_OK){
+        tftpd_send_error(ip, port, 69, 1, f_errmsg(fr));
+        return false;
+    }
+    tftp->total_size = f_size(&tftp->disk_file);
+
+    return true;
+}
+
+static void tftpd_start_session(tftp_header_t *message, char *end, uint32_t ip, uint16_t port)
+{
+    char *ptr = (char*)message->payload.raw, *filename, *mode, *opt, *val;
+    tftp_transfer_t *tftp;
+    packet_sink_t *sink;
+    int val_int;
+
+    for(int i=0; i<tftpd_session_count; i++){
+        sink = tftpd_session[i]->sink;
+        if(sink->match_remote_ip == ip && sink->match_remote_port == port)
+            return; // a retransmitted RRQ: the session is already answering it
+    }
+
+    if(tftpd_session_count == TFTPD_MAX_SESSIONS){
+        tftpd_requests_deferred++; // no reply: the client asks again after its timeout
+        return;
+    }
+
+    filename = tftpd_next_string(&ptr, end);
+    mode = tftpd_next_string(&ptr, end);
+    if(!filename || !mode){
+        tftpd_send_error(ip, port, 69, 4, "malformed request");
+        return;
+    }
+    if(strcasecmp(mode, "octet")){
+        tftpd_send_error(ip, port, 69, 0, "octet mode only");
+        return;
+    }
+
+    tftp = tftp_alloc(filename, true, true);
+    tftp->serving = true;
+    tftp->started = true;
+    if(!tftpd_open(tftp, ip, port)){
+        tftp_free(tftp);
+        return;
+    }
+
+    while((opt = tftpd_next_string(&ptr, end)) && (val = tftpd_next_string(&ptr, end))){
+        val_int = atoi(val);
+        if(!strcasecmp(opt, "blksize") && val_int >= 8){
+            // we can't fragment on transmit: one frame per block
+            tftp->block_size = (val_int < MAX_BLOCK_SIZE) ? val_int : MAX_BLOCK_SIZE;
+            tftp->oack_options |= OACK_BLKSIZE;
+        }else if(!strcasecmp(opt, "windowsize") && val_int >= 1){
+            tftp->window_max = (val_int < MAX_WINDOW_SIZE) ? val_int : MAX_WINDOW_SIZE;
+            tftp->oack_options |= OACK_WINDOWSIZE;
+        }else if(!strcasecmp(opt, "tsize")){
+            tftp->oack_options |= OACK_TSIZE;
+        }else if(!strcasecmp(opt, "rollover") && (val_int == 0 || val_int == 1)){
+            tftp->rollover_value = val_int;
+            tftp->oack_options |= OACK_ROLLOVER;
+        }
+        // others (timeout, multicast) go unacknowledged, so are not in force
+    }
+    tftp->window_size = tftp->window_max;
+
+    sink = packet_sink_alloc();
+    sink->match_interface_local_ip = true;
+    sink->match_ipv4_protocol = ip_proto_udp;
+    sink->match_remote_ip = ip;
+    sink->match_remote_port = port;
+    sink->match_local_port = tftp_next_port();
+    sink->sink_private = tftp;
+    sink->cb_packet_received = tftpd_session_packet_received;
+    sink->cb_timer_expired = tftpd_session_timer_expired;
+    tftp->sink = sink;
+    tftp->start_time = gogoboot_read_timer();
+    net_add_packet_sink(sink);
+    tftpd_session[tftpd_session_count++] = tftp;
+
+    if(!tftp->to_memory)
+        tftp_put_alloc_ring(tftp);
+
+    // with options, the client ACKs our OACK as block 0; without, block 1 goes at once
+    if(tftp->oack_options)
+        tftpd_send_options_ack(sink);
+    else
+        tftp_put_send_data(sink, tftp->window_size);
+}
+
+static void tftpd_request_received(packet_sink_t *sink, packet_t *packet)
+{
+    tftp_header_t *message = (tftp_header_t*)packet->data;
+    uint32_t ip = ntohl(packet->ipv4->source_ip);
+    uint16_t port = ntohs(packet->udp->source_port);
+
+    if(packet->data_length >= 2){
+        switch(ntohs(message->opcode)){
+            case tftp_op_rrq:
+                tftpd_start_session(message, (char*)packet->data + packet->data_length, ip, port);
+                break;
+            case tftp_op_wrq:
+                tftpd_send_error(ip, port, 69, 2, "read-only server");
+                break;
+            default:
+                break; // strays for a finished session
+        }
+    }
+
+    packet_free(packet);
+}
+
+static void tftpd_session_end(tftp_transfer_t *tftp)
+{
+    char ip[16];
+
+    net_remove_packet_sink(tftp->sink);
+    printf("tftpd: %s to %s: ", tftp->tftp_filename, net_format_ipv4(tftp->sink->match_remote_ip, ip));
+    if(tftp->success){
+        tftpd_files_sent++;
+        printf("sent %d bytes", tftp->total_size);
+        if(tftp->timeouts)
+            printf(" (%d timeouts)", tftp->timeouts);
+        putchar('\n');
+    }else
+        printf("failed\n");
+
+    packet_sink_free(tftp->sink);
+    if(!tftp->to_memory)
         f_close(&tftp->disk_file);
+    tftp_free(tftp);
+}
 
-        // unregister the sink
-        net_remove_packet_sink(sink);
+// sessions run from their sink callbacks; the job reaps those that finish
+static bool tftpd_job_step(job_t *job)
+{
+    for(int i=0; i<tftpd_session_count; ){
+        if(!tftpd_session[i]->completed){
+            i++;
+            continue;
+        }
+        tftpd_session_end(tftpd_session[i]);
+        tftpd_session[i] = tftpd_session[--tftpd_session_count];
     }
 
-    packet_sink_free(sink);
-    free(tftp->tftp_filename);
-    free(tftp->disk_filename);
-    packet_queue_drain(&tftp->data_queue);
-    free(tftp);
+    return true; // until killed
+}
+
+static void tftpd_job_status(job_t *job)
+{
+    printf("%d sending, %ld files sent", tftpd_session_count, tftpd_files_sent);
+}
+
+static void tftpd_job_kill(job_t *job)
+{
+    while(tftpd_session_count)
+        tftpd_session_end(tftpd_session[--tftpd_session_count]);
+
+    net_remove_packet_sink(tftpd_sink);
+    packet_sink_free(tftpd_sink);
+    tftpd_sink = NULL;
+}
+
+bool tftpd_start(bool seed_only)
+{
+    job_t *job;
+
+    if(tftpd_sink){
+        printf("tftpd: already running\n");
+        return false;
+    }
+
+    tftpd_seed_only = seed_only;
+    tftpd_sink = packet_sink_alloc();
+    tftpd_sink->match_interface_local_ip = true;
+    tftpd_sink->match_ipv4_protocol = ip_proto_udp;
+    tftpd_sink->match_local_port = 69;
+    tftpd_sink->cb_packet_received = tftpd_request_received;
+    net_add_packet_sink(tftpd_sink);
+
+    job = job_alloc("tftpd", seed_only ? "seed" : "serve");
+    job->cb_step = tftpd_job_step;
+    job->cb_status = tftpd_job_status;
+    job->cb_kill = tftpd_job_kill;
+    job_add(job);
+
+    printf("tftpd: serving %s on port 69; \"kill %d\" to stop\n",
+            seed_only ? "fetched files" : "the FAT volume and fetched files", job->id);
 
     return true;
 }
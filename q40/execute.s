@@ -20,6 +20,7 @@ nextregister:
         movea.l (loader_bounce_buffer_data), %a1        /* a1 = bounce buffer source addr */
         movea.l (loader_bounce_buffer_target), %a2      /* a2 = bounce buffer target addr */
         move.l (loader_bounce_buffer_size), %d0         /* d0 = bounce buffer size */
+        movea.l (loader_entry_caches_off), %a4          /* a4 = turn the caches off at entry? (read it before the copy) */
         cmp.l #0, %d0                                   /* test size == 0? */
         beq.s runit                                     /* not in use? skip copying */
         addq #3, %d0                                    /* round up size (although it should be in whole dwords already) */
@@ -39,20 +40,51 @@ nextword:
         jmp (%a0)                                       /* continue execution in new location */
 
         /* code below this point is copied to a scratch buffer */
-        /* WARNING: the scratch buffer is only 128 bytes in size! */
+        /* WARNING: the scratch buffer is only 256 bytes in size! */
 
+        /* the copy runs with the caches on. if source and target share their
+         * alignment within a 16 byte line we copy whole lines with move16, which
+         * bursts and does not allocate in the data cache, otherwise longwords */
 copystart:
-        br.s bounce_copy
-bounce_loop:
-        move.l (%a1)+,(%a2)+
-bounce_copy:
-        dbra %d0, bounce_loop
+        move.l %a1, %d1
+        move.l %a2, %d2
+        eor.l %d2, %d1
+        and.w #15, %d1                                  /* same offset within a line? */
+        bne.s bounce_longs                              /* no: longwords throughout */
+bounce_head:
+        move.l %a2, %d1
+        and.w #15, %d1                                  /* target line aligned yet? */
+        beq.s bounce_lines
+        subq.l #1, %d0
+        bcs.s runit                                     /* ran out first */
+        move.l (%a1)+, (%a2)+
+        bra.s bounce_head
+bounce_lines:
+        subq.l #8, %d0                                  /* 32 bytes per pass */
+        bcs.s bounce_lines_done
+        move16 (%a1)+, (%a2)+
+        move16 (%a1)+, (%a2)+
+        bra.s bounce_lines
+bounce_lines_done:
+        addq.l #8, %d0
+bounce_longs:
+        subq.l #1, %d0
+        bcs.s runit
+        move.l (%a1)+, (%a2)+
+        bra.s bounce_longs
         /* bounce buffer is now copied into place */
 runit:
         /* clear all data/instruction cache entries */
         /* does not change if cache enabled/disabled */
         cpusha %bc              /* write back and invalidate all data/instruction cache entries */
         nop
+        move.l %a4, %d1
+        beq.s caches_done
+        moveq #0, %d1
+        movec %d1, %cacr        /* disable data, instruction caches */
+        cpusha %bc
+        nop
+caches_done:
         jmp %a5@                                        /* ... off we go! */
 copyend:
         .end
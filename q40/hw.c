@@ -6,13 +6,16 @@
 #include <q40/hw.h>
 #include <init.h>
 #include <cpu.h>
+#include <uart.h>
 
 volatile uint32_t timer_ticks;
+volatile uint32_t timer_sub_ticks;              /* sample interrupts since the last tick */
 
 uint32_t mem_get_max_possible(void)
 {
-    /* code will need adjusting to support 128MB option boards */
-    /* I do not have one of these to test with :( */
+    /* this is the bank at address 0; the 128MB option boards have more DRAM
+     * elsewhere, which "memmap add" can find. I do not have one of these to
+     * test with :( */
     return MAX_RAM_SIZE << 20;
 }
 
@@ -50,7 +53,7 @@ void setup_interrupts(void)
     *q40_keyboard_interrupt_enable = 0;
     *q40_isa_interrupt_enable = 0;
     *q40_sample_interrupt_enable = 0;
-    *q40_sample_rate = 0;
+    *q40_sample_rate = 0;                       /* 10kHz */
 #if TIMER_HZ == 200
     *q40_frame_rate = 1;
 #elif TIMER_HZ == 50
@@ -64,6 +67,22 @@ void setup_interrupts(void)
     cpu_interrupts_on();
 }
 
+/* the sample interrupt handler counts, and the frame interrupt resets the count */
+#define US_PER_SAMPLE (1000000/10000)
+
+uint32_t timer_sub_tick_us(void)
+{
+    return timer_sub_ticks * US_PER_SAMPLE;
+}
+
+/* 10,000 interrupts a second is a cost worth paying only while it is wanted.
+ * the count is left alone when it stops: clearing it mid-tick would take
+ * timer_read_fine() backwards, and the next tick clears it anyway */
+void timer_sub_tick_enable(bool on)
+{
+    *q40_sample_interrupt_enable = on ? 1 : 0;
+}
+
 static void q40_delay(uint32_t count)
 {
     uint32_t x;
@@ -71,6 +90,75 @@ static void q40_delay(uint32_t count)
         x += *q40_interrupt_status;
 }
 
+/* the master chip reports ISA IRQs 3, 4, 5, 6, 7, 10, 14, 15 in bits 0--7 of
+   the ISA interrupt status register, and only has one enable for all of them */
+static const uint8_t q40_isa_irq_number[8] = { 3, 4, 5, 6, 7, 10, 14, 15 };
+static void (*q40_isa_irq_handler[8])(void);
+volatile int target_irq_depth = 0;
+
+static int q40_isa_irq_bit(int irq)
+{
+    for(int bit=0; bit<8; bit++)
+        if(q40_isa_irq_number[bit] == irq)
+            return bit;
+    return -1;
+}
+
+/* called from interrupt_level_2 in vectors.s */
+void q40_isa_interrupt(void)
+{
+    uint8_t status = *q40_isa_interrupt_status;
+
+    for(int bit=0; bit<8; bit++){
+        if(!(status & (1 << bit)))
+            continue;
+        if(q40_isa_irq_handler[bit]){
+            target_irq_depth++;
+            q40_isa_irq_handler[bit]();
+            target_irq_depth--;
+        }else{
+            /* we can't mask one line, so a card we know nothing about could
+               hold us in here forever: give up on ISA interrupts altogether */
+            *q40_isa_interrupt_enable = 0;
+            uart_write_string(":( UNEXPECTED ISA IRQ, ISA interrupts off\r\n");
+            return;
+        }
+    }
+}
+
+bool target_irq_attach(int irq, void (*handler)(void))
+{
+    int bit = q40_isa_irq_bit(irq);
+
+    if(bit < 0){
+        printf("ISA IRQ %d cannot be used (try 3, 4, 5, 6, 7, 10, 14 or 15)\n", irq);
+        return false;
+    }
+
+    cpu_interrupts_off();
+    q40_isa_irq_handler[bit] = handler;
+    *q40_isa_interrupt_enable = 1;
+    cpu_interrupts_on();
+    return true;
+}
+
+void target_irq_detach(int irq)
+{
+    int bit = q40_isa_irq_bit(irq), used = 0;
+
+    if(bit < 0)
+        return;
+
+    cpu_interrupts_off();
+    q40_isa_irq_handler[bit] = NULL;
+    for(bit=0; bit<8; bit++)
+        if(q40_isa_irq_handler[bit])
+            used++;
+    if(!used)
+        *q40_isa_interrupt_enable = 0;
+    cpu_interrupts_on();
+}
+
 void q40_isa_reset(void)
 {
     *q40_isa_bus_reset = 0xff;
@@ -93,7 +181,7 @@ void q40_graphics_init(int mode)
     *q40_display_control = mode;
 
     // clear entire video memory (1MB)
-    memset((void*)VIDEO_RAM_BASE, 0xaa, 1024*1024);
+    memset((void*)VIDEO_RAM_BASE, 0xaa, VIDEO_RAM_SIZE);
 
     // the CPU caches video memory so we need to force it to write the updates out
     // otherwise we get weird artefacts on the screen that hang around forever!
@@ -116,4 +204,6 @@ void target_mem_init(void)
 
     heap_base = ram_size - heap_size;
     heap_size -= stack_size;
+
+    mem_add_region(VIDEO_RAM_BASE, VIDEO_RAM_SIZE, mem_video);
 }
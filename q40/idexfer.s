@@ -0,0 +1,47 @@
+        .globl  q40_ide_sector_xfer_input
+        .globl  q40_ide_sector_xfer_output
+
+        .section .fasttext, "ax"      /* inner loops: in RAM on ROM builds */
+        .even
+
+/* The IDE data register appears on the ISA bus in little-endian byte order,
+   so each 16-bit word is byte-swapped (rol.w #8) as it passes through. We
+   pair words into longwords for the RAM side and unroll 4 longwords (16
+   bytes) per loop so the ISA bus, not the loop overhead, sets the pace. */
+
+q40_ide_sector_xfer_input:
+    moveal %sp@(4),%a0          /* void *buf */
+    moveal %sp@(8),%a1          /* ISA address of IDE data register */
+    moveq #31, %d1              /* total (31+1)*16=512 bytes */
+
+q40_ide_input_nextblock:
+    .rept 4
+    movew %a1@, %d0             /* first word -> top half */
+    rolw #8, %d0
+    swap %d0
+    movew %a1@, %d0             /* second word -> bottom half */
+    rolw #8, %d0
+    movel %d0, %a0@+            /* store to memory */
+    .endr
+    dbra %d1, q40_ide_input_nextblock
+    rts
+
+
+q40_ide_sector_xfer_output:
+    moveal %sp@(4),%a0          /* const void *buf */
+    moveal %sp@(8),%a1          /* ISA address of IDE data register */
+    moveq #31, %d1              /* total (31+1)*16=512 bytes */
+
+q40_ide_output_nextblock:
+    .rept 4
+    movel %a0@+, %d0            /* load from memory */
+    swap %d0                    /* top half first */
+    rolw #8, %d0
+    movew %d0, %a1@
+    swap %d0                    /* then the bottom half */
+    rolw #8, %d0
+    movew %d0, %a1@
+    .endr
+    dbra %d1, q40_ide_output_nextblock
+    rts
+        .end
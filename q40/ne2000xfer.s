@@ -0,0 +1,194 @@
+        .globl  ne2000_pio_input
+        .globl  ne2000_pio_output
+        .globl  ne2000_pio_input_csum
+
+        .section .fasttext, "ax"      /* inner loops: in RAM on ROM builds */
+        .even
+
+/* NE2000 remote DMA data port transfers for the 16-bit ISA bus. As with the
+   IDE data register, words appear in little-endian byte order and are byte
+   swapped (rol.w #8) on the way through. The bulk of the transfer is done 16
+   bytes per loop; the 1, 2 and 4 word remainders are peeled off first by
+   testing bits of the word count, and an odd final byte is handled last. */
+
+ne2000_pio_input:
+    moveal %sp@(4),%a0          /* void *buf */
+    moveal %sp@(8),%a1          /* ISA address of data port */
+    movel %sp@(12),%d1          /* int len (bytes) */
+    lsrl #1,%d1                 /* words */
+
+    btst #0,%d1
+    beq ne2000_input_w2
+    movew %a1@,%d0
+    rolw #8,%d0
+    movew %d0,%a0@+
+ne2000_input_w2:
+    btst #1,%d1
+    beq ne2000_input_w4
+    .rept 2
+    movew %a1@,%d0
+    rolw #8,%d0
+    movew %d0,%a0@+
+    .endr
+ne2000_input_w4:
+    btst #2,%d1
+    beq ne2000_input_bulk
+    .rept 4
+    movew %a1@,%d0
+    rolw #8,%d0
+    movew %d0,%a0@+
+    .endr
+ne2000_input_bulk:
+    lsrl #3,%d1                 /* 16 byte blocks */
+    bra ne2000_input_loop
+
+ne2000_input_nextblock:
+    .rept 4
+    movew %a1@,%d0              /* first word -> top half */
+    rolw #8,%d0
+    swap %d0
+    movew %a1@,%d0              /* second word -> bottom half */
+    rolw #8,%d0
+    movel %d0,%a0@+
+    .endr
+ne2000_input_loop:
+    dbra %d1,ne2000_input_nextblock
+
+    btst #0,%sp@(15)            /* odd length? */
+    beq ne2000_input_done
+    movew %a1@,%d0              /* the byte we want is in the low half */
+    moveb %d0,%a0@
+ne2000_input_done:
+    rts
+
+
+ne2000_pio_output:
+    moveal %sp@(4),%a0          /* const void *buf */
+    moveal %sp@(8),%a1          /* ISA address of data port */
+    movel %sp@(12),%d1          /* int len (bytes) */
+    lsrl #1,%d1                 /* words */
+
+    btst #0,%d1
+    beq ne2000_output_w2
+    movew %a0@+,%d0
+    rolw #8,%d0
+    movew %d0,%a1@
+ne2000_output_w2:
+    btst #1,%d1
+    beq ne2000_output_w4
+    .rept 2
+    movew %a0@+,%d0
+    rolw #8,%d0
+    movew %d0,%a1@
+    .endr
+ne2000_output_w4:
+    btst #2,%d1
+    beq ne2000_output_bulk
+    .rept 4
+    movew %a0@+,%d0
+    rolw #8,%d0
+    movew %d0,%a1@
+    .endr
+ne2000_output_bulk:
+    lsrl #3,%d1                 /* 16 byte blocks */
+    bra ne2000_output_loop
+
+ne2000_output_nextblock:
+    .rept 4
+    movel %a0@+,%d0
+    swap %d0                    /* top half first */
+    rolw #8,%d0
+    movew %d0,%a1@
+    swap %d0                    /* then the bottom half */
+    rolw #8,%d0
+    movew %d0,%a1@
+    .endr
+ne2000_output_loop:
+    dbra %d1,ne2000_output_nextblock
+
+    btst #0,%sp@(15)            /* odd length? */
+    beq ne2000_output_done
+    moveq #0,%d0                /* pad the final byte with a zero */
+    moveb %a0@,%d0
+    movew %d0,%a1@
+ne2000_output_done:
+    rts
+
+
+/* As ne2000_pio_input, but also returns the ones-complement sum of the data
+   (folded to 16 bits, as net_checksum_partial) so the buffer need not be read
+   again to verify the checksum. rol, swap and move leave X alone, so the
+   addx carry chain runs straight through the transfer. */
+
+ne2000_pio_input_csum:
+    moveal %sp@(4),%a0          /* void *buf */
+    moveal %sp@(8),%a1          /* ISA address of data port */
+    movel %sp@(12),%d1          /* int len (bytes) */
+    moveml %d2-%d3,%sp@-        /* len is now at %sp@(20), low byte at %sp@(23) */
+
+    moveq #0,%d0                /* sum */
+    moveq #0,%d3                /* zero, for folding in the final carry */
+    movel %d1,%d2
+    lsrl #4,%d2                 /* 16 byte blocks */
+    addl %d3,%d0                /* clear X before we start the chain */
+
+    btst #1,%sp@(23)
+    beq ne2000_csum_w2
+    movew %a1@,%d1
+    rolw #8,%d1
+    movew %d1,%a0@+
+    addxw %d1,%d0
+ne2000_csum_w2:
+    btst #2,%sp@(23)
+    beq ne2000_csum_w4
+    .rept 2
+    movew %a1@,%d1
+    rolw #8,%d1
+    movew %d1,%a0@+
+    addxw %d1,%d0
+    .endr
+ne2000_csum_w4:
+    btst #3,%sp@(23)
+    beq ne2000_csum_bulk
+    .rept 4
+    movew %a1@,%d1
+    rolw #8,%d1
+    movew %d1,%a0@+
+    addxw %d1,%d0
+    .endr
+ne2000_csum_bulk:
+    bra ne2000_csum_loop
+
+ne2000_csum_nextblock:
+    .rept 4
+    movew %a1@,%d1              /* first word -> top half */
+    rolw #8,%d1
+    swap %d1
+    movew %a1@,%d1              /* second word -> bottom half */
+    rolw #8,%d1
+    movel %d1,%a0@+
+    addxl %d1,%d0
+    .endr
+ne2000_csum_loop:
+    dbra %d2,ne2000_csum_nextblock
+
+    btst #0,%sp@(23)            /* odd length? */
+    beq ne2000_csum_fold
+    movew %a1@,%d1              /* the byte we want is in the low half */
+    moveb %d1,%a0@
+    andiw #0xff,%d1
+    rolw #8,%d1                 /* ... and it is summed as the high half */
+    addxw %d1,%d0
+
+ne2000_csum_fold:
+    addxl %d3,%d0               /* final carry ... */
+    addxl %d3,%d0               /* ... which may itself carry if the sum was 0xffffffff */
+    movel %d0,%d1               /* fold 32 bits down to 16 */
+    swap %d1
+    addw %d1,%d0
+    addxw %d3,%d0
+    andil #0xffff,%d0
+
+    moveml %sp@+,%d2-%d3
+    rts
+        .end
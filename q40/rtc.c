@@ -25,6 +25,21 @@ void q40_rtc_write_nvram(int offset, uint8_t value)
         *Q40_RTC_NVRAM(offset) = value;
 }
 
+int rtc_nvram_size(void)
+{
+    return Q40_RTC_NVRAM_SIZE;
+}
+
+uint8_t rtc_nvram_read(int offset)
+{
+    return q40_rtc_read_nvram(offset);
+}
+
+void rtc_nvram_write(int offset, uint8_t value)
+{
+    q40_rtc_write_nvram(offset, value);
+}
+
 static uint8_t q40_rtc_read_control(void)
 {
     return *Q40_RTC_REGISTER(0);
@@ -88,6 +88,11 @@ copy_loop:
 copy_data:
         dbra    %d0,copy_loop
 
+        /* .data starts with the .fasttext inner loops: push them out of the
+           data cache, and make sure the instruction cache has nothing else */
+        cpusha  %bc
+        nop
+
         /* clear the .bss section -- note limited to 256KB */
         lea.l   bss_start, %a1
         move.l  #(bss_size+3), %d0      /* num bytes to zap; round up  */
@@ -105,6 +110,7 @@ zap_bss:
 
         /* halt */
 halt:
+        jsr uart_flush                  /* let queued output drain */
 halted: stop #0x2700                    /* all done */
         br.s halted                     /* loop on NMI */
 
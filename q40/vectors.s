@@ -1,5 +1,8 @@
         .globl  vector_table
         .globl  timer_ticks
+        .globl  profile_enabled
+        .globl  profile_sample
+        .globl  timer_sub_ticks
         .globl  uart_write_string
         .globl  uart_write_byte
         .globl  report_exception
@@ -38,9 +41,9 @@ vector_table:
         .long   interrupt_level_1    /* 25 level 1 interrupt autovector */
         .long   interrupt_level_2    /* 26 level 2 interrupt autovector */
         .long   interrupt_level_3    /* 27 level 3 interrupt autovector */
-        .long   interrupt_level_4    /* 28 level 4 interrupt autovector */
+        .long   interrupt_sample     /* 28 level 4 interrupt autovector */
         .long   interrupt_level_5    /* 29 level 5 interrupt autovector */
-        .long   interrupt_level_6    /* 30 level 6 interrupt autovector */
+        .long   interrupt_sample     /* 30 level 6 interrupt autovector */
         .long   interrupt_level_7    /* 31 level 7 interrupt autovector */
         .long   trap_0               /* 32 trap 0 instruction */
         .long   unhandled_exception  /* 33 trap 1 instruction */
@@ -67,15 +70,39 @@ trap_0: /* SMSQ/E and QDOS use this vector for "enter supervisor mode";
 interrupt_level_2:
         move.l %d0, -(%sp)
         moveb 0xff000000, %d0           /* load interrupt status */
+        btst #4, %d0                    /* bit 4: ISA (external) interrupt */
+        beqs interrupt_level_2_timer
+        movem.l %d1/%a0-%a1, -(%sp)     /* registers C code may clobber */
+        jsr q40_isa_interrupt
+        movem.l (%sp)+, %d1/%a0-%a1
+        moveb 0xff000000, %d0           /* reload interrupt status */
+interrupt_level_2_timer:
         movew %d0, %ccr                 /* test bit 3 */
         bpls interrupt_level_2_done     /* branch if bit 3 = 0 */
         /* bit 3 set: frame interrupt (50/200Hz timer tick) */
         st.b 0xff000024                 /* frame interrupt ack/clear */
         addq.l #1,(timer_ticks) 
+        clr.l (timer_sub_ticks)
+        movem.l %d1/%a0-%a1, -(%sp)     /* registers C code may clobber */
+        jsr uart_tx_tick                /* send more queued console output */
+        tst.b (profile_enabled)         /* profiling? */
+        beq.s interrupt_level_2_noprofile
+        move.l 18(%sp), -(%sp)          /* the PC we interrupted, above SR and 16 bytes of registers */
+        jsr profile_sample
+        addq.l #4, %sp
+interrupt_level_2_noprofile:
+        movem.l (%sp)+, %d1/%a0-%a1
 interrupt_level_2_done:
         move.l (%sp)+, %d0
         rte
 
+/* sample interrupt (10kHz): we play no sound, it just times things finer than
+   a tick. Linux takes it on level 4 or 6, so do we. */
+interrupt_sample:
+        st.b 0xff000028                 /* sample interrupt ack/clear */
+        addq.l #1,(timer_sub_ticks)
+        rte
+
 /* handlers for things that might happen and which are, generally, bad */
 
 interrupt_level_1:
@@ -86,18 +113,10 @@ interrupt_level_3:
         pea '3'
         bra bad_interrupt
 
-interrupt_level_4:
-        pea '4'
-        bra bad_interrupt
-
 interrupt_level_5:
         pea '5'
         bra bad_interrupt
 
-interrupt_level_6:
-        pea '6'
-        bra bad_interrupt
-
 interrupt_level_7:
         pea '7'
         bra bad_interrupt
@@ -114,8 +133,9 @@ bad_interrupt:
 unhandled_exception:
         pea (%sp)
         jsr report_exception
-halt:   stop #2701
-        br.s halt
+halt:   jsr uart_flush                  /* let queued output drain */
+halted: stop #2701
+        br.s halted
 
         .section .rodata
 bad_interrupt_message: